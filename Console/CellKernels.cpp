@@ -0,0 +1,213 @@
+//////////////////////////////////////////////////////////////////////////////
+// CellKernels.cpp - vectorized loops over console cells
+
+#include "stdafx.h"
+#include "CellKernels.h"
+
+#include <intrin.h>
+#include <immintrin.h>
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+CellKernels::CopyRowFunc	CellKernels::m_pfnCopyRow(CellKernels::SelectCopyRow());
+CellKernels::CountBitsFunc	CellKernels::m_pfnCountBits(CellKernels::SelectCountBits());
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+bool CellKernels::CopyRowScalar(CHAR_INFO* pDest, const CHAR_INFO* pSrc, DWORD dwColumns)
+{
+	// CHAR_INFO is a DWORD, compare it as one
+	DWORD*       pDestCells = reinterpret_cast<DWORD*>(pDest);
+	const DWORD* pSrcCells  = reinterpret_cast<const DWORD*>(pSrc);
+	bool         bChanged   = false;
+
+	for (DWORD i = 0; i < dwColumns; ++i)
+	{
+		if (pDestCells[i] == pSrcCells[i]) continue;
+
+		pDestCells[i] = pSrcCells[i];
+		bChanged      = true;
+	}
+
+	return bChanged;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+bool CellKernels::CopyRowSSE2(CHAR_INFO* pDest, const CHAR_INFO* pSrc, DWORD dwColumns)
+{
+	bool  bChanged = false;
+	DWORD i        = 0;
+
+	// 4 cells at a time, only changed blocks are written
+	for (; i + 4 <= dwColumns; i += 4)
+	{
+		__m128i src  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pSrc + i));
+		__m128i dest = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pDest + i));
+
+		if (_mm_movemask_epi8(_mm_cmpeq_epi32(src, dest)) == 0xFFFF) continue;
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(pDest + i), src);
+		bChanged = true;
+	}
+
+	if (CopyRowScalar(pDest + i, pSrc + i, dwColumns - i)) bChanged = true;
+
+	return bChanged;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+bool CellKernels::CopyRowAVX2(CHAR_INFO* pDest, const CHAR_INFO* pSrc, DWORD dwColumns)
+{
+	bool  bChanged = false;
+	DWORD i        = 0;
+
+	// 8 cells at a time, only changed blocks are written
+	for (; i + 8 <= dwColumns; i += 8)
+	{
+		__m256i src  = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pSrc + i));
+		__m256i dest = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pDest + i));
+
+		if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(src, dest)) == -1) continue;
+
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(pDest + i), src);
+		bChanged = true;
+	}
+
+	// avoid AVX/SSE transition penalties in the code after us
+	_mm256_zeroupper();
+
+	if (CopyRowSSE2(pDest + i, pSrc + i, dwColumns - i)) bChanged = true;
+
+	return bChanged;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+DWORD CellKernels::CountBitsScalar(const DWORD* pWords, DWORD dwWords)
+{
+	DWORD dwSet = 0;
+
+	for (DWORD i = 0; i < dwWords; ++i)
+	{
+		DWORD dwWord = pWords[i];
+
+		dwWord = dwWord - ((dwWord >> 1) & 0x55555555);
+		dwWord = (dwWord & 0x33333333) + ((dwWord >> 2) & 0x33333333);
+		dwSet += (((dwWord + (dwWord >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24;
+	}
+
+	return dwSet;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+DWORD CellKernels::CountBitsPopcnt(const DWORD* pWords, DWORD dwWords)
+{
+	DWORD dwSet = 0;
+
+	for (DWORD i = 0; i < dwWords; ++i) dwSet += __popcnt(pWords[i]);
+
+	return dwSet;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+bool CellKernels::HasSSE2()
+{
+	return ::IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE) != FALSE;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+bool CellKernels::HasAVX2()
+{
+	int cpuInfo[4];
+
+	__cpuid(cpuInfo, 0);
+	if (cpuInfo[0] < 7) return false;
+
+	// the OS has to save YMM registers (OSXSAVE and AVX, then XCR0)
+	__cpuid(cpuInfo, 1);
+	if ((cpuInfo[2] & (1 << 27)) == 0) return false;
+	if ((cpuInfo[2] & (1 << 28)) == 0) return false;
+	if ((_xgetbv(0) & 0x6) != 0x6) return false;
+
+	__cpuidex(cpuInfo, 7, 0);
+	return (cpuInfo[1] & (1 << 5)) != 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+bool CellKernels::HasPopcnt()
+{
+	int cpuInfo[4];
+
+	__cpuid(cpuInfo, 1);
+	return (cpuInfo[2] & (1 << 23)) != 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+CellKernels::CopyRowFunc CellKernels::SelectCopyRow()
+{
+	if (HasAVX2()) return CopyRowAVX2;
+	if (HasSSE2()) return CopyRowSSE2;
+
+	return CopyRowScalar;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+CellKernels::CountBitsFunc CellKernels::SelectCountBits()
+{
+	if (HasPopcnt()) return CountBitsPopcnt;
+
+	return CountBitsScalar;
+}
+
+//////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,63 @@
+//////////////////////////////////////////////////////////////////////////////
+// CellKernels.h - vectorized loops over console cells
+
+#pragma once
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Kernels are picked once for the CPU we run on (AVX2, SSE2, POPCNT or plain C++).
+
+class CellKernels
+{
+	public:
+
+		// copies the cells that differ, returns true if any did (the row is
+		// dirty then)
+		static bool CopyRow(CHAR_INFO* pDest, const CHAR_INFO* pSrc, DWORD dwColumns)
+		{
+			return m_pfnCopyRow(pDest, pSrc, dwColumns);
+		}
+
+		// number of set bits
+		static DWORD CountBits(const DWORD* pWords, DWORD dwWords)
+		{
+			return m_pfnCountBits(pWords, dwWords);
+		}
+
+		// CPU features, kernels check these once to pick an implementation
+		static bool HasSSE2();
+		static bool HasAVX2();
+		static bool HasPopcnt();
+
+	public:
+
+		typedef bool (*CopyRowFunc)(CHAR_INFO* pDest, const CHAR_INFO* pSrc, DWORD dwColumns);
+		typedef DWORD (*CountBitsFunc)(const DWORD* pWords, DWORD dwWords);
+
+		// the variants, callable directly so the tests can compare them
+		static bool CopyRowScalar(CHAR_INFO* pDest, const CHAR_INFO* pSrc, DWORD dwColumns);
+		static bool CopyRowSSE2(CHAR_INFO* pDest, const CHAR_INFO* pSrc, DWORD dwColumns);
+		static bool CopyRowAVX2(CHAR_INFO* pDest, const CHAR_INFO* pSrc, DWORD dwColumns);
+
+		static DWORD CountBitsScalar(const DWORD* pWords, DWORD dwWords);
+		static DWORD CountBitsPopcnt(const DWORD* pWords, DWORD dwWords);
+
+	private:
+
+		static CopyRowFunc SelectCopyRow();
+		static CountBitsFunc SelectCountBits();
+
+	private:
+
+		static CopyRowFunc		m_pfnCopyRow;
+		static CountBitsFunc	m_pfnCountBits;
+};
+
+//////////////////////////////////////////////////////////////////////////////
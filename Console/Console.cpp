@@ -334,6 +334,9 @@ int WINAPI _tWinMain(HINSTANCE hInstance, HINSTANCE /*hPrevInstance*/, LPTSTR lp
 
 	int nRet = Run(lpstrCmdLine, nCmdShow);
 
+	// waits for images being scaled
+	g_imageHandler.reset();
+
 #ifdef _USE_AERO
   // shutdown GDI+;
   Gdiplus::GdiplusShutdown(gdiplusToken);
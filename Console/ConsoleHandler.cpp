@@ -6,6 +6,7 @@
 #include "../shared/SharedMemNames.h"
 #include "ConsoleException.h"
 #include "ConsoleHandler.h"
+#include "CellKernels.h"
 
 //////////////////////////////////////////////////////////////////////////////
 
@@ -25,6 +26,8 @@
 
 std::shared_ptr<Mutex>	ConsoleHandler::s_parentProcessWatchdog;
 std::shared_ptr<void>	ConsoleHandler::s_environmentBlock;
+std::shared_ptr<TP_POOL>	ConsoleHandler::s_monitorPool;
+TP_CALLBACK_ENVIRON		ConsoleHandler::s_monitorCallbackEnviron;
 
 //////////////////////////////////////////////////////////////////////////////
 
@@ -32,14 +35,39 @@ ConsoleHandler::ConsoleHandler()
 : m_hConsoleProcess()
 , m_consoleParams()
 , m_consoleInfo()
-, m_consoleBuffer()
+, m_consoleScreen()
+, m_consoleHistory()
 , m_consoleCopyInfo()
 , m_consoleMouseEvent()
 , m_newConsoleSize()
 , m_newScrollPos()
-, m_hMonitorThread()
-, m_hMonitorThreadExit(std::shared_ptr<void>(::CreateEvent(NULL, FALSE, FALSE, NULL), ::CloseHandle))
+, m_consoleMsgPipe()
+, m_pipeRing()
+, m_pipeWriteBuffer(MESSAGE_RING_SIZE)
+, m_pipeWriteSize(0)
+, m_pipeWritePos(0)
+, m_lPipeWriting(0)
+, m_bStopPipeWrites(false)
+, m_pipeWriteWait()
+, m_pipeOverflow()
+, m_pipeOverflowSize(0)
+, m_bPipeOverflow(false)
+, m_pipeOverflowCritSec()
+, m_strPasteText()
+, m_pastePos(0)
+, m_dwPasteChars(0)
+, m_dwPasteCharsBase(0)
+, m_dwTextCharsSent(0)
+, m_screenWait()
+, m_processWait()
+, m_bStopMonitoring(false)
 , m_bufferMutex(NULL, FALSE, NULL)
+, m_dwScreenVersion(0)
+, m_dwLastFrame(0)
+, m_lLastScrollOffset(0)
+, m_pinnedScreen()
+, m_pinnedRowHashes()
+, m_strUser()
 , m_dwConsolePid(0)
 , m_boolIsElevated(false)
 {
@@ -47,14 +75,15 @@ ConsoleHandler::ConsoleHandler()
 
 ConsoleHandler::~ConsoleHandler()
 {
-	if( m_hMonitorThread.get() )
-		StopMonitorThread();
+	StopMonitoring();
 
 	if ((m_consoleParams.Get() != NULL) && 
 		(m_consoleParams->hwndConsoleWindow))
 	{
 		SendMessage(WM_CLOSE, 0, 0);
 	}
+
+	StopPipeWrites();
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -446,6 +475,7 @@ void ConsoleHandler::StartShellProcess
 	m_consoleParams->dwParentProcessId     = ::GetCurrentProcessId();
 	m_consoleParams->dwNotificationTimeout = g_settingsHandler->GetConsoleSettings().dwChangeRefreshInterval;
 	m_consoleParams->dwRefreshInterval     = g_settingsHandler->GetConsoleSettings().dwRefreshInterval;
+	m_consoleParams->bUseWinEvents         = g_settingsHandler->GetConsoleSettings().bUseWinEvents ? TRUE : FALSE;
 	m_consoleParams->dwRows                = dwStartupRows;
 	m_consoleParams->dwColumns             = dwStartupColumns;
 	m_consoleParams->dwBufferRows          = g_settingsHandler->GetConsoleSettings().dwBufferRows;
@@ -482,6 +512,26 @@ void ConsoleHandler::StartShellProcess
 	if (::WaitForSingleObject(m_consoleParams.GetReqEvent(), 10000) == WAIT_TIMEOUT)
 		throw ConsoleException(boost::str(boost::wformat(Helpers::LoadString(IDS_ERR_DLL_INJECTION_FAILED)) % L"timeout"));
 
+	// the hook opens the console screen (and history) after we resume it in
+	// StartMonitoring
+	try
+	{
+		CreateConsoleScreen(m_consoleParams->dwMaxRows, m_consoleParams->dwMaxColumns);
+
+		// the history is sized for the whole buffer at max width, but no
+		// bigger than the max history size (the hook doesn't mirror buffers
+		// that don't fit, Console scrolls through it then)
+		DWORD dwHistoryCells = min(
+								m_consoleParams->dwBufferRows * max(m_consoleParams->dwBufferColumns, m_consoleParams->dwMaxColumns),
+								min(g_settingsHandler->GetConsoleSettings().dwMaxHistorySize, 1024UL) * static_cast<DWORD>(1024*1024 / sizeof(CHAR_INFO)));
+
+		if (dwHistoryCells != 0) CreateConsoleHistory(dwHistoryCells);
+	}
+	catch(Win32Exception& err)
+	{
+		throw ConsoleException(boost::str(boost::wformat(Helpers::LoadString(IDS_ERR_CREATE_SHARED_OBJECTS_FAILED)) % err.what()));
+	}
+
 	ShowWindow(SW_HIDE);
 }
 
@@ -534,20 +584,29 @@ void ConsoleHandler::StartShellProcessAsAdministrator
 
 //////////////////////////////////////////////////////////////////////////////
 
-DWORD ConsoleHandler::StartMonitorThread()
+void ConsoleHandler::StartMonitoring()
 {
-	DWORD dwThreadId = 0;
-	m_hMonitorThread = std::shared_ptr<void>(
-		::CreateThread(
-		NULL,
-		0, 
-		MonitorThreadStatic, 
-		reinterpret_cast<void*>(this), 
-		0, 
-		&dwThreadId),
-		::CloseHandle);
-
-	return dwThreadId;
+	PTP_CALLBACK_ENVIRON pCallbackEnviron = GetMonitorCallbackEnviron();
+
+	m_bStopMonitoring = false;
+
+	m_screenWait.reset(::CreateThreadpoolWait(ScreenWaitCallback, this, pCallbackEnviron), ::CloseThreadpoolWait);
+	m_processWait.reset(::CreateThreadpoolWait(ProcessWaitCallback, this, pCallbackEnviron), ::CloseThreadpoolWait);
+
+	if (m_screenWait && m_processWait)
+	{
+		::SetThreadpoolWait(m_screenWait.get(), m_consoleScreen.GetReqEvent(), NULL);
+		::SetThreadpoolWait(m_processWait.get(), m_hConsoleProcess.get(), NULL);
+	}
+	else
+	{
+		Win32Exception err(::GetLastError());
+		TRACE(L"CreateThreadpoolWait returns error (%lu) : %S\n", err.GetErrorCode(), err.what());
+	}
+
+	// resume ConsoleHook's thread (even if we can't watch it, it would wait
+	// for us forever)
+	m_consoleParams.SetRespEvent();
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -555,10 +614,29 @@ DWORD ConsoleHandler::StartMonitorThread()
 
 //////////////////////////////////////////////////////////////////////////////
 
-void ConsoleHandler::StopMonitorThread()
+void ConsoleHandler::StopMonitoring()
 {
-	::SetEvent(m_hMonitorThreadExit.get());
-	::WaitForSingleObject(m_hMonitorThread.get(), 10000);
+	// cancel pending waits and wait for running callbacks; a screen
+	// callback that was already running might re-arm its wait before it
+	// sees the flag, so we cancel it again after it's done
+	m_bStopMonitoring = true;
+
+	if (m_screenWait)
+	{
+		::SetThreadpoolWait(m_screenWait.get(), NULL, NULL);
+		::WaitForThreadpoolWaitCallbacks(m_screenWait.get(), TRUE);
+
+		::SetThreadpoolWait(m_screenWait.get(), NULL, NULL);
+		::WaitForThreadpoolWaitCallbacks(m_screenWait.get(), TRUE);
+		m_screenWait.reset();
+	}
+
+	if (m_processWait)
+	{
+		::SetThreadpoolWait(m_processWait.get(), NULL, NULL);
+		::WaitForThreadpoolWaitCallbacks(m_processWait.get(), TRUE);
+		m_processWait.reset();
+	}
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -647,14 +725,8 @@ bool ConsoleHandler::CreateSharedObjects(DWORD dwConsoleProcessId, const wstring
 	// create console info shared memory
 	m_cursorInfo.Create((SharedMemNames::formatCursorInfo % dwConsoleProcessId).str(), 1, syncObjRequest, strUser);
 
-	// TODO: max console size
-	m_consoleBuffer.Create((SharedMemNames::formatBuffer % dwConsoleProcessId).str(), 200*200, syncObjRequest, strUser);
-
-	// initialize buffer with spaces
-	CHAR_INFO ci;
-	ci.Attributes		= 0;
-	ci.Char.UnicodeChar	= L' ';
-	for (int i = 0; i < 200*200; ++i) ::CopyMemory(&m_consoleBuffer[i], &ci, sizeof(CHAR_INFO));
+	// console screen is created when the hook has reported max console size
+	m_strUser = strUser;
 
 	// copy info
 	m_consoleCopyInfo.Create((SharedMemNames::formatCopyInfo % dwConsoleProcessId).str(), 1, syncObjBoth, strUser);
@@ -671,6 +743,16 @@ bool ConsoleHandler::CreateSharedObjects(DWORD dwConsoleProcessId, const wstring
 	// message pipe (workaround for User Interface Privilege Isolation messages filtering)
 	m_consoleMsgPipe.Create((SharedMemNames::formatPipeName % dwConsoleProcessId).str(), strUser);
 
+	// pipe writes complete on the monitor pool, without it we write
+	// synchronously
+	m_pipeWriteWait.reset(::CreateThreadpoolWait(PipeWriteCallback, this, GetMonitorCallbackEnviron()), ::CloseThreadpoolWait);
+
+	if (!m_pipeWriteWait)
+	{
+		Win32Exception err(::GetLastError());
+		TRACE(L"CreateThreadpoolWait returns error (%lu) : %S\n", err.GetErrorCode(), err.what());
+	}
+
 	// TODO: separate function for default settings
 	m_consoleParams->dwRows		= 25;
 	m_consoleParams->dwColumns	= 80;
@@ -681,6 +763,54 @@ bool ConsoleHandler::CreateSharedObjects(DWORD dwConsoleProcessId, const wstring
 //////////////////////////////////////////////////////////////////////////////
 
 
+//////////////////////////////////////////////////////////////////////////////
+
+void ConsoleHandler::CreateConsoleScreen(DWORD dwMaxRows, DWORD dwMaxColumns)
+{
+	DWORD dwVersion = m_dwScreenVersion + 1;
+
+	// frames are empty until the hook publishes the first one, no need to
+	// initialize them past the zero fill in Create
+	SharedMemory<ConsoleScreen> consoleScreen;
+	consoleScreen.Create((SharedMemNames::formatBuffer % m_dwConsolePid % dwVersion).str(), ConsoleScreen::GetSharedMemSize(dwMaxRows, dwMaxColumns), syncObjRequest, m_strUser);
+
+	consoleScreen->dwMaxRows    = dwMaxRows;
+	consoleScreen->dwMaxColumns = dwMaxColumns;
+	consoleScreen->lPinned      = -1;
+
+	TRACE(L"Console screen version %i: %ix%i\n", dwVersion, dwMaxColumns, dwMaxRows);
+
+	// the view reads the screen (with the buffer mutex held) on the UI
+	// thread, we're usually called on a monitor thread
+	MutexLock bufferLock(m_bufferMutex);
+
+	// hand the new version over to the hook, it keeps the old one mapped
+	// until it switches
+	if (m_consoleScreen.Get()) ::InterlockedExchange(&m_consoleScreen->lNewVersion, static_cast<LONG>(dwVersion));
+
+	m_consoleScreen    = consoleScreen;
+	m_dwScreenVersion  = dwVersion;
+	m_dwLastFrame      = 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void ConsoleHandler::CreateConsoleHistory(DWORD dwMaxCells)
+{
+	// the hook sets the mirrored buffer size on its first capture
+	m_consoleHistory.Create((SharedMemNames::formatHistory % m_dwConsolePid).str(), ConsoleHistory::GetSharedMemSize(dwMaxCells), syncObjNone, m_strUser);
+
+	m_consoleHistory->dwMaxCells = dwMaxCells;
+
+	TRACE(L"Console history: %i cells\n", dwMaxCells);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
 //////////////////////////////////////////////////////////////////////////////
 
 void ConsoleHandler::CreateWatchdog()
@@ -955,10 +1085,70 @@ bool ConsoleHandler::InjectHookDLL(PROCESS_INFORMATION& pi)
 
 //////////////////////////////////////////////////////////////////////////////
 
-DWORD WINAPI ConsoleHandler::MonitorThreadStatic(LPVOID lpParameter)
+PTP_CALLBACK_ENVIRON ConsoleHandler::GetMonitorCallbackEnviron()
+{
+	// consoles are only started from the UI thread, no need to sync
+	if (!s_monitorPool)
+	{
+		PTP_POOL pPool = ::CreateThreadpool(NULL);
+
+		if (pPool == NULL) return NULL;
+
+		// a few workers are enough for all consoles, a callback only copies
+		// the console screen and notifies the view
+		SYSTEM_INFO	si;
+		::GetSystemInfo(&si);
+
+		::SetThreadpoolThreadMaximum(pPool, max(si.dwNumberOfProcessors, 2UL));
+		::SetThreadpoolThreadMinimum(pPool, 1);
+
+		s_monitorPool.reset(pPool, ::CloseThreadpool);
+
+		::InitializeThreadpoolEnvironment(&s_monitorCallbackEnviron);
+		::SetThreadpoolCallbackPool(&s_monitorCallbackEnviron, pPool);
+	}
+
+	return &s_monitorCallbackEnviron;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+VOID CALLBACK ConsoleHandler::ScreenWaitCallback(PTP_CALLBACK_INSTANCE /*pInstance*/, PVOID pContext, PTP_WAIT pWait, TP_WAIT_RESULT /*waitResult*/)
+{
+	ConsoleHandler* pConsoleHandler = reinterpret_cast<ConsoleHandler*>(pContext);
+
+	if (pConsoleHandler->m_bStopMonitoring) return;
+
+	pConsoleHandler->OnConsoleScreenChange();
+
+	if (pConsoleHandler->m_bStopMonitoring) return;
+
+	// waits are one-shot, so a console is never handled by two workers at
+	// once and a busy console can't starve the others; console screen (and
+	// its event) changes when it's remapped
+	::SetThreadpoolWait(pWait, pConsoleHandler->m_consoleScreen.GetReqEvent(), NULL);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+VOID CALLBACK ConsoleHandler::ProcessWaitCallback(PTP_CALLBACK_INSTANCE /*pInstance*/, PVOID pContext, PTP_WAIT /*pWait*/, TP_WAIT_RESULT /*waitResult*/)
 {
-	ConsoleHandler* pConsoleHandler = reinterpret_cast<ConsoleHandler*>(lpParameter);
-	return pConsoleHandler->MonitorThread();
+	ConsoleHandler* pConsoleHandler = reinterpret_cast<ConsoleHandler*>(pContext);
+
+	TRACE(L"console process exited\n");
+
+	// stop watching the screen (without waiting for a running callback,
+	// it might be waiting for us; the flag keeps it from re-arming)
+	pConsoleHandler->m_bStopMonitoring = true;
+	::SetThreadpoolWait(pConsoleHandler->m_screenWait.get(), NULL, NULL);
+
+	pConsoleHandler->m_consoleCloseDelegate();
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -966,47 +1156,343 @@ DWORD WINAPI ConsoleHandler::MonitorThreadStatic(LPVOID lpParameter)
 
 //////////////////////////////////////////////////////////////////////////////
 
-DWORD ConsoleHandler::MonitorThread()
+void ConsoleHandler::OnConsoleScreenChange()
 {
-	// resume ConsoleHook's thread
-	m_consoleParams.SetRespEvent();
+	DWORD				dwColumns	= 0;
+	DWORD				dwRows		= 0;
+
+	ReadConsoleFrameInfo(dwRows, dwColumns);
 
-	HANDLE arrWaitHandles[] = { m_hConsoleProcess.get(), m_hMonitorThreadExit.get(), m_consoleBuffer.GetReqEvent() };
-	while (::WaitForMultipleObjects(sizeof(arrWaitHandles)/sizeof(arrWaitHandles[0]), arrWaitHandles, FALSE, INFINITE) > WAIT_OBJECT_0 + 1)
+	DWORD				dwBufferColumns	= m_consoleInfo->csbi.dwSize.X;
+	DWORD				dwBufferRows	= m_consoleInfo->csbi.dwSize.Y;
+	bool				bResize		= false;
+
+	if ((m_consoleParams->dwColumns != dwColumns) ||
+		(m_consoleParams->dwRows != dwRows) ||
+		((m_consoleParams->dwBufferColumns != 0) && (m_consoleParams->dwBufferColumns != dwBufferColumns)) ||
+		((m_consoleParams->dwBufferRows != 0) && (m_consoleParams->dwBufferRows != dwBufferRows)))
 	{
-		DWORD				dwColumns	= m_consoleInfo->csbi.srWindow.Right - m_consoleInfo->csbi.srWindow.Left + 1;
-		DWORD				dwRows		= m_consoleInfo->csbi.srWindow.Bottom - m_consoleInfo->csbi.srWindow.Top + 1;
-		DWORD				dwBufferColumns	= m_consoleInfo->csbi.dwSize.X;
-		DWORD				dwBufferRows	= m_consoleInfo->csbi.dwSize.Y;
-		bool				bResize		= false;
+		MutexLock handlerLock(m_bufferMutex);
+
+		m_consoleParams->dwColumns	= dwColumns;
+		m_consoleParams->dwRows		= dwRows;
+
+		// TODO: improve this
+		// this will handle console applications that change console buffer 
+		// size (like Far manager).
+		// This is not a perfect solution, but it's the best one I have
+		// for now
+		if (m_consoleParams->dwBufferColumns != 0)	m_consoleParams->dwBufferColumns= dwBufferColumns;
+		if (m_consoleParams->dwBufferRows != 0)		m_consoleParams->dwBufferRows	= dwBufferRows;
+		bResize = true;
+	}
 
-		if ((m_consoleParams->dwColumns != dwColumns) ||
-			(m_consoleParams->dwRows != dwRows) ||
-			((m_consoleParams->dwBufferColumns != 0) && (m_consoleParams->dwBufferColumns != dwBufferColumns)) ||
-			((m_consoleParams->dwBufferRows != 0) && (m_consoleParams->dwBufferRows != dwBufferRows)))
+	m_consoleChangeDelegate(bResize);
+
+	// console window doesn't fit the screen frames, create a bigger one
+	if ((m_consoleScreen->dwRequestedRows > m_consoleScreen->dwMaxRows) ||
+		(m_consoleScreen->dwRequestedColumns > m_consoleScreen->dwMaxColumns))
+	{
+		try
+		{
+			CreateConsoleScreen(
+				max(m_consoleScreen->dwRequestedRows, m_consoleScreen->dwMaxRows),
+				max(m_consoleScreen->dwRequestedColumns, m_consoleScreen->dwMaxColumns));
+		}
+#ifdef _DEBUG
+		catch(Win32Exception& ex)
 		{
-			MutexLock handlerLock(m_bufferMutex);
-
-			m_consoleParams->dwColumns	= dwColumns;
-			m_consoleParams->dwRows		= dwRows;
-
-			// TODO: improve this
-			// this will handle console applications that change console buffer 
-			// size (like Far manager).
-			// This is not a perfect solution, but it's the best one I have
-			// for now
-			if (m_consoleParams->dwBufferColumns != 0)	m_consoleParams->dwBufferColumns= dwBufferColumns;
-			if (m_consoleParams->dwBufferRows != 0)		m_consoleParams->dwBufferRows	= dwBufferRows;
-			bResize = true;
+			TRACE(L"CreateConsoleScreen failed (reason: %S)\n", ex.what());
 		}
+#else
+		catch(Win32Exception&) { }
+#endif
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
 
-		m_consoleChangeDelegate(bResize);
+//////////////////////////////////////////////////////////////////////////////
+
+void ConsoleHandler::ReadConsoleFrameInfo(DWORD& dwRows, DWORD& dwColumns)
+{
+	// screen and cursor info are only written here (and read by the UI
+	// thread), the hook doesn't touch them after startup
+	SharedMemoryLock consoleInfoLock(m_consoleInfo);
+
+	for (;;)
+	{
+		ConsoleFrame* pFrame    = m_consoleScreen->GetFrame(m_consoleScreen->lFront);
+		LONG          lSequence = SeqLock::BeginRead(&pFrame->lSequence);
+
+		dwRows    = pFrame->dwRows;
+		dwColumns = pFrame->dwColumns;
+
+		m_consoleInfo->csbi = pFrame->csbi;
+		*m_cursorInfo       = pFrame->cursorInfo;
+
+		// retry on torn read (the hook has started rewriting this frame)
+		if (SeqLock::EndRead(&pFrame->lSequence, lSequence)) break;
 	}
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
 
-	TRACE(L"exiting thread\n");
-	// exiting thread
-	m_consoleCloseDelegate();
-	return 0;
+//////////////////////////////////////////////////////////////////////////////
+
+bool ConsoleHandler::CopyConsoleBuffer(CHAR_INFO* pScreenBuffer, RowFlags& rowChanged, DWORD dwRows, DWORD dwColumns, bool bFullCopy, int& nScrolledRows)
+{
+	nScrolledRows = 0;
+
+	for (;;)
+	{
+		ConsoleFrame* pFrame    = m_consoleScreen->GetFrame(m_consoleScreen->lFront);
+		LONG          lSequence = SeqLock::BeginRead(&pFrame->lSequence);
+
+		// the hook is already rewriting this frame, take the new front one
+		if (lSequence & 1) continue;
+
+		// frame is for a different console size, we'll get another change
+		// notification after the resize; make sure we copy everything then
+		if ((pFrame->dwRows != dwRows) || (pFrame->dwColumns != dwColumns))
+		{
+			if (!SeqLock::EndRead(&pFrame->lSequence, lSequence)) continue;
+
+			m_dwLastFrame = 0;
+			return false;
+		}
+
+		DWORD*     pRowFrames = m_consoleScreen->GetRowFrames(pFrame);
+		CHAR_INFO* pBuffer    = m_consoleScreen->GetBuffer(pFrame);
+		LONG       lScroll    = pFrame->lScrollOffset - m_lLastScrollOffset;
+		DWORD      dwScroll   = static_cast<DWORD>(abs(lScroll));
+
+		if ((m_dwLastFrame == 0) || (dwScroll >= dwRows)) bFullCopy = true;
+
+		// text has scrolled, shift the local buffer (the view shifts its
+		// text the same way); rows that haven't changed in the frame can
+		// still differ from the shifted ones, so we compare all of them
+		if (!bFullCopy && (lScroll != 0))
+		{
+			ShiftScreenBuffer(pScreenBuffer, rowChanged, dwRows, dwColumns, lScroll);
+
+			nScrolledRows += lScroll;
+			bFullCopy      = true;
+		}
+
+		m_lLastScrollOffset = pFrame->lScrollOffset;
+
+		// copy rows changed since the last frame we've read
+		for (DWORD dwRow = 0; dwRow < dwRows; ++dwRow)
+		{
+			if (!bFullCopy && (pRowFrames[dwRow] <= m_dwLastFrame)) continue;
+
+			if (CellKernels::CopyRow(pScreenBuffer + dwRow*dwColumns, pBuffer + dwRow*dwColumns, dwColumns)) rowChanged.Set(dwRow);
+		}
+
+		DWORD dwFrame     = pFrame->dwFrame;
+		DWORD dwTextFrame = pFrame->dwTextFrame;
+
+		// torn read, rows changed since m_dwLastFrame are copied again from
+		// the new front frame (or all rows if we've already shifted the
+		// buffer, the scroll offset we've read might be from the new frame)
+		if (!SeqLock::EndRead(&pFrame->lSequence, lSequence)) continue;
+
+		bool bTextChanged = bFullCopy || (dwTextFrame > m_dwLastFrame);
+
+		m_dwLastFrame = dwFrame;
+		return bTextChanged;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+bool ConsoleHandler::PinConsoleFrame(CHAR_INFO*& pScreenBuffer, RowFlags& rowChanged, DWORD dwRows, DWORD dwColumns, bool bFullCopy, int& nScrolledRows)
+{
+	nScrolledRows = 0;
+
+	LONG lFront = 0;
+
+	// the hook doesn't write a pinned frame, but it might have picked the
+	// frame before it could see the pin; if so, it publishes it first
+	for (;;)
+	{
+		lFront = m_consoleScreen->lFront;
+		::InterlockedExchange(&m_consoleScreen->lPinned, lFront);
+
+		if (m_consoleScreen->lFront == lFront) break;
+	}
+
+	ConsoleFrame* pFrame = m_consoleScreen->GetFrame(lFront);
+
+	// frame is for a different console size, the view doesn't have a frame
+	// to render from until the resize
+	if ((pFrame->dwRows != dwRows) || (pFrame->dwColumns != dwColumns))
+	{
+		m_dwLastFrame = 0;
+		pScreenBuffer = NULL;
+		return false;
+	}
+
+	unsigned __int64* pRowHashes = m_consoleScreen->GetRowHashes(pFrame);
+	LONG              lScroll    = pFrame->lScrollOffset - m_lLastScrollOffset;
+
+	if ((m_dwLastFrame == 0) || (static_cast<DWORD>(abs(lScroll)) >= dwRows) || (m_pinnedRowHashes.size() != dwRows))
+	{
+		m_pinnedRowHashes.assign(dwRows, 0);
+		bFullCopy = true;
+	}
+
+	// text has scrolled, shift the change flags and row hashes the same way
+	// the view shifts its text
+	if (!bFullCopy && (lScroll != 0))
+	{
+		ShiftScreenBuffer(NULL, rowChanged, dwRows, dwColumns, lScroll);
+
+		if (lScroll > 0)
+		{
+			std::rotate(m_pinnedRowHashes.begin(), m_pinnedRowHashes.begin() + lScroll, m_pinnedRowHashes.end());
+			std::fill(m_pinnedRowHashes.end() - lScroll, m_pinnedRowHashes.end(), 0);
+		}
+		else
+		{
+			std::rotate(m_pinnedRowHashes.begin(), m_pinnedRowHashes.end() + lScroll, m_pinnedRowHashes.end());
+			std::fill(m_pinnedRowHashes.begin(), m_pinnedRowHashes.begin() - lScroll, 0);
+		}
+
+		nScrolledRows = lScroll;
+	}
+
+	// rows changed since the frame we've pinned last time, the hook has
+	// already hashed them
+	for (DWORD dwRow = 0; dwRow < dwRows; ++dwRow)
+	{
+		if (!bFullCopy && (pRowHashes[dwRow] == m_pinnedRowHashes[dwRow])) continue;
+
+		m_pinnedRowHashes[dwRow] = pRowHashes[dwRow];
+		rowChanged.Set(dwRow);
+	}
+
+	bool bTextChanged = bFullCopy || (pFrame->dwTextFrame > m_dwLastFrame);
+
+	m_lLastScrollOffset = pFrame->lScrollOffset;
+	m_dwLastFrame       = pFrame->dwFrame;
+
+	// keep the mapping alive while the view renders from it, even if the
+	// screen gets remapped meanwhile
+	m_pinnedScreen = m_consoleScreen;
+	pScreenBuffer  = m_consoleScreen->GetBuffer(pFrame);
+
+	return bTextChanged;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void ConsoleHandler::UnpinConsoleFrame()
+{
+	if (m_consoleScreen.Get()) ::InterlockedExchange(&m_consoleScreen->lPinned, -1);
+	m_pinnedScreen = SharedMemory<ConsoleScreen>();
+	m_pinnedRowHashes.clear();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+bool ConsoleHandler::CopyHistoryRows(CHAR_INFO* pScreenBuffer, RowFlags& rowChanged, DWORD dwRows, DWORD dwColumns, DWORD dwTop, DWORD dwLeft, int nScrollRows)
+{
+	if (!m_consoleHistory.Get()) return false;
+
+	ConsoleHistory* pHistory  = m_consoleHistory.Get();
+	bool            bModified = false;
+
+	for (;;)
+	{
+		LONG lSequence = SeqLock::BeginRead(&pHistory->lSequence);
+
+		// the hook only holds the history while copying rows
+		if (lSequence & 1) continue;
+
+		// rows aren't in the history (or haven't been re-read yet); if we've
+		// already modified the buffer on a torn read, the console frame
+		// fixes it when it has scrolled
+		if ((pHistory->dwRows == 0) ||
+			((dwTop < pHistory->dwStaleRows) && (dwTop + dwRows > pHistory->dwStaleTop)) ||
+			(dwTop + dwRows > pHistory->dwRows) ||
+			(dwLeft + dwColumns > pHistory->dwColumns))
+		{
+			if (!SeqLock::EndRead(&pHistory->lSequence, lSequence)) continue;
+
+			return bModified;
+		}
+
+		if (!bModified && (nScrollRows != 0)) ShiftScreenBuffer(pScreenBuffer, rowChanged, dwRows, dwColumns, nScrollRows);
+
+		bModified = true;
+
+		for (DWORD dwRow = 0; dwRow < dwRows; ++dwRow)
+		{
+			if (CellKernels::CopyRow(pScreenBuffer + dwRow*dwColumns, pHistory->GetRow(dwTop + dwRow) + dwLeft, dwColumns)) rowChanged.Set(dwRow);
+		}
+
+		if (SeqLock::EndRead(&pHistory->lSequence, lSequence)) return true;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void ConsoleHandler::ShiftScreenBuffer(CHAR_INFO* pScreenBuffer, RowFlags& rowChanged, DWORD dwRows, DWORD dwColumns, int nScrollRows)
+{
+	// shifted rows keep their changed flags, uncovered rows are cleared and
+	// flagged (pScreenBuffer is NULL when the view renders from a pinned frame)
+	DWORD dwScroll       = static_cast<DWORD>(abs(nScrollRows));
+	DWORD dwShiftedRows  = dwRows - dwScroll;
+	DWORD dwClearedFirst = 0;
+
+	if (nScrollRows > 0)
+	{
+		if (pScreenBuffer != NULL) ::MoveMemory(pScreenBuffer, pScreenBuffer + dwScroll*dwColumns, dwShiftedRows*dwColumns*sizeof(CHAR_INFO));
+		dwClearedFirst = dwShiftedRows;
+	}
+	else
+	{
+		if (pScreenBuffer != NULL) ::MoveMemory(pScreenBuffer + dwScroll*dwColumns, pScreenBuffer, dwShiftedRows*dwColumns*sizeof(CHAR_INFO));
+	}
+
+	rowChanged.Shift(nScrollRows);
+
+	if (pScreenBuffer == NULL) return;
+
+	for (DWORD dwRow = dwClearedFirst; dwRow < dwClearedFirst + dwScroll; ++dwRow)
+	{
+		ClearRow(pScreenBuffer + dwRow*dwColumns, dwColumns);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void ConsoleHandler::ClearRow(CHAR_INFO* pRow, DWORD dwColumns)
+{
+	for (DWORD i = 0; i < dwColumns; ++i)
+	{
+		pRow[i].Char.UnicodeChar = L' ';
+		pRow[i].Attributes       = 0;
+	}
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -1031,64 +1517,32 @@ void ConsoleHandler::PostMessage(UINT Msg, WPARAM wParam, LPARAM lParam)
 		wParam, lParam);
 #endif
 
+	PostPipeMessage(MakePostMessage(Msg, wParam, lParam));
+}
+
+void ConsoleHandler::WriteConsoleInput(KEY_EVENT_RECORD* pkeyEvent)
+{
+	PostPipeMessage(MakeWriteConsoleInput(pkeyEvent));
+}
+
+NamedPipeMessage ConsoleHandler::MakePostMessage(UINT Msg, WPARAM wParam, LPARAM lParam)
+{
 	NamedPipeMessage npmsg;
 	npmsg.type = NamedPipeMessage::POSTMESSAGE;
 	npmsg.data.winmsg.msg = Msg;
 	npmsg.data.winmsg.wparam = static_cast<DWORD>(wParam);
 	npmsg.data.winmsg.lparam = static_cast<DWORD>(lParam);
 
-	try
-	{
-		m_consoleMsgPipe.Write(&npmsg, sizeof(npmsg));
-	}
-#ifdef _DEBUG
-	catch(std::exception& e)
-	{
-		TRACE(
-			L"PostMessage(pipe) Msg = 0x%08lx (%s) WPARAM = %p LPARAM = %p fails (reason: %S)\n",
-			Msg, strMsg,
-			wParam, lParam,
-			e.what());
-	}
-#else
-	catch(std::exception&) { }
-#endif
+	return npmsg;
 }
 
-void ConsoleHandler::WriteConsoleInput(KEY_EVENT_RECORD* pkeyEvent)
+NamedPipeMessage ConsoleHandler::MakeWriteConsoleInput(const KEY_EVENT_RECORD* pkeyEvent)
 {
 	NamedPipeMessage npmsg;
 	npmsg.type = NamedPipeMessage::WRITECONSOLEINPUT;
 	npmsg.data.keyEvent = *pkeyEvent;
 
-	try
-	{
-		m_consoleMsgPipe.Write(&npmsg, sizeof(npmsg));
-	}
-#ifdef _DEBUG
-	catch(std::exception& e)
-	{
-		TRACE(
-			L"WriteConsoleInput(pipe) fails (reason: %S)\n",
-			L"  bKeyDown          = %s\n"
-			L"  dwControlKeyState = 0x%08lx\n"
-			L"  UnicodeChar       = 0x%04hx\n"
-			L"  wRepeatCount      = %hu\n"
-			L"  wVirtualKeyCode   = 0x%04hx\n"
-			L"  wVirtualScanCode  = 0x%04hx\n",
-			e.what(),
-			npmsg.data.keyEvent.bKeyDown?"TRUE":"FALSE",
-			npmsg.data.keyEvent.dwControlKeyState,
-			npmsg.data.keyEvent.uChar.UnicodeChar,
-			npmsg.data.keyEvent.wRepeatCount,
-			npmsg.data.keyEvent.wVirtualKeyCode,
-			npmsg.data.keyEvent.wVirtualScanCode);
-	}
-#else
-	catch(std::exception&) { }
-#endif
-
-
+	return npmsg;
 }
 
 void ConsoleHandler::SendMessage(UINT Msg, WPARAM wParam, LPARAM lParam)
@@ -1117,22 +1571,7 @@ void ConsoleHandler::SendMessage(UINT Msg, WPARAM wParam, LPARAM lParam)
 		npmsg.data.winmsg.wparam = static_cast<DWORD>(wParam);
 		npmsg.data.winmsg.lparam = static_cast<DWORD>(lParam);
 
-		try
-		{
-			m_consoleMsgPipe.Write(&npmsg, sizeof(npmsg));
-		}
-#ifdef _DEBUG
-		catch(std::exception& e)
-		{
-			TRACE(
-				L"SendMessage(pipe) Msg = 0x%08lx (%s) WPARAM = %p LPARAM = %p fails (reason: %S)\n",
-				Msg, strMsg,
-				wParam, lParam,
-				e.what());
-		}
-#else
-		catch(std::exception&) { }
-#endif
+		PostPipeMessage(npmsg);
 	}
 	else
 	{
@@ -1160,76 +1599,394 @@ void ConsoleHandler::SetWindowPos(int X, int Y, int cx, int cy, UINT uFlags)
 	npmsg.data.windowpos.cy              = cy;
 	npmsg.data.windowpos.uFlags          = uFlags;
 
+	PostPipeMessage(npmsg);
+}
+
+void ConsoleHandler::ShowWindow(int nCmdShow)
+{
+	NamedPipeMessage npmsg;
+	npmsg.type = NamedPipeMessage::SHOWWINDOW;
+	npmsg.data.show.nCmdShow = nCmdShow;
+
+	PostPipeMessage(npmsg);
+}
+
+void ConsoleHandler::SendTextToConsole(const wchar_t* pszText)
+{
+	if ((pszText == NULL) || (*pszText == 0)) return;
+
+	if (!IsPasting())
+	{
+		m_dwPasteChars     = 0;
+		m_dwPasteCharsBase = m_dwTextCharsSent;
+	}
+
+	m_strPasteText += pszText;
+	m_dwPasteChars += static_cast<DWORD>(wcslen(pszText));
+
+	SendPendingText();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+bool ConsoleHandler::SendPendingText()
+{
+	while (m_pastePos < m_strPasteText.length())
+	{
+		DWORD dwInFlight = m_dwTextCharsSent - GetTextCharsDone();
+
+		if (dwInFlight >= PASTE_WINDOW_CHARS) break;
+
+		size_t chunkLen = min(m_strPasteText.length() - m_pastePos, static_cast<size_t>(min(PASTE_CHUNK_CHARS, PASTE_WINDOW_CHARS - dwInFlight)));
+
+		// don't split CR LF pairs, the hook sends them as a single enter
+		if ((m_pastePos + chunkLen < m_strPasteText.length()) &&
+			(m_strPasteText[m_pastePos + chunkLen - 1] == L'\r') &&
+			(m_strPasteText[m_pastePos + chunkLen] == L'\n'))
+		{
+			if (--chunkLen == 0) break;
+		}
+
+		NamedPipeMessage npmsg;
+		npmsg.type = NamedPipeMessage::SENDTEXT;
+		npmsg.data.text.dwTextLen = static_cast<DWORD>(chunkLen);
+
+		PostPipeMessage(npmsg, m_strPasteText.c_str() + m_pastePos, chunkLen * sizeof(wchar_t));
+
+		m_pastePos        += chunkLen;
+		m_dwTextCharsSent += static_cast<DWORD>(chunkLen);
+	}
+
+	// all sent, free the text
+	if ((m_pastePos > 0) && (m_pastePos == m_strPasteText.length()))
+	{
+		wstring().swap(m_strPasteText);
+		m_pastePos = 0;
+	}
+
+	return IsPasting();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+bool ConsoleHandler::IsPasting() const
+{
+	if (m_pastePos < m_strPasteText.length()) return true;
+
+	return (m_dwTextCharsSent != GetTextCharsDone());
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void ConsoleHandler::CancelPaste()
+{
+	if (!IsPasting()) return;
+
+	// the hook drops what it hasn't written yet and counts it as done
+	m_dwPasteChars -= static_cast<DWORD>(m_strPasteText.length() - m_pastePos);
+
+	wstring().swap(m_strPasteText);
+	m_pastePos = 0;
+
+	NamedPipeMessage npmsg;
+	npmsg.type = NamedPipeMessage::CANCELTEXT;
+
+	PostPipeMessage(npmsg);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void ConsoleHandler::GetPasteProgress(DWORD& dwCharsDone, DWORD& dwChars) const
+{
+	dwChars     = m_dwPasteChars;
+	dwCharsDone = min(GetTextCharsDone() - m_dwPasteCharsBase, dwChars);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+DWORD ConsoleHandler::GetTextCharsDone() const
+{
+	// no hook, nothing will ever be done
+	if (m_consoleParams.Get() == NULL) return m_dwTextCharsSent;
+
+	return m_consoleParams->dwTextCharsDone;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void ConsoleHandler::PostPipeMessage(const NamedPipeMessage& npmsg, const void* pPayload, size_t payloadSize)
+{
+	if (!m_pipeWriteWait)
+	{
+		try
+		{
+			m_consoleMsgPipe.Write(&npmsg, sizeof(npmsg));
+			if (payloadSize > 0) m_consoleMsgPipe.Write(pPayload, payloadSize);
+		}
+#ifdef _DEBUG
+		catch(std::exception& e)
+		{
+			TRACE(L"PostPipeMessage(pipe) type = %d fails (reason: %S)\n", npmsg.type, e.what());
+		}
+#else
+		catch(std::exception&) { }
+#endif
+		return;
+	}
+
+	bool bQueued = false;
+
+	if (!m_bPipeOverflow) bQueued = m_pipeRing.Write(&npmsg, sizeof(npmsg), pPayload, payloadSize);
+
+	if (!bQueued)
+	{
+		std::vector<BYTE> message(sizeof(npmsg) + payloadSize);
+
+		::CopyMemory(&message[0], &npmsg, sizeof(npmsg));
+		if (payloadSize > 0) ::CopyMemory(&message[sizeof(npmsg)], pPayload, payloadSize);
+
+		CriticalSectionLock lock(m_pipeOverflowCritSec);
+
+		// only posted input is dropped when the hook doesn't keep up, sent
+		// messages (WM_CLOSE, WM_SYSCOMMAND), window changes and text
+		// always go through
+		if ((m_pipeOverflowSize + message.size() > PIPE_OVERFLOW_MAX_SIZE) &&
+			((npmsg.type == NamedPipeMessage::POSTMESSAGE) || (npmsg.type == NamedPipeMessage::WRITECONSOLEINPUT)))
+		{
+			TRACE(L"PostPipeMessage type = %d dropped (%lu bytes queued)\n", npmsg.type, static_cast<DWORD>(m_pipeOverflowSize));
+			return;
+		}
+
+		m_pipeOverflowSize += message.size();
+		m_pipeOverflow.push_back(std::vector<BYTE>());
+		m_pipeOverflow.back().swap(message);
+		m_bPipeOverflow = true;
+	}
+
+	if (m_bStopPipeWrites) return;
+
+	// start writing unless a write is already pending, its callback will
+	// write this message with anything else queued meanwhile
+	if (::InterlockedCompareExchange(&m_lPipeWriting, 1, 0) == 0) StartPipeWrite();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void ConsoleHandler::StartPipeWrite()
+{
+	// called with the writer flag set
+	for (;;)
+	{
+		if (ReadPipeQueue() == 0)
+		{
+			// nothing to write; a message might have been queued after we
+			// looked, while the flag was still set
+			::InterlockedExchange(&m_lPipeWriting, 0);
+
+			if (m_pipeRing.IsEmpty() && !m_bPipeOverflow) return;
+			if (::InterlockedCompareExchange(&m_lPipeWriting, 1, 0) != 0) return;
+
+			continue;
+		}
+
+		ContinuePipeWrite();
+		return;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+size_t ConsoleHandler::ReadPipeQueue()
+{
+	m_pipeWriteBuffer.resize(MESSAGE_RING_SIZE);
+
+	size_t writeSize = m_pipeRing.Read(&m_pipeWriteBuffer[0], m_pipeWriteBuffer.size());
+
+	if (writeSize == 0)
+	{
+		// ring is empty, messages that didn't fit are next
+		CriticalSectionLock lock(m_pipeOverflowCritSec);
+
+		if (!m_pipeOverflow.empty())
+		{
+			m_pipeWriteBuffer.swap(m_pipeOverflow.front());
+			m_pipeOverflow.pop_front();
+			m_pipeOverflowSize -= m_pipeWriteBuffer.size();
+
+			writeSize = m_pipeWriteBuffer.size();
+		}
+		else
+		{
+			m_bPipeOverflow = false;
+		}
+	}
+
+	m_pipeWriteSize = writeSize;
+	m_pipeWritePos  = 0;
+
+	return writeSize;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void ConsoleHandler::ContinuePipeWrite()
+{
 	try
 	{
-		m_consoleMsgPipe.Write(&npmsg, sizeof(npmsg));
+		m_consoleMsgPipe.BeginWriteAsync(&m_pipeWriteBuffer[m_pipeWritePos], m_pipeWriteSize - m_pipeWritePos);
 	}
 #ifdef _DEBUG
 	catch(std::exception& e)
 	{
-		TRACE(
-			L"SetWindowPos(pipe) X = %d Y = %d cx = %d cy = %d uFlags = 0x%08lx fails (reason: %S)\n",
-			X, Y,
-			cx, cy,
-			uFlags,
-			e.what());
+		// the write event is set, the callback drops this batch
+		TRACE(L"BeginWriteAsync(pipe) fails (reason: %S)\n", e.what());
 	}
 #else
 	catch(std::exception&) { }
 #endif
+
+	::SetThreadpoolWait(m_pipeWriteWait.get(), m_consoleMsgPipe.GetWriteEvent(), NULL);
 }
 
-void ConsoleHandler::ShowWindow(int nCmdShow)
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void ConsoleHandler::StopPipeWrites()
 {
-	NamedPipeMessage npmsg;
-	npmsg.type = NamedPipeMessage::SHOWWINDOW;
-	npmsg.data.show.nCmdShow = nCmdShow;
+	if (!m_pipeWriteWait) return;
+
+	m_bStopPipeWrites = true;
+
+	// callbacks that are already queued still run (they finish their
+	// write without starting another one); a callback that was already
+	// running might re-arm the wait, so we cancel it again after it's done
+	::SetThreadpoolWait(m_pipeWriteWait.get(), NULL, NULL);
+	::WaitForThreadpoolWaitCallbacks(m_pipeWriteWait.get(), FALSE);
+
+	::SetThreadpoolWait(m_pipeWriteWait.get(), NULL, NULL);
+	::WaitForThreadpoolWaitCallbacks(m_pipeWriteWait.get(), FALSE);
+
+	// whatever is still queued (WM_CLOSE at least) is written now, but we
+	// don't wait forever for a hook that doesn't read
+	DWORD dwStart = ::GetTickCount();
 
 	try
 	{
-		m_consoleMsgPipe.Write(&npmsg, sizeof(npmsg));
+		// if the flag is still set, a write is pending and nobody has
+		// waited for it
+		bool bPending = (m_lPipeWriting != 0);
+
+		for (;;)
+		{
+			if (bPending)
+			{
+				DWORD dwElapsed = ::GetTickCount() - dwStart;
+
+				if ((dwElapsed >= PIPE_FLUSH_TIMEOUT) ||
+					(::WaitForSingleObject(m_consoleMsgPipe.GetWriteEvent(), PIPE_FLUSH_TIMEOUT - dwElapsed) != WAIT_OBJECT_0))
+				{
+					TRACE(L"StopPipeWrites: timeout\n");
+					m_consoleMsgPipe.CancelWrite();
+					break;
+				}
+
+				m_pipeWritePos += m_consoleMsgPipe.EndWriteAsync();
+				bPending = false;
+			}
+
+			if ((m_pipeWritePos >= m_pipeWriteSize) && (ReadPipeQueue() == 0)) break;
+
+			m_consoleMsgPipe.BeginWriteAsync(&m_pipeWriteBuffer[m_pipeWritePos], m_pipeWriteSize - m_pipeWritePos);
+			bPending = true;
+		}
 	}
 #ifdef _DEBUG
 	catch(std::exception& e)
 	{
-		TRACE(
-			L"ShowWindow(pipe) nCmdShow = 0x%08lx fails (reason: %S)\n",
-			nCmdShow,
-			e.what());
+		TRACE(L"StopPipeWrites(pipe) fails (reason: %S)\n", e.what());
 	}
 #else
 	catch(std::exception&) { }
 #endif
+
+	::InterlockedExchange(&m_lPipeWriting, 0);
+	m_pipeWriteWait.reset();
 }
 
-void ConsoleHandler::SendTextToConsole(const wchar_t* pszText)
-{
-	if (pszText == NULL) return;
+//////////////////////////////////////////////////////////////////////////////
 
-	size_t textLen = wcslen(pszText);
 
-	if (textLen == 0) return;
+//////////////////////////////////////////////////////////////////////////////
 
-	NamedPipeMessage npmsg;
-	npmsg.type = NamedPipeMessage::SENDTEXT;
-	npmsg.data.text.dwTextLen = static_cast<DWORD>(textLen);
+VOID CALLBACK ConsoleHandler::PipeWriteCallback(PTP_CALLBACK_INSTANCE /*pInstance*/, PVOID pContext, PTP_WAIT /*pWait*/, TP_WAIT_RESULT /*waitResult*/)
+{
+	ConsoleHandler* pConsoleHandler = reinterpret_cast<ConsoleHandler*>(pContext);
+
+	size_t written = 0;
 
 	try
 	{
-		m_consoleMsgPipe.Write(&npmsg, sizeof(npmsg));
-		m_consoleMsgPipe.Write(pszText, textLen * sizeof(wchar_t));
+		written = pConsoleHandler->m_consoleMsgPipe.EndWriteAsync();
 	}
 #ifdef _DEBUG
 	catch(std::exception& e)
 	{
-		TRACE(
-			L"SendTextToConsole(pipe) %s fails (reason: %S)\n",
-			pszText,
-			e.what());
+		// ERROR_BROKEN_PIPE when the console is gone, messages are dropped
+		TRACE(L"EndWriteAsync(pipe) fails (reason: %S)\n", e.what());
 	}
 #else
 	catch(std::exception&) { }
 #endif
+
+	// a failed write drops the rest of the batch
+	if (written == 0) written = pConsoleHandler->m_pipeWriteSize - pConsoleHandler->m_pipeWritePos;
+
+	pConsoleHandler->m_pipeWritePos += written;
+
+	if (pConsoleHandler->m_bStopPipeWrites)
+	{
+		// StopPipeWrites writes the rest
+		::InterlockedExchange(&pConsoleHandler->m_lPipeWriting, 0);
+		return;
+	}
+
+	// short write, the rest of the batch goes first
+	if (pConsoleHandler->m_pipeWritePos < pConsoleHandler->m_pipeWriteSize)
+	{
+		pConsoleHandler->ContinuePipeWrite();
+		return;
+	}
+
+	pConsoleHandler->StartPipeWrite();
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -13,6 +13,23 @@ typedef fastdelegate::FastDelegate0<>		ConsoleCloseDelegate;
 
 //////////////////////////////////////////////////////////////////////////////
 
+// pasted text is sent to the hook in chunks of this many chars
+#define PASTE_CHUNK_CHARS	4096
+
+// max chars sent but not yet written to the console input by the hook
+#define PASTE_WINDOW_CHARS	16384
+
+// max bytes of messages that didn't fit the pipe ring; past this the
+// console isn't reading its pipe, we drop posted input for it (but not sent
+// messages, and not text, that's already limited by the paste window)
+#define PIPE_OVERFLOW_MAX_SIZE	(4*1024*1024)
+
+// max time (ms) we wait for queued messages to be written when the console
+// is closed
+#define PIPE_FLUSH_TIMEOUT		1000
+
+//////////////////////////////////////////////////////////////////////////////
+
 
 //////////////////////////////////////////////////////////////////////////////
 
@@ -116,19 +133,29 @@ class ConsoleHandler
 			const wstring& strInitialCmd
 		);
 
-		DWORD StartMonitorThread();
-		void StopMonitorThread();
+		void StartMonitoring();
+		void StopMonitoring();
 
 		std::shared_ptr<void> GetConsoleHandle() const					{ return m_hConsoleProcess; }
 
 		SharedMemory<ConsoleParams>& GetConsoleParams()				{ return m_consoleParams; }
 		SharedMemory<ConsoleInfo>& GetConsoleInfo()	{ return m_consoleInfo; }
 		SharedMemory<CONSOLE_CURSOR_INFO>& GetCursorInfo()			{ return m_cursorInfo; }
-		SharedMemory<CHAR_INFO>& GetConsoleBuffer()					{ return m_consoleBuffer; }
 		SharedMemory<ConsoleCopy>& GetCopyInfo()					{ return m_consoleCopyInfo; }
 		SharedMemory<ConsoleSize>& GetNewConsoleSize()				{ return m_newConsoleSize; }
 		SharedMemory<SIZE>& GetNewScrollPos()						{ return m_newScrollPos; }
 
+		// the view either copies console frames into its own buffer, or
+		// renders from a pinned frame (pScreenBuffer is set to the frame
+		// text, NULL if the frame doesn't fit); changed rows are flagged in
+		// rowChanged, the view clears the flags when it repaints them
+		bool CopyConsoleBuffer(CHAR_INFO* pScreenBuffer, RowFlags& rowChanged, DWORD dwRows, DWORD dwColumns, bool bFullCopy, int& nScrolledRows);
+		bool PinConsoleFrame(CHAR_INFO*& pScreenBuffer, RowFlags& rowChanged, DWORD dwRows, DWORD dwColumns, bool bFullCopy, int& nScrolledRows);
+		void UnpinConsoleFrame();
+		bool CopyHistoryRows(CHAR_INFO* pScreenBuffer, RowFlags& rowChanged, DWORD dwRows, DWORD dwColumns, DWORD dwTop, DWORD dwLeft, int nScrollRows);
+
+		static void ClearRow(CHAR_INFO* pRow, DWORD dwColumns);
+
 		void SendMouseEvent(const COORD& mousePos, DWORD dwMouseButtonState, DWORD dwControlKeyState, DWORD dwEventFlags);
 
 		void StopScrolling();
@@ -146,9 +173,28 @@ class ConsoleHandler
 		void ShowWindow(int nCmdShow);
 		void SendTextToConsole(const wchar_t* pszText);
 
+		// messages to the hook are queued (never blocking the caller) and
+		// written in batches by overlapped writes, completed on the monitor
+		// thread pool; grouped input is broadcast as one message, built by
+		// Make* and posted to each console
+		void PostPipeMessage(const NamedPipeMessage& npmsg, const void* pPayload = NULL, size_t payloadSize = 0);
+
+		static NamedPipeMessage MakePostMessage(UINT Msg, WPARAM wParam, LPARAM lParam);
+		static NamedPipeMessage MakeWriteConsoleInput(const KEY_EVENT_RECORD* pkeyEvent);
+
+		// text is queued and sent in chunks as the hook writes it to the
+		// console input; SendPendingText sends what the window allows and
+		// returns true while the paste isn't done
+		bool SendPendingText();
+		bool IsPasting() const;
+		void CancelPaste();
+		void GetPasteProgress(DWORD& dwCharsDone, DWORD& dwChars) const;
+
 	private:
 
 		bool CreateSharedObjects(DWORD dwConsoleProcessId, const wstring& strUser);
+		void CreateConsoleScreen(DWORD dwMaxRows, DWORD dwMaxColumns);
+		void CreateConsoleHistory(DWORD dwMaxCells);
 		void CreateWatchdog();
 
 		bool InjectHookDLL(PROCESS_INFORMATION& pi);
@@ -173,8 +219,24 @@ class ConsoleHandler
 
 	private:
 
-		static DWORD WINAPI MonitorThreadStatic(LPVOID lpParameter);
-		DWORD MonitorThread();
+		// console changes and process exit are waited for on a thread pool
+		// shared by all consoles
+		static PTP_CALLBACK_ENVIRON GetMonitorCallbackEnviron();
+		static VOID CALLBACK ScreenWaitCallback(PTP_CALLBACK_INSTANCE pInstance, PVOID pContext, PTP_WAIT pWait, TP_WAIT_RESULT waitResult);
+		static VOID CALLBACK ProcessWaitCallback(PTP_CALLBACK_INSTANCE pInstance, PVOID pContext, PTP_WAIT pWait, TP_WAIT_RESULT waitResult);
+		void OnConsoleScreenChange();
+
+		void StartPipeWrite();
+		size_t ReadPipeQueue();
+		void ContinuePipeWrite();
+		void StopPipeWrites();
+		static VOID CALLBACK PipeWriteCallback(PTP_CALLBACK_INSTANCE pInstance, PVOID pContext, PTP_WAIT pWait, TP_WAIT_RESULT waitResult);
+
+		DWORD GetTextCharsDone() const;
+
+		void ReadConsoleFrameInfo(DWORD& dwRows, DWORD& dwColumns);
+
+		static void ShiftScreenBuffer(CHAR_INFO* pScreenBuffer, RowFlags& rowChanged, DWORD dwRows, DWORD dwColumns, int nScrollRows);
 
 
 	private:
@@ -192,7 +254,8 @@ class ConsoleHandler
     SharedMemory<ConsoleParams>       m_consoleParams;
     SharedMemory<ConsoleInfo>         m_consoleInfo;
     SharedMemory<CONSOLE_CURSOR_INFO> m_cursorInfo;
-    SharedMemory<CHAR_INFO>           m_consoleBuffer;
+    SharedMemory<ConsoleScreen>       m_consoleScreen;
+    SharedMemory<ConsoleHistory>      m_consoleHistory;
     SharedMemory<ConsoleCopy>         m_consoleCopyInfo;
     SharedMemory<MOUSE_EVENT_RECORD>  m_consoleMouseEvent;
 
@@ -201,12 +264,58 @@ class ConsoleHandler
 
     NamedPipe                         m_consoleMsgPipe;
 
-    std::shared_ptr<void>             m_hMonitorThread;
-    std::shared_ptr<void>             m_hMonitorThreadExit;
+    // messages are queued by the UI thread and written by whoever holds
+    // the writer flag (the UI thread starts a write when none is pending,
+    // the write callback starts the next one); the batch being written
+    // can take several writes, m_pipeWritePos is how much of it is done
+    MessageRing                       m_pipeRing;
+    std::vector<BYTE>                 m_pipeWriteBuffer;
+    size_t                            m_pipeWriteSize;
+    size_t                            m_pipeWritePos;
+    volatile LONG                     m_lPipeWriting;
+    volatile bool                     m_bStopPipeWrites;
+    std::shared_ptr<TP_WAIT>          m_pipeWriteWait;
+
+    // messages that didn't fit the ring, everything goes here (to keep the
+    // order) until the writer has caught up
+    std::deque<std::vector<BYTE> >    m_pipeOverflow;
+    size_t                            m_pipeOverflowSize;
+    volatile bool                     m_bPipeOverflow;
+    CriticalSection                   m_pipeOverflowCritSec;
+
+    // text being pasted (UI thread only, freed when all sent), chars of it
+    // already sent, chars in the paste, chars done by the hook when the
+    // paste started and all SENDTEXT chars sent
+    wstring                           m_strPasteText;
+    size_t                            m_pastePos;
+    DWORD                             m_dwPasteChars;
+    DWORD                             m_dwPasteCharsBase;
+    DWORD                             m_dwTextCharsSent;
+
+    std::shared_ptr<TP_WAIT>          m_screenWait;
+    std::shared_ptr<TP_WAIT>          m_processWait;
+    // set before the waits are cancelled, callbacks don't re-arm them then
+    volatile bool                     m_bStopMonitoring;
+
+    static std::shared_ptr<TP_POOL>   s_monitorPool;
+    static TP_CALLBACK_ENVIRON        s_monitorCallbackEnviron;
 
     static std::shared_ptr<void>      s_environmentBlock;
     static std::shared_ptr<Mutex>     s_parentProcessWatchdog;
 
+    // current console screen version, last frame copied by CopyConsoleBuffer
+    // and the scroll offset the local buffer has been shifted to
+    DWORD                             m_dwScreenVersion;
+    DWORD                             m_dwLastFrame;
+    LONG                              m_lLastScrollOffset;
+
+    // screen the view renders from (kept mapped until the next pin) and the
+    // row hashes of the pinned frame
+    SharedMemory<ConsoleScreen>       m_pinnedScreen;
+    std::vector<unsigned __int64>     m_pinnedRowHashes;
+
+    wstring                           m_strUser;
+
     DWORD                             m_dwConsolePid;
     bool                              m_boolIsElevated;
 
@@ -23,6 +23,9 @@
 
 CFont ConsoleView::m_fontText;
 CFont ConsoleView::m_fontTextHigh;
+GdiTextRenderer ConsoleView::m_gdiTextRenderer;
+GlyphAtlas ConsoleView::m_glyphAtlas;
+D2DTextRenderer ConsoleView::m_d2dTextRenderer;
 DWORD ConsoleView::m_dwFontSize(0);
 DWORD ConsoleView::m_dwFontZoom(100); // 100 %
 
@@ -57,9 +60,20 @@ ConsoleView::ConsoleView(MainFrame& mainFrame, HWND hwndTabView, std::shared_ptr
 , m_strUser()
 , m_boolNetOnly(false)
 , m_consoleHandler()
+, m_pScreen(NULL)
 , m_screenBuffer()
+, m_rowChanged()
+, m_rowLayouts()
+, m_nLayoutCharWidth(0)
+, m_bDirectFrames(g_settingsHandler->GetConsoleSettings().bDirectFrames)
 , m_dwScreenRows(0)
 , m_dwScreenColumns(0)
+, m_nPendingScrollRows(0)
+, m_lPendingUpdate(0)
+, m_nLocalScrollTop(-1)
+, m_rectDamage()
+, m_rectLastCursor()
+, m_rectLastSelection()
 , m_consoleSettings(g_settingsHandler->GetConsoleSettings())
 , m_appearanceSettings(g_settingsHandler->GetAppearanceSettings())
 , m_hotkeys(g_settingsHandler->GetHotKeys())
@@ -72,6 +86,8 @@ ConsoleView::ConsoleView(MainFrame& mainFrame, HWND hwndTabView, std::shared_ptr
 , m_mouseCommand(MouseSettings::cmdNone)
 , m_bFlashTimerRunning(false)
 , m_dwFlashes(0)
+, m_bPasteTimerRunning(false)
+, m_bPasteEscDown(false)
 , m_dcOffscreen(::CreateCompatibleDC(NULL))
 , m_dcText(::CreateCompatibleDC(NULL))
 , m_boolIsGrouped(false)
@@ -83,6 +99,9 @@ ConsoleView::ConsoleView(MainFrame& mainFrame, HWND hwndTabView, std::shared_ptr
 
 ConsoleView::~ConsoleView()
 {
+	// monitor callbacks use the view's buffers
+	m_consoleHandler.StopMonitoring();
+	if (m_bDirectFrames) m_consoleHandler.UnpinConsoleFrame();
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -180,9 +199,9 @@ LRESULT ConsoleView::OnCreate(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM lParam, B
 	// TODO: put this in console size change handler
 	m_dwScreenRows    = m_consoleHandler.GetConsoleParams()->dwRows;
 	m_dwScreenColumns = m_consoleHandler.GetConsoleParams()->dwColumns;
-	m_screenBuffer.reset(new CharInfo[m_dwScreenRows * m_dwScreenColumns]);
+	CreateScreenBuffer();
 
-	m_consoleHandler.StartMonitorThread();
+	m_consoleHandler.StartMonitoring();
 
 	return 0;
 }
@@ -195,6 +214,7 @@ LRESULT ConsoleView::OnCreate(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM lParam, B
 LRESULT ConsoleView::OnClose(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM /*lParam*/, BOOL& /*bHandled*/)
 {
 	if (m_bFlashTimerRunning) KillTimer(FLASH_TAB_TIMER);
+	if (m_bPasteTimerRunning) KillTimer(PASTE_TIMER);
 	return 0;
 }
 
@@ -337,6 +357,21 @@ LRESULT ConsoleView::OnConsoleFwdMsg(UINT uMsg, WPARAM wParam, LPARAM lParam, BO
 {
 	if (((uMsg == WM_KEYDOWN) || (uMsg == WM_KEYUP)) && (wParam == VK_PACKET)) return 0;
 
+	// Esc cancels pasting; the key down and its char don't go to the
+	// console, the key up does
+	if ((uMsg == WM_KEYDOWN) && (wParam == VK_ESCAPE) && m_consoleHandler.IsPasting())
+	{
+		m_consoleHandler.CancelPaste();
+		m_bPasteEscDown = true;
+		return 0;
+	}
+
+	if (m_bPasteEscDown && ((uMsg == WM_CHAR) || (uMsg == WM_KEYUP)) && (wParam == VK_ESCAPE))
+	{
+		m_bPasteEscDown = false;
+		if (uMsg == WM_CHAR) return 0;
+	}
+
 	if (uMsg == WM_SYSKEYDOWN && wParam == VK_MENU)
 	{
 		/*
@@ -655,7 +690,7 @@ LRESULT ConsoleView::OnMouseButton(UINT uMsg, WPARAM wParam, LPARAM lParam, BOOL
 			::SetCursor(::LoadCursor(NULL, IDC_IBEAM));
 
 			MutexLock bufferLock(m_consoleHandler.m_bufferMutex);
-			m_selectionHandler->StartSelection(GetConsoleCoord(point, true), m_screenBuffer.get(), seltypeText);
+			m_selectionHandler->StartSelection(GetConsoleCoord(point, true), m_pScreen, seltypeText);
 
 			m_mouseCommand = MouseSettings::cmdSelect;
 			return 0;
@@ -669,7 +704,7 @@ LRESULT ConsoleView::OnMouseButton(UINT uMsg, WPARAM wParam, LPARAM lParam, BOOL
 			if ((*it)->action == mouseActionCopy)
 			{
 				MutexLock bufferLock(m_consoleHandler.m_bufferMutex);
-				m_selectionHandler->SelectWord(GetConsoleCoord(point), m_screenBuffer.get());
+				m_selectionHandler->SelectWord(GetConsoleCoord(point), m_pScreen);
 
 				m_mouseCommand = MouseSettings::cmdSelect;
 				return 0;
@@ -683,7 +718,7 @@ LRESULT ConsoleView::OnMouseButton(UINT uMsg, WPARAM wParam, LPARAM lParam, BOOL
 			::SetCursor(::LoadCursor(NULL, IDC_CROSS));
 
 			MutexLock bufferLock(m_consoleHandler.m_bufferMutex);
-			m_selectionHandler->StartSelection(GetConsoleCoord(point, true), m_screenBuffer.get(), seltypeColumn);
+			m_selectionHandler->StartSelection(GetConsoleCoord(point, true), m_pScreen, seltypeColumn);
 
 			m_mouseCommand = MouseSettings::cmdColumnSelect;
 			return 0;
@@ -823,7 +858,7 @@ LRESULT ConsoleView::OnMouseMove(UINT uMsg, WPARAM wParam, LPARAM lParam, BOOL&
 
 		{
 			MutexLock bufferLock(m_consoleHandler.m_bufferMutex);
-			m_selectionHandler->UpdateSelection(GetConsoleCoord(point), m_screenBuffer.get());
+			m_selectionHandler->UpdateSelection(GetConsoleCoord(point), m_pScreen);
 		}
 
 		BitBltOffscreen();
@@ -939,6 +974,38 @@ LRESULT ConsoleView::OnTimer(UINT /*uMsg*/, WPARAM wParam, LPARAM /*lParam*/, BO
 		return 0;
 	}
 
+	if (wParam == PASTE_TIMER)
+	{
+		if (!m_consoleHandler.SendPendingText())
+		{
+			KillTimer(PASTE_TIMER);
+			m_bPasteTimerRunning = false;
+		}
+
+		return 0;
+	}
+
+	if (wParam == LOCAL_SCROLL_TIMER)
+	{
+		KillTimer(LOCAL_SCROLL_TIMER);
+
+		// the console window hasn't got to the rows we're showing, show
+		// whatever it has
+		MutexLock bufferLock(m_consoleHandler.m_bufferMutex);
+
+		if (m_nLocalScrollTop >= 0)
+		{
+			int nScrolledRows = 0;
+
+			m_nLocalScrollTop = -1;
+			ReadConsoleFrame(true, nScrolledRows);
+
+			ScheduleUpdate(UPDATE_CONSOLE_TEXT_CHANGED);
+		}
+
+		return 0;
+	}
+
 	if (!m_bActive) return 0;
 
 	if (wParam == CURSOR_TIMER)
@@ -1016,7 +1083,7 @@ LRESULT ConsoleView::OnDropFiles(UINT /*uMsg*/, WPARAM wParam, LPARAM /*lParam*/
 	if( this->IsGrouped() )
 		m_mainFrame.SendTextToConsoles(strFilenames);
 	else
-		m_consoleHandler.SendTextToConsole(strFilenames);
+		SendTextToConsole(strFilenames);
 
 	m_mainFrame.SetActiveConsole(m_hwndTabView, m_hWnd);
 
@@ -1030,6 +1097,8 @@ LRESULT ConsoleView::OnDropFiles(UINT /*uMsg*/, WPARAM wParam, LPARAM /*lParam*/
 
 LRESULT ConsoleView::OnUpdateConsoleView(UINT /*uMsg*/, WPARAM wParam, LPARAM /*lParam*/, BOOL& /*bHandled*/)
 {
+	wParam |= static_cast<WPARAM>(::InterlockedExchange(&m_lPendingUpdate, 0));
+
 	if (m_bInitializing) return false;
 
 	bool bResize	= ((wParam & UPDATE_CONSOLE_RESIZE) > 0);
@@ -1078,7 +1147,7 @@ LRESULT ConsoleView::OnUpdateConsoleView(UINT /*uMsg*/, WPARAM wParam, LPARAM /*
 		SCROLLINFO si;
 		si.cbSize = sizeof(si);
 		si.fMask  = SIF_POS | SIF_RANGE | SIF_DISABLENOSCROLL;
-		si.nPos   = consoleInfo->csbi.srWindow.Top;
+		si.nPos   = GetWindowTop();
 		si.nMax   = m_dwVScrollMax;
 		si.nMin   = 0;
 		::FlatSB_SetScrollInfo(m_hWnd, SB_VERT, &si, TRUE);
@@ -1106,7 +1175,7 @@ LRESULT ConsoleView::OnUpdateConsoleView(UINT /*uMsg*/, WPARAM wParam, LPARAM /*
 		ScreenToClient(&point);
 
 		MutexLock bufferLock(m_consoleHandler.m_bufferMutex);
-		m_selectionHandler->UpdateSelection(GetConsoleCoord(point), m_screenBuffer.get());
+		m_selectionHandler->UpdateSelection(GetConsoleCoord(point), m_pScreen);
 	}
 	else if (m_selectionHandler->GetState() == SelectionHandler::selstateSelected)
 	{
@@ -1118,6 +1187,20 @@ LRESULT ConsoleView::OnUpdateConsoleView(UINT /*uMsg*/, WPARAM wParam, LPARAM /*
 	return 0;
 }
 
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+LRESULT ConsoleView::OnImageReady(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM /*lParam*/, BOOL& /*bHandled*/)
+{
+	// the background has been scaled to our size, swap it for the
+	// stretched one (hidden views repaint when they're activated)
+	if (m_bActive && !m_bInitializing) Repaint(true);
+
+	return 0;
+}
+
 
 //////////////////////////////////////////////////////////////////////////////
 
@@ -1287,6 +1370,9 @@ bool ConsoleView::RecreateFont(DWORD dwNewFontSize, bool boolZooming)
 
 	if (!m_fontText.IsNull()) m_fontText.DeleteObject();
 	if (!m_fontTextHigh.IsNull()) m_fontTextHigh.DeleteObject();
+	m_gdiTextRenderer.Clear();
+	m_glyphAtlas.Clear();
+	m_d2dTextRenderer.Clear();
 	if (!CreateFont(g_settingsHandler->GetAppearanceSettings().fontSettings.strName))
 	{
 		CreateFont(wstring(L"Courier New"));
@@ -1298,6 +1384,9 @@ bool ConsoleView::RecreateFont(DWORD dwNewFontSize, bool boolZooming)
 void ConsoleView::RecreateOffscreenBuffers(ADJUSTSIZE as)
 {
   if (!m_backgroundBrush.IsNull())m_backgroundBrush.DeleteObject();
+#ifdef _USE_AERO
+  m_textGraphics.reset();
+#endif //_USE_AERO
   if( as == ADJUSTSIZE_WINDOW )
   {
     if (!m_bmpOffscreen.IsNull())	m_bmpOffscreen.DeleteObject();
@@ -1318,7 +1407,22 @@ void ConsoleView::Repaint(bool bFullRepaint)
 	// OnPaint will do the work for a full repaint
 	if (!m_bNeedFullRepaint)
 	{
-		// not a forced full text repaint, check text difference
+		// text has scrolled, shift the text layer first; with a background
+		// image the image would scroll with the text, so we repaint it all
+		if (!bFullRepaint)
+		{
+			if (m_tabData->backgroundImageType == bktypeNone)
+			{
+				ScrollText(m_dcText);
+			}
+			else
+			{
+				MutexLock bufferLock(m_consoleHandler.m_bufferMutex);
+				if (m_nPendingScrollRows != 0) bFullRepaint = true;
+			}
+		}
+
+		// not a forced full text repaint, check text difference (in rows)
 		if (!bFullRepaint) bFullRepaint = (GetBufferDifference() > 15);
 
 		// repaint text layer
@@ -1461,6 +1565,23 @@ void ConsoleView::ClearSelection()
 //////////////////////////////////////////////////////////////////////////////
 
 
+//////////////////////////////////////////////////////////////////////////////
+
+void ConsoleView::SendTextToConsole(const wchar_t* pszText)
+{
+	m_consoleHandler.SendTextToConsole(pszText);
+
+	// the rest is sent as the console takes it
+	if (m_consoleHandler.IsPasting() && !m_bPasteTimerRunning)
+	{
+		m_bPasteTimerRunning = true;
+		SetTimer(PASTE_TIMER, PASTE_TIMER_INTERVAL);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
 //////////////////////////////////////////////////////////////////////////////
 
 void ConsoleView::DumpBuffer()
@@ -1474,7 +1595,7 @@ void ConsoleView::DumpBuffer()
 	{
 		for (DWORD j = 0; j < m_dwScreenColumns; ++j)
 		{
-			of << m_screenBuffer[dwOffset].charInfo.Char.UnicodeChar;
+			of << m_pScreen[dwOffset].Char.UnicodeChar;
 			++dwOffset;
 		}
 
@@ -1497,11 +1618,7 @@ void ConsoleView::DumpBuffer()
 void ConsoleView::OnConsoleChange(bool bResize)
 {
 	SharedMemory<ConsoleParams>&	consoleParams	= m_consoleHandler.GetConsoleParams();
-	SharedMemory<ConsoleInfo>&	consoleInfo = m_consoleHandler.GetConsoleInfo();
-	SharedMemory<CHAR_INFO>&	consoleBuffer = m_consoleHandler.GetConsoleBuffer();
 
-	SharedMemoryLock	consoleInfoLock(consoleInfo);
-	SharedMemoryLock	sharedBufferLock(consoleBuffer);
 	MutexLock			localBufferLock(m_consoleHandler.m_bufferMutex);
 
 	// console size changed, resize local buffer
@@ -1509,27 +1626,102 @@ void ConsoleView::OnConsoleChange(bool bResize)
 	{
 		m_dwScreenRows    = consoleParams->dwRows;
 		m_dwScreenColumns = consoleParams->dwColumns;
-		m_screenBuffer.reset(new CharInfo[m_dwScreenRows * m_dwScreenColumns]);
+		CreateScreenBuffer();
 	}
-	DWORD dwBufferSize = m_dwScreenRows * m_dwScreenColumns;
 
-	// copy changed data
-	for (DWORD dwOffset = 0; dwOffset < dwBufferSize; ++dwOffset)
+	bool bFullCopy = bResize;
+
+	// we've scrolled from the history, skip frames until the console window
+	// gets there; the buffer might differ from the console in places, so we
+	// compare all rows then
+	if (m_nLocalScrollTop >= 0)
 	{
-		m_screenBuffer[dwOffset].copy(consoleBuffer.Get() + dwOffset);
+		if (!bResize && (m_consoleHandler.GetConsoleInfo()->csbi.srWindow.Top != m_nLocalScrollTop)) return;
+
+		m_nLocalScrollTop = -1;
+		bFullCopy         = true;
 	}
 
-	WPARAM wParam = 0;
+	// copy changed data (all rows after resize)
+	int  nScrolledRows = 0;
+	bool textChanged   = ReadConsoleFrame(bFullCopy, nScrolledRows);
+
+	m_nPendingScrollRows += nScrolledRows;
+
+	LONG lUpdate = 0;
 
-	if (bResize) wParam |= UPDATE_CONSOLE_RESIZE;
+	if (bResize) lUpdate |= UPDATE_CONSOLE_RESIZE;
+	if (textChanged) lUpdate |= UPDATE_CONSOLE_TEXT_CHANGED;
 
-	if (consoleInfo->textChanged)
+	ScheduleUpdate(lUpdate);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void ConsoleView::CreateScreenBuffer()
+{
+	// a blank buffer until we copy (or pin) the first console frame
+	m_screenBuffer.reset(new CHAR_INFO[m_dwScreenRows * m_dwScreenColumns]);
+	m_rowChanged.Reset(m_dwScreenRows);
+	m_rowLayouts.clear();
+	m_rowLayouts.resize(m_dwScreenRows);
+
+	for (DWORD i = 0; i < m_dwScreenRows; ++i)
 	{
-		wParam |= UPDATE_CONSOLE_TEXT_CHANGED;
-		consoleInfo->textChanged = false;
+		ConsoleHandler::ClearRow(m_screenBuffer.get() + i*m_dwScreenColumns, m_dwScreenColumns);
 	}
 
-	PostMessage(UM_UPDATE_CONSOLE_VIEW, wParam);
+	m_pScreen = m_screenBuffer.get();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+bool ConsoleView::ReadConsoleFrame(bool bFullCopy, int& nScrolledRows)
+{
+	if (!m_bDirectFrames)
+	{
+		return m_consoleHandler.CopyConsoleBuffer(m_screenBuffer.get(), m_rowChanged, m_dwScreenRows, m_dwScreenColumns, bFullCopy, nScrolledRows);
+	}
+
+	// we render straight from the frame we've pinned in shared memory
+	CHAR_INFO*	pFrameBuffer	= NULL;
+	bool		textChanged		= m_consoleHandler.PinConsoleFrame(pFrameBuffer, m_rowChanged, m_dwScreenRows, m_dwScreenColumns, bFullCopy, nScrolledRows);
+
+	if (pFrameBuffer != NULL)
+	{
+		m_pScreen = pFrameBuffer;
+		m_screenBuffer.reset();
+	}
+	else if (m_pScreen != m_screenBuffer.get())
+	{
+		// frame doesn't match our size (the console is resizing), we can't
+		// keep showing the frame we've had pinned
+		CreateScreenBuffer();
+		textChanged = true;
+	}
+
+	return textChanged;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void ConsoleView::ScheduleUpdate(LONG lUpdate)
+{
+	// main frame repaints scheduled views once per frame, changes until
+	// then are merged into the pending update
+	if ((::InterlockedOr(&m_lPendingUpdate, lUpdate | UPDATE_CONSOLE_PENDING) & UPDATE_CONSOLE_PENDING) == 0)
+	{
+		m_mainFrame.PostMessage(UM_SCHEDULE_VIEW_UPDATE, reinterpret_cast<WPARAM>(m_hWnd));
+	}
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -1587,6 +1779,11 @@ void ConsoleView::CreateOffscreenBuffers()
 	if (m_bmpOffscreen.IsNull()) CreateOffscreenBitmap(m_dcOffscreen, rectWindowMax, m_bmpOffscreen);
 	if (m_bmpText.IsNull()) CreateOffscreenBitmap(m_dcText, rectWindowMax, m_bmpText);
 	m_dcText.SelectFont(m_fontText);
+#ifdef _USE_AERO
+	// text layer is painted through one GDI+ context
+	m_textGraphics.reset(new Gdiplus::Graphics(m_dcText));
+	PixelKernels::GetPixelBuffer(m_bmpText, m_textPixels);
+#endif //_USE_AERO
 
 	// create background brush
 	m_backgroundBrush.CreateSolidBrush(m_tabData->crBackgroundColor);
@@ -1868,30 +2065,36 @@ void ConsoleView::DoScroll(int nType, int nScrollCode, int nThumbPos)
 			return;
 	}
 
+	int nCurrentPos = 0;
+
 	if( nType == SB_VERT )
 	{
-		int nCurrentPos = m_consoleHandler.GetConsoleInfo()->csbi.srWindow.Top;
+		nCurrentPos = GetWindowTop();
 		int nVScrollMaxTop = static_cast<int>(m_dwVScrollMax - m_consoleHandler.GetConsoleParams()->dwRows + 1);
 		if( (nCurrentPos + nDelta) > nVScrollMaxTop )
 			nDelta = nVScrollMaxTop - nCurrentPos;
+		if( (nCurrentPos + nDelta) < 0 )
+			nDelta = -nCurrentPos;
 	}
 
 	if (nDelta != 0)
 	{
 		SharedMemory<SIZE>& newScrollPos = m_consoleHandler.GetNewScrollPos();
 
-		if (nType == SB_VERT)
-		{
-			newScrollPos->cx = 0;
-			newScrollPos->cy = nDelta;
-		}
-		else
 		{
-			newScrollPos->cx = nDelta;
-			newScrollPos->cy = 0;
+			// the hook adds up our requests until it scrolls the console
+			SharedMemoryLock memLock(newScrollPos);
+
+			if (nType == SB_VERT)
+				newScrollPos->cy += nDelta;
+			else
+				newScrollPos->cx += nDelta;
 		}
 
 		newScrollPos.SetReqEvent();
+
+		// show the rows from the history meanwhile
+		if (nType == SB_VERT) ScrollFromHistory(nCurrentPos + nDelta);
 	}
 }
 
@@ -1900,18 +2103,74 @@ void ConsoleView::DoScroll(int nType, int nScrollCode, int nThumbPos)
 
 /////////////////////////////////////////////////////////////////////////////
 
-DWORD ConsoleView::GetBufferDifference()
+int ConsoleView::GetWindowTop()
 {
-	MutexLock	bufferLock(m_consoleHandler.m_bufferMutex);
-	DWORD		dwCount				= m_dwScreenRows * m_dwScreenColumns;
-	DWORD		dwChangedPositions	= 0;
+	MutexLock bufferLock(m_consoleHandler.m_bufferMutex);
+
+	if (m_nLocalScrollTop >= 0) return m_nLocalScrollTop;
+
+	return m_consoleHandler.GetConsoleInfo()->csbi.srWindow.Top;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+bool ConsoleView::ScrollFromHistory(int nTop)
+{
+	// pinned frames are read-only, we wait for the console
+	if (m_bDirectFrames) return false;
 
-	for (DWORD i = 0; i < dwCount; ++i)
 	{
-		if (m_screenBuffer[i].changed) ++dwChangedPositions;
+		MutexLock bufferLock(m_consoleHandler.m_bufferMutex);
+
+		int nScrollRows = nTop - GetWindowTop();
+
+		// we can't shift the whole buffer away, we just compare all rows
+		if (static_cast<DWORD>(abs(nScrollRows)) >= m_dwScreenRows) nScrollRows = 0;
+
+		if (m_consoleHandler.CopyHistoryRows(
+				m_screenBuffer.get(), 
+				m_rowChanged, 
+				m_dwScreenRows, 
+				m_dwScreenColumns, 
+				nTop, 
+				m_consoleHandler.GetConsoleInfo()->csbi.srWindow.Left, 
+				nScrollRows))
+		{
+			m_nPendingScrollRows += nScrollRows;
+		}
+		else if (m_nLocalScrollTop < 0)
+		{
+			// rows aren't in the history, we wait for the console
+			return false;
+		}
+
+		// we keep showing the rows we have until the console gets there
+		m_nLocalScrollTop = nTop;
 	}
 
-	return dwChangedPositions*100/dwCount;
+	// wheel and thumb scrolling read the scroll position before we repaint
+	if (m_bShowVScroll) ::FlatSB_SetScrollPos(m_hWnd, SB_VERT, nTop, TRUE);
+
+	SetTimer(LOCAL_SCROLL_TIMER, LOCAL_SCROLL_TIMEOUT);
+	ScheduleUpdate(UPDATE_CONSOLE_TEXT_CHANGED);
+
+	return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+DWORD ConsoleView::GetBufferDifference()
+{
+	MutexLock	bufferLock(m_consoleHandler.m_bufferMutex);
+	DWORD		dwChangedRows		= m_rowChanged.Count();
+
+	return dwChangedRows*100/m_dwScreenRows;
 }
 
 /////////////////////////////////////////////////////////////////////////////
@@ -1954,11 +2213,9 @@ void ConsoleView::RepaintText(CDC& dc)
     TransparencySettings& transparencySettings = g_settingsHandler->GetAppearanceSettings().transparencySettings;
     if (transparencySettings.transType == transGlass)
     {
-      Gdiplus::Graphics gr(dc);
-
       COLORREF backgroundColor = m_tabData->crBackgroundColor;
 
-      gr.Clear(
+      m_textGraphics->Clear(
         Gdiplus::Color(
           this->m_mainFrame.GetAppActiveStatus()? transparencySettings.byActiveAlpha : transparencySettings.byInactiveAlpha,
           GetRValue(backgroundColor),
@@ -1987,19 +2244,15 @@ void ConsoleView::RepaintText(CDC& dc)
     //TRACE(L"========UpdateImageBitmap=====================================\n"
     //      L"rect: %ix%i - %ix%i\n", rectTab.left, rectTab.top, rectTab.right, rectTab.bottom);
 
-		g_imageHandler->UpdateImageBitmap(dc, rectTab, m_background);
+		g_imageHandler->UpdateImageBitmap(dc, rectTab, m_background, m_hWnd);
 
 		if (m_tabData->imageData.bRelative)
 		{
-			dc.BitBlt(
-				rectView.left,
-				rectView.top,
-				rectView.right,
-				rectView.bottom,
-				m_background->dcImage,
-				rectView.left + pointView.x - ::GetSystemMetrics(SM_XVIRTUALSCREEN),
-				rectView.top  + pointView.y - ::GetSystemMetrics(SM_YVIRTUALSCREEN),
-				SRCCOPY);
+			g_imageHandler->BitBltRelativeImage(
+				dc,
+				rectView,
+				CPoint(rectView.left + pointView.x, rectView.top + pointView.y),
+				m_background);
 		}
 		else
 		{
@@ -2017,6 +2270,13 @@ void ConsoleView::RepaintText(CDC& dc)
 
   MutexLock bufferLock(m_consoleHandler.m_bufferMutex);
 
+  ShiftRowLayouts(m_nPendingScrollRows);
+
+  m_nPendingScrollRows = 0;
+  m_rectDamage         = bitmapRect;
+
+  m_tabData->palette.Update(m_tabData->consoleColors, m_consoleSettings.backgroundTextOpacity);
+
   for (DWORD i = 0; i < m_dwScreenRows; ++i)
   {
     this->RowTextOut(dc, i);
@@ -2053,7 +2313,7 @@ void ConsoleView::RepaintText(CDC& dc)
 		nCharWidths		= 0;
 		bTextOut		= false;
 		
-		attrBG = (m_screenBuffer[dwOffset].charInfo.Attributes & 0xFF) >> 4;
+		attrBG = (m_pScreen[dwOffset].Attributes & 0xFF) >> 4;
 		
 		// here we decide how to paint text over the background
 		if (/*consoleColors[attrBG] == RGB(0, 0, 0)*/attrBG == 0)
@@ -2069,9 +2329,9 @@ void ConsoleView::RepaintText(CDC& dc)
 		dc.SetBkMode(nBkMode);
 		dc.SetBkColor(crBkColor);
 
-		crTxtColor		= m_appearanceSettings.fontSettings.bUseColor ? m_appearanceSettings.fontSettings.crFontColor : m_tabData->consoleColors[m_screenBuffer[dwOffset].charInfo.Attributes & 0xF];
+		crTxtColor		= m_appearanceSettings.fontSettings.bUseColor ? m_appearanceSettings.fontSettings.crFontColor : m_tabData->consoleColors[m_pScreen[dwOffset].Attributes & 0xF];
 		dc.SetTextColor(crTxtColor);
-		if ((m_screenBuffer[dwOffset].charInfo.Attributes & 0x8) && m_consoleSettings.bBoldIntensified)
+		if ((m_pScreen[dwOffset].Attributes & 0x8) && m_consoleSettings.bBoldIntensified)
 		{
 			if (!lastFontHigh)
 			{
@@ -2088,22 +2348,20 @@ void ConsoleView::RepaintText(CDC& dc)
 			}
 		}
 
-		strText		= m_screenBuffer[dwOffset].charInfo.Char.UnicodeChar;
-		m_screenBuffer[dwOffset].changed = false;
+		strText		= m_pScreen[dwOffset].Char.UnicodeChar;
 
 		nCharWidths	= 1;
 		++dwOffset;
 
 		for (DWORD j = 1; j < m_dwScreenColumns; ++j, ++dwOffset)
 		{
-			if (m_screenBuffer[dwOffset].charInfo.Attributes & COMMON_LVB_TRAILING_BYTE)
+			if (m_pScreen[dwOffset].Attributes & COMMON_LVB_TRAILING_BYTE)
 			{
-				m_screenBuffer[dwOffset].changed = false;
 				++nCharWidths;
 				continue;
 			}
 			
-			attrBG = (m_screenBuffer[dwOffset].charInfo.Attributes & 0xFF) >> 4;
+			attrBG = (m_pScreen[dwOffset].Attributes & 0xFF) >> 4;
 
 			if (/*consoleColors[attrBG] == RGB(0, 0, 0)*/attrBG == 0)
 			{
@@ -2127,13 +2385,13 @@ void ConsoleView::RepaintText(CDC& dc)
 				}
 			}
 
-			if (crTxtColor != (m_appearanceSettings.fontSettings.bUseColor ? m_appearanceSettings.fontSettings.crFontColor : m_tabData->consoleColors[m_screenBuffer[dwOffset].charInfo.Attributes & 0xF]))
+			if (crTxtColor != (m_appearanceSettings.fontSettings.bUseColor ? m_appearanceSettings.fontSettings.crFontColor : m_tabData->consoleColors[m_pScreen[dwOffset].Attributes & 0xF]))
 			{
-				crTxtColor = m_appearanceSettings.fontSettings.bUseColor ? m_appearanceSettings.fontSettings.crFontColor : m_tabData->consoleColors[m_screenBuffer[dwOffset].charInfo.Attributes & 0xF];
+				crTxtColor = m_appearanceSettings.fontSettings.bUseColor ? m_appearanceSettings.fontSettings.crFontColor : m_tabData->consoleColors[m_pScreen[dwOffset].Attributes & 0xF];
 				bTextOut = true;
 			}
 
-			if (m_screenBuffer[dwOffset].charInfo.Attributes & 0x8)
+			if (m_pScreen[dwOffset].Attributes & 0x8)
 			{
 				bTextOut = true;
 			}
@@ -2148,7 +2406,7 @@ void ConsoleView::RepaintText(CDC& dc)
 				dc.SetBkMode(nBkMode);
 				dc.SetBkColor(crBkColor);
 				dc.SetTextColor(crTxtColor);
-				if ((m_screenBuffer[dwOffset].charInfo.Attributes & 0x8) && m_consoleSettings.bBoldIntensified)
+				if ((m_pScreen[dwOffset].Attributes & 0x8) && m_consoleSettings.bBoldIntensified)
 				{
 					if (!lastFontHigh)
 					{
@@ -2165,15 +2423,13 @@ void ConsoleView::RepaintText(CDC& dc)
 					}
 				}
 
-				strText		= m_screenBuffer[dwOffset].charInfo.Char.UnicodeChar;
-				m_screenBuffer[dwOffset].changed = false;
+				strText		= m_pScreen[dwOffset].Char.UnicodeChar;
 				nCharWidths	= 1;
 				bTextOut	= false;
 			}
 			else
 			{
-				strText += m_screenBuffer[dwOffset].charInfo.Char.UnicodeChar;
-				m_screenBuffer[dwOffset].changed = false;
+				strText += m_pScreen[dwOffset].Char.UnicodeChar;
 				++nCharWidths;
 			}
 		}
@@ -2196,7 +2452,6 @@ void ConsoleView::RepaintTextChanges(CDC& dc)
 {
   //TRACE(L"ConsoleView::RepaintTextChanges\n");
   DWORD dwY      = m_nHInsideBorder;
-  DWORD dwOffset = 0;
 
   MutexLock bufferLock(m_consoleHandler.m_bufferMutex);
 
@@ -2214,24 +2469,16 @@ void ConsoleView::RepaintTextChanges(CDC& dc)
     //TRACE(L"========UpdateImageBitmap=====================================\n"
     //      L"rect: %ix%i - %ix%i\n", rectTab.left, rectTab.top, rectTab.right, rectTab.bottom);
 
-    g_imageHandler->UpdateImageBitmap(dc, rectTab, m_background);
+    g_imageHandler->UpdateImageBitmap(dc, rectTab, m_background, m_hWnd);
   }
 
+  m_tabData->palette.Update(m_tabData->consoleColors, m_consoleSettings.backgroundTextOpacity);
+
   for (DWORD i = 0; i < m_dwScreenRows; ++i, dwY += m_nCharHeight)
   {
-    DWORD dwX = m_nVInsideBorder;
-
-    bool rowHasChanged = false;
-
-    for (DWORD j = 0; j < m_dwScreenColumns; ++j, ++dwOffset, dwX += m_nCharWidth)
-    {
-      if (m_screenBuffer[dwOffset].changed)
-      {
-        rowHasChanged = true;
-      }
-    }
+    DWORD dwX = m_nVInsideBorder + m_dwScreenColumns * m_nCharWidth;
 
-    if( rowHasChanged )
+    if( m_rowChanged.Test(i) )
     {
       CRect rect;
       rect.top    = dwY;
@@ -2247,22 +2494,31 @@ void ConsoleView::RepaintTextChanges(CDC& dc)
         TransparencySettings& transparencySettings = g_settingsHandler->GetAppearanceSettings().transparencySettings;
         if (transparencySettings.transType == transGlass)
         {
-          Gdiplus::Graphics gr(dc);
-
-          gr.SetClip(
-            Gdiplus::Rect(
-              rect.left, rect.top,
-              rect.Width(), rect.Height()),
-            Gdiplus::CombineModeReplace);
-
           COLORREF backgroundColor = m_tabData->crBackgroundColor;
-
-          gr.Clear(
-            Gdiplus::Color(
-              this->m_mainFrame.GetAppActiveStatus()? transparencySettings.byActiveAlpha : transparencySettings.byInactiveAlpha,
-              GetRValue(backgroundColor),
-              GetGValue(backgroundColor),
-              GetBValue(backgroundColor)));
+          BYTE     byAlpha         = this->m_mainFrame.GetAppActiveStatus()? transparencySettings.byActiveAlpha : transparencySettings.byInactiveAlpha;
+
+          if (m_textPixels.pBits != NULL)
+          {
+            ::GdiFlush();
+            PixelKernels::FillRect(m_textPixels, rect, backgroundColor, byAlpha);
+          }
+          else
+          {
+            m_textGraphics->SetClip(
+              Gdiplus::Rect(
+                rect.left, rect.top,
+                rect.Width(), rect.Height()),
+              Gdiplus::CombineModeReplace);
+
+            m_textGraphics->Clear(
+              Gdiplus::Color(
+                byAlpha,
+                GetRValue(backgroundColor),
+                GetGValue(backgroundColor),
+                GetBValue(backgroundColor)));
+
+            m_textGraphics->ResetClip();
+          }
         }
 #endif
       }
@@ -2270,15 +2526,11 @@ void ConsoleView::RepaintTextChanges(CDC& dc)
       {
         if (m_tabData->imageData.bRelative)
         {
-          dc.BitBlt(
-            rect.left,
-            rect.top,
-            rect.Width(),
-            rect.Height(),
-            m_background->dcImage,
-            rect.left + pointView.x - ::GetSystemMetrics(SM_XVIRTUALSCREEN),
-            rect.top  + pointView.y - ::GetSystemMetrics(SM_YVIRTUALSCREEN),
-            SRCCOPY);
+          g_imageHandler->BitBltRelativeImage(
+            dc,
+            rect,
+            CPoint(rect.left + pointView.x, rect.top + pointView.y),
+            m_background);
         }
         else
         {
@@ -2295,207 +2547,285 @@ void ConsoleView::RepaintTextChanges(CDC& dc)
       }
 
       this->RowTextOut(dc, i);
+
+      m_rectDamage.UnionRect(&m_rectDamage, &rect);
     }
   }
 }
 
 
+/////////////////////////////////////////////////////////////////////////////
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+void ConsoleView::ScrollText(CDC& dc)
+{
+	MutexLock bufferLock(m_consoleHandler.m_bufferMutex);
+
+	int nScrollRows = m_nPendingScrollRows;
+
+	ShiftRowLayouts(nScrollRows);
+
+	m_nPendingScrollRows = 0;
+
+	if ((nScrollRows == 0) || (static_cast<DWORD>(abs(nScrollRows)) >= m_dwScreenRows)) return;
+
+	// move the rows that are still on screen, the uncovered ones have been
+	// marked as changed in the buffer and are repainted by RepaintTextChanges
+	int nShiftedHeight = (m_dwScreenRows - abs(nScrollRows)) * m_nCharHeight;
+	int nScrollHeight  = abs(nScrollRows) * m_nCharHeight;
+	int nWidth         = m_dwScreenColumns * m_nCharWidth;
+
+	CRect rectText(m_nVInsideBorder, m_nHInsideBorder, m_nVInsideBorder + nWidth, m_nHInsideBorder + m_dwScreenRows * m_nCharHeight);
+	m_rectDamage.UnionRect(&m_rectDamage, &rectText);
+
+	if (nScrollRows > 0)
+	{
+		dc.BitBlt(
+			m_nVInsideBorder,
+			m_nHInsideBorder,
+			nWidth,
+			nShiftedHeight,
+			dc,
+			m_nVInsideBorder,
+			m_nHInsideBorder + nScrollHeight,
+			SRCCOPY);
+	}
+	else
+	{
+		dc.BitBlt(
+			m_nVInsideBorder,
+			m_nHInsideBorder + nScrollHeight,
+			nWidth,
+			nShiftedHeight,
+			dc,
+			m_nVInsideBorder,
+			m_nHInsideBorder,
+			SRCCOPY);
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+
+/////////////////////////////////////////////////////////////////////////////
+
 void ConsoleView::RowTextOut(CDC& dc, DWORD dwRow)
 {
   //TRACE(L"ConsoleView::RepaintRow %lu\n", dwRow);
-  DWORD dwX      = m_nVInsideBorder;
-  DWORD dwY      = m_nHInsideBorder + m_nCharHeight * dwRow;
-  DWORD dwOffset = m_dwScreenColumns * dwRow;
+  DWORD dwY = m_nHInsideBorder + m_nCharHeight * dwRow;
 
-  COLORREF * consoleColors = m_tabData->consoleColors;
+  COLORREF *     consoleColors = m_tabData->consoleColors;
+  PaletteCache & palette       = m_tabData->palette;
 
-#ifdef _USE_AERO
-  Gdiplus::Graphics gr(dc);
-#endif //_USE_AERO
-
-  std::unique_ptr<INT[]> dxWidths(new INT[m_dwScreenColumns]);
+  const RowLayout&              layout = GetRowLayout(dwRow);
+  const std::vector<TextRun>&   runs   = layout.runs;
 
-  // first pass : text background color
-  WORD    attrBG    = 0;
-  DWORD   dwBGWidth = 0;
+  // reset change state
+  m_rowChanged.Clear(dwRow);
 
-  for (DWORD j = 0; j < m_dwScreenColumns; ++j, ++dwOffset)
+  // first pass : text background color, adjacent runs with the same
+  // background are filled at once
+  for (size_t i = 0; i < runs.size(); )
   {
-    // reset change state
-    m_screenBuffer[dwOffset].changed = false;
+    WORD  attrBG    = runs[i].wAttributes >> 4;
+    DWORD dwX       = m_nVInsideBorder + runs[i].nX;
+    DWORD dwBGWidth = 0;
+
+    for (; (i < runs.size()) && ((runs[i].wAttributes >> 4) == attrBG); ++i) dwBGWidth += runs[i].nWidth;
+
+    if (attrBG == 0) continue;
 
-    // compare background color
-    WORD attrBG2 = (m_screenBuffer[dwOffset].charInfo.Attributes & 0xFF) >> 4;
-    if( dwBGWidth == 0 )
+#ifdef _USE_AERO
+    if (m_textPixels.pBits != NULL)
     {
-      attrBG    = attrBG2;
-      dwBGWidth = m_nCharWidth;
+      ::GdiFlush();
+      PixelKernels::BlendRect(
+        m_textPixels,
+        CRect(dwX, dwY, dwX + dwBGWidth, dwY + m_nCharHeight),
+        consoleColors[attrBG],
+        m_consoleSettings.backgroundTextOpacity);
     }
     else
     {
-      if( attrBG == attrBG2 )
-      {
-        dwBGWidth += m_nCharWidth;
-      }
-      else
-      {
-        // draw background and reset
-
-        if (attrBG != 0)
-        {
-#ifdef _USE_AERO
-          COLORREF backgroundColor = consoleColors[attrBG];
-          Gdiplus::SolidBrush backgroundBrush(
-            Gdiplus::Color(
-              m_consoleSettings.backgroundTextOpacity,
-              GetRValue(backgroundColor),
-              GetGValue(backgroundColor),
-              GetBValue(backgroundColor)));
-
-          gr.FillRectangle(
-            &backgroundBrush,
-            dwX, dwY,
-            dwBGWidth, m_nCharHeight);
+      m_textGraphics->FillRectangle(
+        palette.GetAeroBrush(attrBG),
+        dwX, dwY,
+        dwBGWidth, m_nCharHeight);
+    }
 #else //_USE_AERO
-          CBrush backgroundBrush;
-          backgroundBrush.CreateSolidBrush(consoleColors[attrBG]);
+    CRect rect;
+    rect.top    = dwY;
+    rect.left   = dwX;
+    rect.bottom = dwY + m_nCharHeight;
+    rect.right  = dwX + dwBGWidth;
+    dc.FillRect(&rect, palette.GetBrush(attrBG));
+#endif //_USE_AERO
+  }
 
-          CRect rect;
-          rect.top    = dwY;
-          rect.left   = dwX;
-          rect.bottom = dwY + m_nCharHeight;
-          rect.right  = dwX + dwBGWidth;
+  // second pass : text
+  bool     boolIntensified = m_appearanceSettings.fontSettings.bBoldIntensified ||
+                             m_appearanceSettings.fontSettings.bItalicIntensified;
+  bool     boolUseColor    = m_appearanceSettings.fontSettings.bUseColor;
+  COLORREF crFontColor     = m_appearanceSettings.fontSettings.crFontColor;
 
-          dc.FillRect(&rect, (HBRUSH)backgroundBrush);
-#endif //_USE_AERO
-        }
+  CRect rectRow;
+  rectRow.top    = dwY;
+  rectRow.left   = m_nVInsideBorder;
+  rectRow.bottom = dwY + m_nCharHeight;
+  rectRow.right  = m_nVInsideBorder + m_dwScreenColumns * m_nCharWidth;
 
-        attrBG    = attrBG2;
-        dwX       += dwBGWidth;
-        dwBGWidth = m_nCharWidth;
-      }
-    }
+  TextRenderer* pRenderer = &GetTextRenderer();
+
+  pRenderer->SetFonts(m_fontText, m_fontTextHigh, m_dwFontZoom, m_nCharWidth, m_nCharHeight);
+
+  // renderer can't draw into the text bitmap, fall back to GDI
+  if (!pRenderer->BeginDraw(dc, rectRow))
+  {
+    pRenderer = &m_gdiTextRenderer;
+    pRenderer->SetFonts(m_fontText, m_fontTextHigh, m_dwFontZoom, m_nCharWidth, m_nCharHeight);
+    pRenderer->BeginDraw(dc, rectRow);
   }
 
-  if( dwBGWidth > 0 )
+  // adjacent runs with the same color and font are drawn at once
+  for (size_t i = 0; i < runs.size(); )
   {
-    if (attrBG != 0)
+    COLORREF colorFG   = boolUseColor ? crFontColor : consoleColors[runs[i].wAttributes & 0xF];
+    bool     fontHigh  = boolIntensified && (runs[i].wAttributes & 0x8);
+    DWORD    dwX       = m_nVInsideBorder + runs[i].nX;
+    DWORD    dwFGWidth = 0;
+    DWORD    dwFirst   = runs[i].dwFirstChar;
+    DWORD    dwChars   = 0;
+
+    for (; i < runs.size(); ++i)
     {
-#ifdef _USE_AERO
-      COLORREF backgroundColor = consoleColors[attrBG];
-      Gdiplus::SolidBrush backgroundBrush(
-        Gdiplus::Color(
-          m_consoleSettings.backgroundTextOpacity,
-          GetRValue(backgroundColor),
-          GetGValue(backgroundColor),
-          GetBValue(backgroundColor)));
+      if (!boolUseColor && (consoleColors[runs[i].wAttributes & 0xF] != colorFG)) break;
+      if ((boolIntensified && (runs[i].wAttributes & 0x8)) != fontHigh) break;
 
-      gr.FillRectangle(
-        &backgroundBrush,
-        dwX, dwY,
-        dwBGWidth, m_nCharHeight);
-#else //_USE_AERO
-      CBrush backgroundBrush;
-      backgroundBrush.CreateSolidBrush(consoleColors[attrBG]);
+      dwFGWidth += runs[i].nWidth;
+      dwChars   += runs[i].dwChars;
+    }
 
-      CRect rect;
-      rect.top    = dwY;
-      rect.left   = dwX;
-      rect.bottom = dwY + m_nCharHeight;
-      rect.right  = dwX + dwBGWidth;
-      dc.FillRect(&rect, backgroundBrush);
-#endif //_USE_AERO
+    CRect rect;
+    rect.top    = dwY;
+    rect.left   = dwX;
+    rect.bottom = dwY + m_nCharHeight;
+    rect.right  = dwX + dwFGWidth;
 
-      dwX        += dwBGWidth;
-    }
+    // we add the space of the next char
+    // in italic a part of the previous char is drawn in the following char space
+    if( i < runs.size() ) rect.right += layout.charWidths[runs[i].dwFirstChar];
+
+    pRenderer->DrawRun(dwX, dwY, &layout.chars[dwFirst], &layout.charWidths[dwFirst], dwChars, fontHigh, colorFG, rect);
   }
 
-  // second pass : text
-  dwX      = m_nVInsideBorder;
-  dwOffset = m_dwScreenColumns * dwRow;
+  pRenderer->EndDraw();
+}
 
-  wstring  strText(L"");
-  COLORREF colorFG   = 0;
-  DWORD    dwFGWidth = 0;
-	DWORD    dwCharIdx = 0;
-  bool     fontHigh  = false;
+/////////////////////////////////////////////////////////////////////////////
 
-  bool     boolIntensified = m_appearanceSettings.fontSettings.bBoldIntensified ||
-                             m_appearanceSettings.fontSettings.bItalicIntensified;
 
-  for (DWORD j = 0; j < m_dwScreenColumns; ++j, ++dwOffset)
-  {
-    CHAR_INFO & charInfo = m_screenBuffer[dwOffset].charInfo;
-    if (charInfo.Attributes & COMMON_LVB_TRAILING_BYTE) continue;
+/////////////////////////////////////////////////////////////////////////////
 
-    int nCharWidth = (charInfo.Attributes & COMMON_LVB_LEADING_BYTE)? m_nCharWidth * 2 : m_nCharWidth;
+TextRenderer& ConsoleView::GetTextRenderer()
+{
+  if (m_appearanceSettings.fontSettings.bDirect2D) return m_d2dTextRenderer;
 
-    // compare foreground color
-    COLORREF colorFG2  = m_appearanceSettings.fontSettings.bUseColor ? m_appearanceSettings.fontSettings.crFontColor : consoleColors[charInfo.Attributes & 0xF];
-    bool     fontHigh2 = boolIntensified && (charInfo.Attributes & 0x8);
+  // blend cached glyphs straight into the text bitmap
+  if (m_appearanceSettings.fontSettings.bGlyphAtlas) return m_glyphAtlas;
 
-    if( dwFGWidth == 0 )
-    {
-      colorFG   = colorFG2;
-      dwFGWidth = nCharWidth;
-      fontHigh  = fontHigh2;
+  return m_gdiTextRenderer;
+}
 
-      dc.SelectFont(fontHigh? m_fontTextHigh : m_fontText);
-    }
-    else
-    {
-      if( colorFG == colorFG2 && fontHigh == fontHigh2 )
-      {
-        dwFGWidth += nCharWidth;
-      }
-      else
-      {
-        // draw text and reset
+/////////////////////////////////////////////////////////////////////////////
+
+
+/////////////////////////////////////////////////////////////////////////////
 
-        dc.SetBkMode(TRANSPARENT);
-        dc.SetTextColor(colorFG);
+const ConsoleView::RowLayout& ConsoleView::GetRowLayout(DWORD dwRow)
+{
+  RowLayout& layout = m_rowLayouts[dwRow];
 
-        CRect rect;
-        rect.top    = dwY;
-        rect.left   = dwX;
-        rect.bottom = dwY + m_nCharHeight;
-        // we add the space of the next char
-        // in italic a part of the previous char is drawn in the following char space
-        rect.right  = dwX + dwFGWidth + nCharWidth;
+  if( layout.bValid && !m_rowChanged.Test(dwRow) ) return layout;
 
-        dc.ExtTextOut(dwX, dwY, ETO_CLIPPED, &rect, strText.c_str(), static_cast<UINT>(strText.length()), dxWidths.get());
+  layout.runs.clear();
+  layout.chars.clear();
+  layout.charWidths.clear();
 
-        strText.clear();
-        colorFG   = colorFG2;
-        dwX       += dwFGWidth;
-        dwFGWidth = nCharWidth;
-        dwCharIdx = 0;
+  const CHAR_INFO* pRow = m_pScreen + m_dwScreenColumns * dwRow;
+  int              nX   = 0;
 
-        // change font
-        if( fontHigh != fontHigh2 )
-        {
-          fontHigh = fontHigh2;
-          dc.SelectFont(fontHigh? m_fontTextHigh : m_fontText);
-        }
-      }
+  // runs of chars with the same colors (the intensity bit picks the font)
+  for (DWORD j = 0; j < m_dwScreenColumns; ++j)
+  {
+    const CHAR_INFO & charInfo = pRow[j];
+    if (charInfo.Attributes & COMMON_LVB_TRAILING_BYTE) continue;
+
+    int  nCharWidth  = (charInfo.Attributes & COMMON_LVB_LEADING_BYTE)? m_nCharWidth * 2 : m_nCharWidth;
+    WORD wAttributes = charInfo.Attributes & 0xFF;
+
+    if( layout.runs.empty() || (layout.runs.back().wAttributes != wAttributes) )
+    {
+      TextRun run;
+      run.dwFirstChar = static_cast<DWORD>(layout.chars.size());
+      run.dwChars     = 0;
+      run.nX          = nX;
+      run.nWidth      = 0;
+      run.wAttributes = wAttributes;
+
+      layout.runs.push_back(run);
     }
 
-    strText += charInfo.Char.UnicodeChar;
-    dxWidths[dwCharIdx ++] = nCharWidth;
+    TextRun& run = layout.runs.back();
+
+    ++run.dwChars;
+    run.nWidth += nCharWidth;
+    nX         += nCharWidth;
+
+    layout.chars.push_back(charInfo.Char.UnicodeChar);
+    layout.charWidths.push_back(nCharWidth);
   }
 
-  if( dwFGWidth > 0 )
+  layout.bValid = true;
+
+  return layout;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+void ConsoleView::ShiftRowLayouts(int nScrollRows)
+{
+  DWORD dwScroll = static_cast<DWORD>(abs(nScrollRows));
+
+  // layouts are in pixels, they're rebuilt after font changes
+  if( m_nLayoutCharWidth != m_nCharWidth )
   {
-    dc.SetBkMode(TRANSPARENT);
-    dc.SetTextColor(colorFG);
+    m_nLayoutCharWidth = m_nCharWidth;
+    dwScroll           = m_dwScreenRows;
+  }
 
-    CRect rect;
-    rect.top    = dwY;
-    rect.left   = dwX;
-    rect.bottom = dwY + m_nCharHeight;
-    rect.right  = dwX + dwFGWidth;
+  if( dwScroll == 0 ) return;
+
+  if( dwScroll >= m_rowLayouts.size() )
+  {
+    for (size_t i = 0; i < m_rowLayouts.size(); ++i) m_rowLayouts[i].bValid = false;
+    return;
+  }
 
-    dc.ExtTextOut(dwX, dwY, ETO_CLIPPED, &rect, strText.c_str(), static_cast<UINT>(strText.length()), dxWidths.get());
+  // layouts move with their rows, uncovered rows get new ones
+  if( nScrollRows > 0 )
+  {
+    std::rotate(m_rowLayouts.begin(), m_rowLayouts.begin() + dwScroll, m_rowLayouts.end());
+    for (size_t i = m_rowLayouts.size() - dwScroll; i < m_rowLayouts.size(); ++i) m_rowLayouts[i].bValid = false;
+  }
+  else
+  {
+    std::rotate(m_rowLayouts.begin(), m_rowLayouts.end() - dwScroll, m_rowLayouts.end());
+    for (size_t i = 0; i < dwScroll; ++i) m_rowLayouts[i].bValid = false;
   }
 }
 
@@ -2507,40 +2837,75 @@ void ConsoleView::RowTextOut(CDC& dc, DWORD dwRow)
 void ConsoleView::BitBltOffscreen(bool bOnlyCursor /*= false*/)
 {
 	CRect			rectBlit;
+	CRect			rectClient;
+	CRect			rectCursor		= GetCursorCellRect();
 
-	if (bOnlyCursor)
-	{
-		// blit only cursor
-		if (!(m_cursorDBCS) || !m_consoleHandler.GetCursorInfo()->bVisible) return;
+	GetClientRect(&rectClient);
 
-		SharedMemory<ConsoleInfo>& consoleInfo = m_consoleHandler.GetConsoleInfo();
-		SharedMemoryLock consoleInfoLock(consoleInfo);
+	// relative background images need a full repaint, OnPaint will do it
+	// (and update the offscreen buffer)
+	if (m_tabData->imageData.bRelative && m_bNeedFullRepaint)
+	{
+		InvalidateRect(&rectClient, FALSE);
+		return;
+	}
 
-		rectBlit = m_cursorDBCS->GetCursorRect();
-		rectBlit.MoveToXY(
-			(consoleInfo->csbi.dwCursorPosition.X - consoleInfo->csbi.srWindow.Left) * m_nCharWidth  + m_nVInsideBorder,
-			(consoleInfo->csbi.dwCursorPosition.Y - consoleInfo->csbi.srWindow.Top)  * m_nCharHeight + m_nHInsideBorder);
+	if (bOnlyCursor)
+	{
+		// blit only cursor (and where it was, if it has been hidden or moved
+		// since)
+		rectBlit.UnionRect(&rectCursor, &m_rectLastCursor);
 	}
 	else
 	{
-		// blit rect is entire view
-		GetClientRect(&rectBlit);
-	}
+		// blit repainted text, the cursor where it was and where it is now,
+		// and the selection before and after
+		CRect rectSelection = m_selectionHandler->GetSelectionRect();
 
-	// we can skip this for relative background images when a full repaint 
-	// is needed (UpdateOffscreen will be called in OnPaint)
-	if (!m_tabData->imageData.bRelative || (m_tabData->imageData.bRelative && !m_bNeedFullRepaint))
-	{
-		// we don't do this for relative backgrounds here
-		UpdateOffscreen(rectBlit);
+		rectBlit.UnionRect(&m_rectDamage, &m_rectLastCursor);
+		rectBlit.UnionRect(&rectBlit, &rectCursor);
+		rectBlit.UnionRect(&rectBlit, &m_rectLastSelection);
+		rectBlit.UnionRect(&rectBlit, &rectSelection);
+
+		m_rectDamage.SetRectEmpty();
+		m_rectLastSelection = rectSelection;
 	}
 
+	m_rectLastCursor = rectCursor;
+
+	rectBlit.IntersectRect(&rectBlit, &rectClient);
+	if (rectBlit.IsRectEmpty()) return;
+
+	UpdateOffscreen(rectBlit);
 	InvalidateRect(&rectBlit, FALSE);
 }
 
 /////////////////////////////////////////////////////////////////////////////
 
 
+/////////////////////////////////////////////////////////////////////////////
+
+CRect ConsoleView::GetCursorCellRect()
+{
+	CRect rectCursor;
+
+	if (!(m_cursorDBCS) || !m_consoleHandler.GetCursorInfo()->bVisible) return rectCursor;
+
+	SharedMemory<ConsoleInfo>& consoleInfo = m_consoleHandler.GetConsoleInfo();
+	SharedMemoryLock consoleInfoLock(consoleInfo);
+
+	// DBCS cursor is two cells wide, so it covers both cursors
+	rectCursor = m_cursorDBCS->GetCursorRect();
+	rectCursor.MoveToXY(
+		(consoleInfo->csbi.dwCursorPosition.X - consoleInfo->csbi.srWindow.Left) * m_nCharWidth  + m_nVInsideBorder,
+		(consoleInfo->csbi.dwCursorPosition.Y - consoleInfo->csbi.srWindow.Top)  * m_nCharHeight + m_nHInsideBorder);
+
+	return rectCursor;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+
 /////////////////////////////////////////////////////////////////////////////
 
 void ConsoleView::UpdateOffscreen(const CRect& rectBlit)
@@ -2548,13 +2913,17 @@ void ConsoleView::UpdateOffscreen(const CRect& rectBlit)
 	m_dcOffscreen.BitBlt(
 					rectBlit.left, 
 					rectBlit.top, 
-					rectBlit.right, 
-					rectBlit.bottom, 
+					rectBlit.Width(), 
+					rectBlit.Height(), 
 					m_dcText, 
 					rectBlit.left, 
 					rectBlit.top, 
 					SRCCOPY);
 
+	// cursor and selection are drawn over the text we've just copied only,
+	// elsewhere they're already there
+	m_dcOffscreen.IntersectClipRect(&rectBlit);
+
 	// blit cursor
 	if (m_consoleHandler.GetCursorInfo()->bVisible)
 	{
@@ -2573,7 +2942,7 @@ void ConsoleView::UpdateOffscreen(const CRect& rectBlit)
 				DWORD dwOffset =
 					(consoleInfo->csbi.dwCursorPosition.Y - consoleInfo->csbi.srWindow.Top) * m_dwScreenColumns +
 					(consoleInfo->csbi.dwCursorPosition.X - consoleInfo->csbi.srWindow.Left);
-				DBCS = (m_screenBuffer[dwOffset].charInfo.Attributes & COMMON_LVB_LEADING_BYTE) == COMMON_LVB_LEADING_BYTE;
+				DBCS = (m_pScreen[dwOffset].Attributes & COMMON_LVB_LEADING_BYTE) == COMMON_LVB_LEADING_BYTE;
 			}
 
 			if( DBCS )
@@ -2601,6 +2970,8 @@ void ConsoleView::UpdateOffscreen(const CRect& rectBlit)
 #else //_USE_AERO
 	m_selectionHandler->BitBlt(m_dcOffscreen);
 #endif //_USE_AERO
+
+	m_dcOffscreen.SelectClipRgn(NULL);
 }
 
 /////////////////////////////////////////////////////////////////////////////
@@ -2841,7 +3212,7 @@ void ConsoleView::RedrawCharOnCursor(CDC& dc)
     (consoleInfo->csbi.dwCursorPosition.X - consoleInfo->csbi.srWindow.Left);
 
   CRect                      rectCursor;
-  CHAR_INFO &                charInfo = m_screenBuffer[dwOffset].charInfo;
+  CHAR_INFO &                charInfo = m_pScreen[dwOffset];
   int                      nCharWidth = (charInfo.Attributes & COMMON_LVB_LEADING_BYTE)? m_nCharWidth * 2 : m_nCharWidth;
 
   rectCursor.left   = (consoleInfo->csbi.dwCursorPosition.X - consoleInfo->csbi.srWindow.Left) * m_nCharWidth + m_nVInsideBorder;
@@ -2860,7 +3231,7 @@ void ConsoleView::RedrawCharOnCursor(CDC& dc)
   if( g_settingsHandler->GetAppearanceSettings().fontSettings.bItalic && 
       (consoleInfo->csbi.dwCursorPosition.X - consoleInfo->csbi.srWindow.Left) > 0 )
   {
-    CHAR_INFO & charInfo = m_screenBuffer[dwOffset - 1].charInfo;
+    CHAR_INFO & charInfo = m_pScreen[dwOffset - 1];
     int       nCharWidth = (charInfo.Attributes & COMMON_LVB_TRAILING_BYTE)? m_nCharWidth * 2 : m_nCharWidth;
 
     colorBG = consoleColors[(charInfo.Attributes & 0xF0) >> 4];
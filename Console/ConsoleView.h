@@ -1,12 +1,24 @@
 #pragma once
 
 #include "Cursors.h"
+#include "GlyphAtlas.h"
+#include "D2DTextRenderer.h"
+#include "PixelKernels.h"
 #include "SelectionHandler.h"
 
 //////////////////////////////////////////////////////////////////////////////
 
 #define	FLASH_TAB_TIMER		444
 
+// rows scrolled to from the console history are shown until the console
+// window gets there, or for this long (ms)
+#define	LOCAL_SCROLL_TIMER		445
+#define	LOCAL_SCROLL_TIMEOUT	250
+
+// pasted text is fed to the console handler while it's being pasted (ms)
+#define	PASTE_TIMER				446
+#define	PASTE_TIMER_INTERVAL	50
+
 //////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////
@@ -67,6 +79,7 @@ class ConsoleView
 			MESSAGE_HANDLER(WM_INPUTLANGCHANGE, OnInputLangChange)
 			MESSAGE_HANDLER(WM_DROPFILES, OnDropFiles)
 			MESSAGE_HANDLER(UM_UPDATE_CONSOLE_VIEW, OnUpdateConsoleView)
+			MESSAGE_HANDLER(UM_IMAGE_READY, OnImageReady)
 
 			MESSAGE_HANDLER(WM_IME_COMPOSITION, OnIMEComposition)
 			MESSAGE_HANDLER(WM_IME_STARTCOMPOSITION, OnIMEStartComposition)
@@ -100,6 +113,7 @@ class ConsoleView
 		LRESULT OnInputLangChange(UINT uMsg, WPARAM wParam, LPARAM lParam, BOOL& bHandled);
 		LRESULT OnDropFiles(UINT /*uMsg*/, WPARAM wParam, LPARAM /*lParam*/, BOOL& /*bHandled*/);
 		LRESULT OnUpdateConsoleView(UINT /*uMsg*/, WPARAM wParam, LPARAM /*lParam*/, BOOL& /*bHandled*/);
+		LRESULT OnImageReady(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM /*lParam*/, BOOL& /*bHandled*/);
 
 		LRESULT OnIMEComposition(UINT uMsg, WPARAM wParam, LPARAM lParam, BOOL& bHandled);
 		LRESULT OnIMEStartComposition(UINT uMsg, WPARAM wParam, LPARAM lParam, BOOL& bHandled);
@@ -145,6 +159,9 @@ class ConsoleView
 		bool CanClearSelection() const { return m_selectionHandler->GetState() > SelectionHandler::selstateNoSelection; }
 		bool CanPaste() const { return (m_selectionHandler->GetState() == SelectionHandler::selstateNoSelection) && (::IsClipboardFormatAvailable(CF_UNICODETEXT) || ::IsClipboardFormatAvailable(CF_TEXT) || ::IsClipboardFormatAvailable(CF_OEMTEXT)) ; }
 
+		// large texts are sent in chunks, Esc cancels the rest
+		void SendTextToConsole(const wchar_t* pszText);
+
 		void DumpBuffer();
 		void InitializeScrollbars();
 
@@ -158,10 +175,41 @@ class ConsoleView
 		static inline int GetCharWidth(void) { return m_nCharWidth; }
 		static inline int GetCharHeight(void) { return m_nCharHeight; }
 
+	private:
+
+		// chars with the same attributes, positions are in pixels from the
+		// row start
+		struct TextRun
+		{
+			DWORD	dwFirstChar;
+			DWORD	dwChars;
+			int		nX;
+			int		nWidth;
+			WORD	wAttributes;
+		};
+
+		struct RowLayout
+		{
+			RowLayout() : bValid(false) {}
+
+			bool					bValid;
+			std::vector<TextRun>	runs;
+			// row chars without DBCS trailing bytes, and their widths
+			std::vector<wchar_t>	chars;
+			std::vector<INT>		charWidths;
+		};
+
 	private:
 
 		void OnConsoleChange(bool bResize);
 		void OnConsoleClose();
+		void ScheduleUpdate(LONG lUpdate);
+
+		void CreateScreenBuffer();
+		bool ReadConsoleFrame(bool bFullCopy, int& nScrolledRows);
+
+		int GetWindowTop();
+		bool ScrollFromHistory(int nTop);
 
 		void CreateOffscreenBuffers();
 		void CreateOffscreenBitmap(CDC& cdc, const CRect& rect, CBitmap& bitmap);
@@ -173,10 +221,15 @@ class ConsoleView
 
 		void RepaintText(CDC& dc);
 		void RepaintTextChanges(CDC& dc);
+		void ScrollText(CDC& dc);
 		void RowTextOut(CDC& dc, DWORD dwRow);
+		TextRenderer& GetTextRenderer();
+		const RowLayout& GetRowLayout(DWORD dwRow);
+		void ShiftRowLayouts(int nScrollRows);
 
 		void BitBltOffscreen(bool bOnlyCursor = false);
 		void UpdateOffscreen(const CRect& rectBlit);
+		CRect GetCursorCellRect();
 
 		bool TranslateKeyDown(UINT uMsg, WPARAM wParam, LPARAM /*lParam*/);
 		void ForwardMouseClick(UINT uMsg, WPARAM wParam, const CPoint& point);
@@ -216,9 +269,30 @@ class ConsoleView
 
 		ConsoleHandler	m_consoleHandler;
 
-		std::unique_ptr<CharInfo[]> m_screenBuffer;
+		// text we render: m_screenBuffer, or the console frame we've pinned
+		// when rendering straight from shared memory
+		CHAR_INFO*	                  m_pScreen;
+		std::unique_ptr<CHAR_INFO[]>  m_screenBuffer;
+		RowFlags                      m_rowChanged;
+		// runs of each row, rebuilt when the row changes
+		std::vector<RowLayout>        m_rowLayouts;
+		int	                          m_nLayoutCharWidth;
+		bool	                        m_bDirectFrames;
 		DWORD	                      m_dwScreenRows;
 		DWORD	                      m_dwScreenColumns;
+		// rows the buffer has scrolled since the last text repaint
+		int	                          m_nPendingScrollRows;
+		// UPDATE_CONSOLE_* flags collected until the main frame updates us
+		volatile LONG	                m_lPendingUpdate;
+		// window top we've scrolled to from the history, -1 when the buffer
+		// shows the console window
+		int	                          m_nLocalScrollTop;
+
+		// text layer area not yet copied to the offscreen buffer, and where
+		// the cursor and selection were drawn over it last time
+		CRect	                        m_rectDamage;
+		CRect	                        m_rectLastCursor;
+		CRect	                        m_rectLastSelection;
 
 		ConsoleSettings&				m_consoleSettings;
 		AppearanceSettings&				m_appearanceSettings;
@@ -238,6 +312,9 @@ class ConsoleView
 		bool							m_bFlashTimerRunning;
 		DWORD							m_dwFlashes;
 
+		bool							m_bPasteTimerRunning;
+		bool							m_bPasteEscDown;
+
 		// since message handlers are not exception-safe,
 		// we'll store error messages thrown during OnCreate
 		// handler here...
@@ -251,9 +328,17 @@ private:
 
   /*static*/ CBitmap    m_bmpOffscreen;
   /*static*/ CBitmap    m_bmpText;
+#ifdef _USE_AERO
+  std::unique_ptr<Gdiplus::Graphics> m_textGraphics;
+  // text bitmap bits, glass and text backgrounds are blended straight in
+  PixelBuffer           m_textPixels;
+#endif //_USE_AERO
 
   static CFont          m_fontText;
   static CFont          m_fontTextHigh;
+  static GdiTextRenderer m_gdiTextRenderer;
+  static GlyphAtlas     m_glyphAtlas;
+  static D2DTextRenderer m_d2dTextRenderer;
 
   static int            m_nCharHeight;
   static int            m_nCharWidth;
@@ -0,0 +1,354 @@
+//////////////////////////////////////////////////////////////////////////////
+// D2DTextRenderer.cpp - Direct2D/DirectWrite console text renderer
+
+#include "stdafx.h"
+#include "D2DTextRenderer.h"
+
+#define NO_GLYPH_INDEX	0xFFFF
+
+typedef HRESULT (WINAPI *D2D1CreateFactoryFunc)(D2D1_FACTORY_TYPE factoryType, REFIID riid, const D2D1_FACTORY_OPTIONS* pFactoryOptions, void** ppIFactory);
+typedef HRESULT (WINAPI *DWriteCreateFactoryFunc)(DWRITE_FACTORY_TYPE factoryType, REFIID iid, IUnknown** factory);
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+D2DTextRenderer::D2DTextRenderer()
+: m_hD2D(NULL)
+, m_hDWrite(NULL)
+, m_bUnavailable(false)
+, m_d2dFactory()
+, m_dwriteFactory()
+, m_gdiInterop()
+, m_renderTarget()
+, m_brush()
+, m_hFont(NULL)
+, m_hFontHigh(NULL)
+, m_dcFont(::CreateCompatibleDC(NULL))
+, m_glyphIndexes()
+, m_ptOrigin(0, 0)
+, m_bDrawing(false)
+, m_runGlyphs()
+, m_runAdvances()
+{
+	::FillMemory(m_asciiIndexes, sizeof(m_asciiIndexes), 0xFF);
+}
+
+D2DTextRenderer::~D2DTextRenderer()
+{
+	// interfaces have to go before their modules
+	m_brush.Release();
+	m_renderTarget.Release();
+	m_fontFaces[0].fontFace.Release();
+	m_fontFaces[1].fontFace.Release();
+	m_gdiInterop.Release();
+	m_dwriteFactory.Release();
+	m_d2dFactory.Release();
+
+	if (m_hDWrite != NULL) ::FreeLibrary(m_hDWrite);
+	if (m_hD2D != NULL) ::FreeLibrary(m_hD2D);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void D2DTextRenderer::SetFonts(HFONT hFont, HFONT hFontHigh, DWORD /*dwFontZoom*/, int /*nCharWidth*/, int /*nCharHeight*/)
+{
+	// zoom and cell size come with new fonts
+	if ((m_hFont == hFont) && (m_hFontHigh == hFontHigh)) return;
+
+	Clear();
+
+	m_hFont     = hFont;
+	m_hFontHigh = hFontHigh;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void D2DTextRenderer::Clear()
+{
+	m_fontFaces[0].fontFace.Release();
+	m_fontFaces[1].fontFace.Release();
+
+	m_glyphIndexes.clear();
+	::FillMemory(m_asciiIndexes, sizeof(m_asciiIndexes), 0xFF);
+
+	m_hFont     = NULL;
+	m_hFontHigh = NULL;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+bool D2DTextRenderer::BeginDraw(CDC& dc, const CRect& rectRow)
+{
+	if (!CreateFactories()) return false;
+	if (!CreateFontFaces()) return false;
+
+	if (!m_renderTarget)
+	{
+#ifdef _USE_AERO
+		// the text layer keeps its alpha for glass
+		D2D1_PIXEL_FORMAT pixelFormat = D2D1::PixelFormat(DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_PREMULTIPLIED);
+#else //_USE_AERO
+		D2D1_PIXEL_FORMAT pixelFormat = D2D1::PixelFormat(DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_IGNORE);
+#endif //_USE_AERO
+
+		// glyph positions are in GDI pixels, so the target must not scale
+		// them by the system DPI
+		D2D1_RENDER_TARGET_PROPERTIES props = D2D1::RenderTargetProperties(
+			D2D1_RENDER_TARGET_TYPE_DEFAULT,
+			pixelFormat,
+			96.f,
+			96.f,
+			D2D1_RENDER_TARGET_USAGE_GDI_COMPATIBLE);
+
+		if (FAILED(m_d2dFactory->CreateDCRenderTarget(&props, &m_renderTarget))) return false;
+
+#ifdef _USE_AERO
+		// ClearType needs an opaque target
+		m_renderTarget->SetTextAntialiasMode(D2D1_TEXT_ANTIALIAS_MODE_GRAYSCALE);
+#else //_USE_AERO
+		m_renderTarget->SetTextAntialiasMode(D2D1_TEXT_ANTIALIAS_MODE_CLEARTYPE);
+#endif //_USE_AERO
+
+		m_brush.Release();
+		if (FAILED(m_renderTarget->CreateSolidColorBrush(D2D1::ColorF(D2D1::ColorF::White), &m_brush)))
+		{
+			m_renderTarget.Release();
+			return false;
+		}
+	}
+
+	// the target covers just the row, so only the row is read back from
+	// and written to the text bitmap
+	if (FAILED(m_renderTarget->BindDC(dc, &rectRow))) return false;
+
+	m_ptOrigin = rectRow.TopLeft();
+	m_bDrawing = true;
+
+	m_renderTarget->BeginDraw();
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void D2DTextRenderer::DrawRun(int nX, int nY, const wchar_t* pChars, const INT* pCharWidths, DWORD dwChars, bool bHigh, COLORREF crColor, const CRect& rectClip)
+{
+	if (!m_bDrawing || (dwChars == 0)) return;
+
+	const FontFace& fontFace = m_fontFaces[bHigh ? 1 : 0];
+
+	m_runGlyphs.resize(dwChars);
+	m_runAdvances.resize(dwChars);
+
+	for (DWORD i = 0; i < dwChars; ++i)
+	{
+		m_runGlyphs[i]   = GetGlyphIndex(pChars[i], bHigh);
+		m_runAdvances[i] = static_cast<FLOAT>(pCharWidths[i]);
+	}
+
+	DWRITE_GLYPH_RUN glyphRun;
+
+	glyphRun.fontFace      = fontFace.fontFace;
+	glyphRun.fontEmSize    = fontFace.fEmSize;
+	glyphRun.glyphCount    = dwChars;
+	glyphRun.glyphIndices  = &m_runGlyphs[0];
+	glyphRun.glyphAdvances = &m_runAdvances[0];
+	glyphRun.glyphOffsets  = NULL;
+	glyphRun.isSideways    = FALSE;
+	glyphRun.bidiLevel     = 0;
+
+	m_brush->SetColor(D2D1::ColorF(
+		GetRValue(crColor) / 255.0f,
+		GetGValue(crColor) / 255.0f,
+		GetBValue(crColor) / 255.0f));
+
+	m_renderTarget->PushAxisAlignedClip(
+		D2D1::RectF(
+			static_cast<FLOAT>(rectClip.left - m_ptOrigin.x),
+			static_cast<FLOAT>(rectClip.top - m_ptOrigin.y),
+			static_cast<FLOAT>(rectClip.right - m_ptOrigin.x),
+			static_cast<FLOAT>(rectClip.bottom - m_ptOrigin.y)),
+		D2D1_ANTIALIAS_MODE_ALIASED);
+
+	m_renderTarget->DrawGlyphRun(
+		D2D1::Point2F(
+			static_cast<FLOAT>(nX - m_ptOrigin.x),
+			static_cast<FLOAT>(nY - m_ptOrigin.y) + fontFace.fBaseline),
+		&glyphRun,
+		m_brush,
+		DWRITE_MEASURING_MODE_GDI_CLASSIC);
+
+	m_renderTarget->PopAxisAlignedClip();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void D2DTextRenderer::EndDraw()
+{
+	if (!m_bDrawing) return;
+
+	m_bDrawing = false;
+
+	// device lost, we'll create a new target for the next row
+	if (m_renderTarget->EndDraw() == D2DERR_RECREATE_TARGET)
+	{
+		TRACE(L"D2DTextRenderer: render target lost\n");
+		m_brush.Release();
+		m_renderTarget.Release();
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+bool D2DTextRenderer::CreateFactories()
+{
+	if (m_bUnavailable) return false;
+	if (m_d2dFactory && m_gdiInterop) return true;
+
+	// not linked, so we still start where Direct2D isn't installed
+	m_hD2D    = ::LoadLibrary(L"d2d1.dll");
+	m_hDWrite = ::LoadLibrary(L"dwrite.dll");
+
+	D2D1CreateFactoryFunc   pfnD2D1CreateFactory   = (m_hD2D != NULL) ? reinterpret_cast<D2D1CreateFactoryFunc>(::GetProcAddress(m_hD2D, "D2D1CreateFactory")) : NULL;
+	DWriteCreateFactoryFunc pfnDWriteCreateFactory = (m_hDWrite != NULL) ? reinterpret_cast<DWriteCreateFactoryFunc>(::GetProcAddress(m_hDWrite, "DWriteCreateFactory")) : NULL;
+
+	if ((pfnD2D1CreateFactory == NULL) ||
+		(pfnDWriteCreateFactory == NULL) ||
+		FAILED(pfnD2D1CreateFactory(D2D1_FACTORY_TYPE_SINGLE_THREADED, __uuidof(ID2D1Factory), NULL, reinterpret_cast<void**>(&m_d2dFactory))) ||
+		FAILED(pfnDWriteCreateFactory(DWRITE_FACTORY_TYPE_SHARED, __uuidof(IDWriteFactory), reinterpret_cast<IUnknown**>(&m_dwriteFactory))) ||
+		FAILED(m_dwriteFactory->GetGdiInterop(&m_gdiInterop)))
+	{
+		TRACE(L"D2DTextRenderer: Direct2D not available\n");
+		m_bUnavailable = true;
+		return false;
+	}
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+bool D2DTextRenderer::CreateFontFaces()
+{
+	if (m_fontFaces[0].fontFace && m_fontFaces[1].fontFace) return true;
+	if ((m_hFont == NULL) || (m_hFontHigh == NULL)) return false;
+
+	return CreateFontFace(m_hFont, m_fontFaces[0]) && CreateFontFace(m_hFontHigh, m_fontFaces[1]);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+bool D2DTextRenderer::CreateFontFace(HFONT hFont, FontFace& fontFace)
+{
+	// the face takes weight and style simulations from the GDI font
+	HFONT hOldFont = m_dcFont.SelectFont(hFont);
+	HRESULT hr     = m_gdiInterop->CreateFontFaceFromHdc(m_dcFont, &fontFace.fontFace);
+
+	m_dcFont.SelectFont(hOldFont);
+
+	if (FAILED(hr)) return false;
+
+	LOGFONT             logFont;
+	DWRITE_FONT_METRICS fontMetrics;
+
+	::GetObject(hFont, sizeof(LOGFONT), &logFont);
+	fontFace.fontFace->GetMetrics(&fontMetrics);
+
+	// negative height is the em size, positive is the cell height
+	if (logFont.lfHeight < 0)
+	{
+		fontFace.fEmSize = static_cast<FLOAT>(-logFont.lfHeight);
+	}
+	else
+	{
+		fontFace.fEmSize = static_cast<FLOAT>(logFont.lfHeight) * fontMetrics.designUnitsPerEm / (fontMetrics.ascent + fontMetrics.descent);
+	}
+
+	// baseline on a whole pixel, like GDI
+	fontFace.fBaseline = static_cast<FLOAT>(static_cast<int>(fontFace.fEmSize * fontMetrics.ascent / fontMetrics.designUnitsPerEm + 0.5f));
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+UINT16 D2DTextRenderer::GetGlyphIndex(wchar_t wch, bool bHigh)
+{
+	UINT16* pIndex = NULL;
+	UINT16  index  = NO_GLYPH_INDEX;
+
+	if (wch < 0x80)
+	{
+		pIndex = &m_asciiIndexes[bHigh ? 1 : 0][wch];
+		if (*pIndex != NO_GLYPH_INDEX) return *pIndex;
+	}
+	else
+	{
+		DWORD dwKey = static_cast<DWORD>(wch) | (bHigh ? 0x10000 : 0);
+
+		auto it = m_glyphIndexes.find(dwKey);
+		if (it != m_glyphIndexes.end()) return it->second;
+	}
+
+	UINT32 codePoint = wch;
+
+	// missing glyphs map to 0, the face's .notdef glyph
+	if (FAILED(m_fontFaces[bHigh ? 1 : 0].fontFace->GetGlyphIndices(&codePoint, 1, &index))) index = 0;
+
+	if (pIndex != NULL)
+	{
+		*pIndex = index;
+	}
+	else
+	{
+		m_glyphIndexes.insert(std::make_pair(static_cast<DWORD>(wch) | (bHigh ? 0x10000 : 0), index));
+	}
+
+	return index;
+}
+
+//////////////////////////////////////////////////////////////////////////////
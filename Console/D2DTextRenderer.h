@@ -0,0 +1,84 @@
+//////////////////////////////////////////////////////////////////////////////
+// D2DTextRenderer.h - Direct2D/DirectWrite console text renderer
+
+#pragma once
+
+#include <d2d1.h>
+#include <dwrite.h>
+
+#include "TextRenderer.h"
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Draws rows as DirectWrite glyph runs through a DC render target bound to
+// the text layer. Font faces are created from the GDI fonts, so cell
+// metrics match the GDI renderers; glyph indexes are cached per char.
+// Direct2D is loaded on first use, BeginDraw fails if it's not available.
+
+class D2DTextRenderer : public TextRenderer
+{
+	public:
+		D2DTextRenderer();
+		~D2DTextRenderer();
+
+	public:
+
+		void SetFonts(HFONT hFont, HFONT hFontHigh, DWORD dwFontZoom, int nCharWidth, int nCharHeight);
+		void Clear();
+
+		bool BeginDraw(CDC& dc, const CRect& rectRow);
+		void DrawRun(int nX, int nY, const wchar_t* pChars, const INT* pCharWidths, DWORD dwChars, bool bHigh, COLORREF crColor, const CRect& rectClip);
+		void EndDraw();
+
+	private:
+
+		struct FontFace
+		{
+			CComPtr<IDWriteFontFace>	fontFace;
+			FLOAT						fEmSize;
+			FLOAT						fBaseline;
+		};
+
+		bool CreateFactories();
+		bool CreateFontFaces();
+		bool CreateFontFace(HFONT hFont, FontFace& fontFace);
+
+		UINT16 GetGlyphIndex(wchar_t wch, bool bHigh);
+
+	private:
+
+		HMODULE	m_hD2D;
+		HMODULE	m_hDWrite;
+		bool	m_bUnavailable;
+
+		CComPtr<ID2D1Factory>			m_d2dFactory;
+		CComPtr<IDWriteFactory>			m_dwriteFactory;
+		CComPtr<IDWriteGdiInterop>		m_gdiInterop;
+		CComPtr<ID2D1DCRenderTarget>	m_renderTarget;
+		CComPtr<ID2D1SolidColorBrush>	m_brush;
+
+		HFONT		m_hFont;
+		HFONT		m_hFontHigh;
+		FontFace	m_fontFaces[2];
+		CDC			m_dcFont;
+
+		// glyph indexes by char and variant, ASCII is looked up directly
+		std::map<DWORD, UINT16>	m_glyphIndexes;
+		UINT16					m_asciiIndexes[2][0x80];
+
+		// row we're drawing
+		CPoint					m_ptOrigin;
+		bool					m_bDrawing;
+
+		std::vector<UINT16>		m_runGlyphs;
+		std::vector<FLOAT>		m_runAdvances;
+};
+
+//////////////////////////////////////////////////////////////////////////////
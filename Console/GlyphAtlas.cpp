@@ -0,0 +1,302 @@
+//////////////////////////////////////////////////////////////////////////////
+// GlyphAtlas.cpp - cache of rasterized console glyphs
+
+#include "stdafx.h"
+#include "GlyphAtlas.h"
+
+#define NO_GLYPH	0xFFFFFFFF
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+GlyphAtlas::GlyphAtlas()
+: m_hFont(NULL)
+, m_hFontHigh(NULL)
+, m_dwFontZoom(0)
+, m_nCharWidth(0)
+, m_nCharHeight(0)
+, m_nSlotWidth(0)
+, m_nSlotHeight(0)
+, m_dcGlyph(::CreateCompatibleDC(NULL))
+, m_bmpGlyph()
+, m_pGlyphBits(NULL)
+, m_pages()
+, m_glyphs()
+, m_glyphIndexes()
+, m_pTargetBits(NULL)
+, m_nTargetStride(0)
+, m_nTargetWidth(0)
+, m_nTargetHeight(0)
+, m_bTargetBottomUp(false)
+{
+	::FillMemory(m_asciiIndexes, sizeof(m_asciiIndexes), 0xFF);
+}
+
+GlyphAtlas::~GlyphAtlas()
+{
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void GlyphAtlas::SetFonts(HFONT hFont, HFONT hFontHigh, DWORD dwFontZoom, int nCharWidth, int nCharHeight)
+{
+	if ((m_hFont == hFont) &&
+		(m_hFontHigh == hFontHigh) &&
+		(m_dwFontZoom == dwFontZoom) &&
+		(m_nCharWidth == nCharWidth) &&
+		(m_nCharHeight == nCharHeight))
+	{
+		return;
+	}
+
+	Clear();
+
+	m_hFont       = hFont;
+	m_hFontHigh   = hFontHigh;
+	m_dwFontZoom  = dwFontZoom;
+	m_nCharWidth  = nCharWidth;
+	m_nCharHeight = nCharHeight;
+
+	m_nSlotWidth  = nCharWidth * GLYPH_SLOT_CELLS;
+	m_nSlotHeight = nCharHeight;
+
+	// recreate the rasterizing bitmap for the new slot size
+	BITMAPINFO bmpInfo;
+	void*      pBits = NULL;
+
+	::ZeroMemory(&bmpInfo, sizeof(BITMAPINFO));
+
+	bmpInfo.bmiHeader.biSize        = sizeof(BITMAPINFOHEADER);
+	bmpInfo.bmiHeader.biWidth       = m_nSlotWidth;
+	bmpInfo.bmiHeader.biHeight      = -m_nSlotHeight;
+	bmpInfo.bmiHeader.biPlanes      = 1;
+	bmpInfo.bmiHeader.biBitCount    = 32;
+	bmpInfo.bmiHeader.biCompression = BI_RGB;
+
+	if (!m_bmpGlyph.IsNull()) m_bmpGlyph.DeleteObject();
+
+	m_bmpGlyph.CreateDIBSection(m_dcGlyph, &bmpInfo, DIB_RGB_COLORS, &pBits, NULL, 0);
+	m_dcGlyph.SelectBitmap(m_bmpGlyph);
+	m_pGlyphBits = static_cast<DWORD*>(pBits);
+
+	m_dcGlyph.SetBkMode(TRANSPARENT);
+	m_dcGlyph.SetTextColor(RGB(255, 255, 255));
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void GlyphAtlas::Clear()
+{
+	m_pages.clear();
+	m_glyphs.clear();
+	m_glyphIndexes.clear();
+	::FillMemory(m_asciiIndexes, sizeof(m_asciiIndexes), 0xFF);
+
+	// fonts might have been recreated with the same handles
+	m_hFont     = NULL;
+	m_hFontHigh = NULL;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+bool GlyphAtlas::BeginDraw(CDC& dc, const CRect& /*rectRow*/)
+{
+	HBITMAP    hBitmap = dc.GetCurrentBitmap();
+	DIBSECTION dibSection;
+
+	m_pTargetBits = NULL;
+
+	if (m_pGlyphBits == NULL) return false;
+	if (::GetObject(hBitmap, sizeof(DIBSECTION), &dibSection) != sizeof(DIBSECTION)) return false;
+	if ((dibSection.dsBm.bmBitsPixel != 32) || (dibSection.dsBm.bmBits == NULL)) return false;
+
+	m_pTargetBits     = static_cast<BYTE*>(dibSection.dsBm.bmBits);
+	m_nTargetStride   = dibSection.dsBm.bmWidthBytes;
+	m_nTargetWidth    = dibSection.dsBm.bmWidth;
+	m_nTargetHeight   = dibSection.dsBm.bmHeight;
+	m_bTargetBottomUp = (dibSection.dsBmih.biHeight > 0);
+
+	// backgrounds are painted with GDI, make sure they're in the bits
+	::GdiFlush();
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void GlyphAtlas::DrawRun(int nX, int nY, const wchar_t* pChars, const INT* pCharWidths, DWORD dwChars, bool bHigh, COLORREF crColor, const CRect& rectClip)
+{
+	for (DWORD i = 0; i < dwChars; ++i)
+	{
+		DrawGlyph(nX, nY, pChars[i], bHigh, crColor, rectClip);
+		nX += pCharWidths[i];
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void GlyphAtlas::EndDraw()
+{
+	m_pTargetBits = NULL;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void GlyphAtlas::DrawGlyph(int nX, int nY, wchar_t wch, bool bHigh, COLORREF crColor, const CRect& rectClip)
+{
+	if (m_pTargetBits == NULL) return;
+
+	DWORD        dwIndex = GetGlyph(wch, bHigh);
+	const Glyph& glyph   = m_glyphs[dwIndex];
+
+	// blanks
+	if (glyph.nInkLeft >= glyph.nInkRight) return;
+
+	int nLeft  = max(max(nX + glyph.nInkLeft, rectClip.left), 0);
+	int nRight = min(min(nX + glyph.nInkRight, rectClip.right), m_nTargetWidth);
+	int nRows  = min(m_nSlotHeight, m_nTargetHeight - nY);
+
+	if ((nLeft >= nRight) || (nY < 0)) return;
+
+	const DWORD* pSlot = GetSlotPixels(dwIndex);
+
+	int nColorR = GetRValue(crColor);
+	int nColorG = GetGValue(crColor);
+	int nColorB = GetBValue(crColor);
+
+	for (int nRow = 0; nRow < nRows; ++nRow)
+	{
+		int          nTargetRow = m_bTargetBottomUp ? (m_nTargetHeight - 1 - (nY + nRow)) : (nY + nRow);
+		BYTE*        pDest      = m_pTargetBits + nTargetRow*m_nTargetStride + nLeft*4;
+		const DWORD* pSrc       = pSlot + nRow*m_nSlotWidth + (nLeft - nX);
+
+		for (int x = nLeft; x < nRight; ++x, pDest += 4, ++pSrc)
+		{
+			DWORD dwCoverage = *pSrc;
+			if (dwCoverage == 0) continue;
+
+			// DIB pixels are BGRA, and so is the coverage of each channel
+			int nCoverageB = dwCoverage & 0xFF;
+			int nCoverageG = (dwCoverage >> 8) & 0xFF;
+			int nCoverageR = (dwCoverage >> 16) & 0xFF;
+
+			pDest[0] = static_cast<BYTE>(pDest[0] + (nColorB - pDest[0]) * nCoverageB / 255);
+			pDest[1] = static_cast<BYTE>(pDest[1] + (nColorG - pDest[1]) * nCoverageG / 255);
+			pDest[2] = static_cast<BYTE>(pDest[2] + (nColorR - pDest[2]) * nCoverageR / 255);
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+DWORD GlyphAtlas::GetGlyph(wchar_t wch, bool bHigh)
+{
+	if (wch < 0x80)
+	{
+		DWORD& dwIndex = m_asciiIndexes[bHigh ? 1 : 0][wch];
+
+		if (dwIndex == NO_GLYPH) dwIndex = RasterizeGlyph(wch, bHigh);
+		return dwIndex;
+	}
+
+	DWORD dwKey = static_cast<DWORD>(wch) | (bHigh ? 0x10000 : 0);
+
+	auto it = m_glyphIndexes.find(dwKey);
+	if (it != m_glyphIndexes.end()) return it->second;
+
+	DWORD dwIndex = RasterizeGlyph(wch, bHigh);
+
+	m_glyphIndexes.insert(std::make_pair(dwKey, dwIndex));
+	return dwIndex;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+DWORD GlyphAtlas::RasterizeGlyph(wchar_t wch, bool bHigh)
+{
+	DWORD dwIndex     = static_cast<DWORD>(m_glyphs.size());
+	DWORD dwSlotPixels = m_nSlotWidth*m_nSlotHeight;
+
+	if ((dwIndex % GLYPH_PAGE_SLOTS) == 0)
+	{
+		m_pages.push_back(std::unique_ptr<DWORD[]>(new DWORD[GLYPH_PAGE_SLOTS*dwSlotPixels]));
+	}
+
+	// white on black gives us the coverage of each channel
+	CRect rectSlot(0, 0, m_nSlotWidth, m_nSlotHeight);
+
+	m_dcGlyph.FillSolidRect(&rectSlot, RGB(0, 0, 0));
+	m_dcGlyph.SelectFont(bHigh ? m_hFontHigh : m_hFont);
+	m_dcGlyph.ExtTextOut(0, 0, ETO_CLIPPED, &rectSlot, &wch, 1, NULL);
+
+	::GdiFlush();
+
+	DWORD* pSlot = GetSlotPixels(dwIndex);
+	Glyph  glyph = { m_nSlotWidth, 0 };
+
+	for (int y = 0; y < m_nSlotHeight; ++y)
+	{
+		for (int x = 0; x < m_nSlotWidth; ++x)
+		{
+			DWORD dwCoverage = m_pGlyphBits[y*m_nSlotWidth + x] & 0x00FFFFFF;
+
+			pSlot[y*m_nSlotWidth + x] = dwCoverage;
+
+			if (dwCoverage == 0) continue;
+
+			glyph.nInkLeft  = min(glyph.nInkLeft, x);
+			glyph.nInkRight = max(glyph.nInkRight, x + 1);
+		}
+	}
+
+	m_glyphs.push_back(glyph);
+	return dwIndex;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+DWORD* GlyphAtlas::GetSlotPixels(DWORD dwSlot)
+{
+	return m_pages[dwSlot / GLYPH_PAGE_SLOTS].get() + (dwSlot % GLYPH_PAGE_SLOTS)*m_nSlotWidth*m_nSlotHeight;
+}
+
+//////////////////////////////////////////////////////////////////////////////
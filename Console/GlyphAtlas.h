@@ -0,0 +1,95 @@
+//////////////////////////////////////////////////////////////////////////////
+// GlyphAtlas.h - cache of rasterized console glyphs
+
+#pragma once
+
+#include "TextRenderer.h"
+
+//////////////////////////////////////////////////////////////////////////////
+
+// glyph slots are allocated in pages of this many slots
+#define GLYPH_PAGE_SLOTS	256
+
+// slots are this many cells wide (double width chars and italic overhang)
+#define GLYPH_SLOT_CELLS	3
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Each glyph is rasterized once per font variant (white on black, so we get
+// the ClearType coverage of each color channel) and then blended into the
+// text bitmap in any color.
+
+class GlyphAtlas : public TextRenderer
+{
+	public:
+		GlyphAtlas();
+		~GlyphAtlas();
+
+	public:
+
+		// drops cached glyphs if fonts, zoom or cell size have changed
+		void SetFonts(HFONT hFont, HFONT hFontHigh, DWORD dwFontZoom, int nCharWidth, int nCharHeight);
+		void Clear();
+
+		// returns false if we can't draw directly into the DC's bitmap (it's
+		// not a 32-bit DIB section)
+		bool BeginDraw(CDC& dc, const CRect& rectRow);
+		void DrawRun(int nX, int nY, const wchar_t* pChars, const INT* pCharWidths, DWORD dwChars, bool bHigh, COLORREF crColor, const CRect& rectClip);
+		void EndDraw();
+
+	private:
+
+		// glyphs are stored in the slot with the same index
+		struct Glyph
+		{
+			// columns of the slot with any ink
+			int		nInkLeft;
+			int		nInkRight;
+		};
+
+		void DrawGlyph(int nX, int nY, wchar_t wch, bool bHigh, COLORREF crColor, const CRect& rectClip);
+
+		DWORD GetGlyph(wchar_t wch, bool bHigh);
+		DWORD RasterizeGlyph(wchar_t wch, bool bHigh);
+
+		DWORD* GetSlotPixels(DWORD dwSlot);
+
+	private:
+
+		HFONT	m_hFont;
+		HFONT	m_hFontHigh;
+		DWORD	m_dwFontZoom;
+		int		m_nCharWidth;
+		int		m_nCharHeight;
+
+		int		m_nSlotWidth;
+		int		m_nSlotHeight;
+
+		// rasterizing DC, a top-down 32-bit DIB of one slot
+		CDC		m_dcGlyph;
+		CBitmap	m_bmpGlyph;
+		DWORD*	m_pGlyphBits;
+
+		std::vector<std::unique_ptr<DWORD[]>>	m_pages;
+		std::vector<Glyph>						m_glyphs;
+
+		// glyph indexes by char and variant, ASCII is looked up directly
+		std::map<DWORD, DWORD>	m_glyphIndexes;
+		DWORD					m_asciiIndexes[2][0x80];
+
+		// bitmap we're drawing into
+		BYTE*	m_pTargetBits;
+		int		m_nTargetStride;
+		int		m_nTargetWidth;
+		int		m_nTargetHeight;
+		bool	m_bTargetBottomUp;
+};
+
+//////////////////////////////////////////////////////////////////////////////
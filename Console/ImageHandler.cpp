@@ -1,5 +1,6 @@
 #include "StdAfx.h"
 #include "ImageHandler.h"
+#include "PixelKernels.h"
 
 //////////////////////////////////////////////////////////////////////////////
 
@@ -41,11 +42,22 @@ bool ImageHandler::CheckWin8()
 
 ImageHandler::ImageHandler()
 : m_images()
+, m_scalePool()
+, m_scaleCallbackEnviron()
+, m_scaleWork()
+, m_scaleQueue()
+, m_scaleQueueCritSec()
 {
 }
 
 ImageHandler::~ImageHandler()
 {
+	// images still queued are dropped, a running scale has to finish before
+	// its image goes away
+	if (m_scaleWork) ::WaitForThreadpoolWorkCallbacks(m_scaleWork.get(), TRUE);
+
+	m_scaleWork.reset();
+	m_scalePool.reset();
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -175,25 +187,92 @@ void ImageHandler::ReloadDesktopImages()
 
 //////////////////////////////////////////////////////////////////////////////
 
-void ImageHandler::UpdateImageBitmap(const CDC& dc, const CRect& clientRect, std::shared_ptr<BackgroundImage>& bkImage)
+void ImageHandler::UpdateImageBitmap(const CDC& dc, const CRect& clientRect, std::shared_ptr<BackgroundImage>& bkImage, HWND hwndNotify)
 {
 	if (bkImage->imageData.bRelative)
 	{
-		if (!bkImage->image.IsNull()) return;
-		// first access to relative image, create it
+		if (!bkImage->tiles.empty()) return;
+		// first access to relative image, create its tile grid
 		CreateRelativeImage(dc, bkImage);
+		return;
 	}
-	else
+
+	DWORD dwWidth  = clientRect.Width();
+	DWORD dwHeight = clientRect.Height();
+
+	CriticalSectionLock	lock(bkImage->updateCritSec);
+
+	if (bkImage->currentImage &&
+		(bkImage->currentImage->dwWidth == dwWidth) &&
+		(bkImage->currentImage->dwHeight == dwHeight))
+	{
+		// no client size change, nothing to do
+		return;
+	}
+
+	// scaled before (or the worker has just finished it)
+	for (ScaledImages::iterator itImage = bkImage->scaledImages.begin(); itImage != bkImage->scaledImages.end(); ++itImage)
+	{
+		if (((*itImage)->dwWidth != dwWidth) || ((*itImage)->dwHeight != dwHeight)) continue;
+
+		std::shared_ptr<ScaledImage> scaledImage(*itImage);
+
+		bkImage->scaledImages.erase(itImage);
+		bkImage->scaledImages.insert(bkImage->scaledImages.begin(), scaledImage);
+
+		SelectScaledImage(bkImage, scaledImage);
+		return;
+	}
+
+	// first bitmap, we don't have anything to show meanwhile
+	if (bkImage->dcImage.IsNull())
+	{
+		std::shared_ptr<ScaledImage> scaledImage(CreateScaledImage(bkImage->imageData, bkImage->originalImage, dwWidth, dwHeight));
+
+		AddScaledImage(bkImage, scaledImage);
+		SelectScaledImage(bkImage, scaledImage);
+		return;
+	}
+
+	bkImage->notifyWindows.insert(hwndNotify);
+
+	// already stretched to this size, waiting for the worker
+	if ((bkImage->dwImageWidth == dwWidth) && (bkImage->dwImageHeight == dwHeight)) return;
+
+	// the worker scales to the last size we've asked for, sizes we've
+	// passed while resizing are skipped
+	bkImage->dwPendingWidth  = dwWidth;
+	bkImage->dwPendingHeight = dwHeight;
+
+	if (!bkImage->bScaling)
 	{
-		if ((bkImage->dwImageWidth == static_cast<DWORD>(clientRect.Width())) &&
-			(bkImage->dwImageHeight == static_cast<DWORD>(clientRect.Height())))
+		PTP_WORK pScaleWork = GetScaleWork();
+
+		if (pScaleWork != NULL)
 		{
-			// no client size change, nothing to do
-			return;
+			{
+				CriticalSectionLock	queueLock(m_scaleQueueCritSec);
+				m_scaleQueue.push_back(bkImage);
+			}
+
+			::SubmitThreadpoolWork(pScaleWork);
+			bkImage->bScaling = true;
 		}
+		else
+		{
+			bkImage->dwPendingWidth  = 0;
+			bkImage->dwPendingHeight = 0;
+
+			std::shared_ptr<ScaledImage> scaledImage(CreateScaledImage(bkImage->imageData, bkImage->originalImage, dwWidth, dwHeight));
 
-		CreateImage(dc, clientRect, bkImage);
+			AddScaledImage(bkImage, scaledImage);
+			SelectScaledImage(bkImage, scaledImage);
+			return;
+		}
 	}
+
+	// show the previous bitmap stretched until then
+	StretchImage(bkImage, dwWidth, dwHeight);
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -310,6 +389,18 @@ bool ImageHandler::LoadImage(std::shared_ptr<BackgroundImage>& bkImage)
 
 	if (!bkImage->image.IsNull()) bkImage->image.DeleteObject();
 
+	// drop bitmaps scaled from the old image
+	bkImage->scaledImages.clear();
+	bkImage->currentImage.reset();
+	bkImage->dwImageWidth  = 0;
+	bkImage->dwImageHeight = 0;
+	++bkImage->dwGeneration;
+
+	// and relative image tiles
+	bkImage->tiles.clear();
+	bkImage->dwTileColumns = 0;
+	bkImage->dwTileRows    = 0;
+
 	// create new original image
 	bkImage->originalImage.reset(new fipImage());
 
@@ -396,24 +487,46 @@ void ImageHandler::PaintRelativeImage(const CDC& dc, CBitmap&	bmpTemplate, std::
   dwDisplayHeight = dwNewHeight;
 }
 
-void ImageHandler::CreateRelativeImage(const CDC& dc, std::shared_ptr<BackgroundImage>& bkImage)
+void ImageHandler::CreateRelativeImage(const CDC& /*dc*/, std::shared_ptr<BackgroundImage>& bkImage)
 {
   CriticalSectionLock	lock(bkImage->updateCritSec);
 
   bkImage->dwImageWidth	= ::GetSystemMetrics(SM_CXVIRTUALSCREEN);
   bkImage->dwImageHeight	= ::GetSystemMetrics(SM_CYVIRTUALSCREEN);
 
+  // tiles are painted when views need them, see BitBltRelativeImage
+  bkImage->dwTileColumns = (bkImage->dwImageWidth + IMAGE_TILE_SIZE - 1) / IMAGE_TILE_SIZE;
+  bkImage->dwTileRows    = (bkImage->dwImageHeight + IMAGE_TILE_SIZE - 1) / IMAGE_TILE_SIZE;
+
+  bkImage->tiles.clear();
+  bkImage->tiles.resize(bkImage->dwTileColumns*bkImage->dwTileRows);
+
   // create background DC
-  bkImage->dcImage.CreateCompatibleDC(NULL);
+  if (bkImage->dcImage.IsNull()) bkImage->dcImage.CreateCompatibleDC(NULL);
+}
+
+//////////////////////////////////////////////////////////////////////////////
 
-  // create background bitmap
-  Helpers::CreateBitmap(dc, bkImage->dwImageWidth, bkImage->dwImageHeight, bkImage->image);
-  bkImage->dcImage.SelectBitmap(bkImage->image);
 
-  // paint background
+//////////////////////////////////////////////////////////////////////////////
+
+void ImageHandler::PaintRelativeTiles(const CDC& dc, std::shared_ptr<BackgroundImage>& bkImage, const vector<DWORD>& tiles)
+{
   CBrush	backgroundBrush(::CreateSolidBrush(bkImage->imageData.crBackground));
-  CRect	rect(0, 0, bkImage->dwImageWidth, bkImage->dwImageHeight);
-  bkImage->dcImage.FillRect(&rect, backgroundBrush);
+
+  // create tile bitmaps and paint background
+  for (vector<DWORD>::const_iterator itTile = tiles.begin(); itTile != tiles.end(); ++itTile)
+  {
+    std::shared_ptr<CBitmap> tile(new CBitmap());
+
+    Helpers::CreateBitmap(dc, IMAGE_TILE_SIZE, IMAGE_TILE_SIZE, *tile);
+    bkImage->tiles[*itTile] = tile;
+
+    SelectTile(bkImage, *itTile);
+
+    CRect	rect(GetTileRect(bkImage, *itTile));
+    bkImage->dcImage.FillRect(&rect, backgroundBrush);
+  }
 
   // this can be false only for desktop backgrounds with no wallpaper image
   if (bkImage->originalImage.get() != NULL)
@@ -436,39 +549,159 @@ void ImageHandler::CreateRelativeImage(const CDC& dc, std::shared_ptr<Background
 
       if (bkImage->imageData.imagePosition == imagePositionTile)
       {
-        ImageHandler::TileTemplateImage(
-          dcTemplate,
-          ImageHandler::IsWin8() ? 0 : ::GetSystemMetrics(SM_XVIRTUALSCREEN), // Windows 8 wallpaper tiles starts
-          ImageHandler::IsWin8() ? 0 : ::GetSystemMetrics(SM_YVIRTUALSCREEN), // in the top left corner of virtual screen
-          bkImage);
+        for (vector<DWORD>::const_iterator itTile = tiles.begin(); itTile != tiles.end(); ++itTile)
+        {
+          SelectTile(bkImage, *itTile);
+
+          ImageHandler::TileTemplateImage(
+            dcTemplate,
+            ImageHandler::IsWin8() ? 0 : ::GetSystemMetrics(SM_XVIRTUALSCREEN), // Windows 8 wallpaper tiles starts
+            ImageHandler::IsWin8() ? 0 : ::GetSystemMetrics(SM_YVIRTUALSCREEN), // in the top left corner of virtual screen
+            bkImage);
+        }
       }
       else if (bkImage->imageData.bExtend)
       {
-        ImageHandler::PaintTemplateImage(
-          dcTemplate,
-          0,
-          0,
-          dwNewWidth,
-          dwNewHeight,
-          bkImage->dwImageWidth,
-          bkImage->dwImageHeight,
-          bkImage);
+        for (vector<DWORD>::const_iterator itTile = tiles.begin(); itTile != tiles.end(); ++itTile)
+        {
+          SelectTile(bkImage, *itTile);
+
+          ImageHandler::PaintTemplateImage(
+            dcTemplate,
+            0,
+            0,
+            dwNewWidth,
+            dwNewHeight,
+            bkImage->dwImageWidth,
+            bkImage->dwImageHeight,
+            bkImage);
+        }
       }
       else
       {
-        MonitorEnumData	enumData(dcTemplate, bkImage);
+        MonitorEnumData	enumData(dcTemplate, bkImage, tiles);
         ::EnumDisplayMonitors(NULL, NULL, ImageHandler::MonitorEnumProc, reinterpret_cast<LPARAM>(&enumData));
       }
     }
     else
     {
       // Windows 8 wallpaper (Stretch, Fit & Fill) is handled separately for each monitor
-      MonitorEnumData	enumData(dc, bkImage);
+      MonitorEnumData	enumData(dc, bkImage, tiles);
       ::EnumDisplayMonitors(NULL, NULL, ImageHandler::MonitorEnumProcWin8, reinterpret_cast<LPARAM>(&enumData));
     }
   }
 
-  if (bkImage->imageData.byTintOpacity > 0) TintImage(dc, bkImage);
+  if (bkImage->imageData.byTintOpacity > 0)
+  {
+    for (vector<DWORD>::const_iterator itTile = tiles.begin(); itTile != tiles.end(); ++itTile)
+    {
+      SelectTile(bkImage, *itTile);
+      TintImage(dc, bkImage, *bkImage->tiles[*itTile], GetTileRect(bkImage, *itTile));
+    }
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+CRect ImageHandler::GetTileRect(std::shared_ptr<BackgroundImage>& bkImage, DWORD dwTile)
+{
+  int nLeft = (dwTile % bkImage->dwTileColumns) * IMAGE_TILE_SIZE;
+  int nTop  = (dwTile / bkImage->dwTileColumns) * IMAGE_TILE_SIZE;
+
+  return CRect(nLeft, nTop, nLeft + IMAGE_TILE_SIZE, nTop + IMAGE_TILE_SIZE);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void ImageHandler::SelectTile(std::shared_ptr<BackgroundImage>& bkImage, DWORD dwTile)
+{
+  CRect rectTile(GetTileRect(bkImage, dwTile));
+
+  bkImage->dcImage.SelectBitmap(*bkImage->tiles[dwTile]);
+
+  // tiles are painted and blitted in image coordinates, GDI clips the rest
+  bkImage->dcImage.SetViewportOrg(-rectTile.left, -rectTile.top);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void ImageHandler::BitBltRelativeImage(CDC& dc, const CRect& rectDest, const CPoint& pointScreen, std::shared_ptr<BackgroundImage>& bkImage)
+{
+  CriticalSectionLock	lock(bkImage->updateCritSec);
+
+  if (bkImage->tiles.empty()) return;
+
+  // part of the image we need
+  CPoint pointImage(
+          pointScreen.x - ::GetSystemMetrics(SM_XVIRTUALSCREEN),
+          pointScreen.y - ::GetSystemMetrics(SM_YVIRTUALSCREEN));
+
+  CRect rectImage(pointImage, rectDest.Size());
+  CRect rectBounds(0, 0, bkImage->dwImageWidth, bkImage->dwImageHeight);
+
+  if (!rectImage.IntersectRect(&rectImage, &rectBounds)) return;
+
+  DWORD dwFirstColumn = rectImage.left / IMAGE_TILE_SIZE;
+  DWORD dwLastColumn  = (rectImage.right - 1) / IMAGE_TILE_SIZE;
+  DWORD dwFirstRow    = rectImage.top / IMAGE_TILE_SIZE;
+  DWORD dwLastRow     = (rectImage.bottom - 1) / IMAGE_TILE_SIZE;
+
+  // paint tiles we haven't needed before, all at once so the template
+  // images are created only once
+  vector<DWORD> missingTiles;
+
+  for (DWORD dwRow = dwFirstRow; dwRow <= dwLastRow; ++dwRow)
+  {
+    for (DWORD dwColumn = dwFirstColumn; dwColumn <= dwLastColumn; ++dwColumn)
+    {
+      DWORD dwTile = dwRow*bkImage->dwTileColumns + dwColumn;
+
+      if (!bkImage->tiles[dwTile]) missingTiles.push_back(dwTile);
+    }
+  }
+
+  if (!missingTiles.empty())
+  {
+#ifdef _DEBUG
+    DWORD dwGetTickCount = ::GetTickCount();
+#endif
+    PaintRelativeTiles(dc, bkImage, missingTiles);
+#ifdef _DEBUG
+    TRACE(L"painted %i relative image tiles in %lu ms\n", static_cast<int>(missingTiles.size()), ::GetTickCount() - dwGetTickCount);
+#endif
+  }
+
+  for (DWORD dwRow = dwFirstRow; dwRow <= dwLastRow; ++dwRow)
+  {
+    for (DWORD dwColumn = dwFirstColumn; dwColumn <= dwLastColumn; ++dwColumn)
+    {
+      DWORD dwTile = dwRow*bkImage->dwTileColumns + dwColumn;
+      CRect rectTile(GetTileRect(bkImage, dwTile));
+
+      rectTile.IntersectRect(&rectTile, &rectImage);
+
+      SelectTile(bkImage, dwTile);
+
+      dc.BitBlt(
+        rectDest.left + rectTile.left - pointImage.x,
+        rectDest.top  + rectTile.top  - pointImage.y,
+        rectTile.Width(),
+        rectTile.Height(),
+        bkImage->dcImage,
+        rectTile.left,
+        rectTile.top,
+        SRCCOPY);
+    }
+  }
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -563,7 +796,229 @@ void ImageHandler::CreateImage(const CDC& dc, const CRect& clientRect, std::shar
 		}
 	}
 
-	if (bkImage->imageData.byTintOpacity > 0) TintImage(dc, bkImage);
+	if (bkImage->imageData.byTintOpacity > 0) TintImage(dc, bkImage, bkImage->image, CRect(0, 0, bkImage->dwImageWidth, bkImage->dwImageHeight));
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+std::shared_ptr<ScaledImage> ImageHandler::CreateScaledImage(const ImageData& imageData, const std::shared_ptr<fipImage>& originalImage, DWORD dwWidth, DWORD dwHeight)
+{
+	// paint into a private image, so this can run on any thread
+	std::shared_ptr<BackgroundImage>	bkImage(new BackgroundImage(imageData));
+	std::shared_ptr<ScaledImage>		scaledImage(new ScaledImage(dwWidth, dwHeight));
+
+	bkImage->originalImage = originalImage;
+
+	if (originalImage)
+	{
+		bkImage->dwOriginalImageWidth  = originalImage->getWidth();
+		bkImage->dwOriginalImageHeight = originalImage->getHeight();
+	}
+
+	// bitmaps are created compatible with the screen
+	CDC	dcScreen(::GetDC(NULL));
+
+	CreateImage(dcScreen, CRect(0, 0, dwWidth, dwHeight), bkImage);
+
+	::ReleaseDC(NULL, dcScreen.Detach());
+
+	bkImage->dcImage.DeleteDC();
+	scaledImage->image.Attach(bkImage->image.Detach());
+
+	return scaledImage;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void ImageHandler::AddScaledImage(std::shared_ptr<BackgroundImage>& bkImage, const std::shared_ptr<ScaledImage>& scaledImage)
+{
+	bkImage->scaledImages.insert(bkImage->scaledImages.begin(), scaledImage);
+
+	// the current bitmap stays alive even if it's dropped here
+	if (bkImage->scaledImages.size() > IMAGE_CACHE_SIZE) bkImage->scaledImages.resize(IMAGE_CACHE_SIZE);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void ImageHandler::SelectScaledImage(std::shared_ptr<BackgroundImage>& bkImage, const std::shared_ptr<ScaledImage>& scaledImage)
+{
+	if (bkImage->dcImage.IsNull()) bkImage->dcImage.CreateCompatibleDC(NULL);
+
+	bkImage->dcImage.SelectBitmap(scaledImage->image);
+
+	// stretched bitmap isn't selected anymore
+	if (!bkImage->image.IsNull()) bkImage->image.DeleteObject();
+
+	bkImage->currentImage  = scaledImage;
+	bkImage->dwImageWidth  = scaledImage->dwWidth;
+	bkImage->dwImageHeight = scaledImage->dwHeight;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void ImageHandler::StretchImage(std::shared_ptr<BackgroundImage>& bkImage, DWORD dwWidth, DWORD dwHeight)
+{
+	CBitmap	bmpStretched;
+
+	if (Helpers::CreateBitmap(bkImage->dcImage, dwWidth, dwHeight, bmpStretched) == NULL) return;
+
+	{
+		CDC	dcStretched;
+
+		dcStretched.CreateCompatibleDC(NULL);
+		dcStretched.SelectBitmap(bmpStretched);
+
+		// fast and rough, it's only shown while resizing
+		dcStretched.SetStretchBltMode(COLORONCOLOR);
+		dcStretched.StretchBlt(
+						0,
+						0,
+						dwWidth,
+						dwHeight,
+						bkImage->dcImage,
+						0,
+						0,
+						bkImage->dwImageWidth,
+						bkImage->dwImageHeight,
+						SRCCOPY);
+	}
+
+	bkImage->dcImage.SelectBitmap(bmpStretched);
+
+	if (!bkImage->image.IsNull()) bkImage->image.DeleteObject();
+	bkImage->image.Attach(bmpStretched.Detach());
+
+	bkImage->currentImage.reset();
+	bkImage->dwImageWidth  = dwWidth;
+	bkImage->dwImageHeight = dwHeight;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+PTP_WORK ImageHandler::GetScaleWork()
+{
+	// images are only updated from the UI thread, no need to sync
+	if (!m_scaleWork)
+	{
+		PTP_POOL pPool = ::CreateThreadpool(NULL);
+
+		if (pPool == NULL) return NULL;
+
+		// one worker is enough, scaling is only needed on resize
+		::SetThreadpoolThreadMaximum(pPool, 1);
+		::SetThreadpoolThreadMinimum(pPool, 1);
+
+		m_scalePool.reset(pPool, ::CloseThreadpool);
+
+		::InitializeThreadpoolEnvironment(&m_scaleCallbackEnviron);
+		::SetThreadpoolCallbackPool(&m_scaleCallbackEnviron, pPool);
+
+		PTP_WORK pWork = ::CreateThreadpoolWork(ImageHandler::ScaleImageCallback, this, &m_scaleCallbackEnviron);
+
+		if (pWork == NULL)
+		{
+			m_scalePool.reset();
+			return NULL;
+		}
+
+		m_scaleWork.reset(pWork, ::CloseThreadpoolWork);
+	}
+
+	return m_scaleWork.get();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+VOID CALLBACK ImageHandler::ScaleImageCallback(PTP_CALLBACK_INSTANCE /*pInstance*/, PVOID pContext, PTP_WORK /*pWork*/)
+{
+	ImageHandler*						pImageHandler = static_cast<ImageHandler*>(pContext);
+	std::shared_ptr<BackgroundImage>	bkImage;
+
+	{
+		CriticalSectionLock	queueLock(pImageHandler->m_scaleQueueCritSec);
+
+		if (pImageHandler->m_scaleQueue.empty()) return;
+
+		bkImage = pImageHandler->m_scaleQueue.front();
+		pImageHandler->m_scaleQueue.pop_front();
+	}
+
+	// the handler keeps its images (and waits for us) until it's destroyed
+	for (;;)
+	{
+		ImageData					imageData;
+		std::shared_ptr<fipImage>	originalImage;
+		DWORD						dwWidth			= 0;
+		DWORD						dwHeight		= 0;
+		DWORD						dwGeneration	= 0;
+
+		{
+			CriticalSectionLock	lock(bkImage->updateCritSec);
+
+			dwWidth			= bkImage->dwPendingWidth;
+			dwHeight		= bkImage->dwPendingHeight;
+			imageData		= bkImage->imageData;
+			originalImage	= bkImage->originalImage;
+			dwGeneration	= bkImage->dwGeneration;
+
+			bkImage->dwPendingWidth  = 0;
+			bkImage->dwPendingHeight = 0;
+
+			if ((dwWidth == 0) || (dwHeight == 0))
+			{
+				bkImage->bScaling = false;
+				return;
+			}
+		}
+
+#ifdef _DEBUG
+		DWORD dwGetTickCount = ::GetTickCount();
+#endif
+		std::shared_ptr<ScaledImage> scaledImage(CreateScaledImage(imageData, originalImage, dwWidth, dwHeight));
+#ifdef _DEBUG
+		TRACE(L"scaled image %lux%lu in %lu ms\n", dwWidth, dwHeight, ::GetTickCount() - dwGetTickCount);
+#endif
+
+		std::set<HWND> notifyWindows;
+
+		{
+			CriticalSectionLock	lock(bkImage->updateCritSec);
+
+			if (dwGeneration == bkImage->dwGeneration) AddScaledImage(bkImage, scaledImage);
+
+			// views have asked for another size meanwhile, they're
+			// notified when we've scaled to the last one
+			if ((bkImage->dwPendingWidth != 0) && (bkImage->dwPendingHeight != 0)) continue;
+
+			bkImage->bScaling = false;
+			notifyWindows.swap(bkImage->notifyWindows);
+		}
+
+		for (std::set<HWND>::iterator it = notifyWindows.begin(); it != notifyWindows.end(); ++it)
+		{
+			::PostMessage(*it, UM_IMAGE_READY, 0, 0);
+		}
+
+		return;
+	}
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -621,6 +1076,11 @@ void ImageHandler::PaintTemplateImage(const CDC& dcTemplate, int nOffsetX, int n
 
 void ImageHandler::TileTemplateImage(const CDC& dcTemplate, int nOffsetX, int nOffsetY, std::shared_ptr<BackgroundImage>& bkImage)
 {
+	// relative images are painted one tile at a time, skip blits outside
+	// of the selected tile
+	CRect rectClip;
+	bkImage->dcImage.GetClipBox(&rectClip);
+
 	// we're tiling the image, starting at coordinates (0, 0)
 	DWORD dwY = 0;
 	DWORD dwImageOffsetY = bkImage->originalImage->getHeight() + (nOffsetY - (int)bkImage->originalImage->getHeight()*(nOffsetY/(int)bkImage->originalImage->getHeight()));
@@ -632,15 +1092,20 @@ void ImageHandler::TileTemplateImage(const CDC& dcTemplate, int nOffsetX, int nO
 
 		while (dwX < bkImage->dwImageWidth)
 		{
-			bkImage->dcImage.BitBlt(
-						dwX, 
-						dwY, 
-						bkImage->originalImage->getWidth(), 
-						bkImage->originalImage->getHeight(),
-						dcTemplate,
-						dwImageOffsetX,
-						dwImageOffsetY,
-						SRCCOPY);
+			CRect rectBlit(dwX, dwY, dwX + bkImage->originalImage->getWidth(), dwY + bkImage->originalImage->getHeight());
+
+			if (rectBlit.IntersectRect(&rectBlit, &rectClip))
+			{
+				bkImage->dcImage.BitBlt(
+							dwX, 
+							dwY, 
+							bkImage->originalImage->getWidth(), 
+							bkImage->originalImage->getHeight(),
+							dcTemplate,
+							dwImageOffsetX,
+							dwImageOffsetY,
+							SRCCOPY);
+			}
 
 			dwX += bkImage->originalImage->getWidth() - dwImageOffsetX;
 			dwImageOffsetX = 0;
@@ -656,13 +1121,29 @@ void ImageHandler::TileTemplateImage(const CDC& dcTemplate, int nOffsetX, int nO
 
 //////////////////////////////////////////////////////////////////////////////
 
-void ImageHandler::TintImage(const CDC& dc, std::shared_ptr<BackgroundImage>& bkImage)
+void ImageHandler::TintImage(const CDC& dc, std::shared_ptr<BackgroundImage>& bkImage, HBITMAP hImage, const CRect& rect)
 {
+	PixelBuffer		pixels;
+
+	// blend the tint straight into the bitmap bits when we can
+	if (PixelKernels::GetPixelBuffer(hImage, pixels))
+	{
+		::GdiFlush();
+
+		PixelKernels::BlendRect(
+						pixels,
+						CRect(0, 0, rect.Width(), rect.Height()),
+						bkImage->imageData.crTint,
+						bkImage->imageData.byTintOpacity);
+
+		return;
+	}
+
 	CDC				dcTint;
 	CBitmap			bmpTint;
 	CBrush			tintBrush(::CreateSolidBrush(bkImage->imageData.crTint));
 	BLENDFUNCTION	bf;
-	CRect			rect(0, 0, bkImage->dwImageWidth, bkImage->dwImageHeight);
+	CRect			rectTint(0, 0, rect.Width(), rect.Height());
 
 	bf.BlendOp				= AC_SRC_OVER;
 	bf.BlendFlags			= 0;
@@ -675,21 +1156,21 @@ void ImageHandler::TintImage(const CDC& dc, std::shared_ptr<BackgroundImage>& bk
 		// when resizing the window fast
 		return;
 	}
-//	bmpTint.CreateCompatibleBitmap(dc, bkImage->dwImageWidth, bkImage->dwImageHeight);
-	Helpers::CreateBitmap(dc, bkImage->dwImageWidth, bkImage->dwImageHeight, bmpTint);
+//	bmpTint.CreateCompatibleBitmap(dc, rect.Width(), rect.Height());
+	Helpers::CreateBitmap(dc, rect.Width(), rect.Height(), bmpTint);
 	dcTint.SelectBitmap(bmpTint);
-	dcTint.FillRect(&rect, tintBrush);
+	dcTint.FillRect(&rectTint, tintBrush);
 
 	bkImage->dcImage.AlphaBlend(
-						0,
-						0,
-						bkImage->dwImageWidth,
-						bkImage->dwImageHeight,
+						rect.left,
+						rect.top,
+						rect.Width(),
+						rect.Height(),
 						dcTint,
 						0,
 						0,
-						bkImage->dwImageWidth,
-						bkImage->dwImageHeight,
+						rect.Width(),
+						rect.Height(),
 						bf);
 }
 
@@ -709,15 +1190,27 @@ BOOL CALLBACK ImageHandler::MonitorEnumProc(HMONITOR /*hMonitor*/, HDC /*hdcMoni
 
 	ImageHandler::CalcRescale(dwNewWidth, dwNewHeight, pEnumData->bkImage);
 
-	ImageHandler::PaintTemplateImage(
-					pEnumData->dcTemplate, 
-					rectMonitor.left - ::GetSystemMetrics(SM_XVIRTUALSCREEN), 
-					rectMonitor.top  - ::GetSystemMetrics(SM_YVIRTUALSCREEN), 
-					dwNewWidth,
-					dwNewHeight,
-					rectMonitor.Width(), 
-					rectMonitor.Height(), 
-					pEnumData->bkImage);
+	// monitor in image coordinates
+	rectMonitor.OffsetRect(-::GetSystemMetrics(SM_XVIRTUALSCREEN), -::GetSystemMetrics(SM_YVIRTUALSCREEN));
+
+	for (vector<DWORD>::const_iterator itTile = pEnumData->tiles.begin(); itTile != pEnumData->tiles.end(); ++itTile)
+	{
+		CRect rectTile(ImageHandler::GetTileRect(pEnumData->bkImage, *itTile));
+
+		if (!rectTile.IntersectRect(&rectTile, &rectMonitor)) continue;
+
+		ImageHandler::SelectTile(pEnumData->bkImage, *itTile);
+
+		ImageHandler::PaintTemplateImage(
+						pEnumData->dcTemplate, 
+						rectMonitor.left, 
+						rectMonitor.top, 
+						dwNewWidth,
+						dwNewHeight,
+						rectMonitor.Width(), 
+						rectMonitor.Height(), 
+						pEnumData->bkImage);
+	}
 
 	return TRUE;
 }
@@ -729,6 +1222,25 @@ BOOL CALLBACK ImageHandler::MonitorEnumProc(HMONITOR /*hMonitor*/, HDC /*hdcMoni
 
 BOOL CALLBACK ImageHandler::MonitorEnumProcWin8(HMONITOR hMonitor, HDC /*hdcMonitor*/, LPRECT lprcMonitor, LPARAM lpData)
 {
+  MonitorEnumData* pEnumData = reinterpret_cast<MonitorEnumData*>(lpData);
+
+  // monitor in image coordinates
+  CRect   rectMonitor(lprcMonitor);
+  rectMonitor.OffsetRect(-::GetSystemMetrics(SM_XVIRTUALSCREEN), -::GetSystemMetrics(SM_YVIRTUALSCREEN));
+
+  // tiles we're painting on this monitor, if there are none we don't need
+  // to load and rescale its wallpaper
+  vector<DWORD> monitorTiles;
+
+  for (vector<DWORD>::const_iterator itTile = pEnumData->tiles.begin(); itTile != pEnumData->tiles.end(); ++itTile)
+  {
+    CRect rectTile(ImageHandler::GetTileRect(pEnumData->bkImage, *itTile));
+
+    if (rectTile.IntersectRect(&rectTile, &rectMonitor)) monitorTiles.push_back(*itTile);
+  }
+
+  if (monitorTiles.empty()) return TRUE;
+
   MONITORINFOEX miex;
   miex.cbSize = sizeof(miex);
   ::GetMonitorInfo(hMonitor, &miex);
@@ -834,8 +1346,6 @@ BOOL CALLBACK ImageHandler::MonitorEnumProcWin8(HMONITOR hMonitor, HDC /*hdcMoni
   {
   }
 
-  MonitorEnumData* pEnumData = reinterpret_cast<MonitorEnumData*>(lpData);
-
   std::shared_ptr<BackgroundImage> bkImage;
 
   if( szTranscodedImage[0] )
@@ -856,8 +1366,6 @@ BOOL CALLBACK ImageHandler::MonitorEnumProcWin8(HMONITOR hMonitor, HDC /*hdcMoni
     bkImage = pEnumData->bkImage;
   }
 
-  CRect   rectMonitor(lprcMonitor);
-
   // create template image
   CDC     dcTemplate;
   CBitmap	bmpTemplate;
@@ -869,15 +1377,20 @@ BOOL CALLBACK ImageHandler::MonitorEnumProcWin8(HMONITOR hMonitor, HDC /*hdcMoni
 
   dcTemplate.SelectBitmap(bmpTemplate);
 
-  ImageHandler::PaintTemplateImage(
-    dcTemplate, 
-    rectMonitor.left - ::GetSystemMetrics(SM_XVIRTUALSCREEN), 
-    rectMonitor.top  - ::GetSystemMetrics(SM_YVIRTUALSCREEN), 
-    dwNewWidth,
-    dwNewHeight,
-    rectMonitor.Width(), 
-    rectMonitor.Height(), 
-    pEnumData->bkImage);
+  for (vector<DWORD>::const_iterator itTile = monitorTiles.begin(); itTile != monitorTiles.end(); ++itTile)
+  {
+    ImageHandler::SelectTile(pEnumData->bkImage, *itTile);
+
+    ImageHandler::PaintTemplateImage(
+      dcTemplate, 
+      rectMonitor.left, 
+      rectMonitor.top, 
+      dwNewWidth,
+      dwNewHeight,
+      rectMonitor.Width(), 
+      rectMonitor.Height(), 
+      pEnumData->bkImage);
+  }
 
   return TRUE;
 }
@@ -4,6 +4,14 @@
 
 //////////////////////////////////////////////////////////////////////////////
 
+// scaled bitmaps kept for each image (client sizes used recently)
+#define IMAGE_CACHE_SIZE	4
+
+// relative images are painted in tiles of this size, only where views need them
+#define IMAGE_TILE_SIZE		512
+
+//////////////////////////////////////////////////////////////////////////////
+
 enum ImagePosition
 {
   /* new names like Win7 walppaper settings */
@@ -104,6 +112,28 @@ struct ImageData
 //////////////////////////////////////////////////////////////////////////////
 
 
+//////////////////////////////////////////////////////////////////////////////
+
+struct ScaledImage
+{
+	ScaledImage(DWORD width, DWORD height)
+	: dwWidth(width)
+	, dwHeight(height)
+	, image()
+	{
+	}
+
+	DWORD				dwWidth;
+	DWORD				dwHeight;
+
+	CBitmap				image;
+};
+
+typedef vector<std::shared_ptr<ScaledImage> >	ScaledImages;
+
+//////////////////////////////////////////////////////////////////////////////
+
+
 //////////////////////////////////////////////////////////////////////////////
 
 struct BackgroundImage
@@ -118,6 +148,16 @@ struct BackgroundImage
 	, originalImage()
 	, image()
 	, dcImage()
+	, scaledImages()
+	, currentImage()
+	, dwPendingWidth(0)
+	, dwPendingHeight(0)
+	, bScaling(false)
+	, notifyWindows()
+	, dwGeneration(0)
+	, dwTileColumns(0)
+	, dwTileRows(0)
+	, tiles()
 	, updateCritSec()
 	{
 	}
@@ -136,19 +176,46 @@ struct BackgroundImage
 	CBitmap				image;
 	CDC					dcImage;
 
+	// non-relative images are scaled on a worker thread; dcImage has the
+	// current scaled bitmap selected, or image (the previous bitmap
+	// stretched) until the worker is done
+	ScaledImages					scaledImages;
+	std::shared_ptr<ScaledImage>	currentImage;
+
+	// size the worker scales to next, windows to repaint when it's done
+	DWORD				dwPendingWidth;
+	DWORD				dwPendingHeight;
+	bool				bScaling;
+	std::set<HWND>		notifyWindows;
+
+	// bumped on reload, older worker results are dropped
+	DWORD				dwGeneration;
+
+	// relative images cover the virtual screen (dwImageWidth x dwImageHeight)
+	// with a grid of tiles, row by row; a tile is painted the first time a
+	// view needs it, and is selected into dcImage with its viewport origin
+	// set so it can be used in image coordinates
+	DWORD				dwTileColumns;
+	DWORD				dwTileRows;
+	vector<std::shared_ptr<CBitmap> >	tiles;
+
 	CriticalSection		updateCritSec;
 };
 
 struct MonitorEnumData
 {
-	MonitorEnumData(const CDC& dcTempl, std::shared_ptr<BackgroundImage>& img)
+	MonitorEnumData(const CDC& dcTempl, std::shared_ptr<BackgroundImage>& img, const vector<DWORD>& tileIndexes)
 	: bkImage(img)
 	, dcTemplate(dcTempl)
+	, tiles(tileIndexes)
 	{
 	}
 
 	std::shared_ptr<BackgroundImage>&	bkImage;
 	const CDC&                        dcTemplate;
+
+	// tiles being painted
+	const vector<DWORD>&              tiles;
 };
 
 //////////////////////////////////////////////////////////////////////////////
@@ -175,7 +242,12 @@ class ImageHandler
 		std::shared_ptr<BackgroundImage> GetDesktopImage(ImageData& imageData);
 		void ReloadDesktopImages();
 
-		void UpdateImageBitmap(const CDC& dc, const CRect& clientRect, std::shared_ptr<BackgroundImage>& bkImage);
+		// hwndNotify gets UM_IMAGE_READY when a bitmap for its size is ready
+		void UpdateImageBitmap(const CDC& dc, const CRect& clientRect, std::shared_ptr<BackgroundImage>& bkImage, HWND hwndNotify);
+
+		// blits a relative image to rectDest, pointScreen being the screen
+		// position of its top left corner; paints missing tiles first
+		void BitBltRelativeImage(CDC& dc, const CRect& rectDest, const CPoint& pointScreen, std::shared_ptr<BackgroundImage>& bkImage);
     static inline bool IsWin8(void) { return m_win8; }
 
 	private:
@@ -186,12 +258,25 @@ class ImageHandler
 		static void CalcRescale(DWORD& dwNewWidth, DWORD& dwNewHeight, std::shared_ptr<BackgroundImage>& bkImage);
 		static void PaintRelativeImage(const CDC& dc, CBitmap&	bmpTemplate, std::shared_ptr<BackgroundImage>& bkImage, DWORD& dwDisplayWidth, DWORD& dwDisplayHeight);
 		static void CreateRelativeImage(const CDC& dc, std::shared_ptr<BackgroundImage>& bkImage);
+		static void PaintRelativeTiles(const CDC& dc, std::shared_ptr<BackgroundImage>& bkImage, const vector<DWORD>& tiles);
+		static CRect GetTileRect(std::shared_ptr<BackgroundImage>& bkImage, DWORD dwTile);
+		static void SelectTile(std::shared_ptr<BackgroundImage>& bkImage, DWORD dwTile);
 		static void CreateImage(const CDC& dc, const CRect& clientRect, std::shared_ptr<BackgroundImage>& bkImage);
 
+		static std::shared_ptr<ScaledImage> CreateScaledImage(const ImageData& imageData, const std::shared_ptr<fipImage>& originalImage, DWORD dwWidth, DWORD dwHeight);
+		static void AddScaledImage(std::shared_ptr<BackgroundImage>& bkImage, const std::shared_ptr<ScaledImage>& scaledImage);
+		static void SelectScaledImage(std::shared_ptr<BackgroundImage>& bkImage, const std::shared_ptr<ScaledImage>& scaledImage);
+		static void StretchImage(std::shared_ptr<BackgroundImage>& bkImage, DWORD dwWidth, DWORD dwHeight);
+		// images are scaled on a private pool, one queued image per
+		// submitted work callback
+		PTP_WORK GetScaleWork();
+		static VOID CALLBACK ScaleImageCallback(PTP_CALLBACK_INSTANCE pInstance, PVOID pContext, PTP_WORK pWork);
+
 		static void PaintTemplateImage(const CDC& dcTemplate, int nOffsetX, int nOffsetY, DWORD dwSrcWidth, DWORD dwSrcHeight, DWORD dwDstWidth, DWORD dwDstHeight, std::shared_ptr<BackgroundImage>& bkImage);
 		static void TileTemplateImage(const CDC& dcTemplate, int nOffsetX, int nOffsetY, std::shared_ptr<BackgroundImage>& bkImage);
 
-		static void TintImage(const CDC& dc, std::shared_ptr<BackgroundImage>& bkImage);
+		// rect is in dcImage coordinates, hImage has its top left corner there
+		static void TintImage(const CDC& dc, std::shared_ptr<BackgroundImage>& bkImage, HBITMAP hImage, const CRect& rect);
 
 		// called by the ::EnumDisplayMonitors to create background for each display
 		static BOOL CALLBACK MonitorEnumProc(HMONITOR /*hMonitor*/, HDC /*hdcMonitor*/, LPRECT lprcMonitor, LPARAM lpData);
@@ -202,6 +287,12 @@ class ImageHandler
 
 		Images	m_images;
 		static bool	m_win8;
+
+		std::shared_ptr<TP_POOL>						m_scalePool;
+		TP_CALLBACK_ENVIRON								m_scaleCallbackEnviron;
+		std::shared_ptr<TP_WORK>						m_scaleWork;
+		std::deque<std::shared_ptr<BackgroundImage> >	m_scaleQueue;
+		CriticalSection									m_scaleQueueCritSec;
 };
 
 //////////////////////////////////////////////////////////////////////////////
@@ -116,6 +116,12 @@ MainFrame::MainFrame
 , m_rectRestoredWnd(0, 0, 0, 0)
 , m_bAppActive(true)
 , m_hwndPreviousForeground(NULL)
+, m_dirtyViews()
+, m_bFrameTimerRunning(false)
+, m_dwLastFrame(0)
+, m_dwFrameInterval(1000 / 60)
+, m_hFrameMonitor(NULL)
+, m_bPasteProgress(false)
 {
 	m_Margins.cxLeftWidth    = 0;
 	m_Margins.cxRightWidth   = 0;
@@ -385,6 +391,8 @@ LRESULT MainFrame::OnCreate(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM /*lParam*/,
 	// if they're being called after OnCreate has finished
 	m_bOnCreateDone = true;
 
+	UpdateFrameInterval();
+
 	if( positionSettings.bSaveSize ||
 	    (positionSettings.nW != -1 && positionSettings.nH != -1) )
 	{
@@ -912,6 +920,20 @@ LRESULT MainFrame::OnMouseMove(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM lParam,
 //////////////////////////////////////////////////////////////////////////////
 
 
+//////////////////////////////////////////////////////////////////////////////
+
+LRESULT MainFrame::OnMove(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM /*lParam*/, BOOL& bHandled)
+{
+	// the monitor we moved to may have a different refresh rate
+	if (::MonitorFromWindow(m_hWnd, MONITOR_DEFAULTTONEAREST) != m_hFrameMonitor) UpdateFrameInterval();
+
+	bHandled = FALSE;
+	return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
 //////////////////////////////////////////////////////////////////////////////
 
 LRESULT MainFrame::OnExitSizeMove(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM /*lParam*/, BOOL& /*bHandled*/)
@@ -932,6 +954,12 @@ LRESULT MainFrame::OnTimer(UINT /*uMsg*/, WPARAM wParam, LPARAM /*lParam*/, BOOL
 		KillTimer(TIMER_SIZING);
 		ResizeWindow();
 	}
+	else if (wParam == TIMER_FRAME)
+	{
+		KillTimer(TIMER_FRAME);
+		m_bFrameTimerRunning = false;
+		UpdateDirtyViews();
+	}
 
 	return 0;
 }
@@ -971,6 +999,19 @@ LRESULT MainFrame::OnSettingChange(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM lPar
 //////////////////////////////////////////////////////////////////////////////
 
 
+//////////////////////////////////////////////////////////////////////////////
+
+LRESULT MainFrame::OnDisplayChange(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM /*lParam*/, BOOL& bHandled)
+{
+	UpdateFrameInterval();
+
+	bHandled = FALSE;
+	return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
 //////////////////////////////////////////////////////////////////////////////
 
 LRESULT MainFrame::OnConsoleResized(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM /*lParam*/, BOOL& /* bHandled */)
@@ -983,6 +1024,35 @@ LRESULT MainFrame::OnConsoleResized(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM /*l
 //////////////////////////////////////////////////////////////////////////////
 
 
+//////////////////////////////////////////////////////////////////////////////
+
+LRESULT MainFrame::OnScheduleViewUpdate(UINT /*uMsg*/, WPARAM wParam, LPARAM /*lParam*/, BOOL& /*bHandled*/)
+{
+	m_dirtyViews.insert(reinterpret_cast<HWND>(wParam));
+
+	if (m_bFrameTimerRunning) return 0;
+
+	// if a frame is due, update now (keeps typing latency low), otherwise
+	// wait for the next one; views that change in the meantime are updated
+	// only once
+	DWORD dwElapsed = ::GetTickCount() - m_dwLastFrame;
+
+	if (dwElapsed >= m_dwFrameInterval)
+	{
+		UpdateDirtyViews();
+	}
+	else
+	{
+		SetTimer(TIMER_FRAME, m_dwFrameInterval - dwElapsed);
+		m_bFrameTimerRunning = true;
+	}
+
+	return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
 //////////////////////////////////////////////////////////////////////////////
 
 LRESULT MainFrame::OnConsoleClosed(UINT /*uMsg*/, WPARAM wParam, LPARAM /*lParam*/, BOOL& /* bHandled */)
@@ -2036,6 +2106,7 @@ LRESULT MainFrame::OnEditSettings(WORD /*wNotifyCode*/, WORD /*wID*/, HWND /*hWn
 		::SetWindowLong(GetTabCtrl().m_hWnd, GWL_STYLE, dwTabStyles);
 
 		SetWindowStyles();
+		UpdateFrameInterval();
 
 		UpdateTabsMenu(m_CmdBar.GetMenu(), m_tabsMenu);
 		UpdateMenuHotKeys();
@@ -2585,6 +2656,7 @@ void MainFrame::UpdateStatusBar()
   wchar_t strBufColsRows [16] = L"";
   wchar_t strPid         [16] = L"";
   wchar_t strZoom        [16] = L"";
+  wstring strPasteProgress;
 
   if (m_activeTabView)
   {
@@ -2608,6 +2680,15 @@ void MainFrame::UpdateStatusBar()
       _snwprintf_s(strZoom, ARRAYSIZE(strZoom),               _TRUNCATE, L"%lu%%",
         activeConsoleView->GetFontZoom());
 
+      if( activeConsoleView->GetConsoleHandler().IsPasting() )
+      {
+        DWORD dwPasteCharsDone = 0;
+        DWORD dwPasteChars     = 0;
+
+        activeConsoleView->GetConsoleHandler().GetPasteProgress(dwPasteCharsDone, dwPasteChars);
+        strPasteProgress = boost::str(boost::wformat(Helpers::LoadString(IDS_PASTE_PROGRESS)) % dwPasteCharsDone % dwPasteChars);
+      }
+
       UIEnable(ID_EDIT_COPY,            activeConsoleView->CanCopy()           ? TRUE : FALSE);
       UIEnable(ID_EDIT_CLEAR_SELECTION, activeConsoleView->CanClearSelection() ? TRUE : FALSE);
       UIEnable(ID_EDIT_PASTE,           activeConsoleView->CanPaste()          ? TRUE : FALSE);
@@ -2621,6 +2702,18 @@ void MainFrame::UpdateStatusBar()
   UISetText(7, strBufColsRows);
   UISetText(8, strZoom);
 
+  // menu help uses the default pane too, we only touch it while pasting
+  if( !strPasteProgress.empty() )
+  {
+    m_statusBar.SetPaneText(ID_DEFAULT_PANE, strPasteProgress.c_str());
+    m_bPasteProgress = true;
+  }
+  else if( m_bPasteProgress )
+  {
+    m_statusBar.SetPaneText(ID_DEFAULT_PANE, CString(LPCTSTR(ATL_IDS_IDLEMESSAGE)));
+    m_bPasteProgress = false;
+  }
+
   UIUpdateStatusBar();
 }
 
@@ -3472,19 +3565,29 @@ void MainFrame::SetActiveConsole(HWND hwndTabView, HWND hwndConsoleView)
 
 void MainFrame::PostMessageToConsoles(UINT Msg, WPARAM wParam, LPARAM lParam)
 {
-  MutexLock lock(m_tabsMutex);
-  for (TabViewMap::iterator it = m_tabs.begin(); it != m_tabs.end(); ++it)
+  vector<std::shared_ptr<ConsoleView> > groupedViews;
+  GetGroupedConsoles(groupedViews);
+
+  // one message, queued to each console (writes complete asynchronously,
+  // a console that doesn't read its pipe doesn't hold up the others)
+  NamedPipeMessage npmsg(ConsoleHandler::MakePostMessage(Msg, wParam, lParam));
+
+  for (auto it = groupedViews.begin(); it != groupedViews.end(); ++it)
   {
-    it->second->PostMessageToConsoles(Msg, wParam, lParam);
+    (*it)->GetConsoleHandler().PostPipeMessage(npmsg);
   }
 }
 
 void MainFrame::WriteConsoleInputToConsoles(KEY_EVENT_RECORD* pkeyEvent)
 {
-  MutexLock lock(m_tabsMutex);
-  for (TabViewMap::iterator it = m_tabs.begin(); it != m_tabs.end(); ++it)
+  vector<std::shared_ptr<ConsoleView> > groupedViews;
+  GetGroupedConsoles(groupedViews);
+
+  NamedPipeMessage npmsg(ConsoleHandler::MakeWriteConsoleInput(pkeyEvent));
+
+  for (auto it = groupedViews.begin(); it != groupedViews.end(); ++it)
   {
-    it->second->WriteConsoleInputToConsoles(pkeyEvent);
+    (*it)->GetConsoleHandler().PostPipeMessage(npmsg);
   }
 }
 
@@ -3520,25 +3623,31 @@ void MainFrame::PasteToConsoles()
 		if( !text.empty() )
 		{
 			if( activeConsoleView->IsGrouped() )
-			{
-				MutexLock lock(m_tabsMutex);
-				for (TabViewMap::iterator it = m_tabs.begin(); it != m_tabs.end(); ++it)
-				{
-					it->second->SendTextToConsoles(text.c_str());
-				}
-			}
+				SendTextToConsoles(text.c_str());
 			else
-				activeConsoleView->GetConsoleHandler().SendTextToConsole(text.c_str());
+				activeConsoleView->SendTextToConsole(text.c_str());
 		}
 	}
 }
 
 void MainFrame::SendTextToConsoles(const wchar_t* pszText)
+{
+  vector<std::shared_ptr<ConsoleView> > groupedViews;
+  GetGroupedConsoles(groupedViews);
+
+  // each console takes the text at its own pace
+  for (auto it = groupedViews.begin(); it != groupedViews.end(); ++it)
+  {
+    (*it)->SendTextToConsole(pszText);
+  }
+}
+
+void MainFrame::GetGroupedConsoles(vector<std::shared_ptr<ConsoleView> >& groupedViews)
 {
   MutexLock lock(m_tabsMutex);
   for (TabViewMap::iterator it = m_tabs.begin(); it != m_tabs.end(); ++it)
   {
-    it->second->SendTextToConsoles(pszText);
+    it->second->GetGroupedConsoles(groupedViews);
   }
 }
 
@@ -3632,3 +3741,45 @@ void MainFrame::UpdateUI()
 	UIEnable(ID_FILE_CLOSE_ALL_TABS_LEFT, m_TabCtrl.GetCurSel() > 0);
 	UIEnable(ID_FILE_CLOSE_ALL_TABS_RIGHT, m_TabCtrl.GetCurSel() < (m_TabCtrl.GetItemCount() - 1));
 }
+
+/////////////////////////////////////////////////////////////////////////////
+
+/////////////////////////////////////////////////////////////////////////////
+
+void MainFrame::UpdateFrameInterval(void)
+{
+	DWORD dwFrameRate = g_settingsHandler->GetConsoleSettings().dwMaxFrameRate;
+
+	m_hFrameMonitor = ::MonitorFromWindow(m_hWnd, MONITOR_DEFAULTTONEAREST);
+
+	// default is the refresh rate of the display we're on (0 and 1 mean
+	// the hardware default)
+	if (dwFrameRate == 0)
+	{
+		CWindowDC dc(m_hWnd);
+
+		dwFrameRate = static_cast<DWORD>(dc.GetDeviceCaps(VREFRESH));
+		if (dwFrameRate <= 1) dwFrameRate = 60;
+	}
+
+	m_dwFrameInterval = max(1000 / dwFrameRate, 1UL);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+/////////////////////////////////////////////////////////////////////////////
+
+void MainFrame::UpdateDirtyViews(void)
+{
+	m_dwLastFrame = ::GetTickCount();
+
+	// views can be scheduled again while we're updating them
+	set<HWND> dirtyViews;
+	dirtyViews.swap(m_dirtyViews);
+
+	for (set<HWND>::iterator it = dirtyViews.begin(); it != dirtyViews.end(); ++it)
+	{
+		// view might have been closed since it was scheduled
+		if (::IsWindow(*it)) ::SendMessage(*it, UM_UPDATE_CONSOLE_VIEW, 0, 0);
+	}
+}
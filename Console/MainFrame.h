@@ -12,6 +12,10 @@
 #define	TIMER_SIZING			42
 #define	TIMER_SIZING_INTERVAL	100
 
+// Timer for the next frame, console views are repainted at most once per
+// frame (display refresh rate or max_fps setting)
+#define	TIMER_FRAME				43
+
 //////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////
@@ -101,6 +105,7 @@ class MainFrame
 			MESSAGE_HANDLER(WM_SIZE, OnSize)
 			MESSAGE_HANDLER(WM_SIZING, OnSizing)
 			MESSAGE_HANDLER(WM_WINDOWPOSCHANGING, OnWindowPosChanging)
+			MESSAGE_HANDLER(WM_MOVE, OnMove)
 			MESSAGE_HANDLER(WM_LBUTTONUP, OnMouseButtonUp)
 			MESSAGE_HANDLER(WM_RBUTTONUP, OnMouseButtonUp)
 			MESSAGE_HANDLER(WM_MBUTTONUP, OnMouseButtonUp)
@@ -109,6 +114,7 @@ class MainFrame
 			MESSAGE_HANDLER(WM_EXITSIZEMOVE, OnExitSizeMove)
 			MESSAGE_HANDLER(WM_TIMER, OnTimer)
 			MESSAGE_HANDLER(WM_SETTINGCHANGE, OnSettingChange)
+			MESSAGE_HANDLER(WM_DISPLAYCHANGE, OnDisplayChange)
 			MESSAGE_HANDLER(UM_CONSOLE_RESIZED, OnConsoleResized)
 			MESSAGE_HANDLER(UM_CONSOLE_CLOSED, OnConsoleClosed)
 			MESSAGE_HANDLER(UM_UPDATE_TITLES, OnUpdateTitles)
@@ -116,6 +122,7 @@ class MainFrame
 			MESSAGE_HANDLER(UM_START_MOUSE_DRAG, OnStartMouseDrag)
 			MESSAGE_HANDLER(m_uTaskbarRestart, OnTaskbarCreated)
 			MESSAGE_HANDLER(UM_TRAY_NOTIFY, OnTrayNotify)
+			MESSAGE_HANDLER(UM_SCHEDULE_VIEW_UPDATE, OnScheduleViewUpdate)
 			MESSAGE_HANDLER(WM_COPYDATA, OnCopyData)
 
 			NOTIFY_CODE_HANDLER(CTCN_SELCHANGE, OnTabChanged)
@@ -209,10 +216,12 @@ class MainFrame
 		LRESULT OnWindowPosChanging(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM lParam, BOOL& bHandled);
 		LRESULT OnMouseButtonUp(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM /*lParam*/, BOOL& bHandled);
 		LRESULT OnMouseMove(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM lParam, BOOL& /*bHandled*/);
+		LRESULT OnMove(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM /*lParam*/, BOOL& bHandled);
 		LRESULT OnExitSizeMove(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM /*lParam*/, BOOL& /*bHandled*/);
 		LRESULT OnTimer(UINT /*uMsg*/, WPARAM wParam, LPARAM /*lParam*/, BOOL& /*bHandled*/);
 
 		LRESULT OnSettingChange(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM lParam, BOOL& /*bHandled*/);
+		LRESULT OnDisplayChange(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM /*lParam*/, BOOL& bHandled);
 
 		LRESULT OnConsoleResized(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM /*lParam*/, BOOL& /* bHandled */);
 		LRESULT OnConsoleClosed(UINT /*uMsg*/, WPARAM wParam, LPARAM /*lParam*/, BOOL& /*bHandled*/);
@@ -221,6 +230,7 @@ class MainFrame
 		LRESULT OnStartMouseDrag(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM lParam, BOOL& /*bHandled*/);
 		LRESULT OnTrayNotify(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM lParam, BOOL& /*bHandled*/);
 		LRESULT OnTaskbarCreated(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM lParam, BOOL& /*bHandled*/);
+		LRESULT OnScheduleViewUpdate(UINT /*uMsg*/, WPARAM wParam, LPARAM /*lParam*/, BOOL& /*bHandled*/);
 
 		LRESULT OnTabChanged(int /*idCtrl*/, LPNMHDR pnmh, BOOL& bHandled);
 		LRESULT OnTabOrderChanged(int /*idCtrl*/, LPNMHDR pnmh, BOOL& bHandled);
@@ -297,7 +307,13 @@ class MainFrame
 		void UpdateOpenedTabsMenu(CMenu& tabsMenu);
 		void UpdateMenuHotKeys(void);
 		void UpdateStatusBar();
+
+		// grouped views of all tabs, messages are broadcast to them without
+		// holding the tabs and views mutexes
+		void GetGroupedConsoles(vector<std::shared_ptr<ConsoleView> >& groupedViews);
 		void SetWindowStyles(void);
+		void UpdateFrameInterval(void);
+		void UpdateDirtyViews(void);
 		void DockWindow(DockPosition dockPosition);
 		void SetZOrder(ZOrder zOrder);
 		HWND GetDesktopWindow();
@@ -388,6 +404,19 @@ class MainFrame
 		int     m_nFullSreen1Bitmap;
 		int     m_nFullSreen2Bitmap;
 		HWND    m_hwndPreviousForeground;
+
+		// console views waiting for the next frame
+		set<HWND>	m_dirtyViews;
+		bool		m_bFrameTimerRunning;
+		DWORD		m_dwLastFrame;
+
+		// frame interval for the display we're on, updated when the display
+		// settings or the monitor change
+		DWORD		m_dwFrameInterval;
+		HMONITOR	m_hFrameMonitor;
+
+		// default pane shows the active console's paste progress
+		bool		m_bPasteProgress;
 };
 
 //////////////////////////////////////////////////////////////////////////////
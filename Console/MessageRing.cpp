@@ -0,0 +1,105 @@
+//////////////////////////////////////////////////////////////////////////////
+// MessageRing.cpp - lock-free byte ring with one writer and one reader
+
+#include "stdafx.h"
+#include "MessageRing.h"
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+MessageRing::MessageRing()
+: m_buffer(new BYTE[MESSAGE_RING_SIZE])
+, m_lWritePos(0)
+, m_lReadPos(0)
+{
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+bool MessageRing::Write(const void* pData, size_t size, const void* pPayload, size_t payloadSize)
+{
+	DWORD dwWritePos = static_cast<DWORD>(m_lWritePos);
+	DWORD dwReadPos  = static_cast<DWORD>(::InterlockedCompareExchange(&m_lReadPos, 0, 0));
+	DWORD dwFree     = MESSAGE_RING_SIZE - (dwWritePos - dwReadPos);
+
+	if (size + payloadSize > dwFree) return false;
+
+	CopyIn(dwWritePos, pData, size);
+	if (payloadSize > 0) CopyIn(dwWritePos + static_cast<DWORD>(size), pPayload, payloadSize);
+
+	// publish the message after its bytes
+	::InterlockedExchange(&m_lWritePos, static_cast<LONG>(dwWritePos + static_cast<DWORD>(size + payloadSize)));
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+size_t MessageRing::Read(void* pBuffer, size_t size)
+{
+	DWORD dwReadPos  = static_cast<DWORD>(m_lReadPos);
+	DWORD dwWritePos = static_cast<DWORD>(::InterlockedCompareExchange(&m_lWritePos, 0, 0));
+	DWORD dwRead     = min(dwWritePos - dwReadPos, static_cast<DWORD>(size));
+
+	if (dwRead == 0) return 0;
+
+	DWORD dwOffset = dwReadPos & (MESSAGE_RING_SIZE - 1);
+	DWORD dwFirst  = min(dwRead, MESSAGE_RING_SIZE - dwOffset);
+
+	::CopyMemory(pBuffer, m_buffer.get() + dwOffset, dwFirst);
+	::CopyMemory(static_cast<BYTE*>(pBuffer) + dwFirst, m_buffer.get(), dwRead - dwFirst);
+
+	// the writer can reuse the space now
+	::InterlockedExchange(&m_lReadPos, static_cast<LONG>(dwReadPos + dwRead));
+
+	return dwRead;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+bool MessageRing::IsEmpty() const
+{
+	return (m_lWritePos == m_lReadPos);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void MessageRing::CopyIn(DWORD dwPos, const void* pData, size_t size)
+{
+	DWORD dwOffset = dwPos & (MESSAGE_RING_SIZE - 1);
+	DWORD dwFirst  = min(static_cast<DWORD>(size), MESSAGE_RING_SIZE - dwOffset);
+
+	::CopyMemory(m_buffer.get() + dwOffset, pData, dwFirst);
+	::CopyMemory(m_buffer.get(), static_cast<const BYTE*>(pData) + dwFirst, size - dwFirst);
+}
+
+//////////////////////////////////////////////////////////////////////////////
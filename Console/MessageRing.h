@@ -0,0 +1,52 @@
+//////////////////////////////////////////////////////////////////////////////
+// MessageRing.h - lock-free byte ring with one writer and one reader
+
+#pragma once
+
+//////////////////////////////////////////////////////////////////////////////
+
+// ring capacity in bytes (a power of 2)
+#define MESSAGE_RING_SIZE	65536
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Messages are queued by one thread and taken by another as a byte stream.
+// Read and write positions run freely and wrap around, the writer only
+// publishes whole messages.
+
+class MessageRing
+{
+	public:
+		MessageRing();
+
+	public:
+
+		// writer: queues both parts as one message, false if there's not
+		// enough room for all of it
+		bool Write(const void* pData, size_t size, const void* pPayload = NULL, size_t payloadSize = 0);
+
+		// reader: takes up to size bytes, returns how many it took
+		size_t Read(void* pBuffer, size_t size);
+
+		bool IsEmpty() const;
+
+	private:
+
+		void CopyIn(DWORD dwPos, const void* pData, size_t size);
+
+	private:
+
+		std::unique_ptr<BYTE[]>	m_buffer;
+
+		volatile LONG			m_lWritePos;
+		volatile LONG			m_lReadPos;
+};
+
+//////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,82 @@
+//////////////////////////////////////////////////////////////////////////////
+// PaletteCache.cpp - brushes for the console color palette
+
+#include "stdafx.h"
+#include "PaletteCache.h"
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+PaletteCache::PaletteCache()
+: m_bValid(false)
+, m_byTextOpacity(0)
+{
+	::ZeroMemory(m_colors, sizeof(m_colors));
+}
+
+// copies (of cloned tab data) create their own brushes
+PaletteCache::PaletteCache(const PaletteCache& /*other*/)
+: m_bValid(false)
+, m_byTextOpacity(0)
+{
+	::ZeroMemory(m_colors, sizeof(m_colors));
+}
+
+PaletteCache::~PaletteCache()
+{
+}
+
+PaletteCache& PaletteCache::operator=(const PaletteCache& /*other*/)
+{
+	m_bValid = false;
+	return *this;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void PaletteCache::Update(const COLORREF consoleColors[16], BYTE byTextOpacity)
+{
+	if (m_bValid &&
+		(m_byTextOpacity == byTextOpacity) &&
+		(::memcmp(m_colors, consoleColors, sizeof(m_colors)) == 0))
+	{
+		return;
+	}
+
+	::CopyMemory(m_colors, consoleColors, sizeof(m_colors));
+	m_byTextOpacity = byTextOpacity;
+
+	for (int i = 0; i < 16; ++i)
+	{
+		if (!m_brushes[i].IsNull()) m_brushes[i].DeleteObject();
+		m_brushes[i].CreateSolidBrush(m_colors[i]);
+
+#ifdef _USE_AERO
+		m_aeroBrushes[i].reset(new Gdiplus::SolidBrush(
+			Gdiplus::Color(
+				byTextOpacity,
+				GetRValue(m_colors[i]),
+				GetGValue(m_colors[i]),
+				GetBValue(m_colors[i]))));
+#endif //_USE_AERO
+	}
+
+	m_bValid = true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,48 @@
+//////////////////////////////////////////////////////////////////////////////
+// PaletteCache.h - brushes for the console color palette
+
+#pragma once
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Text background brushes of a tab, shared by all of its views. They're
+// rebuilt only when the palette or the text background opacity changes.
+
+class PaletteCache
+{
+	public:
+		PaletteCache();
+		PaletteCache(const PaletteCache& other);
+		~PaletteCache();
+
+		PaletteCache& operator=(const PaletteCache& other);
+
+	public:
+
+		void Update(const COLORREF consoleColors[16], BYTE byTextOpacity);
+
+		HBRUSH GetBrush(WORD wColor) const { return m_brushes[wColor & 0xF]; }
+#ifdef _USE_AERO
+		Gdiplus::SolidBrush* GetAeroBrush(WORD wColor) const { return m_aeroBrushes[wColor & 0xF].get(); }
+#endif //_USE_AERO
+
+	private:
+
+		bool		m_bValid;
+		COLORREF	m_colors[16];
+		BYTE		m_byTextOpacity;
+
+		CBrush		m_brushes[16];
+#ifdef _USE_AERO
+		std::unique_ptr<Gdiplus::SolidBrush>	m_aeroBrushes[16];
+#endif //_USE_AERO
+};
+
+//////////////////////////////////////////////////////////////////////////////
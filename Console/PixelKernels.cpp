@@ -0,0 +1,206 @@
+//////////////////////////////////////////////////////////////////////////////
+// PixelKernels.cpp - vectorized loops over 32-bit bitmap pixels
+
+#include "stdafx.h"
+#include "PixelKernels.h"
+#include "CellKernels.h"
+
+#include <emmintrin.h>
+
+// x/255 rounded, exact for x <= 255*255
+#define DIV255(x)	(((x) + 128 + (((x) + 128) >> 8)) >> 8)
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+PixelKernels::SpanFunc	PixelKernels::m_pfnFill(CellKernels::HasSSE2() ? PixelKernels::FillSSE2 : PixelKernels::FillScalar);
+PixelKernels::SpanFunc	PixelKernels::m_pfnBlend(CellKernels::HasSSE2() ? PixelKernels::BlendSSE2 : PixelKernels::BlendScalar);
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+bool PixelKernels::GetPixelBuffer(HBITMAP hBitmap, PixelBuffer& pixels)
+{
+	DIBSECTION dibSection;
+
+	pixels = PixelBuffer();
+
+	if (hBitmap == NULL) return false;
+	if (::GetObject(hBitmap, sizeof(DIBSECTION), &dibSection) != sizeof(DIBSECTION)) return false;
+	if ((dibSection.dsBm.bmBitsPixel != 32) || (dibSection.dsBm.bmBits == NULL)) return false;
+
+	pixels.pBits     = static_cast<BYTE*>(dibSection.dsBm.bmBits);
+	pixels.nStride   = dibSection.dsBm.bmWidthBytes;
+	pixels.nWidth    = dibSection.dsBm.bmWidth;
+	pixels.nHeight   = dibSection.dsBm.bmHeight;
+	pixels.bBottomUp = (dibSection.dsBmih.biHeight > 0);
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void PixelKernels::FillRect(const PixelBuffer& pixels, const CRect& rect, COLORREF crColor, BYTE byAlpha)
+{
+	ForEachRow(pixels, rect, m_pfnFill, crColor, byAlpha);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void PixelKernels::BlendRect(const PixelBuffer& pixels, const CRect& rect, COLORREF crColor, BYTE byAlpha)
+{
+	ForEachRow(pixels, rect, m_pfnBlend, crColor, byAlpha);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+DWORD PixelKernels::PremultipliedPixel(COLORREF crColor, BYTE byAlpha)
+{
+	DWORD dwRed   = DIV255(GetRValue(crColor) * byAlpha);
+	DWORD dwGreen = DIV255(GetGValue(crColor) * byAlpha);
+	DWORD dwBlue  = DIV255(GetBValue(crColor) * byAlpha);
+
+	// COLORREF is RGB, DIB pixels are BGRA
+	return (static_cast<DWORD>(byAlpha) << 24) | (dwRed << 16) | (dwGreen << 8) | dwBlue;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void PixelKernels::FillScalar(DWORD* pPixels, DWORD dwCount, COLORREF crColor, BYTE byAlpha)
+{
+	DWORD dwPixel = PremultipliedPixel(crColor, byAlpha);
+
+	for (DWORD i = 0; i < dwCount; ++i) pPixels[i] = dwPixel;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void PixelKernels::FillSSE2(DWORD* pPixels, DWORD dwCount, COLORREF crColor, BYTE byAlpha)
+{
+	DWORD   dwPixel = PremultipliedPixel(crColor, byAlpha);
+	__m128i pixel   = _mm_set1_epi32(static_cast<int>(dwPixel));
+	DWORD   i       = 0;
+
+	for (; i + 4 <= dwCount; i += 4)
+	{
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(pPixels + i), pixel);
+	}
+
+	for (; i < dwCount; ++i) pPixels[i] = dwPixel;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void PixelKernels::BlendScalar(DWORD* pPixels, DWORD dwCount, COLORREF crColor, BYTE byAlpha)
+{
+	// source over: color*alpha + pixel*(1 - alpha), all channels
+	DWORD dwSource  = PremultipliedPixel(crColor, byAlpha);
+	DWORD dwInverse = 255 - byAlpha;
+
+	for (DWORD i = 0; i < dwCount; ++i)
+	{
+		DWORD dwPixel  = pPixels[i];
+		DWORD dwResult = 0;
+
+		for (int nShift = 0; nShift < 32; nShift += 8)
+		{
+			DWORD dwChannel = DIV255(((dwPixel >> nShift) & 0xFF) * dwInverse) + ((dwSource >> nShift) & 0xFF);
+
+			dwResult |= min(dwChannel, static_cast<DWORD>(255)) << nShift;
+		}
+
+		pPixels[i] = dwResult;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void PixelKernels::BlendSSE2(DWORD* pPixels, DWORD dwCount, COLORREF crColor, BYTE byAlpha)
+{
+	DWORD   dwSource = PremultipliedPixel(crColor, byAlpha);
+	__m128i source   = _mm_set1_epi32(static_cast<int>(dwSource));
+	__m128i inverse  = _mm_set1_epi16(static_cast<short>(255 - byAlpha));
+	__m128i round    = _mm_set1_epi16(128);
+	__m128i zero     = _mm_setzero_si128();
+	DWORD   i        = 0;
+
+	// 4 pixels at a time, channels widened to 16 bits
+	for (; i + 4 <= dwCount; i += 4)
+	{
+		__m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pPixels + i));
+
+		__m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(pixels, zero), inverse), round);
+		__m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(pixels, zero), inverse), round);
+
+		lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+		hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(pPixels + i), _mm_adds_epu8(_mm_packus_epi16(lo, hi), source));
+	}
+
+	BlendScalar(pPixels + i, dwCount - i, crColor, byAlpha);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void PixelKernels::ForEachRow(const PixelBuffer& pixels, const CRect& rect, SpanFunc pfnSpan, COLORREF crColor, BYTE byAlpha)
+{
+	if (pixels.pBits == NULL) return;
+
+	int nLeft   = max(static_cast<int>(rect.left), 0);
+	int nRight  = min(static_cast<int>(rect.right), pixels.nWidth);
+	int nTop    = max(static_cast<int>(rect.top), 0);
+	int nBottom = min(static_cast<int>(rect.bottom), pixels.nHeight);
+
+	if ((nLeft >= nRight) || (nTop >= nBottom)) return;
+
+	for (int nY = nTop; nY < nBottom; ++nY)
+	{
+		pfnSpan(pixels.GetRow(nY) + nLeft, static_cast<DWORD>(nRight - nLeft), crColor, byAlpha);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,101 @@
+//////////////////////////////////////////////////////////////////////////////
+// PixelKernels.h - vectorized loops over 32-bit bitmap pixels
+
+#pragma once
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Bits of a 32-bit DIB section (BGRA pixels)
+
+struct PixelBuffer
+{
+	PixelBuffer()
+	: pBits(NULL)
+	, nStride(0)
+	, nWidth(0)
+	, nHeight(0)
+	, bBottomUp(false)
+	{
+	}
+
+	DWORD* GetRow(int nY) const
+	{
+		return reinterpret_cast<DWORD*>(pBits + (bBottomUp ? (nHeight - 1 - nY) : nY)*nStride);
+	}
+
+	BYTE*	pBits;
+	int		nStride;
+	int		nWidth;
+	int		nHeight;
+	bool	bBottomUp;
+};
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Solid color fills and blends, written straight into bitmap bits instead
+// of going through a temporary DC (AlphaBlend) or GDI+. Colors with alpha
+// are premultiplied, the way layered and glass windows want them.
+// Kernels are picked once for the CPU we run on (SSE2 or plain C++).
+
+class PixelKernels
+{
+	public:
+
+		// returns false if the bitmap isn't a 32-bit DIB section; GDI
+		// drawing has to be flushed before touching the bits
+		static bool GetPixelBuffer(HBITMAP hBitmap, PixelBuffer& pixels);
+
+		// sets pixels to the color with the given alpha
+		static void Fill(DWORD* pPixels, DWORD dwCount, COLORREF crColor, BYTE byAlpha)
+		{
+			m_pfnFill(pPixels, dwCount, crColor, byAlpha);
+		}
+
+		// blends the color with the given alpha over the pixels
+		static void Blend(DWORD* pPixels, DWORD dwCount, COLORREF crColor, BYTE byAlpha)
+		{
+			m_pfnBlend(pPixels, dwCount, crColor, byAlpha);
+		}
+
+		// same for a rectangle (clipped to the buffer)
+		static void FillRect(const PixelBuffer& pixels, const CRect& rect, COLORREF crColor, BYTE byAlpha);
+		static void BlendRect(const PixelBuffer& pixels, const CRect& rect, COLORREF crColor, BYTE byAlpha);
+
+	public:
+
+		// the variants, callable directly so the tests can compare them
+		static void FillScalar(DWORD* pPixels, DWORD dwCount, COLORREF crColor, BYTE byAlpha);
+		static void FillSSE2(DWORD* pPixels, DWORD dwCount, COLORREF crColor, BYTE byAlpha);
+
+		static void BlendScalar(DWORD* pPixels, DWORD dwCount, COLORREF crColor, BYTE byAlpha);
+		static void BlendSSE2(DWORD* pPixels, DWORD dwCount, COLORREF crColor, BYTE byAlpha);
+
+	private:
+
+		typedef void (*SpanFunc)(DWORD* pPixels, DWORD dwCount, COLORREF crColor, BYTE byAlpha);
+
+		static DWORD PremultipliedPixel(COLORREF crColor, BYTE byAlpha);
+
+		static void ForEachRow(const PixelBuffer& pixels, const CRect& rect, SpanFunc pfnSpan, COLORREF crColor, BYTE byAlpha);
+
+	private:
+
+		static SpanFunc		m_pfnFill;
+		static SpanFunc		m_pfnBlend;
+};
+
+//////////////////////////////////////////////////////////////////////////////
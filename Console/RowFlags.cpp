@@ -0,0 +1,104 @@
+//////////////////////////////////////////////////////////////////////////////
+// RowFlags.cpp - bitset of per-row screen flags
+
+#include "stdafx.h"
+#include "RowFlags.h"
+#include "CellKernels.h"
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+RowFlags::RowFlags()
+: m_dwRows(0)
+, m_words()
+{
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void RowFlags::Reset(DWORD dwRows)
+{
+	m_dwRows = dwRows;
+	m_words.assign((dwRows + 31) / 32, 0);
+
+	SetAll();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void RowFlags::SetAll()
+{
+	if (m_words.empty()) return;
+
+	std::fill(m_words.begin(), m_words.end(), 0xFFFFFFFF);
+
+	// bits past the last row stay clear, Count relies on it
+	if (m_dwRows % 32) m_words.back() = (1u << (m_dwRows % 32)) - 1;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+DWORD RowFlags::Count() const
+{
+	if (m_words.empty()) return 0;
+
+	return CellKernels::CountBits(&m_words[0], static_cast<DWORD>(m_words.size()));
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void RowFlags::Shift(int nScrollRows)
+{
+	DWORD dwScroll = static_cast<DWORD>(abs(nScrollRows));
+
+	if (dwScroll >= m_dwRows)
+	{
+		SetAll();
+		return;
+	}
+
+	if (nScrollRows > 0)
+	{
+		for (DWORD dwRow = 0; dwRow < m_dwRows - dwScroll; ++dwRow)
+		{
+			if (Test(dwRow + dwScroll)) Set(dwRow); else Clear(dwRow);
+		}
+
+		for (DWORD dwRow = m_dwRows - dwScroll; dwRow < m_dwRows; ++dwRow) Set(dwRow);
+	}
+	else if (nScrollRows < 0)
+	{
+		for (DWORD dwRow = m_dwRows - 1; dwRow >= dwScroll; --dwRow)
+		{
+			if (Test(dwRow - dwScroll)) Set(dwRow); else Clear(dwRow);
+		}
+
+		for (DWORD dwRow = 0; dwRow < dwScroll; ++dwRow) Set(dwRow);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////
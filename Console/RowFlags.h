@@ -0,0 +1,48 @@
+//////////////////////////////////////////////////////////////////////////////
+// RowFlags.h - bitset of per-row screen flags
+
+#pragma once
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+// One bit per screen row (changed rows), scrolled along with the text.
+
+class RowFlags
+{
+	public:
+		RowFlags();
+
+	public:
+
+		// resizes the set, all rows are flagged
+		void Reset(DWORD dwRows);
+
+		DWORD GetRows() const { return m_dwRows; }
+
+		bool Test(DWORD dwRow) const	{ return (m_words[dwRow / 32] & (1u << (dwRow % 32))) != 0; }
+		void Set(DWORD dwRow)			{ m_words[dwRow / 32] |= (1u << (dwRow % 32)); }
+		void Clear(DWORD dwRow)			{ m_words[dwRow / 32] &= ~(1u << (dwRow % 32)); }
+
+		void SetAll();
+
+		// number of flagged rows
+		DWORD Count() const;
+
+		// moves flags the way text scrolls (positive is up), uncovered rows
+		// are flagged
+		void Shift(int nScrollRows);
+
+	private:
+
+		DWORD				m_dwRows;
+		std::vector<DWORD>	m_words;
+};
+
+//////////////////////////////////////////////////////////////////////////////
@@ -56,6 +56,12 @@ SelectionHandler::SelectionHandler(
 	Helpers::CreateBitmap(dcConsoleView, rectConsoleView.Width(), rectConsoleView.Height(), m_bmpSelection);
 	m_dcSelection.SelectBitmap(m_bmpSelection);
 	m_dcSelection.SetBkColor(RGB(0, 0, 0));
+#else //_USE_AERO
+	Gdiplus::Color selectionColor;
+	selectionColor.SetFromCOLORREF(g_settingsHandler->GetAppearanceSettings().stylesSettings.crSelectionColor);
+
+	m_selectionPen.reset(new Gdiplus::Pen(selectionColor));
+	m_selectionBrush.reset(new Gdiplus::SolidBrush(Gdiplus::Color(64,  selectionColor.GetR(), selectionColor.GetG(), selectionColor.GetB())));
 #endif //_USE_AERO
 }
 
@@ -70,7 +76,7 @@ SelectionHandler::~SelectionHandler()
 //////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////
 
-void SelectionHandler::SelectWord(const COORD& coordInit, CharInfo screenBuffer [])
+void SelectionHandler::SelectWord(const COORD& coordInit, CHAR_INFO screenBuffer [])
 {
   if (m_selectionState > selstateNoSelection) return;
 
@@ -97,7 +103,7 @@ void SelectionHandler::SelectWord(const COORD& coordInit, CharInfo screenBuffer
   int nStartSel = nDeltaY * m_consoleParams->dwColumns + nDeltaX - 1;
   while(nStartSel >= 0)
   {
-    if( copyPasteSettings.strLeftDelimiters.find(screenBuffer[nStartSel].charInfo.Char.UnicodeChar) != std::wstring::npos )
+    if( copyPasteSettings.strLeftDelimiters.find(screenBuffer[nStartSel].Char.UnicodeChar) != std::wstring::npos )
     {
       if( !copyPasteSettings.bIncludeLeftDelimiter )
         ++nStartSel;
@@ -114,7 +120,7 @@ void SelectionHandler::SelectWord(const COORD& coordInit, CharInfo screenBuffer
   DWORD nEndSel = nDeltaY * m_consoleParams->dwColumns + nDeltaX;
   while (nEndSel < m_consoleParams->dwColumns * m_consoleParams->dwRows)
   {
-    if( copyPasteSettings.strRightDelimiters.find(screenBuffer[nEndSel].charInfo.Char.UnicodeChar) != std::wstring::npos )
+    if( copyPasteSettings.strRightDelimiters.find(screenBuffer[nEndSel].Char.UnicodeChar) != std::wstring::npos )
     {
       if( !copyPasteSettings.bIncludeRightDelimiter )
         --nEndSel;
@@ -135,7 +141,7 @@ void SelectionHandler::SelectWord(const COORD& coordInit, CharInfo screenBuffer
 
 //////////////////////////////////////////////////////////////////////////////
 
-void SelectionHandler::StartSelection(const COORD& coordInit, CharInfo screenBuffer [], SelectionType selectionType)
+void SelectionHandler::StartSelection(const COORD& coordInit, CHAR_INFO screenBuffer [], SelectionType selectionType)
 {
 	if (m_selectionState > selstateNoSelection) return;
 
@@ -162,7 +168,7 @@ void SelectionHandler::StartSelection(const COORD& coordInit, CharInfo screenBuf
 	if (nDeltaY < 0) nDeltaY = 0;
 
 	m_coordInitialXLeading = m_coordInitialXTrailing = m_coordInitial.X;
-	WORD wAttributes = screenBuffer[nDeltaY * m_consoleParams->dwColumns + nDeltaX].charInfo.Attributes;
+	WORD wAttributes = screenBuffer[nDeltaY * m_consoleParams->dwColumns + nDeltaX].Attributes;
 	if (wAttributes & COMMON_LVB_LEADING_BYTE)
 	{
 		++m_coordInitial.X;
@@ -182,7 +188,7 @@ void SelectionHandler::StartSelection(const COORD& coordInit, CharInfo screenBuf
 
 //////////////////////////////////////////////////////////////////////////////
 
-void SelectionHandler::UpdateSelection(const COORD& coordCurrent, CharInfo screenBuffer [])
+void SelectionHandler::UpdateSelection(const COORD& coordCurrent, CHAR_INFO screenBuffer [])
 {
 	if ((m_selectionState != selstateStartedSelecting) &&
 		(m_selectionState != selstateSelecting))
@@ -208,14 +214,14 @@ void SelectionHandler::UpdateSelection(const COORD& coordCurrent, CharInfo scree
 		  (m_coordInitial.Y * m_consoleParams->dwBufferColumns + m_coordInitial.X) )
 	{
 		// selecting from top left to bottom right
-		if (screenBuffer[nDeltaY * m_consoleParams->dwColumns + nDeltaX].charInfo.Attributes & COMMON_LVB_LEADING_BYTE)
+		if (screenBuffer[nDeltaY * m_consoleParams->dwColumns + nDeltaX].Attributes & COMMON_LVB_LEADING_BYTE)
 			++m_coordCurrent.X;
 		m_coordInitial.X = m_coordInitialXLeading;
 	}
 	else
 	{
 		// selecting from bottom right to top left
-		if (screenBuffer[nDeltaY * m_consoleParams->dwColumns + nDeltaX].charInfo.Attributes & COMMON_LVB_TRAILING_BYTE)
+		if (screenBuffer[nDeltaY * m_consoleParams->dwColumns + nDeltaX].Attributes & COMMON_LVB_TRAILING_BYTE)
 			--m_coordCurrent.X;
 		m_coordInitial.X = m_coordInitialXTrailing;
 	}
@@ -462,11 +468,6 @@ void SelectionHandler::Draw(CDC& offscreenDC)
   INT nXmin   = (static_cast<INT>(0)            - static_cast<INT>(srWindow.Left)) * m_nCharWidth  + m_nVInsideBorder;
 
   Gdiplus::Graphics gr(offscreenDC);
-
-  Gdiplus::Color selectionColor;
-  selectionColor.SetFromCOLORREF(g_settingsHandler->GetAppearanceSettings().stylesSettings.crSelectionColor);
-  Gdiplus::Pen        pen  (selectionColor);
-  Gdiplus::SolidBrush brush(Gdiplus::Color(64,  selectionColor.GetR(), selectionColor.GetG(), selectionColor.GetB()));
   Gdiplus::GraphicsPath gp;
 
 	if( m_selectionType == seltypeText )
@@ -540,8 +541,8 @@ void SelectionHandler::Draw(CDC& offscreenDC)
 		gp.AddRectangle(rect);
 	}
 
-  gr.FillPath(&brush, &gp);
-  gr.DrawPath(&pen, &gp);
+  gr.FillPath(m_selectionBrush.get(), &gp);
+  gr.DrawPath(m_selectionPen.get(), &gp);
 }
 
 #else //_USE_AERO
@@ -639,6 +640,39 @@ DWORD SelectionHandler::GetSelectionSize(void)
 //////////////////////////////////////////////////////////////////////////////
 
 
+//////////////////////////////////////////////////////////////////////////////
+
+CRect SelectionHandler::GetSelectionRect(void)
+{
+	CRect rectSelection;
+
+	if (m_selectionState == selstateNoSelection) return rectSelection;
+
+	COORD coordStart;
+	COORD coordEnd;
+
+	GetSelectionCoordinates(coordStart, coordEnd);
+
+	SMALL_RECT& srWindow = m_consoleInfo->csbi.srWindow;
+
+	// text selections wrap, so we take whole rows; the selection outline
+	// is drawn one pixel below the last row
+	m_consoleView.GetClientRect(&rectSelection);
+
+	CRect rectRows(
+		rectSelection.left,
+		(static_cast<INT>(coordStart.Y) - static_cast<INT>(srWindow.Top)) * m_nCharHeight + m_nHInsideBorder,
+		rectSelection.right,
+		(static_cast<INT>(coordEnd.Y) - static_cast<INT>(srWindow.Top) + 1) * m_nCharHeight + m_nHInsideBorder + 1);
+
+	rectSelection.IntersectRect(&rectSelection, &rectRows);
+
+	return rectSelection;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
 /////////////////////////////////////////////////////////////////////////////
 
 #ifndef _USE_AERO
@@ -44,9 +44,9 @@ class SelectionHandler
 
 	public:
 
-		void StartSelection(const COORD& coordInit, CharInfo screenBuffer [], SelectionType selectionType);
-		void SelectWord(const COORD& coordInit, CharInfo screenBuffer []);
-		void UpdateSelection(const COORD& coordCurrent, CharInfo screenBuffer []);
+		void StartSelection(const COORD& coordInit, CHAR_INFO screenBuffer [], SelectionType selectionType);
+		void SelectWord(const COORD& coordInit, CHAR_INFO screenBuffer []);
+		void UpdateSelection(const COORD& coordCurrent, CHAR_INFO screenBuffer []);
 		void UpdateSelection();
 		bool CopySelection(const COORD& coordCurrent);
 		void CopySelection();
@@ -56,6 +56,8 @@ class SelectionHandler
 
 		inline SelectionState GetState() const;
 		DWORD GetSelectionSize(void);
+		// view area the selection is drawn in, empty without a selection
+		CRect GetSelectionRect(void);
 
 #ifdef _USE_AERO
 		void Draw(CDC& offscreenDC);
@@ -82,6 +84,10 @@ class SelectionHandler
 
 		CBrush			m_paintBrush;
 		CBrush			m_backgroundBrush;
+#else //_USE_AERO
+		// we're recreated when settings change
+		std::unique_ptr<Gdiplus::Pen>			m_selectionPen;
+		std::unique_ptr<Gdiplus::SolidBrush>	m_selectionBrush;
 #endif //_USE_AERO
 
 		ConsoleHandler&               m_consoleHandler;
@@ -22,12 +22,16 @@ ConsoleSettings::ConsoleSettings()
 , strInitialDir(L"")
 , dwRefreshInterval(100)
 , dwChangeRefreshInterval(10)
+, dwMaxFrameRate(0)
 , dwRows(25)
 , dwColumns(80)
 , dwBufferRows(200)
 , dwBufferColumns(80)
+, dwMaxHistorySize(8)
 , bStartHidden(false)
 , bSaveSize(false)
+, bUseWinEvents(false)
+, bDirectFrames(false)
 , backgroundTextOpacity(255)
 {
 	defaultConsoleColors[0]	= 0x000000;
@@ -65,12 +69,16 @@ bool ConsoleSettings::Load(const CComPtr<IXMLDOMElement>& pSettingsRoot)
 	XmlHelper::GetAttribute(pConsoleElement, CComBSTR(L"init_dir"), strInitialDir, wstring(L""));
 	XmlHelper::GetAttribute(pConsoleElement, CComBSTR(L"refresh"), dwRefreshInterval, 100);
 	XmlHelper::GetAttribute(pConsoleElement, CComBSTR(L"change_refresh"), dwChangeRefreshInterval, 10);
+	XmlHelper::GetAttribute(pConsoleElement, CComBSTR(L"max_fps"), dwMaxFrameRate, 0);
 	XmlHelper::GetAttribute(pConsoleElement, CComBSTR(L"rows"), dwRows, 25);
 	XmlHelper::GetAttribute(pConsoleElement, CComBSTR(L"columns"), dwColumns, 80);
 	XmlHelper::GetAttribute(pConsoleElement, CComBSTR(L"buffer_rows"), dwBufferRows, 0);
 	XmlHelper::GetAttribute(pConsoleElement, CComBSTR(L"buffer_columns"), dwBufferColumns, 0);
+	XmlHelper::GetAttribute(pConsoleElement, CComBSTR(L"max_history_mb"), dwMaxHistorySize, 8);
 	XmlHelper::GetAttribute(pConsoleElement, CComBSTR(L"start_hidden"), bStartHidden, false);
 	XmlHelper::GetAttribute(pConsoleElement, CComBSTR(L"save_size"), bSaveSize, false);
+	XmlHelper::GetAttribute(pConsoleElement, CComBSTR(L"win_events"), bUseWinEvents, false);
+	XmlHelper::GetAttribute(pConsoleElement, CComBSTR(L"direct_frames"), bDirectFrames, false);
 	XmlHelper::GetAttribute(pConsoleElement, CComBSTR(L"background_text_opacity"), backgroundTextOpacity, 255);
 
 	if( !XmlHelper::LoadColors(pConsoleElement, consoleColors) )
@@ -94,12 +102,16 @@ bool ConsoleSettings::Save(const CComPtr<IXMLDOMElement>& pSettingsRoot)
 	XmlHelper::SetAttribute(pConsoleElement, CComBSTR(L"init_dir"), strInitialDir);
 	XmlHelper::SetAttribute(pConsoleElement, CComBSTR(L"refresh"), dwRefreshInterval);
 	XmlHelper::SetAttribute(pConsoleElement, CComBSTR(L"change_refresh"), dwChangeRefreshInterval);
+	XmlHelper::SetAttribute(pConsoleElement, CComBSTR(L"max_fps"), dwMaxFrameRate);
 	XmlHelper::SetAttribute(pConsoleElement, CComBSTR(L"rows"), dwRows);
 	XmlHelper::SetAttribute(pConsoleElement, CComBSTR(L"columns"), dwColumns);
 	XmlHelper::SetAttribute(pConsoleElement, CComBSTR(L"buffer_rows"), dwBufferRows);
 	XmlHelper::SetAttribute(pConsoleElement, CComBSTR(L"buffer_columns"), dwBufferColumns);
+	XmlHelper::SetAttribute(pConsoleElement, CComBSTR(L"max_history_mb"), dwMaxHistorySize);
 	XmlHelper::SetAttribute(pConsoleElement, CComBSTR(L"start_hidden"), bStartHidden);
 	XmlHelper::SetAttribute(pConsoleElement, CComBSTR(L"save_size"), bSaveSize);
+	XmlHelper::SetAttribute(pConsoleElement, CComBSTR(L"win_events"), bUseWinEvents);
+	XmlHelper::SetAttribute(pConsoleElement, CComBSTR(L"direct_frames"), bDirectFrames);
 	XmlHelper::SetAttribute(pConsoleElement, CComBSTR(L"background_text_opacity"), backgroundTextOpacity);
 
 	XmlHelper::SaveColors(pConsoleElement, consoleColors);
@@ -118,12 +130,16 @@ ConsoleSettings& ConsoleSettings::operator=(const ConsoleSettings& other)
 
 	dwRefreshInterval		= other.dwRefreshInterval;
 	dwChangeRefreshInterval	= other.dwChangeRefreshInterval;
+	dwMaxFrameRate			= other.dwMaxFrameRate;
 	dwRows					= other.dwRows;
 	dwColumns				= other.dwColumns;
 	dwBufferRows			= other.dwBufferRows;
 	dwBufferColumns			= other.dwBufferColumns;
+	dwMaxHistorySize		= other.dwMaxHistorySize;
 	bStartHidden			= other.bStartHidden;
 	bSaveSize				= other.bSaveSize;
+	bUseWinEvents			= other.bUseWinEvents;
+	bDirectFrames			= other.bDirectFrames;
 
 	::CopyMemory(defaultConsoleColors, other.defaultConsoleColors, sizeof(COLORREF)*16);
 	::CopyMemory(consoleColors, other.consoleColors, sizeof(COLORREF)*16);
@@ -154,6 +170,8 @@ FontSettings::FontSettings()
 , crFontColor(0)
 , bBoldIntensified(false)
 , bItalicIntensified(false)
+, bGlyphAtlas(false)
+, bDirect2D(false)
 {
 }
 
@@ -179,6 +197,8 @@ bool FontSettings::Load(const CComPtr<IXMLDOMElement>& pSettingsRoot)
 	XmlHelper::GetAttribute(pFontElement, CComBSTR(L"smoothing"), nFontSmoothing, 0);
 	XmlHelper::GetAttribute(pFontElement, CComBSTR(L"bold_intensified"), bBoldIntensified, false);
 	XmlHelper::GetAttribute(pFontElement, CComBSTR(L"italic_intensified"), bItalicIntensified, false);
+	XmlHelper::GetAttribute(pFontElement, CComBSTR(L"glyph_atlas"), bGlyphAtlas, false);
+	XmlHelper::GetAttribute(pFontElement, CComBSTR(L"direct2d"), bDirect2D, false);
 
 	fontSmoothing = static_cast<FontSmoothing>(nFontSmoothing);
 
@@ -211,6 +231,8 @@ bool FontSettings::Save(const CComPtr<IXMLDOMElement>& pSettingsRoot)
 	XmlHelper::SetAttribute(pFontElement, CComBSTR(L"smoothing"), static_cast<int>(fontSmoothing));
 	XmlHelper::SetAttribute(pFontElement, CComBSTR(L"bold_intensified"), bBoldIntensified);
 	XmlHelper::SetAttribute(pFontElement, CComBSTR(L"italic_intensified"), bItalicIntensified);
+	XmlHelper::SetAttribute(pFontElement, CComBSTR(L"glyph_atlas"), bGlyphAtlas);
+	XmlHelper::SetAttribute(pFontElement, CComBSTR(L"direct2d"), bDirect2D);
 
 	CComPtr<IXMLDOMElement>	pColorElement;
 
@@ -237,6 +259,8 @@ FontSettings& FontSettings::operator=(const FontSettings& other)
 	fontSmoothing	= other.fontSmoothing;
 	bBoldIntensified		= other.bBoldIntensified;
 	bItalicIntensified		= other.bItalicIntensified;
+	bGlyphAtlas		= other.bGlyphAtlas;
+	bDirect2D		= other.bDirect2D;
 
 	bUseColor		= other.bUseColor;
 	crFontColor		= other.crFontColor;
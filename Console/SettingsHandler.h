@@ -39,13 +39,20 @@ struct ConsoleSettings : public SettingsBase
 
 	DWORD		dwRefreshInterval;
 	DWORD		dwChangeRefreshInterval;
+	// max console view repaints per second, 0 for display refresh rate
+	DWORD		dwMaxFrameRate;
 	DWORD		dwRows;
 	DWORD		dwColumns;
 	DWORD		dwBufferRows;
 	DWORD		dwBufferColumns;
+	// max size of a tab's shared buffer history (MB), 0 turns it off
+	DWORD		dwMaxHistorySize;
 
 	bool		bStartHidden;
 	bool		bSaveSize;
+	bool		bUseWinEvents;
+	// render views from the hook's shared frames instead of copies
+	bool		bDirectFrames;
 
 	COLORREF	defaultConsoleColors[16];
 	COLORREF	consoleColors[16];
@@ -90,6 +97,10 @@ struct FontSettings : public SettingsBase
 	FontSmoothing	fontSmoothing;
 	bool			bBoldIntensified;
 	bool			bItalicIntensified;
+	// draw text from a cache of rasterized glyphs instead of ExtTextOut
+	bool			bGlyphAtlas;
+	// draw text with Direct2D/DirectWrite
+	bool			bDirect2D;
 
 	bool			bUseColor;
 	COLORREF		crFontColor;
@@ -694,6 +705,7 @@ struct TabData
 	, iconMenu()
 	, imageData()
 	, bInheritedColors(true)
+	, palette()
 	{
 		consoleColors[0]  = 0x000000;
 		consoleColors[1]  = 0x800000;
@@ -738,6 +750,9 @@ struct TabData
 	bool							bInheritedColors;
 	COLORREF						consoleColors[16];
 
+	// text background brushes for consoleColors
+	PaletteCache					palette;
+
 	void SetColors(const COLORREF colors[16], const bool bForced)
 	{
 		if (bInheritedColors || bForced)
@@ -570,41 +570,13 @@ void TabView::OnSplitBarMove(HWND /*hwndPane0*/, HWND /*hwndPane1*/, bool /*bool
 
 /////////////////////////////////////////////////////////////////////////////
 
-void TabView::PostMessageToConsoles(UINT Msg, WPARAM wParam, LPARAM lParam)
+void TabView::GetGroupedConsoles(vector<std::shared_ptr<ConsoleView> >& groupedViews)
 {
 	MutexLock	viewMapLock(m_viewsMutex);
 	for (ConsoleViewMap::iterator it = m_views.begin(); it != m_views.end(); ++it)
 	{
 		if( it->second->IsGrouped() )
-			it->second->GetConsoleHandler().PostMessage(Msg, wParam, lParam);
-	}
-}
-
-/////////////////////////////////////////////////////////////////////////////
-
-/////////////////////////////////////////////////////////////////////////////
-
-void TabView::WriteConsoleInputToConsoles(KEY_EVENT_RECORD* pkeyEvent)
-{
-	MutexLock	viewMapLock(m_viewsMutex);
-	for (ConsoleViewMap::iterator it = m_views.begin(); it != m_views.end(); ++it)
-	{
-		if( it->second->IsGrouped() )
-			it->second->GetConsoleHandler().WriteConsoleInput(pkeyEvent);
-	}
-}
-
-/////////////////////////////////////////////////////////////////////////////
-
-/////////////////////////////////////////////////////////////////////////////
-
-void TabView::SendTextToConsoles(const wchar_t* pszText)
-{
-	MutexLock	viewMapLock(m_viewsMutex);
-	for (ConsoleViewMap::iterator it = m_views.begin(); it != m_views.end(); ++it)
-	{
-		if( it->second->IsGrouped() )
-			it->second->GetConsoleHandler().SendTextToConsole(pszText);
+			groupedViews.push_back(it->second);
 	}
 }
 
@@ -73,9 +73,8 @@ public:
   void ResizeView(WORD wID);
   void SetActiveConsole(HWND hwnd);
 
-  void PostMessageToConsoles(UINT Msg, WPARAM wParam, LPARAM lParam);
-  void WriteConsoleInputToConsoles(KEY_EVENT_RECORD* pkeyEvent);
-  void SendTextToConsoles(const wchar_t* pszText);
+  // adds grouped views to groupedViews
+  void GetGroupedConsoles(vector<std::shared_ptr<ConsoleView> >& groupedViews);
 
   inline bool IsGrouped() const { return m_boolIsGrouped; }
   void Group(bool b);
@@ -0,0 +1,274 @@
+//////////////////////////////////////////////////////////////////////////////
+// TextRenderer.cpp - console text renderers
+
+#include "stdafx.h"
+#include "TextRenderer.h"
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+GdiTextRenderer::GdiTextRenderer()
+: m_hFont(NULL)
+, m_hFontHigh(NULL)
+, m_hdc(NULL)
+, m_nSelectedFont(-1)
+{
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void GdiTextRenderer::SetFonts(HFONT hFont, HFONT hFontHigh, DWORD /*dwFontZoom*/, int /*nCharWidth*/, int /*nCharHeight*/)
+{
+	m_hFont     = hFont;
+	m_hFontHigh = hFontHigh;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void GdiTextRenderer::Clear()
+{
+	m_hFont     = NULL;
+	m_hFontHigh = NULL;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+bool GdiTextRenderer::BeginDraw(CDC& dc, const CRect& /*rectRow*/)
+{
+	m_hdc           = dc;
+	m_nSelectedFont = -1;
+
+	::SetBkMode(m_hdc, TRANSPARENT);
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void GdiTextRenderer::DrawRun(int nX, int nY, const wchar_t* pChars, const INT* pCharWidths, DWORD dwChars, bool bHigh, COLORREF crColor, const CRect& rectClip)
+{
+	if (m_nSelectedFont != (bHigh ? 1 : 0))
+	{
+		m_nSelectedFont = bHigh ? 1 : 0;
+		::SelectObject(m_hdc, bHigh ? m_hFontHigh : m_hFont);
+	}
+
+	::SetTextColor(m_hdc, crColor);
+	::ExtTextOut(m_hdc, nX, nY, ETO_CLIPPED, &rectClip, pChars, static_cast<UINT>(dwChars), const_cast<INT*>(pCharWidths));
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void GdiTextRenderer::EndDraw()
+{
+	m_hdc = NULL;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+SoftwareTextRenderer::SoftwareTextRenderer()
+: m_hFont(NULL)
+, m_hFontHigh(NULL)
+, m_dcFont(::CreateCompatibleDC(NULL))
+, m_glyphs()
+, m_pixels()
+{
+	m_nAscent[0] = 0;
+	m_nAscent[1] = 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void SoftwareTextRenderer::SetFonts(HFONT hFont, HFONT hFontHigh, DWORD /*dwFontZoom*/, int /*nCharWidth*/, int /*nCharHeight*/)
+{
+	if ((m_hFont == hFont) && (m_hFontHigh == hFontHigh)) return;
+
+	Clear();
+
+	m_hFont     = hFont;
+	m_hFontHigh = hFontHigh;
+
+	// glyphs are placed on the baseline, the same way ExtTextOut does
+	TEXTMETRIC textMetric;
+
+	for (int i = 0; i < 2; ++i)
+	{
+		m_dcFont.SelectFont((i == 0) ? m_hFont : m_hFontHigh);
+		m_nAscent[i] = m_dcFont.GetTextMetrics(&textMetric) ? textMetric.tmAscent : 0;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void SoftwareTextRenderer::Clear()
+{
+	m_glyphs.clear();
+
+	m_hFont     = NULL;
+	m_hFontHigh = NULL;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+bool SoftwareTextRenderer::BeginDraw(CDC& dc, const CRect& /*rectRow*/)
+{
+	if (!PixelKernels::GetPixelBuffer(dc.GetCurrentBitmap(), m_pixels)) return false;
+
+	// backgrounds are painted with GDI, make sure they're in the bits
+	::GdiFlush();
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void SoftwareTextRenderer::DrawRun(int nX, int nY, const wchar_t* pChars, const INT* pCharWidths, DWORD dwChars, bool bHigh, COLORREF crColor, const CRect& rectClip)
+{
+	CRect rectBuffer(0, 0, m_pixels.nWidth, m_pixels.nHeight);
+	CRect rectDraw;
+
+	if (!rectDraw.IntersectRect(&rectClip, &rectBuffer)) return;
+
+	int nBaseline = nY + m_nAscent[bHigh ? 1 : 0];
+
+	for (DWORD i = 0; i < dwChars; ++i)
+	{
+		const Glyph& glyph = GetGlyph(pChars[i], bHigh);
+		int          nPenX = nX;
+
+		nX += pCharWidths[i];
+
+		if (glyph.coverage.empty()) continue;
+
+		int nGlyphLeft  = nPenX + glyph.metrics.gmptGlyphOrigin.x;
+		int nGlyphTop   = nBaseline - glyph.metrics.gmptGlyphOrigin.y;
+		int nGlyphWidth = static_cast<int>(glyph.metrics.gmBlackBoxX);
+
+		int nLeft   = max(nGlyphLeft, rectDraw.left);
+		int nRight  = min(nGlyphLeft + nGlyphWidth, static_cast<int>(rectDraw.right));
+		int nTop    = max(nGlyphTop, rectDraw.top);
+		int nBottom = min(nGlyphTop + static_cast<int>(glyph.metrics.gmBlackBoxY), static_cast<int>(rectDraw.bottom));
+
+		if ((nLeft >= nRight) || (nTop >= nBottom)) continue;
+
+		for (int y = nTop; y < nBottom; ++y)
+		{
+			DWORD*      pPixel    = m_pixels.GetRow(y) + nLeft;
+			const BYTE* pCoverage = &glyph.coverage[(y - nGlyphTop)*nGlyphWidth + (nLeft - nGlyphLeft)];
+
+			for (int x = nLeft; x < nRight; ++x, ++pPixel, ++pCoverage)
+			{
+				if (*pCoverage != 0) PixelKernels::Blend(pPixel, 1, crColor, *pCoverage);
+			}
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void SoftwareTextRenderer::EndDraw()
+{
+	m_pixels = PixelBuffer();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+const SoftwareTextRenderer::Glyph& SoftwareTextRenderer::GetGlyph(wchar_t wch, bool bHigh)
+{
+	DWORD dwKey = static_cast<DWORD>(wch) | (bHigh ? 0x10000 : 0);
+
+	std::map<DWORD, Glyph>::iterator it = m_glyphs.find(dwKey);
+	if (it != m_glyphs.end()) return it->second;
+
+	Glyph& glyph = m_glyphs[dwKey];
+
+	::ZeroMemory(&glyph.metrics, sizeof(GLYPHMETRICS));
+
+	// unscaled outline, 65 levels of gray
+	MAT2 matrix = { {0, 1}, {0, 0}, {0, 0}, {0, 1} };
+
+	m_dcFont.SelectFont(bHigh ? m_hFontHigh : m_hFont);
+
+	DWORD dwSize = ::GetGlyphOutline(m_dcFont, wch, GGO_GRAY8_BITMAP, &glyph.metrics, 0, NULL, &matrix);
+
+	// whitespace has no bitmap
+	if ((dwSize == GDI_ERROR) || (dwSize == 0)) return glyph;
+
+	std::vector<BYTE> bits(dwSize);
+
+	if (::GetGlyphOutline(m_dcFont, wch, GGO_GRAY8_BITMAP, &glyph.metrics, dwSize, &bits[0], &matrix) == GDI_ERROR) return glyph;
+
+	// rows of the outline bitmap are DWORD aligned
+	UINT unWidth  = glyph.metrics.gmBlackBoxX;
+	UINT unHeight = glyph.metrics.gmBlackBoxY;
+	UINT unStride = (unWidth + 3) & ~3;
+
+	if (unStride*unHeight > dwSize) return glyph;
+
+	glyph.coverage.resize(unWidth*unHeight);
+
+	for (UINT y = 0; y < unHeight; ++y)
+	{
+		for (UINT x = 0; x < unWidth; ++x)
+		{
+			glyph.coverage[y*unWidth + x] = static_cast<BYTE>((bits[y*unStride + x]*255 + 32) / 64);
+		}
+	}
+
+	return glyph;
+}
+
+//////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,134 @@
+//////////////////////////////////////////////////////////////////////////////
+// TextRenderer.h - console text renderers
+
+#pragma once
+
+#include "PixelKernels.h"
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Draws the text of console rows into the text layer. The view paints
+// backgrounds and hands each row's runs to the renderer selected in
+// appearance settings (GDI, glyph atlas or Direct2D).
+
+class TextRenderer
+{
+	public:
+		virtual ~TextRenderer() {}
+
+	public:
+
+		// fonts and cell size for the following rows; renderers keep their
+		// caches while these don't change
+		virtual void SetFonts(HFONT hFont, HFONT hFontHigh, DWORD dwFontZoom, int nCharWidth, int nCharHeight) = 0;
+
+		// drops cached font data (fonts might be recreated with the same
+		// handles)
+		virtual void Clear() = 0;
+
+		// starts drawing a row, returns false if the renderer can't draw
+		// into this DC (the view falls back to GDI then)
+		virtual bool BeginDraw(CDC& dc, const CRect& rectRow) = 0;
+
+		// draws a run of chars starting at nX, nY with the given advances
+		virtual void DrawRun(int nX, int nY, const wchar_t* pChars, const INT* pCharWidths, DWORD dwChars, bool bHigh, COLORREF crColor, const CRect& rectClip) = 0;
+
+		virtual void EndDraw() = 0;
+};
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Plain ExtTextOut
+
+class GdiTextRenderer : public TextRenderer
+{
+	public:
+		GdiTextRenderer();
+
+	public:
+
+		void SetFonts(HFONT hFont, HFONT hFontHigh, DWORD dwFontZoom, int nCharWidth, int nCharHeight);
+		void Clear();
+
+		bool BeginDraw(CDC& dc, const CRect& rectRow);
+		void DrawRun(int nX, int nY, const wchar_t* pChars, const INT* pCharWidths, DWORD dwChars, bool bHigh, COLORREF crColor, const CRect& rectClip);
+		void EndDraw();
+
+	private:
+
+		HFONT	m_hFont;
+		HFONT	m_hFontHigh;
+
+		HDC		m_hdc;
+		int		m_nSelectedFont;
+};
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Reference renderer: grayscale glyph coverage from GetGlyphOutline,
+// blended into the bitmap bits in plain C++. It doesn't depend on GDI text
+// output, ClearType or Direct2D, so the other renderers can be compared
+// against it.
+
+class SoftwareTextRenderer : public TextRenderer
+{
+	public:
+		SoftwareTextRenderer();
+
+	public:
+
+		void SetFonts(HFONT hFont, HFONT hFontHigh, DWORD dwFontZoom, int nCharWidth, int nCharHeight);
+		void Clear();
+
+		// returns false if the DC's bitmap isn't a 32-bit DIB section
+		bool BeginDraw(CDC& dc, const CRect& rectRow);
+		void DrawRun(int nX, int nY, const wchar_t* pChars, const INT* pCharWidths, DWORD dwChars, bool bHigh, COLORREF crColor, const CRect& rectClip);
+		void EndDraw();
+
+	private:
+
+		struct Glyph
+		{
+			GLYPHMETRICS		metrics;
+			// 0-255 coverage, metrics.gmBlackBoxX wide
+			std::vector<BYTE>	coverage;
+		};
+
+		const Glyph& GetGlyph(wchar_t wch, bool bHigh);
+
+	private:
+
+		HFONT	m_hFont;
+		HFONT	m_hFontHigh;
+		int		m_nAscent[2];
+		CDC		m_dcFont;
+
+		// glyphs by char and variant
+		std::map<DWORD, Glyph>	m_glyphs;
+
+		// bitmap we're drawing into
+		PixelBuffer				m_pixels;
+};
+
+//////////////////////////////////////////////////////////////////////////////
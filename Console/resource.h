@@ -309,6 +309,7 @@
 #define IDS_ERR_CREATE_SHARED_OBJECTS_FAILED 5004
 #define IDS_ERR_CANT_START_SHELL_AS_ADMIN 5005
 #define IDS_ERR_CANT_GET_ELEVATION_TYPE 5006
+#define IDS_PASTE_PROGRESS              5007
 #define MSG_SETTINGS_INVALID_BUFFER_ROWS 10000
 #define MSG_SETTINGS_INVALID_BUFFER_COLUMNS 10001
 #define MSG_SETTINGS_INVALID_ROWS       10002
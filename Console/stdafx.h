@@ -93,8 +93,11 @@ extern CAppModule _Module;
 #include <sstream>
 #include <string>
 #include <map>
+#include <set>
 #include <vector>
+#include <deque>
 #include <stack>
+#include <algorithm>
 using namespace std;
 #pragma warning(pop)
 
@@ -122,8 +125,11 @@ using namespace boost::multi_index;
 #include "../shared/Win32Exception.h"
 #include "../shared/NamedPipe.h"
 #include "Helpers.h"
+#include "RowFlags.h"
+#include "MessageRing.h"
 #include "ConsoleHandler.h"
 #include "ImageHandler.h"
+#include "PaletteCache.h"
 #include "SettingsHandler.h"
 
 //////////////////////////////////////////////////////////////////////////////
@@ -161,9 +167,13 @@ using namespace boost::multi_index;
 #define UM_SHOW_POPUP_MENU		WM_USER + 0x1004
 #define UM_START_MOUSE_DRAG		WM_USER + 0x1005
 #define UM_TRAY_NOTIFY			WM_USER + 0x1006
+#define UM_SCHEDULE_VIEW_UPDATE	WM_USER + 0x1007
+#define UM_IMAGE_READY			WM_USER + 0x1008
 
 #define UPDATE_CONSOLE_RESIZE		0x0001
 #define UPDATE_CONSOLE_TEXT_CHANGED	0x0002
+// view update is scheduled with the main frame
+#define UPDATE_CONSOLE_PENDING		0x0004
 
 #define IDC_TRAY_ICON		0x0001
 
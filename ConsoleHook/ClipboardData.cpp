@@ -0,0 +1,65 @@
+//////////////////////////////////////////////////////////////////////////////
+// ClipboardData.cpp - clipboard formats built from copied console rows
+
+#include "stdafx.h"
+#include "ClipboardData.h"
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+const char* const ClipboardDataRtf::s_arrAsciiEscapes[0x80] =
+{
+  NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+  NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+  NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+  NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+  NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+  NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, "\\\\", NULL, NULL, NULL,
+  NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+  NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, "\\{",  NULL, "\\}",  NULL, NULL,
+};
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void AddCopyRow(const CHAR_INFO* pRow, SHORT sLeft, SHORT sRight, std::unique_ptr<ClipboardData> clipboardDataPtr[], size_t clipboardDataCount)
+{
+	SHORT x = sLeft;
+
+	while (x <= sRight)
+	{
+		if (pRow[x].Attributes & COMMON_LVB_TRAILING_BYTE)
+		{
+			++x;
+			continue;
+		}
+
+		SHORT sRunStart = x;
+		WORD  wColors   = pRow[x].Attributes & 0x00ff;
+
+		for (++x; x <= sRight; ++x)
+		{
+			if (pRow[x].Attributes & COMMON_LVB_TRAILING_BYTE) break;
+			if ((pRow[x].Attributes & 0x00ff) != wColors) break;
+		}
+
+		for(size_t clipboardDataIndex = 0; clipboardDataIndex < clipboardDataCount; clipboardDataIndex ++)
+			clipboardDataPtr[clipboardDataIndex]->AddRun(pRow + sRunStart, x - sRunStart);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////
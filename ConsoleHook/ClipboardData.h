@@ -0,0 +1,617 @@
+//////////////////////////////////////////////////////////////////////////////
+// ClipboardData.h - clipboard formats built from copied console rows
+
+#pragma once
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Each builder gets the same rows (in runs of chars with the same colors)
+// and publishes one clipboard format
+
+class ClipboardData
+{
+public:
+  ClipboardData(void) {}
+  virtual ~ClipboardData(void) {}
+  // called once before the first row with the selection size
+  virtual void Reserve(size_t /*sizeChars*/, size_t /*sizeRows*/) {}
+  virtual void StartRow(void) = 0;
+  virtual void EndRow(void) = 0;
+  virtual void AddChar(const CHAR_INFO*) = 0;
+  // chars with the same colors (and no trailing bytes)
+  virtual void AddRun(const CHAR_INFO* p, size_t count)
+  {
+    for(size_t i = 0; i < count; ++i) AddChar(p + i);
+  }
+  virtual bool IsEOL(DWORD dwEOLSpaces) = 0;
+  virtual size_t GetRowLength(void) = 0;
+  virtual void TrimRight(void) = 0;
+  virtual void Wrap(CopyNewlineChar) = 0;
+  virtual void Publish(void) = 0;
+
+  class Global
+  {
+  public:
+    Global(const void* p, size_t size)
+    {
+      hText = ::GlobalAlloc(GMEM_MOVEABLE, size);
+      if( hText )
+      {
+        LPVOID lpTextLock = ::GlobalLock(hText);
+        if ( lpTextLock )
+        {
+          ::CopyMemory(lpTextLock, p, size);
+          ::GlobalUnlock(hText);
+        }
+      }
+    }
+    ~Global(void)
+    {
+      if( hText )
+      {
+        // we need to global-free data only if copying failed
+        ::GlobalFree(hText);
+      }
+    }
+    HGLOBAL release(void)
+    {
+      HGLOBAL h = hText;
+      hText = NULL;
+      return h;
+    }
+    HGLOBAL get(void) const
+    {
+      return hText;
+    }
+  private:
+    HGLOBAL hText;
+  };
+};
+
+class ClipboardDataUnicode : public ClipboardData
+{
+public:
+  ClipboardDataUnicode(void):strText(L"") {}
+  virtual ~ClipboardDataUnicode(void) {}
+  virtual void Reserve(size_t sizeChars, size_t sizeRows)
+  {
+    strText.reserve(sizeChars + sizeRows * 2 + 1);
+  }
+  virtual void StartRow(void)
+  {
+    strRow = L"";
+  }
+  virtual void EndRow(void)
+  {
+    strText += strRow;
+  }
+  virtual void AddChar(const CHAR_INFO* p)
+  {
+    strRow += p->Char.UnicodeChar;
+  }
+  virtual bool IsEOL(DWORD dwEOLSpaces)
+  {
+		size_t len = strRow.length();
+		if( len < dwEOLSpaces ) return false;
+
+		for(size_t i = (len - dwEOLSpaces); i < len; ++i)
+			if( strRow[i] != L' ' )
+				return false;
+
+		return true;
+  }
+  size_t GetRowLength(void)
+  {
+    return strRow.length();
+  }
+  virtual void TrimRight(void)
+  {
+    boost::trim_right(strRow);
+  }
+  virtual void Wrap(CopyNewlineChar copyNewlineChar)
+  {
+    switch(copyNewlineChar)
+    {
+      case newlineCRLF: strRow += wstring(L"\r\n"); break;
+      case newlineLF:   strRow += wstring(L"\n");   break;
+      default:          strRow += wstring(L"\r\n"); break;
+    }
+  }
+  virtual void Publish(void)
+  {
+    ClipboardData::Global global(strText.c_str(), (strText.length()+1)*sizeof(wchar_t));
+
+    if( !global.get() ) return;
+
+    if( ::SetClipboardData(CF_UNICODETEXT, global.get()) )
+    {
+      global.release();
+    }
+  }
+
+private:
+  wstring strText;
+  wstring strRow;
+};
+
+class ClipboardDataRtf : public ClipboardData
+{
+public:
+  ClipboardDataRtf(ConsoleCopy* pconsoleCopy):sizeRtfLen(0)
+  {
+    strRtf = "{\\rtf\\ansi\\deff0";
+
+    strRtf += "{\\fonttbl{\\f0\\fnil ";
+    strRtf += pconsoleCopy->szFontName;
+    strRtf += ";}}";
+
+    strRtf += "{\\colortbl\n";
+    for(int i = 0; i < 16; i ++)
+    {
+      char szColor[64];
+      _snprintf_s(
+        szColor, sizeof(szColor),
+        _TRUNCATE,
+        "\\red%lu\\green%lu\\blue%lu;\n",
+        GetRValue(pconsoleCopy->consoleColors[i]),
+        GetGValue(pconsoleCopy->consoleColors[i]),
+        GetBValue(pconsoleCopy->consoleColors[i]));
+      strRtf += szColor;
+
+      // color switches are looked up per char
+      _snprintf_s(szColor, sizeof(szColor), _TRUNCATE, "\\cf%d ", i);
+      strForegroundRtf[i] = szColor;
+      _snprintf_s(szColor, sizeof(szColor), _TRUNCATE, "\\highlight%d ", i);
+      strBackgroundRtf[i] = szColor;
+    }
+    strRtf += "}";
+
+    char szFont[64];
+    _snprintf_s(
+      szFont, sizeof(szFont),
+      _TRUNCATE,
+      "\\f0\\fs%lu%s%s\n",
+      pconsoleCopy->dwSize,
+      pconsoleCopy->bBold ? "\\b" : "",
+      pconsoleCopy->bItalic ? "\\i" : "");
+
+    strRtf += szFont;
+  }
+  virtual ~ClipboardDataRtf(void) {}
+  virtual void Reserve(size_t sizeChars, size_t sizeRows)
+  {
+    // plain ASCII, a few color switches and a \line per row
+    strRtf.reserve(strRtf.length() + sizeChars + sizeChars / 4 + sizeRows * 8 + 2);
+  }
+  virtual void StartRow(void)
+  {
+    strRowRtf.clear();
+    sizeRowLen = 0;
+  }
+  virtual void EndRow(void)
+  {
+    strRtf += strRowRtf;
+    strRtf += strTrimRowRtf;
+    strTrimRowRtf.clear();
+  }
+  virtual void AddChar(const CHAR_INFO* p)
+  {
+    WORD wCharForegroundAttributes = p->Attributes & 0x000f;
+    WORD wCharBackgroundAttributes = (p->Attributes >> 4) & 0x000f;
+    if( sizeRtfLen == 0 )
+    {
+      wLastCharForegroundAttributes = ~wCharForegroundAttributes;
+      wLastCharBackgroundAttributes = ~wCharBackgroundAttributes;
+    }
+
+    WCHAR wc   = p->Char.UnicodeChar;
+    bool  trim = IsSpace(wc);
+
+    std::string& strRowRtfRef = (trim)?strTrimRowRtf:strRowRtf;
+    if( trim )
+    {
+      if( strTrimRowRtf.empty() )
+      {
+        wLastTrimCharForegroundAttributes = wLastCharForegroundAttributes;
+        wLastTrimCharBackgroundAttributes = wLastCharBackgroundAttributes;
+      }
+    }
+    else if( !strTrimRowRtf.empty() )
+    {
+      strRowRtf += strTrimRowRtf;
+      strTrimRowRtf.clear();
+    }
+
+    if( wLastCharBackgroundAttributes != wCharBackgroundAttributes )
+      strRowRtfRef += strBackgroundRtf[wCharBackgroundAttributes];
+    if( wLastCharForegroundAttributes != wCharForegroundAttributes )
+      strRowRtfRef += strForegroundRtf[wCharForegroundAttributes];
+
+    wLastCharForegroundAttributes = wCharForegroundAttributes;
+    wLastCharBackgroundAttributes = wCharBackgroundAttributes;
+
+    if( wc <= 0x7f )
+    {
+      const char* pszEscape = s_arrAsciiEscapes[wc];
+
+      if( pszEscape )
+        strRowRtfRef += pszEscape;
+      else
+        strRowRtfRef += static_cast<char>(wc);
+    }
+    else
+    {
+      // \uN? (N is the char code in decimal)
+      char  szCode[8];
+      char* pszCode = szCode + sizeof(szCode);
+
+      for(unsigned int n = wc; n > 0; n /= 10)
+        *--pszCode = static_cast<char>('0' + n % 10);
+
+      strRowRtfRef += "\\u";
+      strRowRtfRef.append(pszCode, szCode + sizeof(szCode));
+      strRowRtfRef += '?';
+    }
+    sizeRowLen ++;
+    sizeRtfLen ++;
+  }
+  virtual bool IsEOL(DWORD /*dwEOLSpaces*/)
+  {
+    return !strTrimRowRtf.empty();
+  }
+  size_t GetRowLength(void)
+  {
+    return sizeRowLen;
+  }
+  virtual void TrimRight(void)
+  {
+    if( !strTrimRowRtf.empty() )
+    {
+      strTrimRowRtf.clear();
+      wLastCharForegroundAttributes = wLastTrimCharForegroundAttributes;
+      wLastCharBackgroundAttributes = wLastTrimCharBackgroundAttributes;
+    }
+  }
+  virtual void Wrap(CopyNewlineChar /*copyNewlineChar*/)
+  {
+    strTrimRowRtf += "\\line\n";
+  }
+  virtual void Publish(void)
+  {
+    strRtf += "}";
+
+    ClipboardData::Global global(strRtf.c_str(), strRtf.length() + 1);
+
+    if( !global.get() ) return;
+
+    if( ::SetClipboardData(::RegisterClipboardFormat(L"Rich Text Format"), global.get()) )
+    {
+      global.release();
+    }
+  }
+
+private:
+  static bool IsSpace(WCHAR wc)
+  {
+    // ASCII spaces are the common case, the rest are left to the CRT
+    if( wc <= 0x7f ) return (wc == L' ') || ((wc >= L'\t') && (wc <= L'\r'));
+    return ::iswspace(wc) != 0;
+  }
+
+  // RTF escapes of ASCII chars, NULL if the char goes as is
+  static const char* const s_arrAsciiEscapes[0x80];
+
+  string strRtf;
+  string strRowRtf;
+  string strTrimRowRtf;
+  string strForegroundRtf[16];
+  string strBackgroundRtf[16];
+  size_t sizeRtfLen;
+  size_t sizeRowLen;
+  WORD   wLastCharForegroundAttributes;
+  WORD   wLastCharBackgroundAttributes;
+  WORD   wLastTrimCharForegroundAttributes;
+  WORD   wLastTrimCharBackgroundAttributes;
+};
+
+// rows are kept as text and color spans, formats that only change at color
+// boundaries emit whole spans
+class ClipboardDataSpans : public ClipboardData
+{
+public:
+  ClipboardDataSpans(void):bWrapRow(false), copyNewlineChar(newlineCRLF) {}
+  virtual ~ClipboardDataSpans(void) {}
+  virtual void StartRow(void)
+  {
+    strRow.clear();
+    spans.clear();
+    bWrapRow = false;
+  }
+  virtual void EndRow(void)
+  {
+    for(size_t i = 0; i < spans.size(); ++i)
+    {
+      size_t sizeEnd = (i + 1 < spans.size()) ? spans[i + 1].sizeStart : strRow.length();
+      EmitSpan(spans[i].wAttributes, strRow.c_str() + spans[i].sizeStart, sizeEnd - spans[i].sizeStart);
+    }
+
+    if( bWrapRow ) EmitNewline(copyNewlineChar);
+  }
+  virtual void AddChar(const CHAR_INFO* p)
+  {
+    AddRun(p, 1);
+  }
+  virtual void AddRun(const CHAR_INFO* p, size_t count)
+  {
+    WORD wAttributes = p->Attributes & 0x00ff;
+
+    if( spans.empty() || (spans.back().wAttributes != wAttributes) )
+    {
+      Span span = { wAttributes, strRow.length() };
+      spans.push_back(span);
+    }
+
+    for(size_t i = 0; i < count; ++i)
+      strRow += p[i].Char.UnicodeChar;
+  }
+  virtual bool IsEOL(DWORD dwEOLSpaces)
+  {
+    size_t len = strRow.length();
+    if( len < dwEOLSpaces ) return false;
+
+    for(size_t i = (len - dwEOLSpaces); i < len; ++i)
+      if( strRow[i] != L' ' )
+        return false;
+
+    return true;
+  }
+  size_t GetRowLength(void)
+  {
+    return strRow.length();
+  }
+  virtual void TrimRight(void)
+  {
+    boost::trim_right(strRow);
+
+    while( !spans.empty() && (spans.back().sizeStart >= strRow.length()) )
+      spans.pop_back();
+  }
+  virtual void Wrap(CopyNewlineChar newlineChar)
+  {
+    bWrapRow        = true;
+    copyNewlineChar = newlineChar;
+  }
+
+protected:
+  virtual void EmitSpan(WORD wAttributes, const wchar_t* pszText, size_t textLen) = 0;
+  virtual void EmitNewline(CopyNewlineChar newlineChar) = 0;
+
+private:
+  struct Span
+  {
+    WORD   wAttributes;
+    size_t sizeStart;
+  };
+
+  wstring         strRow;
+  vector<Span>    spans;
+  bool            bWrapRow;
+  CopyNewlineChar copyNewlineChar;
+};
+
+class ClipboardDataHtml : public ClipboardDataSpans
+{
+public:
+  ClipboardDataHtml(ConsoleCopy* pconsoleCopy)
+  {
+    for(int i = 0; i < 16; i ++)
+    {
+      wchar_t szColor[16];
+      _snwprintf_s(
+        szColor, ARRAYSIZE(szColor),
+        _TRUNCATE,
+        L"#%02x%02x%02x",
+        GetRValue(pconsoleCopy->consoleColors[i]),
+        GetGValue(pconsoleCopy->consoleColors[i]),
+        GetBValue(pconsoleCopy->consoleColors[i]));
+      strColors[i] = szColor;
+    }
+
+    wchar_t szFontName[256];
+    if( ::MultiByteToWideChar(CP_ACP, 0, pconsoleCopy->szFontName, -1, szFontName, ARRAYSIZE(szFontName)) == 0 )
+      szFontName[0] = 0;
+
+    strHtml  = L"<pre style=\"font-family:'";
+    AppendEscaped(szFontName, wcslen(szFontName));
+
+    wchar_t szFont[64];
+    _snwprintf_s(
+      szFont, ARRAYSIZE(szFont),
+      _TRUNCATE,
+      L"',monospace;font-size:%lupt%s%s\">",
+      pconsoleCopy->dwSize / 2,
+      pconsoleCopy->bBold ? L";font-weight:bold" : L"",
+      pconsoleCopy->bItalic ? L";font-style:italic" : L"");
+
+    strHtml += szFont;
+  }
+  virtual ~ClipboardDataHtml(void) {}
+  virtual void Reserve(size_t sizeChars, size_t sizeRows)
+  {
+    strHtml.reserve(strHtml.length() + sizeChars + sizeRows * 80 + 16);
+  }
+  virtual void Publish(void)
+  {
+    strHtml += L"</pre>";
+
+    // CF_HTML is UTF-8 with a header of byte offsets
+    int nFragmentLen = ::WideCharToMultiByte(CP_UTF8, 0, strHtml.c_str(), static_cast<int>(strHtml.length()), NULL, 0, NULL, NULL);
+    if( (nFragmentLen == 0) && !strHtml.empty() ) return;
+
+    const char szHeaderFormat[] = "Version:0.9\r\nStartHTML:%010lu\r\nEndHTML:%010lu\r\nStartFragment:%010lu\r\nEndFragment:%010lu\r\n";
+    const char szPrefix[]       = "<html>\r\n<body>\r\n<!--StartFragment-->";
+    const char szSuffix[]       = "<!--EndFragment-->\r\n</body>\r\n</html>";
+
+    char  szHeader[128];
+    DWORD dwStartHtml     = static_cast<DWORD>(_snprintf_s(szHeader, sizeof(szHeader), _TRUNCATE, szHeaderFormat, 0UL, 0UL, 0UL, 0UL));
+    DWORD dwStartFragment = dwStartHtml + static_cast<DWORD>(sizeof(szPrefix) - 1);
+    DWORD dwEndFragment   = dwStartFragment + static_cast<DWORD>(nFragmentLen);
+    DWORD dwEndHtml       = dwEndFragment + static_cast<DWORD>(sizeof(szSuffix) - 1);
+
+    _snprintf_s(szHeader, sizeof(szHeader), _TRUNCATE, szHeaderFormat, dwStartHtml, dwEndHtml, dwStartFragment, dwEndFragment);
+
+    string strClipboard(dwEndHtml, '\0');
+
+    ::CopyMemory(&strClipboard[0], szHeader, dwStartHtml);
+    ::CopyMemory(&strClipboard[dwStartHtml], szPrefix, sizeof(szPrefix) - 1);
+    if( nFragmentLen > 0 )
+      ::WideCharToMultiByte(CP_UTF8, 0, strHtml.c_str(), static_cast<int>(strHtml.length()), &strClipboard[dwStartFragment], nFragmentLen, NULL, NULL);
+    ::CopyMemory(&strClipboard[dwEndFragment], szSuffix, sizeof(szSuffix) - 1);
+
+    ClipboardData::Global global(strClipboard.c_str(), strClipboard.length() + 1);
+
+    if( !global.get() ) return;
+
+    if( ::SetClipboardData(::RegisterClipboardFormat(L"HTML Format"), global.get()) )
+    {
+      global.release();
+    }
+  }
+
+protected:
+  virtual void EmitSpan(WORD wAttributes, const wchar_t* pszText, size_t textLen)
+  {
+    strHtml += L"<span style=\"color:";
+    strHtml += strColors[wAttributes & 0x000f];
+    strHtml += L";background-color:";
+    strHtml += strColors[(wAttributes >> 4) & 0x000f];
+    strHtml += L"\">";
+    AppendEscaped(pszText, textLen);
+    strHtml += L"</span>";
+  }
+  virtual void EmitNewline(CopyNewlineChar /*newlineChar*/)
+  {
+    strHtml += L"\r\n";
+  }
+
+private:
+  void AppendEscaped(const wchar_t* pszText, size_t textLen)
+  {
+    for(size_t i = 0; i < textLen; ++i)
+    {
+      switch( pszText[i] )
+      {
+        case L'&': strHtml += L"&amp;";  break;
+        case L'<': strHtml += L"&lt;";   break;
+        case L'>': strHtml += L"&gt;";   break;
+        case L'"': strHtml += L"&quot;"; break;
+        default:   strHtml += pszText[i]; break;
+      }
+    }
+  }
+
+  wstring strHtml;
+  wstring strColors[16];
+};
+
+class ClipboardDataAnsi : public ClipboardDataSpans
+{
+public:
+  // the default background isn't written out, so pasted text keeps the
+  // background of the terminal it's pasted into
+  ClipboardDataAnsi(WORD wDefaultAttributes):wDefaultBackground((wDefaultAttributes >> 4) & 0x000f), wLastAttributes(NO_ATTRIBUTES) {}
+  virtual ~ClipboardDataAnsi(void) {}
+  virtual void Reserve(size_t sizeChars, size_t sizeRows)
+  {
+    strText.reserve(sizeChars + sizeRows * 16 + 8);
+  }
+  const wstring& GetText(void) const
+  {
+    return strText;
+  }
+  virtual void Publish(void)
+  {
+    if( wLastAttributes != NO_ATTRIBUTES ) strText += L"\x1b[0m";
+
+    ClipboardData::Global global(strText.c_str(), (strText.length()+1)*sizeof(wchar_t));
+
+    if( !global.get() ) return;
+
+    if( ::SetClipboardData(::RegisterClipboardFormat(L"ANSI Colored Text"), global.get()) )
+    {
+      global.release();
+    }
+  }
+
+protected:
+  virtual void EmitSpan(WORD wAttributes, const wchar_t* pszText, size_t textLen)
+  {
+    if( wAttributes != wLastAttributes )
+    {
+      // console colors are IRGB, ANSI colors are BGR (plus bright variants)
+      static const int arrAnsiColors[8] = { 0, 4, 2, 6, 1, 5, 3, 7 };
+
+      WORD wForeground = wAttributes & 0x000f;
+      WORD wBackground = (wAttributes >> 4) & 0x000f;
+
+      wchar_t szSgr[32];
+      if( wBackground == wDefaultBackground )
+        _snwprintf_s(
+          szSgr, ARRAYSIZE(szSgr),
+          _TRUNCATE,
+          L"\x1b[0;%dm",
+          ((wForeground & 0x8) ? 90 : 30) + arrAnsiColors[wForeground & 0x7]);
+      else
+        _snwprintf_s(
+          szSgr, ARRAYSIZE(szSgr),
+          _TRUNCATE,
+          L"\x1b[0;%d;%dm",
+          ((wForeground & 0x8) ? 90 : 30) + arrAnsiColors[wForeground & 0x7],
+          ((wBackground & 0x8) ? 100 : 40) + arrAnsiColors[wBackground & 0x7]);
+
+      strText += szSgr;
+      wLastAttributes = wAttributes;
+    }
+
+    strText.append(pszText, textLen);
+  }
+  virtual void EmitNewline(CopyNewlineChar newlineChar)
+  {
+    // rows don't carry colors over, backgrounds would bleed into the next one
+    if( wLastAttributes != NO_ATTRIBUTES )
+    {
+      strText += L"\x1b[0m";
+      wLastAttributes = NO_ATTRIBUTES;
+    }
+
+    strText += (newlineChar == newlineLF) ? L"\n" : L"\r\n";
+  }
+
+private:
+  static const WORD NO_ATTRIBUTES = 0xffff;
+
+  wstring strText;
+  WORD    wDefaultBackground;
+  WORD    wLastAttributes;
+};
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+// adds the chars of a copied row in runs of the same colors
+void AddCopyRow(const CHAR_INFO* pRow, SHORT sLeft, SHORT sRight, std::unique_ptr<ClipboardData> clipboardDataPtr[], size_t clipboardDataCount);
+
+//////////////////////////////////////////////////////////////////////////////
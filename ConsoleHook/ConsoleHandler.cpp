@@ -3,6 +3,7 @@ using namespace std;
 
 #include "../shared/SharedMemNames.h"
 #include "ConsoleHandler.h"
+#include "ClipboardData.h"
 
 //////////////////////////////////////////////////////////////////////////////
 
@@ -11,6 +12,7 @@ using namespace std;
 //////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////
 
+ConsoleHandler* ConsoleHandler::s_pWinEventHandler = NULL;
 
 //////////////////////////////////////////////////////////////////////////////
 
@@ -18,15 +20,57 @@ ConsoleHandler::ConsoleHandler()
 : m_consoleParams()
 , m_consoleInfo()
 , m_cursorInfo()
-, m_consoleBuffer()
+, m_consoleScreen()
+, m_consoleHistory()
 , m_consoleCopyInfo()
 , m_consoleMouseEvent()
 , m_newConsoleSize()
 , m_newScrollPos()
 , m_hMonitorThread()
 , m_hMonitorThreadExit(std::shared_ptr<void>(::CreateEvent(NULL, FALSE, FALSE, NULL), ::CloseHandle))
+, m_dwScreenVersion(0)
 , m_dwScreenBufferSize(0)
+, m_dwFrame(0)
+, m_dwTextFrame(0)
+, m_lScrollOffset(0)
+, m_lastConsoleInfo()
+, m_lastCursorInfo()
+, m_bScreenTooSmall(false)
+, m_captureBuffer()
+, m_dwCaptureBufferSize(0)
+, m_dwMaxReadCells(INITIAL_READ_CELLS)
+, m_bCaptureValid(false)
+, m_dwLastFullCapture(0)
+, m_srCaptureWindow()
+, m_coordCaptureBufferSize()
+, m_coordCaptureCursor()
+, m_rowHashes()
+, m_rowFrames()
+, m_newRowHashes()
+, m_coordHistorySize()
+, m_sHistoryStaleTop(0)
+, m_sHistoryStaleRows(0)
+, m_historyBuffer()
+, m_bWinEvents(false)
+, m_bDirty(false)
+, m_bDirtyAll(false)
+, m_sDirtyTop(0)
+, m_sDirtyBottom(-1)
+, m_lLastCaret(-1)
+, m_pipeBuffer(new BYTE[NAMED_PIPE_BUFFER_SIZE])
+, m_pipeBufferLen(0)
+, m_pipeText()
+, m_dwPipeTextLen(0)
+, m_pipeTextRead(0)
+, m_inputRecords()
+, m_strPendingText()
+, m_pendingTextPos(0)
+, m_textRecords()
+, m_heldInput()
+, m_hklVirtualKeys(NULL)
+, m_virtualKeys(new BYTE[0x10000])
 {
+	::ZeroMemory(m_virtualKeys.get(), 0x10000);
 }
 
 ConsoleHandler::~ConsoleHandler()
@@ -97,9 +141,6 @@ bool ConsoleHandler::OpenSharedObjects()
     // open console info shared memory object
     m_cursorInfo.Open((SharedMemNames::formatCursorInfo % dwProcessId).str(), syncObjRequest);
 
-    // open console buffer shared memory object
-    m_consoleBuffer.Open((SharedMemNames::formatBuffer % dwProcessId).str(), syncObjRequest);
-
     // copy info
     m_consoleCopyInfo.Open((SharedMemNames::formatCopyInfo % dwProcessId).str(), syncObjBoth);
 
@@ -127,6 +168,66 @@ bool ConsoleHandler::OpenSharedObjects()
 //////////////////////////////////////////////////////////////////////////////
 
 
+//////////////////////////////////////////////////////////////////////////////
+
+bool ConsoleHandler::OpenConsoleScreen(DWORD dwVersion)
+{
+  // console screen is created by Console after startup params handshake,
+  // and recreated (with a new version) when we ask for bigger frames
+  SharedMemory<ConsoleScreen> consoleScreen;
+
+  try
+  {
+    consoleScreen.Open((SharedMemNames::formatBuffer % ::GetCurrentProcessId() % dwVersion).str(), syncObjRequest);
+  }
+  catch(Win32Exception& ex)
+  {
+    fprintf(stderr, "/!\\ ConsoleZ: can't open console screen (reason: %s)\n", ex.what());
+    return false;
+  }
+
+  m_consoleScreen   = consoleScreen;
+  m_dwScreenVersion = dwVersion;
+
+  // republish the whole screen
+  m_dwScreenBufferSize = 0;
+  m_rowHashes.clear();
+
+  return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void ConsoleHandler::OpenConsoleHistory()
+{
+  // history is optional, Console doesn't create it for consoles without
+  // scrollback (and scrolls through us without it)
+  SharedMemory<ConsoleHistory> consoleHistory;
+
+  try
+  {
+    consoleHistory.Open((SharedMemNames::formatHistory % ::GetCurrentProcessId()).str(), syncObjNone);
+  }
+  catch(Win32Exception& ex)
+  {
+    TRACE(L"Can't open console history (reason: %S)\n", ex.what());
+    return;
+  }
+
+  m_consoleHistory = consoleHistory;
+  m_historyBuffer.reset(new CHAR_INFO[HISTORY_REFRESH_CELLS]);
+
+  // mirror everything on the first capture
+  m_coordHistorySize.X = 0;
+  m_coordHistorySize.Y = 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
 //////////////////////////////////////////////////////////////////////////////
 
 void ConsoleHandler::ReadConsoleBuffer()
@@ -170,98 +271,656 @@ void ConsoleHandler::ReadConsoleBuffer()
 	*/
 
 	// do console output buffer reading
-	DWORD					dwScreenBufferSize	= coordConsoleSize.X * coordConsoleSize.Y;
-	DWORD					dwScreenBufferOffset= 0;
+	DWORD	dwScreenBufferSize	= coordConsoleSize.X * coordConsoleSize.Y;
+	DWORD	dwTickCount			= ::GetTickCount();
 
-	std::unique_ptr<CHAR_INFO[]> pScreenBuffer(new CHAR_INFO[dwScreenBufferSize]);
+	// capture buffer is kept between calls, it's only reallocated when the
+	// console window grows
+	if (m_dwCaptureBufferSize < dwScreenBufferSize)
+	{
+		m_captureBuffer.reset(new CHAR_INFO[dwScreenBufferSize]);
+		m_dwCaptureBufferSize	= dwScreenBufferSize;
+		m_bCaptureValid			= false;
+	}
 
-	COORD		coordBufferSize;
+	// between periodic full captures, if the console window hasn't moved,
+	// we only read the rows that could have changed: the rows the cursor
+	// has moved over since the last capture, and the top row (if it changed,
+	// the window contents have scrolled and we need a full capture)
+	//
+	// with console WinEvents hooked we know which rows have changed, there
+	// are no periodic full captures and we don't need the top row check
+	bool	bFullCapture		=
+		!m_bCaptureValid ||
+		(m_bWinEvents ? m_bDirtyAll : (dwTickCount - m_dwLastFullCapture >= FULL_CAPTURE_INTERVAL)) ||
+		(::memcmp(&m_srCaptureWindow, &csbiConsole.srWindow, sizeof(SMALL_RECT)) != 0) ||
+		(m_coordCaptureBufferSize.X != csbiConsole.dwSize.X) ||
+		(m_coordCaptureBufferSize.Y != csbiConsole.dwSize.Y);
+
+	SHORT	sFirstRow			= 0;
+	SHORT	sLastRow			= coordConsoleSize.Y - 1;
+	bool	bTopRowRead			= true;
+	SHORT	sLastWindowTop		= m_srCaptureWindow.Top;
+
+	m_bCaptureValid = false;
+
+	if (!bFullCapture && !m_bWinEvents)
+	{
+		unsigned __int64 topRowHash = HashRow(m_captureBuffer.get(), coordConsoleSize.X);
+
+		if (!ReadWindowRows(hStdOut.get(), csbiConsole.srWindow, 0, 1)) return;
+
+		if (HashRow(m_captureBuffer.get(), coordConsoleSize.X) != topRowHash) bFullCapture = true;
+	}
+
+	if (!bFullCapture)
+	{
+		sFirstRow	= min(m_coordCaptureCursor.Y, csbiConsole.dwCursorPosition.Y);
+		sLastRow	= max(m_coordCaptureCursor.Y, csbiConsole.dwCursorPosition.Y);
+
+		if (m_bWinEvents)
+		{
+			if (m_sDirtyTop <= m_sDirtyBottom)
+			{
+				sFirstRow	= min(sFirstRow, m_sDirtyTop);
+				sLastRow	= max(sLastRow, m_sDirtyBottom);
+			}
+
+			bTopRowRead	= false;
+		}
+
+		sFirstRow	= sFirstRow - csbiConsole.srWindow.Top;
+		sLastRow	= sLastRow - csbiConsole.srWindow.Top;
+
+		if (sFirstRow < 0) sFirstRow = 0;
+		if (sLastRow >= coordConsoleSize.Y) sLastRow = coordConsoleSize.Y - 1;
+
+		if ((sFirstRow <= sLastRow) && !ReadWindowRows(hStdOut.get(), csbiConsole.srWindow, sFirstRow, sLastRow - sFirstRow + 1)) return;
+	}
+	else
+	{
+		sFirstRow	= 0;
+		sLastRow	= coordConsoleSize.Y - 1;
+
+		if (!ReadWindowRows(hStdOut.get(), csbiConsole.srWindow, 0, coordConsoleSize.Y)) return;
+
+		m_dwLastFullCapture = dwTickCount;
+	}
+
+	// changes outside the window only go to the history, we re-read them
+	// from there
+	if (m_consoleHistory.Get() && (m_sDirtyTop <= m_sDirtyBottom))
+	{
+		if (m_sDirtyTop < csbiConsole.srWindow.Top) MarkHistoryStale(m_sDirtyTop, min(static_cast<SHORT>(m_sDirtyBottom + 1), csbiConsole.srWindow.Top));
+		if (m_sDirtyBottom > csbiConsole.srWindow.Bottom) MarkHistoryStale(max(m_sDirtyTop, static_cast<SHORT>(csbiConsole.srWindow.Bottom + 1)), min(static_cast<SHORT>(m_sDirtyBottom + 1), csbiConsole.dwSize.Y));
+	}
+
+	// all changes reported so far are in the capture
+	m_bDirty					= false;
+	m_bDirtyAll					= false;
+	m_sDirtyTop					= 0;
+	m_sDirtyBottom				= -1;
+
+	m_bCaptureValid				= true;
+	m_srCaptureWindow			= csbiConsole.srWindow;
+	m_coordCaptureBufferSize	= csbiConsole.dwSize;
+	m_coordCaptureCursor		= csbiConsole.dwCursorPosition;
+
+	CHAR_INFO* pScreenBuffer = m_captureBuffer.get();
+
+	// Console has remapped the screen for us
+	if ((m_consoleScreen->lNewVersion != 0) && (static_cast<DWORD>(m_consoleScreen->lNewVersion) != m_dwScreenVersion))
+	{
+		OpenConsoleScreen(m_consoleScreen->lNewVersion);
+	}
+
+	// screen is clipped to the shared frame size, ask Console for a bigger
+	// one (we keep publishing until it remaps the screen)
+	m_bScreenTooSmall = false;
+
+	if ((static_cast<DWORD>(coordConsoleSize.Y) > m_consoleScreen->dwMaxRows) ||
+		(static_cast<DWORD>(coordConsoleSize.X) > m_consoleScreen->dwMaxColumns))
+	{
+		m_consoleScreen->dwRequestedRows    = coordConsoleSize.Y;
+		m_consoleScreen->dwRequestedColumns = coordConsoleSize.X;
+		m_bScreenTooSmall = true;
+	}
+
+	DWORD dwRows    = min(static_cast<DWORD>(coordConsoleSize.Y), m_consoleScreen->dwMaxRows);
+	DWORD dwColumns = min(static_cast<DWORD>(coordConsoleSize.X), m_consoleScreen->dwMaxColumns);
+
+	// compare rows with the last published frame, it holds every row as of
+	// m_rowFrames (with their hashes); a frame of another size is as good
+	// as none
+	DWORD         dwNextFrame  = m_dwFrame + 1;
+	bool          bSizeChanged = (m_dwScreenBufferSize != dwRows*dwColumns) || (m_rowHashes.size() != dwRows);
+	ConsoleFrame* pLastFrame   = m_consoleScreen->GetFrame(m_consoleScreen->lFront);
+
+	if ((pLastFrame->dwRows != dwRows) || (pLastFrame->dwColumns != dwColumns)) bSizeChanged = true;
+
+	bool textChanged = bSizeChanged;
+
+	if (bSizeChanged)
+	{
+		m_rowHashes.assign(dwRows, 0);
+		m_rowFrames.assign(dwRows, dwNextFrame);
+	}
+
+	m_newRowHashes.resize(dwRows);
+
+	CHAR_INFO* pLastBuffer = m_consoleScreen->GetBuffer(pLastFrame);
+
+	for (DWORD dwRow = 0; dwRow < dwRows; ++dwRow)
+	{
+		CHAR_INFO* pRow = pScreenBuffer + dwRow*coordConsoleSize.X;
+
+		// rows we haven't read this time can't have changed; rows we have
+		// read are only hashed (for scroll detection) if they've changed
+		if (!bSizeChanged &&
+			((((dwRow != 0) || !bTopRowRead) && ((static_cast<LONG>(dwRow) < sFirstRow) || (static_cast<LONG>(dwRow) > sLastRow))) ||
+			 (::memcmp(pLastBuffer + dwRow*dwColumns, pRow, dwColumns*sizeof(CHAR_INFO)) == 0)))
+		{
+			m_newRowHashes[dwRow] = m_rowHashes[dwRow];
+			continue;
+		}
+
+		m_newRowHashes[dwRow] = HashRow(pRow, dwColumns);
+		m_rowFrames[dwRow]    = dwNextFrame;
+		textChanged           = true;
+	}
+
+	// text can only scroll if the top row has changed, i.e. on a full capture
+	LONG lScroll = 0;
+
+	if (!bSizeChanged && bFullCapture)
+	{
+		lScroll = DetectScroll(m_rowHashes, m_newRowHashes);
+
+		if (lScroll != 0)
+		{
+			m_lScrollOffset += lScroll;
+			textChanged      = true;
+		}
+	}
+
+	// text scrolls in the window when the window moves or when the console
+	// buffer itself scrolls (the window is at the bottom and the buffer is
+	// full), the history only follows the latter
+	if (m_consoleHistory.Get())
+	{
+		LONG lBufferScroll = (lScroll != 0) ? lScroll - (csbiConsole.srWindow.Top - sLastWindowTop) : 0;
+
+		UpdateConsoleHistory(hStdOut.get(), csbiConsole, lBufferScroll);
+		RefreshConsoleHistory(hStdOut.get());
+	}
+
+	m_rowHashes.swap(m_newRowHashes);
+
+	CONSOLE_CURSOR_INFO cursorInfo;
+	::GetConsoleCursorInfo(hStdOut.get(), &cursorInfo);
+
+	if (!textChanged &&
+		!m_bScreenTooSmall &&
+		(::memcmp(&m_lastConsoleInfo, &csbiConsole, sizeof(CONSOLE_SCREEN_BUFFER_INFO)) == 0) &&
+		(::memcmp(&m_lastCursorInfo, &cursorInfo, sizeof(CONSOLE_CURSOR_INFO)) == 0))
+	{
+		return;
+	}
+
+	// update screen buffer variables
+	m_dwFrame            = dwNextFrame;
+	m_dwScreenBufferSize = dwRows*dwColumns;
+	m_lastConsoleInfo    = csbiConsole;
+	m_lastCursorInfo     = cursorInfo;
+
+	// Console compares the text frame with the last frame it has read
+	if (textChanged) m_dwTextFrame = m_dwFrame;
+
+	// write a frame that's neither published nor pinned by Console (Console
+	// re-checks lFront after pinning, so it never renders from a frame we've
+	// picked before seeing the pin); we only need to copy rows that changed
+	// since the frame was last written
+	LONG lFront  = m_consoleScreen->lFront;
+	MemoryBarrier();
+	LONG lPinned = m_consoleScreen->lPinned;
+	LONG lBack   = 0;
+
+	while ((lBack == lFront) || (lBack == lPinned)) ++lBack;
+
+	ConsoleFrame*     pFrame     = m_consoleScreen->GetFrame(lBack);
+	unsigned __int64* pRowHashes = m_consoleScreen->GetRowHashes(pFrame);
+	DWORD*            pRowFrames = m_consoleScreen->GetRowFrames(pFrame);
+	CHAR_INFO*        pBuffer    = m_consoleScreen->GetBuffer(pFrame);
+
+	SeqLock::BeginWrite(&pFrame->lSequence);
+
+	pFrame->dwFrame       = m_dwFrame;
+	pFrame->dwTextFrame   = m_dwTextFrame;
+	pFrame->dwRows        = dwRows;
+	pFrame->dwColumns     = dwColumns;
+	pFrame->lScrollOffset = m_lScrollOffset;
+	pFrame->csbi          = csbiConsole;
+	pFrame->cursorInfo    = cursorInfo;
+
+	for (DWORD dwRow = 0; dwRow < dwRows; ++dwRow)
+	{
+		if (pRowFrames[dwRow] == m_rowFrames[dwRow]) continue;
+
+		::CopyMemory(pBuffer + dwRow*dwColumns, pScreenBuffer + dwRow*coordConsoleSize.X, dwColumns*sizeof(CHAR_INFO));
+		pRowHashes[dwRow] = m_rowHashes[dwRow];
+		pRowFrames[dwRow] = m_rowFrames[dwRow];
+	}
+
+	SeqLock::EndWrite(&pFrame->lSequence);
+
+	// publish the frame and notify Console
+	::InterlockedExchange(&m_consoleScreen->lFront, lBack);
+	m_consoleScreen.SetReqEvent();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+bool ConsoleHandler::ReadWindowRows(HANDLE hStdOut, const SMALL_RECT& srWindow, SHORT sFirstRow, SHORT sRowCount)
+{
+	SMALL_RECT	srRows;
+
+	srRows.Top		= srWindow.Top + sFirstRow;
+	srRows.Bottom	= srRows.Top + sRowCount - 1;
+	srRows.Left		= srWindow.Left;
+	srRows.Right	= srWindow.Right;
+
+	return ReadConsoleRows(hStdOut, srRows, m_captureBuffer.get() + sFirstRow * (srWindow.Right - srWindow.Left + 1));
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+bool ConsoleHandler::ReadConsoleRows(HANDLE hStdOut, const SMALL_RECT& srRegion, CHAR_INFO* pBuffer)
+{
+	SHORT	sColumns	= srRegion.Right - srRegion.Left + 1;
+	SHORT	sFirstRow	= 0;
+	SHORT	sRowCount	= srRegion.Bottom - srRegion.Top + 1;
 	// start coordinates for the buffer are always (0, 0) - we use offset
-	COORD		coordStart = {0, 0};
-	SMALL_RECT	srBuffer;
-
-//	TRACE(L"===================================================================\n");
-
-	// ReadConsoleOutput seems to fail for large (around 6k CHAR_INFO's) buffers
-	// here we calculate max buffer size (row count) for safe reading
-	coordBufferSize.X	= csbiConsole.srWindow.Right - csbiConsole.srWindow.Left + 1;
-	coordBufferSize.Y	= 6144 / coordBufferSize.X;
-
-	// initialize reading rectangle
-	srBuffer.Top		= csbiConsole.srWindow.Top;
-	srBuffer.Bottom		= csbiConsole.srWindow.Top + coordBufferSize.Y - 1;
-	srBuffer.Left		= csbiConsole.srWindow.Left;
-	srBuffer.Right		= csbiConsole.srWindow.Left + csbiConsole.srWindow.Right - csbiConsole.srWindow.Left;
-
-/*
-	TRACE(L"Buffer size for loop reads: %ix%i\n", coordBufferSize.X, coordBufferSize.Y);
-	TRACE(L"-------------------------------------------------------------------\n");
-*/
-
-	// read rows 'chunks'
-	SHORT i = 0;
-	for (; i < coordConsoleSize.Y / coordBufferSize.Y; ++i)
+	COORD	coordStart	= {0, 0};
+
+	while (sRowCount > 0)
+	{
+		COORD		coordBufferSize;
+		SMALL_RECT	srBuffer;
+
+		coordBufferSize.X	= sColumns;
+		coordBufferSize.Y	= static_cast<SHORT>(min(static_cast<DWORD>(sRowCount), max(m_dwMaxReadCells / sColumns, 1UL)));
+
+		srBuffer.Top		= srRegion.Top + sFirstRow;
+		srBuffer.Bottom		= srBuffer.Top + coordBufferSize.Y - 1;
+		srBuffer.Left		= srRegion.Left;
+		srBuffer.Right		= srRegion.Right;
+
+		if (!::ReadConsoleOutput(
+				hStdOut, 
+				pBuffer + sFirstRow * sColumns, 
+				coordBufferSize, 
+				coordStart, 
+				&srBuffer))
+		{
+			// ReadConsoleOutput fails for large buffers (the limit depends on
+			// conhost version), halve the chunk down to the size known to work
+			DWORD dwChunkCells = coordBufferSize.X * coordBufferSize.Y;
+
+			if (dwChunkCells <= SAFE_READ_CELLS)
+			{
+				Win32Exception err(::GetLastError());
+				TRACE(L"ReadConsoleOutput returns error (%lu) : %S\n", err.GetErrorCode(), err.what());
+				return false;
+			}
+
+			m_dwMaxReadCells = max(dwChunkCells / 2, static_cast<DWORD>(SAFE_READ_CELLS));
+			TRACE(L"ReadConsoleOutput chunk size: %lu\n", m_dwMaxReadCells);
+			continue;
+		}
+
+		sFirstRow	= sFirstRow + coordBufferSize.Y;
+		sRowCount	= sRowCount - coordBufferSize.Y;
+	}
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void ConsoleHandler::UpdateConsoleHistory(HANDLE hStdOut, const CONSOLE_SCREEN_BUFFER_INFO& csbi, LONG lBufferScroll)
+{
+	ConsoleHistory* pHistory = m_consoleHistory.Get();
+
+	// console buffer has been resized, start over
+	if ((m_coordHistorySize.X != csbi.dwSize.X) || (m_coordHistorySize.Y != csbi.dwSize.Y))
 	{
-//		TRACE(L"Reading region: (%i, %i) - (%i, %i)\n", srBuffer.Left, srBuffer.Top, srBuffer.Right, srBuffer.Bottom);
+		DWORD dwCells = static_cast<DWORD>(csbi.dwSize.X) * static_cast<DWORD>(csbi.dwSize.Y);
 
-		::ReadConsoleOutput(
-			hStdOut.get(), 
-			pScreenBuffer.get() + dwScreenBufferOffset, 
-			coordBufferSize, 
-			coordStart, 
-			&srBuffer);
+		SeqLock::BeginWrite(&pHistory->lSequence);
 
-		srBuffer.Top		= srBuffer.Top + coordBufferSize.Y;
-		srBuffer.Bottom		= srBuffer.Bottom + coordBufferSize.Y;
+		pHistory->dwRows      = (dwCells <= pHistory->dwMaxCells) ? csbi.dwSize.Y : 0;
+		pHistory->dwColumns   = csbi.dwSize.X;
+		pHistory->dwHead      = 0;
+		pHistory->dwStaleTop  = 0;
+		pHistory->dwStaleRows = csbi.dwSize.Y;
 
-		dwScreenBufferOffset += coordBufferSize.X * coordBufferSize.Y;
+		SeqLock::EndWrite(&pHistory->lSequence);
+
+		m_coordHistorySize  = csbi.dwSize;
+		m_sHistoryStaleTop  = 0;
+		m_sHistoryStaleRows = csbi.dwSize.Y;
+		lBufferScroll       = 0;
 	}
 
-	// read the last 'chunk', we need to calculate the number of rows in the
-	// last chunk and update bottom coordinate for the region
-	coordBufferSize.Y	= coordConsoleSize.Y - i * coordBufferSize.Y;
-	srBuffer.Bottom		= csbiConsole.srWindow.Bottom;
+	// buffer doesn't fit, Console scrolls through us
+	if (pHistory->dwRows == 0)
+	{
+		m_sHistoryStaleTop  = 0;
+		m_sHistoryStaleRows = 0;
+		return;
+	}
 
-/*
-	TRACE(L"Buffer size for last read: %ix%i\n", coordBufferSize.X, coordBufferSize.Y);
-	TRACE(L"-------------------------------------------------------------------\n");
-	TRACE(L"Reading region: (%i, %i) - (%i, %i)\n", srBuffer.Left, srBuffer.Top, srBuffer.Right, srBuffer.Bottom);
-*/
+	SHORT      sRows    = csbi.srWindow.Bottom - csbi.srWindow.Top + 1;
+	SHORT      sColumns = csbi.srWindow.Right - csbi.srWindow.Left + 1;
+	CHAR_INFO* pCapture = m_captureBuffer.get();
 
-	::ReadConsoleOutput(
-		hStdOut.get(), 
-		pScreenBuffer.get() + dwScreenBufferOffset, 
-		coordBufferSize, 
-		coordStart, 
-		&srBuffer);
+	// console buffer has scrolled up, move the ring head; stale rows have
+	// scrolled with the rest, and the rows scrolled in at the bottom are
+	// only in the capture if the window is at the bottom
+	if ((lBufferScroll > 0) && (lBufferScroll < csbi.dwSize.Y))
+	{
+		SeqLock::BeginWrite(&pHistory->lSequence);
+		pHistory->dwHead = (pHistory->dwHead + lBufferScroll) % pHistory->dwRows;
+		SeqLock::EndWrite(&pHistory->lSequence);
 
+		if (csbi.srWindow.Bottom == csbi.dwSize.Y - 1)
+		{
+			m_sHistoryStaleTop  = static_cast<SHORT>(max(m_sHistoryStaleTop - lBufferScroll, 0L));
+			m_sHistoryStaleRows = static_cast<SHORT>(max(m_sHistoryStaleRows - lBufferScroll, 0L));
+			MarkHistoryStale(0, 0);
+		}
+		else
+		{
+			MarkHistoryStale(0, csbi.dwSize.Y);
+		}
+	}
+	else if (lBufferScroll != 0)
+	{
+		MarkHistoryStale(0, csbi.dwSize.Y);
+	}
 
-//	TRACE(L"===================================================================\n");
+	// if most window rows differ from the history and the buffer hasn't
+	// scrolled (or we couldn't tell by how much), the buffer has most likely
+	// scrolled by more than a window since the last capture; if we can't
+	// find out by how much, the rows above the window have changed, too
+	DWORD dwChangedRows = 0;
 
-	// compare previous buffer, and if different notify Console
-	SharedMemoryLock consoleInfoLock(m_consoleInfo);
-	SharedMemoryLock bufferLock(m_consoleBuffer);
+	for (SHORT sRow = 0; sRow < sRows; ++sRow)
+	{
+		if (::memcmp(pHistory->GetRow(csbi.srWindow.Top + sRow) + csbi.srWindow.Left, pCapture + sRow*sColumns, sColumns*sizeof(CHAR_INFO)) != 0) ++dwChangedRows;
+	}
+
+	if ((dwChangedRows*2 > static_cast<DWORD>(sRows)) &&
+		((lBufferScroll != 0) || !CatchUpConsoleHistory(hStdOut, csbi)))
+	{
+		MarkHistoryStale(0, csbi.srWindow.Top);
+	}
 
-	::GetConsoleCursorInfo(hStdOut.get(), m_cursorInfo.Get());
+	// window rows are current after the copy
+	if ((m_sHistoryStaleTop >= csbi.srWindow.Top) && (m_sHistoryStaleTop <= csbi.srWindow.Bottom)) m_sHistoryStaleTop = csbi.srWindow.Bottom + 1;
+	if ((m_sHistoryStaleRows > csbi.srWindow.Top) && (m_sHistoryStaleRows <= csbi.srWindow.Bottom + 1)) m_sHistoryStaleRows = csbi.srWindow.Top;
 
-	bool textChanged = (::memcmp(m_consoleBuffer.Get(), pScreenBuffer.get(), m_dwScreenBufferSize*sizeof(CHAR_INFO)) != 0);
+	MarkHistoryStale(0, 0);
 
-	if ((::memcmp(&m_consoleInfo->csbi, &csbiConsole, sizeof(CONSOLE_SCREEN_BUFFER_INFO)) != 0) ||
-		(m_dwScreenBufferSize != dwScreenBufferSize) ||
-		textChanged)
+	if ((dwChangedRows == 0) &&
+		(pHistory->dwStaleTop == static_cast<DWORD>(m_sHistoryStaleTop)) &&
+		(pHistory->dwStaleRows == static_cast<DWORD>(m_sHistoryStaleRows)))
 	{
-		// update screen buffer variables
-		m_dwScreenBufferSize = dwScreenBufferSize;
+		return;
+	}
 
-		::CopyMemory(&m_consoleInfo->csbi, &csbiConsole, sizeof(CONSOLE_SCREEN_BUFFER_INFO));
-		
-		// only Console sets the flag to false, after it's done repainting text
-		if (textChanged) m_consoleInfo->textChanged = true;
+	SeqLock::BeginWrite(&pHistory->lSequence);
 
-		::CopyMemory(m_consoleBuffer.Get(), pScreenBuffer.get(), m_dwScreenBufferSize*sizeof(CHAR_INFO));
+	for (SHORT sRow = 0; sRow < sRows; ++sRow)
+	{
+		CHAR_INFO* pRow = pHistory->GetRow(csbi.srWindow.Top + sRow) + csbi.srWindow.Left;
+
+		if (::memcmp(pRow, pCapture + sRow*sColumns, sColumns*sizeof(CHAR_INFO)) == 0) continue;
 
-		m_consoleBuffer.SetReqEvent();
+		::CopyMemory(pRow, pCapture + sRow*sColumns, sColumns*sizeof(CHAR_INFO));
 	}
+
+	pHistory->dwStaleTop  = m_sHistoryStaleTop;
+	pHistory->dwStaleRows = m_sHistoryStaleRows;
+
+	SeqLock::EndWrite(&pHistory->lSequence);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+bool ConsoleHandler::CatchUpConsoleHistory(HANDLE hStdOut, const CONSOLE_SCREEN_BUFFER_INFO& csbi)
+{
+	ConsoleHistory* pHistory = m_consoleHistory.Get();
+
+	// the previous window is still in the history at the window rows; if
+	// the buffer has scrolled, it's now somewhere above the window (text
+	// only scrolls out of a window at the bottom of the buffer)
+	SHORT	sTop		= csbi.srWindow.Top;
+	SHORT	sRows		= csbi.srWindow.Bottom - csbi.srWindow.Top + 1;
+	SHORT	sColumns	= m_coordHistorySize.X;
+	SHORT	sScanRows	= static_cast<SHORT>(min(static_cast<DWORD>(sTop), HISTORY_REFRESH_CELLS / static_cast<DWORD>(sColumns)));
+
+	if ((csbi.srWindow.Bottom != csbi.dwSize.Y - 1) || (sScanRows < sRows)) return false;
+
+	// a window of identical (e.g. blank) rows would match anywhere
+	SHORT sRow = 1;
+
+	while ((sRow < sRows) && (::memcmp(pHistory->GetRow(sTop + sRow), pHistory->GetRow(sTop), sColumns*sizeof(CHAR_INFO)) == 0)) ++sRow;
+
+	if (sRow == sRows) return false;
+
+	SMALL_RECT srRows;
+
+	srRows.Top		= sTop - sScanRows;
+	srRows.Bottom	= sTop - 1;
+	srRows.Left		= 0;
+	srRows.Right	= sColumns - 1;
+
+	if (!ReadConsoleRows(hStdOut, srRows, m_historyBuffer.get())) return false;
+
+	// look for the smallest scroll that moves the previous window to rows
+	// we've read
+	CHAR_INFO* pScan = m_historyBuffer.get();
+
+	for (SHORT sScroll = sRows; sScroll <= sScanRows; ++sScroll)
+	{
+		SHORT sFirst = sScanRows - sScroll;
+
+		for (sRow = 0; sRow < sRows; ++sRow)
+		{
+			if (::memcmp(pHistory->GetRow(sTop + sRow), pScan + (sFirst + sRow)*sColumns, sColumns*sizeof(CHAR_INFO)) != 0) break;
+		}
+
+		if (sRow < sRows) continue;
+
+		// move the head, only the rows that scrolled in between the previous
+		// window and this one are new
+		SeqLock::BeginWrite(&pHistory->lSequence);
+
+		pHistory->dwHead = (pHistory->dwHead + sScroll) % pHistory->dwRows;
+
+		for (sRow = sFirst + sRows; sRow < sScanRows; ++sRow)
+		{
+			::CopyMemory(pHistory->GetRow(srRows.Top + sRow), pScan + sRow*sColumns, sColumns*sizeof(CHAR_INFO));
+		}
+
+		SeqLock::EndWrite(&pHistory->lSequence);
+
+		m_sHistoryStaleTop  = max(static_cast<SHORT>(m_sHistoryStaleTop - sScroll), static_cast<SHORT>(0));
+		m_sHistoryStaleRows = max(static_cast<SHORT>(m_sHistoryStaleRows - sScroll), static_cast<SHORT>(0));
+		MarkHistoryStale(0, 0);
+
+		TRACE(L"Console history caught up with a %i row scroll\n", sScroll);
+		return true;
+	}
+
+	return false;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void ConsoleHandler::RefreshConsoleHistory(HANDLE hStdOut)
+{
+	ConsoleHistory* pHistory = m_consoleHistory.Get();
+
+	if ((pHistory->dwRows == 0) || (m_sHistoryStaleRows <= m_sHistoryStaleTop)) return;
+
+	// re-read the stale rows closest to the window first, Console is most
+	// likely to scroll to them; we read outside the seqlock so Console can
+	// use the rest of the history meanwhile
+	SHORT		sColumns	= m_coordHistorySize.X;
+	SHORT		sRowCount	= static_cast<SHORT>(min(static_cast<DWORD>(m_sHistoryStaleRows - m_sHistoryStaleTop), max(HISTORY_REFRESH_CELLS / static_cast<DWORD>(sColumns), 1UL)));
+	SMALL_RECT	srRows;
+
+	srRows.Top		= m_sHistoryStaleRows - sRowCount;
+	srRows.Bottom	= m_sHistoryStaleRows - 1;
+	srRows.Left		= 0;
+	srRows.Right	= sColumns - 1;
+
+	if (!ReadConsoleRows(hStdOut, srRows, m_historyBuffer.get())) return;
+
+	SeqLock::BeginWrite(&pHistory->lSequence);
+
+	for (SHORT sRow = 0; sRow < sRowCount; ++sRow)
+	{
+		::CopyMemory(pHistory->GetRow(srRows.Top + sRow), m_historyBuffer.get() + sRow*sColumns, sColumns*sizeof(CHAR_INFO));
+	}
+
+	m_sHistoryStaleRows = srRows.Top;
+	MarkHistoryStale(0, 0);
+
+	pHistory->dwStaleTop  = m_sHistoryStaleTop;
+	pHistory->dwStaleRows = m_sHistoryStaleRows;
+
+	SeqLock::EndWrite(&pHistory->lSequence);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void ConsoleHandler::MarkHistoryStale(SHORT sTop, SHORT sBottom)
+{
+	// stale rows are kept as a single band (rows sTop..sBottom-1 are added
+	// to it), an empty band is 0..0
+	if (m_sHistoryStaleTop >= m_sHistoryStaleRows)
+	{
+		m_sHistoryStaleTop  = 0;
+		m_sHistoryStaleRows = 0;
+	}
+
+	if (sTop >= sBottom) return;
+
+	if (m_sHistoryStaleTop == m_sHistoryStaleRows)
+	{
+		m_sHistoryStaleTop  = sTop;
+		m_sHistoryStaleRows = sBottom;
+	}
+	else
+	{
+		m_sHistoryStaleTop  = min(m_sHistoryStaleTop, sTop);
+		m_sHistoryStaleRows = max(m_sHistoryStaleRows, sBottom);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+unsigned __int64 ConsoleHandler::HashRow(const CHAR_INFO* pRow, DWORD dwColumns)
+{
+	// FNV-1a over whole cells (char + attributes)
+	const DWORD*     pCell = reinterpret_cast<const DWORD*>(pRow);
+	unsigned __int64 hash  = 14695981039346656037ULL;
+
+	for (DWORD i = 0; i < dwColumns; ++i)
+	{
+		hash ^= pCell[i];
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+LONG ConsoleHandler::DetectScroll(const std::vector<unsigned __int64>& oldHashes, const std::vector<unsigned __int64>& newHashes)
+{
+	LONG lRows      = static_cast<LONG>(newHashes.size());
+	LONG lUnchanged = 0;
+
+	for (LONG i = 0; i < lRows; ++i)
+	{
+		if (newHashes[i] == oldHashes[i]) ++lUnchanged;
+	}
+
+	// most of the screen is in place, nothing to gain from a scroll
+	if (lUnchanged*2 >= lRows) return 0;
+
+	LONG lBestScroll  = 0;
+	LONG lBestMatches = lUnchanged;
+
+	// text moved up by lScroll rows when newHashes[i] == oldHashes[i + lScroll],
+	// down when newHashes[i + lScroll] == oldHashes[i]; we stop when a bigger
+	// shift can't match more rows than the best one
+	for (LONG lScroll = 1; lRows - lScroll > lBestMatches; ++lScroll)
+	{
+		LONG lUpMatches   = 0;
+		LONG lDownMatches = 0;
+
+		for (LONG i = 0; i < lRows - lScroll; ++i)
+		{
+			if (newHashes[i] == oldHashes[i + lScroll]) ++lUpMatches;
+			if (newHashes[i + lScroll] == oldHashes[i]) ++lDownMatches;
+		}
+
+		if (lUpMatches > lBestMatches)
+		{
+			lBestScroll  = lScroll;
+			lBestMatches = lUpMatches;
+		}
+
+		if (lDownMatches > lBestMatches)
+		{
+			lBestScroll  = -lScroll;
+			lBestMatches = lDownMatches;
+		}
+	}
+
+	// the shifted rows must mostly match, or it's just a screen redraw
+	if ((lBestMatches < 2) || (lBestMatches*4 < (lRows - abs(lBestScroll))*3)) return 0;
+
+	return lBestScroll;
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -504,343 +1163,59 @@ void ConsoleHandler::ResizeConsoleWindow(HANDLE hStdOut, DWORD& dwColumns, DWORD
 	TRACE(L"Rows: %i\n", dwRows);
 
 //	TRACE(L"console buffer size: %ix%i\n", csbi.dwSize.X, csbi.dwSize.Y);
-//	TRACE(L"console rect: %ix%i - %ix%i\n", csbi.srWindow.Left, csbi.srWindow.Top, csbi.srWindow.Right, csbi.srWindow.Bottom);
-}
-
-//////////////////////////////////////////////////////////////////////////////
-
-
-//////////////////////////////////////////////////////////////////////////////
-
-class ClipboardData
-{
-public:
-  ClipboardData(void) {}
-  virtual ~ClipboardData(void) {}
-  virtual void StartRow(void) = 0;
-  virtual void EndRow(void) = 0;
-  virtual void AddChar(PCHAR_INFO) = 0;
-  virtual bool IsEOL(DWORD dwEOLSpaces) = 0;
-  virtual size_t GetRowLength(void) = 0;
-  virtual void TrimRight(void) = 0;
-  virtual void Wrap(CopyNewlineChar) = 0;
-  virtual void Publish(void) = 0;
-
-  class Global
-  {
-  public:
-    Global(const void* p, size_t size)
-    {
-      hText = ::GlobalAlloc(GMEM_MOVEABLE, size);
-      if( hText )
-      {
-        LPVOID lpTextLock = ::GlobalLock(hText);
-        if ( lpTextLock )
-        {
-          ::CopyMemory(lpTextLock, p, size);
-          ::GlobalUnlock(hText);
-        }
-      }
-    }
-    ~Global(void)
-    {
-      if( hText )
-      {
-        // we need to global-free data only if copying failed
-        ::GlobalFree(hText);
-      }
-    }
-    HGLOBAL release(void)
-    {
-      HGLOBAL h = hText;
-      hText = NULL;
-      return h;
-    }
-    HGLOBAL get(void) const
-    {
-      return hText;
-    }
-  private:
-    HGLOBAL hText;
-  };
-};
-
-class ClipboardDataUnicode : public ClipboardData
-{
-public:
-  ClipboardDataUnicode(void):strText(L"") {}
-  virtual ~ClipboardDataUnicode(void) {}
-  virtual void StartRow(void)
-  {
-    strRow = L"";
-  }
-  virtual void EndRow(void)
-  {
-    strText += strRow;
-  }
-  virtual void AddChar(PCHAR_INFO p)
-  {
-    strRow += p->Char.UnicodeChar;
-  }
-  virtual bool IsEOL(DWORD dwEOLSpaces)
-  {
-		size_t len = strRow.length();
-		if( len < dwEOLSpaces ) return false;
-
-		for(size_t i = (len - dwEOLSpaces); i < len; ++i)
-			if( strRow[i] != L' ' )
-				return false;
-
-		return true;
-  }
-  size_t GetRowLength(void)
-  {
-    return strRow.length();
-  }
-  virtual void TrimRight(void)
-  {
-    boost::trim_right(strRow);
-  }
-  virtual void Wrap(CopyNewlineChar copyNewlineChar)
-  {
-    switch(copyNewlineChar)
-    {
-      case newlineCRLF: strRow += wstring(L"\r\n"); break;
-      case newlineLF:   strRow += wstring(L"\n");   break;
-      default:          strRow += wstring(L"\r\n"); break;
-    }
-  }
-  virtual void Publish(void)
-  {
-    ClipboardData::Global global(strText.c_str(), (strText.length()+1)*sizeof(wchar_t));
-
-    if( !global.get() ) return;
-
-    if( ::SetClipboardData(CF_UNICODETEXT, global.get()) )
-    {
-      global.release();
-    }
-  }
-
-private:
-  wstring strText;
-  wstring strRow;
-};
-
-class ClipboardDataRtf : public ClipboardData
-{
-public:
-  ClipboardDataRtf(ConsoleCopy* pconsoleCopy):sizeRtfLen(0)
-  {
-    strRtf = "{\\rtf\\ansi\\deff0";
-
-    strRtf += "{\\fonttbl{\\f0\\fnil ";
-    strRtf += pconsoleCopy->szFontName;
-    strRtf += ";}}";
-
-    strRtf += "{\\colortbl\n";
-    for(int i = 0; i < 16; i ++)
-    {
-      char szColor[64];
-      _snprintf_s(
-        szColor, sizeof(szColor),
-        _TRUNCATE,
-        "\\red%lu\\green%lu\\blue%lu;\n",
-        GetRValue(pconsoleCopy->consoleColors[i]),
-        GetGValue(pconsoleCopy->consoleColors[i]),
-        GetBValue(pconsoleCopy->consoleColors[i]));
-      strRtf += szColor;
-    }
-    strRtf += "}";
-
-    char szFont[64];
-    _snprintf_s(
-      szFont, sizeof(szFont),
-      _TRUNCATE,
-      "\\f0\\fs%lu%s%s\n",
-      pconsoleCopy->dwSize,
-      pconsoleCopy->bBold ? "\\b" : "",
-      pconsoleCopy->bItalic ? "\\i" : "");
-
-    strRtf += szFont;
-  }
-  virtual ~ClipboardDataRtf(void) {}
-  virtual void StartRow(void)
-  {
-    strRowRtf.clear();
-    sizeRowLen = 0;
-  }
-  virtual void EndRow(void)
-  {
-    strRtf += strRowRtf;
-    strRtf += strTrimRowRtf;
-    strTrimRowRtf.clear();
-  }
-  virtual void AddChar(PCHAR_INFO p)
-  {
-    char szDummy[32];
-
-    WORD wCharForegroundAttributes = p->Attributes & 0x000f;
-    WORD wCharBackgroundAttributes = (p->Attributes >> 4) & 0x000f;
-    if( sizeRtfLen == 0 )
-    {
-      wLastCharForegroundAttributes = ~wCharForegroundAttributes;
-      wLastCharBackgroundAttributes = ~wCharBackgroundAttributes;
-    }
-
-    bool trim = std::isspace<wchar_t>(p->Char.UnicodeChar, std::locale());
-
-    std::string& strRowRtfRef = (trim)?strTrimRowRtf:strRowRtf;
-    if( trim )
-    {
-      if( strTrimRowRtf.empty() )
-      {
-        wLastTrimCharForegroundAttributes = wLastCharForegroundAttributes;
-        wLastTrimCharBackgroundAttributes = wLastCharBackgroundAttributes;
-      }
-    }
-    else
-    {
-      strRowRtf += strTrimRowRtf;
-      strTrimRowRtf.clear();
-    }
-
-    if( wLastCharBackgroundAttributes != wCharBackgroundAttributes )
-    {
-      _snprintf_s(
-        szDummy, sizeof(szDummy),
-        _TRUNCATE,
-        "\\highlight%hu ",
-        wCharBackgroundAttributes);
-      strRowRtfRef += szDummy;
-    }
-    if( wLastCharForegroundAttributes != wCharForegroundAttributes )
-    {
-      _snprintf_s(
-        szDummy, sizeof(szDummy),
-        _TRUNCATE,
-        "\\cf%hu ",
-        wCharForegroundAttributes);
-      strRowRtfRef += szDummy;
-    }
-    wLastCharForegroundAttributes = wCharForegroundAttributes;
-    wLastCharBackgroundAttributes = wCharBackgroundAttributes;
-
-    WCHAR wc = p->Char.UnicodeChar;
-         if( wc == L'\\' ) strRowRtfRef += "\\\\";
-    else if( wc == L'{' )  strRowRtfRef += "\\{";
-    else if( wc == L'}' )  strRowRtfRef += "\\}";
-    else if( wc <= 0x7f )  strRowRtfRef += p->Char.AsciiChar;
-    else
-    {
-      _snprintf_s(szDummy, sizeof(szDummy), _TRUNCATE, "\\u%u?", wc);
-      strRowRtfRef += szDummy;
-    }
-    sizeRowLen ++;
-    sizeRtfLen ++;
-  }
-  virtual bool IsEOL(DWORD /*dwEOLSpaces*/)
-  {
-    return !strTrimRowRtf.empty();
-  }
-  size_t GetRowLength(void)
-  {
-    return sizeRowLen;
-  }
-  virtual void TrimRight(void)
-  {
-    if( !strTrimRowRtf.empty() )
-    {
-      strTrimRowRtf.clear();
-      wLastCharForegroundAttributes = wLastTrimCharForegroundAttributes;
-      wLastCharBackgroundAttributes = wLastTrimCharBackgroundAttributes;
-    }
-  }
-  virtual void Wrap(CopyNewlineChar /*copyNewlineChar*/)
-  {
-    strTrimRowRtf += "\\line\n";
-  }
-  virtual void Publish(void)
-  {
-    strRtf += "}";
-
-    ClipboardData::Global global(strRtf.c_str(), strRtf.length() + 1);
+//	TRACE(L"console rect: %ix%i - %ix%i\n", csbi.srWindow.Left, csbi.srWindow.Top, csbi.srWindow.Right, csbi.srWindow.Bottom);
+}
 
-    if( !global.get() ) return;
+//////////////////////////////////////////////////////////////////////////////
 
-    if( ::SetClipboardData(::RegisterClipboardFormat(L"Rich Text Format"), global.get()) )
-    {
-      global.release();
-    }
-  }
 
-private:
-  string strRtf;
-  string strRowRtf;
-  string strTrimRowRtf;
-  size_t sizeRtfLen;
-  size_t sizeRowLen;
-  WORD   wLastCharForegroundAttributes;
-  WORD   wLastCharBackgroundAttributes;
-  WORD   wLastTrimCharForegroundAttributes;
-  WORD   wLastTrimCharBackgroundAttributes;
-};
+//////////////////////////////////////////////////////////////////////////////
 
 void ConsoleHandler::CopyConsoleTextLine(HANDLE hStdOut, std::unique_ptr<ClipboardData> clipboardDataPtr[], size_t clipboardDataCount)
 {
 	COORD& coordStart = m_consoleCopyInfo->coordStart;
 	COORD& coordEnd   = m_consoleCopyInfo->coordEnd;
 
-	COORD                        coordFrom       = {0, 0};
-	COORD                        coordBufferSize = {(m_consoleParams->dwBufferColumns > 0) ? static_cast<SHORT>(m_consoleParams->dwBufferColumns) : static_cast<SHORT>(m_consoleParams->dwColumns), 1};
-	std::unique_ptr<CHAR_INFO[]> pScreenBuffer(new CHAR_INFO[coordBufferSize.X]);
+	SHORT sColumns = (m_consoleParams->dwBufferColumns > 0) ? static_cast<SHORT>(m_consoleParams->dwBufferColumns) : static_cast<SHORT>(m_consoleParams->dwColumns);
+
+	if ((coordEnd.Y < coordStart.Y) || (sColumns <= 0)) return;
+
+	// the whole selection is read at once (in chunks the console can take)
+	SMALL_RECT                   srSelection = {0, coordStart.Y, sColumns - 1, coordEnd.Y};
+	std::unique_ptr<CHAR_INFO[]> pSelection(new CHAR_INFO[static_cast<size_t>(sColumns) * (coordEnd.Y - coordStart.Y + 1)]);
+
+	if (!ReadConsoleRows(hStdOut, srSelection, pSelection.get())) return;
 
 	// suppress end empty lines
 	bool emptyLine = true;
 	for (SHORT i = coordEnd.Y; i > coordStart.Y && emptyLine; --i)
 	{
-		SMALL_RECT srBuffer;
-
-		srBuffer.Left   = 0;
-		srBuffer.Top    = i;
-		srBuffer.Right  = (i == coordEnd.Y) ? coordEnd.X : (m_consoleParams->dwBufferColumns > 0) ? static_cast<SHORT>(m_consoleParams->dwBufferColumns - 1) : static_cast<SHORT>(m_consoleParams->dwColumns - 1);
-		srBuffer.Bottom = i;
-
-		::ReadConsoleOutput(
-			hStdOut,
-			pScreenBuffer.get(),
-			coordBufferSize,
-			coordFrom,
-			&srBuffer);
+		const CHAR_INFO* pRow   = pSelection.get() + static_cast<size_t>(i - coordStart.Y) * sColumns;
+		SHORT            sRight = (i == coordEnd.Y) ? coordEnd.X : sColumns - 1;
 
-		for (SHORT x = 0; x <= srBuffer.Right - srBuffer.Left && emptyLine; ++x)
+		for (SHORT x = 0; x <= sRight && emptyLine; ++x)
 		{
-			if( pScreenBuffer[x].Char.UnicodeChar != L' ' )
+			if( pRow[x].Char.UnicodeChar != L' ' )
 				emptyLine = false;
 		}
 
 		if( emptyLine )
 		{
 			coordEnd.Y --;
-			coordEnd.X = coordBufferSize.X - 1;
+			coordEnd.X = sColumns - 1;
 		}
 	}
 
-	for (SHORT i = coordStart.Y; i <= coordEnd.Y; ++i)
-	{
-		SMALL_RECT srBuffer;
+	size_t sizeChars = static_cast<size_t>(sColumns) * (coordEnd.Y - coordStart.Y + 1);
 
-		srBuffer.Left	= (i == coordStart.Y) ? coordStart.X : 0;
-		srBuffer.Top	= i;
-		srBuffer.Right	= (i == coordEnd.Y) ? coordEnd.X : (m_consoleParams->dwBufferColumns > 0) ? static_cast<SHORT>(m_consoleParams->dwBufferColumns - 1) : static_cast<SHORT>(m_consoleParams->dwColumns - 1);
-		srBuffer.Bottom	= i;
+	for(size_t clipboardDataIndex = 0; clipboardDataIndex < clipboardDataCount; clipboardDataIndex ++)
+		clipboardDataPtr[clipboardDataIndex]->Reserve(sizeChars, coordEnd.Y - coordStart.Y + 1);
 
-		::ReadConsoleOutput(
-			hStdOut,
-			pScreenBuffer.get(),
-			coordBufferSize,
-			coordFrom,
-			&srBuffer);
+	for (SHORT i = coordStart.Y; i <= coordEnd.Y; ++i)
+	{
+		const CHAR_INFO* pRow   = pSelection.get() + static_cast<size_t>(i - coordStart.Y) * sColumns;
+		SHORT            sLeft  = (i == coordStart.Y) ? coordStart.X : 0;
+		SHORT            sRight = (i == coordEnd.Y) ? coordEnd.X : sColumns - 1;
 
 		for(size_t clipboardDataIndex = 0; clipboardDataIndex < clipboardDataCount; clipboardDataIndex ++)
 			clipboardDataPtr[clipboardDataIndex]->StartRow();
@@ -848,12 +1223,7 @@ void ConsoleHandler::CopyConsoleTextLine(HANDLE hStdOut, std::unique_ptr<Clipboa
 		bool bWrap       = true;
 		bool bTrimSpaces = m_consoleCopyInfo->bTrimSpaces;
 
-		for (SHORT x = 0; x <= srBuffer.Right - srBuffer.Left; ++x)
-		{
-			if (pScreenBuffer[x].Attributes & COMMON_LVB_TRAILING_BYTE) continue;
-			for(size_t clipboardDataIndex = 0; clipboardDataIndex < clipboardDataCount; clipboardDataIndex ++)
-				clipboardDataPtr[clipboardDataIndex]->AddChar(&(pScreenBuffer[x]));
-		}
+		AddCopyRow(pRow, sLeft, sRight, clipboardDataPtr, clipboardDataCount);
 
 		// handle trim/wrap settings
 		if (coordStart.Y == coordEnd.Y)
@@ -864,7 +1234,7 @@ void ConsoleHandler::CopyConsoleTextLine(HANDLE hStdOut, std::unique_ptr<Clipboa
 		if (i == coordEnd.Y)
 		{
 			// last row
-			if (clipboardDataPtr[0]->GetRowLength() < static_cast<size_t>(coordBufferSize.X))
+			if (clipboardDataPtr[0]->GetRowLength() < static_cast<size_t>(sColumns))
 			{
 				bWrap = false;
 			}
@@ -906,31 +1276,24 @@ void ConsoleHandler::CopyConsoleTextColumn(HANDLE hStdOut, std::unique_ptr<Clipb
 		coordEnd.X   = nRight;
 	}
 
-	COORD                        coordFrom       = {0, 0};
-	COORD                        coordBufferSize = {coordEnd.X - coordStart.X + 1, 1};
-	std::unique_ptr<CHAR_INFO[]> pScreenBuffer(new CHAR_INFO[coordBufferSize.X]);
+	if ((coordEnd.Y < coordStart.Y) || (coordEnd.X < coordStart.X)) return;
+
+	// the whole selection is read at once (in chunks the console can take)
+	SHORT                        sColumns    = coordEnd.X - coordStart.X + 1;
+	SMALL_RECT                   srSelection = {coordStart.X, coordStart.Y, coordEnd.X, coordEnd.Y};
+	std::unique_ptr<CHAR_INFO[]> pSelection(new CHAR_INFO[static_cast<size_t>(sColumns) * (coordEnd.Y - coordStart.Y + 1)]);
+
+	if (!ReadConsoleRows(hStdOut, srSelection, pSelection.get())) return;
 
 	// suppress end empty lines
 	bool emptyLine = true;
 	for (SHORT i = coordEnd.Y; i > coordStart.Y && emptyLine; --i)
 	{
-		SMALL_RECT srBuffer;
-
-		srBuffer.Left   = coordStart.X;
-		srBuffer.Top    = i;
-		srBuffer.Right  = coordEnd.X;
-		srBuffer.Bottom = i;
+		const CHAR_INFO* pRow = pSelection.get() + static_cast<size_t>(i - coordStart.Y) * sColumns;
 
-		::ReadConsoleOutput(
-			hStdOut,
-			pScreenBuffer.get(),
-			coordBufferSize,
-			coordFrom,
-			&srBuffer);
-
-		for (SHORT x = 0; x <= srBuffer.Right - srBuffer.Left && emptyLine; ++x)
+		for (SHORT x = 0; x < sColumns && emptyLine; ++x)
 		{
-			if( pScreenBuffer[x].Char.UnicodeChar != L' ' )
+			if( pRow[x].Char.UnicodeChar != L' ' )
 				emptyLine = false;
 		}
 
@@ -940,21 +1303,14 @@ void ConsoleHandler::CopyConsoleTextColumn(HANDLE hStdOut, std::unique_ptr<Clipb
 		}
 	}
 
-	for (SHORT i = coordStart.Y; i <= coordEnd.Y; ++i)
-	{
-		SMALL_RECT srBuffer;
+	size_t sizeChars = static_cast<size_t>(sColumns) * (coordEnd.Y - coordStart.Y + 1);
 
-		srBuffer.Left   = coordStart.X;
-		srBuffer.Top    = i;
-		srBuffer.Right  = coordEnd.X;
-		srBuffer.Bottom = i;
+	for(size_t clipboardDataIndex = 0; clipboardDataIndex < clipboardDataCount; clipboardDataIndex ++)
+		clipboardDataPtr[clipboardDataIndex]->Reserve(sizeChars, coordEnd.Y - coordStart.Y + 1);
 
-		::ReadConsoleOutput(
-			hStdOut,
-			pScreenBuffer.get(),
-			coordBufferSize,
-			coordFrom,
-			&srBuffer);
+	for (SHORT i = coordStart.Y; i <= coordEnd.Y; ++i)
+	{
+		const CHAR_INFO* pRow = pSelection.get() + static_cast<size_t>(i - coordStart.Y) * sColumns;
 
 		for(size_t clipboardDataIndex = 0; clipboardDataIndex < clipboardDataCount; clipboardDataIndex ++)
 			clipboardDataPtr[clipboardDataIndex]->StartRow();
@@ -962,12 +1318,7 @@ void ConsoleHandler::CopyConsoleTextColumn(HANDLE hStdOut, std::unique_ptr<Clipb
 		bool bWrap       = true;
 		bool bTrimSpaces = false;
 
-		for (SHORT x = 0; x <= srBuffer.Right - srBuffer.Left; ++x)
-		{
-			if (pScreenBuffer[x].Attributes & COMMON_LVB_TRAILING_BYTE) continue;
-			for(size_t clipboardDataIndex = 0; clipboardDataIndex < clipboardDataCount; clipboardDataIndex ++)
-				clipboardDataPtr[clipboardDataIndex]->AddChar(&(pScreenBuffer[x]));
-		}
+		AddCopyRow(pRow, 0, sColumns - 1, clipboardDataPtr, clipboardDataCount);
 
 		for(size_t clipboardDataIndex = 0; clipboardDataIndex < clipboardDataCount; clipboardDataIndex ++)
 		{
@@ -996,10 +1347,19 @@ void ConsoleHandler::CopyConsoleText()
 			0,
 			0));
 
-	std::unique_ptr<ClipboardData> clipboardDataPtr[2];
-	size_t clipboardDataCount = 2;
+	// ANSI text leaves out the background the console is filled with
+	CONSOLE_SCREEN_BUFFER_INFO csbi;
+	WORD                       wDefaultAttributes = FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE;
+
+	if (::GetConsoleScreenBufferInfo(hStdOut.get(), &csbi)) wDefaultAttributes = csbi.wAttributes;
+
+	// all formats are built in the same pass over the selection
+	std::unique_ptr<ClipboardData> clipboardDataPtr[4];
+	size_t clipboardDataCount = 4;
 	clipboardDataPtr[0].reset(new ClipboardDataUnicode());
 	clipboardDataPtr[1].reset(new ClipboardDataRtf(m_consoleCopyInfo.Get()));
+	clipboardDataPtr[2].reset(new ClipboardDataHtml(m_consoleCopyInfo.Get()));
+	clipboardDataPtr[3].reset(new ClipboardDataAnsi(wDefaultAttributes));
 
 	if( m_consoleCopyInfo->selectionType == seltypeColumn )
 		CopyConsoleTextColumn(hStdOut.get(), clipboardDataPtr, clipboardDataCount);
@@ -1020,70 +1380,368 @@ void ConsoleHandler::CopyConsoleText()
 
 //////////////////////////////////////////////////////////////////////////////
 
-void ConsoleHandler::SendConsoleText(HANDLE hStdIn, const wchar_t*	pszText, size_t	textLen)
+void ConsoleHandler::BeginPipeRead()
+{
+	// a text payload is read straight into the text buffer, messages are
+	// read after the partial message we have (if any)
+	if (m_pipeText)
+	{
+		m_consoleMsgPipe.BeginReadAsync(
+			reinterpret_cast<LPBYTE>(m_pipeText.get()) + m_pipeTextRead,
+			static_cast<size_t>(m_dwPipeTextLen) * sizeof(wchar_t) - m_pipeTextRead);
+	}
+	else
+	{
+		m_consoleMsgPipe.BeginReadAsync(
+			m_pipeBuffer.get() + m_pipeBufferLen,
+			NAMED_PIPE_BUFFER_SIZE - m_pipeBufferLen);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void ConsoleHandler::OnPipeRead(HANDLE hStdIn, size_t readLen)
 {
-	const size_t partMaxLen    = min(512, textLen);
-	size_t       keyEventCount = 0;
-	DWORD        dwTextWritten;
+	if (m_pipeText)
+	{
+		m_pipeTextRead += readLen;
+
+		if (m_pipeTextRead < static_cast<size_t>(m_dwPipeTextLen) * sizeof(wchar_t)) return;
 
-	std::unique_ptr<INPUT_RECORD[]> pKeyEvents(new INPUT_RECORD[partMaxLen]);
+		SendPipeText(hStdIn);
+	}
+	else
+	{
+		m_pipeBufferLen += readLen;
+	}
 
-	for(size_t i = 0; i < textLen; ++i)
+	// we handle all messages we've got; key events of consecutive messages
+	// go to the console input in one call
+	size_t pos = 0;
+
+	m_inputRecords.clear();
+
+	while (m_pipeBufferLen - pos >= sizeof(NamedPipeMessage))
 	{
-		if( keyEventCount == partMaxLen )
+		// text payloads can leave messages unaligned
+		NamedPipeMessage npmsg;
+		::CopyMemory(&npmsg, m_pipeBuffer.get() + pos, sizeof(NamedPipeMessage));
+		pos += sizeof(NamedPipeMessage);
+
+		if (npmsg.type == NamedPipeMessage::WRITECONSOLEINPUT)
 		{
-			::WriteConsoleInput(hStdIn, pKeyEvents.get(), static_cast<DWORD>(keyEventCount), &dwTextWritten);
+			INPUT_RECORD record;
+			record.EventType = KEY_EVENT;
+			record.Event.KeyEvent = npmsg.data.keyEvent;
 
-			keyEventCount = 0;
+			m_inputRecords.push_back(record);
+			continue;
 		}
 
-		if( (pszText[i] == L'\r') || (pszText[i] == L'\n') )
+		// keep the order of key events and other messages
+		WritePipeInput(hStdIn);
+
+		if (npmsg.type == NamedPipeMessage::SENDTEXT)
 		{
-			if((pszText[i] == L'\r') && (i + 1) < textLen && (pszText[i + 1] == L'\n')) ++i;
+			TRACE(
+				L"NamedPipeMessage::SENDTEXT dwTextLen = %lu\n",
+				npmsg.data.text.dwTextLen);
 
-			pKeyEvents[keyEventCount].EventType                        = KEY_EVENT;
-			pKeyEvents[keyEventCount].Event.KeyEvent.bKeyDown          = TRUE;
-			pKeyEvents[keyEventCount].Event.KeyEvent.wRepeatCount      = 1;
-			pKeyEvents[keyEventCount].Event.KeyEvent.wVirtualKeyCode   = VK_RETURN;
-			pKeyEvents[keyEventCount].Event.KeyEvent.wVirtualScanCode  = 0;
-			pKeyEvents[keyEventCount].Event.KeyEvent.uChar.UnicodeChar = VK_RETURN;
-			pKeyEvents[keyEventCount].Event.KeyEvent.dwControlKeyState = 0;
+			size_t textSize  = static_cast<size_t>(npmsg.data.text.dwTextLen) * sizeof(wchar_t);
+			size_t textBytes = min(textSize, m_pipeBufferLen - pos);
 
-			keyEventCount++;
+			m_pipeText.reset(new wchar_t[npmsg.data.text.dwTextLen + 1]);
+			m_dwPipeTextLen = npmsg.data.text.dwTextLen;
+			m_pipeTextRead  = textBytes;
 
-			if( keyEventCount == partMaxLen )
-			{
-				::WriteConsoleInput(hStdIn, pKeyEvents.get(), static_cast<DWORD>(keyEventCount), &dwTextWritten);
+			::CopyMemory(m_pipeText.get(), m_pipeBuffer.get() + pos, textBytes);
+			pos += textBytes;
 
-				keyEventCount = 0;
-			}
+			// the rest of the text is read next
+			if (textBytes < textSize) break;
+
+			SendPipeText(hStdIn);
+			continue;
+		}
+
+		DispatchPipeMessage(npmsg);
+	}
+
+	WritePipeInput(hStdIn);
+
+	// keep the partial message for the next read
+	m_pipeBufferLen -= pos;
+	if (m_pipeBufferLen > 0) ::MoveMemory(m_pipeBuffer.get(), m_pipeBuffer.get() + pos, m_pipeBufferLen);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void ConsoleHandler::DispatchPipeMessage(const NamedPipeMessage& npmsg)
+{
+	switch( npmsg.type )
+	{
+	case NamedPipeMessage::POSTMESSAGE:
+		TRACE(
+			L"NamedPipeMessage::POSTMESSAGE Msg = 0x%08lx WPARAM = %p LPARAM = %p\n",
+			npmsg.data.winmsg.msg,
+			npmsg.data.winmsg.wparam,
+			npmsg.data.winmsg.lparam);
+
+		if( !::PostMessage(
+			m_consoleParams->hwndConsoleWindow,
+			npmsg.data.winmsg.msg,
+			npmsg.data.winmsg.wparam,
+			npmsg.data.winmsg.lparam) )
+		{
+#ifdef _DEBUG
+			Win32Exception err(::GetLastError());
+			TRACE(
+				L"PostMessage Msg = 0x%08lx WPARAM = %p LPARAM = %p fails (reason: %S)\n",
+				npmsg.data.winmsg.msg,
+				npmsg.data.winmsg.wparam,
+				npmsg.data.winmsg.lparam,
+				err.what());
+#endif
+		}
+		break;
+
+	case NamedPipeMessage::SENDMESSAGE:
+		TRACE(
+			L"NamedPipeMessage::SENDMESSAGE Msg = 0x%08lx WPARAM = %p LPARAM = %p\n",
+			npmsg.data.winmsg.msg,
+			npmsg.data.winmsg.wparam,
+			npmsg.data.winmsg.lparam);
+
+#ifdef _DEBUG
+		{
+			LRESULT res = ::SendMessage(
+				m_consoleParams->hwndConsoleWindow,
+				npmsg.data.winmsg.msg,
+				npmsg.data.winmsg.wparam,
+				npmsg.data.winmsg.lparam);
+			TRACE(
+				L"SendMessage Msg = 0x%08lx WPARAM = %p LPARAM = %p returns %p (last error 0x%08lx)\n",
+				npmsg.data.winmsg.msg,
+				npmsg.data.winmsg.wparam,
+				npmsg.data.winmsg.lparam,
+				res,
+				GetLastError());
+		}
+#else
+		::SendMessage(
+			m_consoleParams->hwndConsoleWindow,
+			npmsg.data.winmsg.msg,
+			npmsg.data.winmsg.wparam,
+			npmsg.data.winmsg.lparam);
+#endif
+		break;
+
+	case NamedPipeMessage::SHOWWINDOW:
+		TRACE(
+			L"NamedPipeMessage::SHOWWINDOW nCmdShow = %ld\n",
+			npmsg.data.show.nCmdShow);
+
+		::ShowWindow(
+			m_consoleParams->hwndConsoleWindow,
+			npmsg.data.show.nCmdShow);
+		break;
+
+	case NamedPipeMessage::CANCELTEXT:
+		TRACE(
+			L"NamedPipeMessage::CANCELTEXT %lu chars pending\n",
+			static_cast<DWORD>(m_strPendingText.length() - m_pendingTextPos));
+
+		CancelPendingText();
+		break;
+
+	case NamedPipeMessage::SETWINDOWPOS:
+		TRACE(
+			L"NamedPipeMessage::SETWINDOWPOS X = %d Y = %d cx = %d cy = %d uFlags = 0x%08lx\n",
+				npmsg.data.windowpos.X,
+				npmsg.data.windowpos.Y,
+				npmsg.data.windowpos.cx,
+				npmsg.data.windowpos.cy,
+				npmsg.data.windowpos.uFlags);
+
+		::SetWindowPos(
+			m_consoleParams->hwndConsoleWindow,
+			NULL,
+			npmsg.data.windowpos.X,
+			npmsg.data.windowpos.Y,
+			npmsg.data.windowpos.cx,
+			npmsg.data.windowpos.cy,
+			npmsg.data.windowpos.uFlags);
+		break;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void ConsoleHandler::WritePipeInput(HANDLE hStdIn)
+{
+	// keys typed during a paste go to the console after the pasted text
+	if (m_pendingTextPos < m_strPendingText.length())
+	{
+		m_heldInput.insert(m_heldInput.end(), m_inputRecords.begin(), m_inputRecords.end());
+		m_inputRecords.clear();
+		return;
+	}
+
+	if (!m_heldInput.empty())
+	{
+		m_inputRecords.insert(m_inputRecords.begin(), m_heldInput.begin(), m_heldInput.end());
+		m_heldInput.clear();
+	}
+
+	if (m_inputRecords.empty()) return;
+
+	TRACE(
+		L"NamedPipeMessage::WRITECONSOLEINPUT %lu events\n",
+		static_cast<DWORD>(m_inputRecords.size()));
+
+	DWORD dwEventsWritten = 0;
+	::WriteConsoleInput(hStdIn, &m_inputRecords[0], static_cast<DWORD>(m_inputRecords.size()), &dwEventsWritten);
+
+	m_inputRecords.clear();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void ConsoleHandler::SendPipeText(HANDLE hStdIn)
+{
+	m_strPendingText.append(m_pipeText.get(), m_dwPipeTextLen);
+
+	m_pipeText.reset();
+	m_dwPipeTextLen = 0;
+	m_pipeTextRead  = 0;
+
+	SendPendingText(hStdIn);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+bool ConsoleHandler::SendPendingText(HANDLE hStdIn)
+{
+	if (m_pendingTextPos >= m_strPendingText.length())
+	{
+		// keys held back by a paste that has been cancelled
+		WritePipeInput(hStdIn);
+		return false;
+	}
+
+	// don't flood the console input, the app reads it at its own pace
+	DWORD dwEvents = 0;
+	if (!::GetNumberOfConsoleInputEvents(hStdIn, &dwEvents)) dwEvents = 0;
+	if (dwEvents >= PASTE_INPUT_EVENTS) return true;
+
+	HKL hkl = ::GetKeyboardLayout(0);
+
+	if (hkl != m_hklVirtualKeys)
+	{
+		::ZeroMemory(m_virtualKeys.get(), 0x10000);
+		m_hklVirtualKeys = hkl;
+	}
 
-			pKeyEvents[keyEventCount].EventType                        = KEY_EVENT;
-			pKeyEvents[keyEventCount].Event.KeyEvent.bKeyDown          = FALSE;
-			pKeyEvents[keyEventCount].Event.KeyEvent.wRepeatCount      = 1;
-			pKeyEvents[keyEventCount].Event.KeyEvent.wVirtualKeyCode   = VK_RETURN;
-			pKeyEvents[keyEventCount].Event.KeyEvent.wVirtualScanCode  = 0;
-			pKeyEvents[keyEventCount].Event.KeyEvent.uChar.UnicodeChar = VK_RETURN;
-			pKeyEvents[keyEventCount].Event.KeyEvent.dwControlKeyState = 0;
+	const wchar_t* pszText    = m_strPendingText.c_str();
+	size_t         textLen    = m_strPendingText.length();
+	size_t         pos        = m_pendingTextPos;
+	size_t         maxRecords = PASTE_INPUT_EVENTS - dwEvents;
 
-			keyEventCount++;
+	m_textRecords.clear();
+
+	INPUT_RECORD record;
+	::ZeroMemory(&record, sizeof(INPUT_RECORD));
+
+	record.EventType                   = KEY_EVENT;
+	record.Event.KeyEvent.wRepeatCount = 1;
+
+	// enter is a key down and up, other chars just a key down
+	while ((pos < textLen) && (m_textRecords.size() + 2 <= maxRecords))
+	{
+		wchar_t ch = pszText[pos++];
+
+		if ((ch == L'\r') || (ch == L'\n'))
+		{
+			if ((ch == L'\r') && (pos < textLen) && (pszText[pos] == L'\n')) ++pos;
+
+			record.Event.KeyEvent.wVirtualKeyCode   = VK_RETURN;
+			record.Event.KeyEvent.uChar.UnicodeChar = VK_RETURN;
+
+			record.Event.KeyEvent.bKeyDown = TRUE;
+			m_textRecords.push_back(record);
+
+			record.Event.KeyEvent.bKeyDown = FALSE;
+			m_textRecords.push_back(record);
 		}
 		else
 		{
-			pKeyEvents[keyEventCount].EventType                        = KEY_EVENT;
-			pKeyEvents[keyEventCount].Event.KeyEvent.bKeyDown          = TRUE;
-			pKeyEvents[keyEventCount].Event.KeyEvent.wRepeatCount      = 1;
-			pKeyEvents[keyEventCount].Event.KeyEvent.wVirtualKeyCode   = LOBYTE(::VkKeyScan(pszText[i]));
-			pKeyEvents[keyEventCount].Event.KeyEvent.wVirtualScanCode  = 0;
-			pKeyEvents[keyEventCount].Event.KeyEvent.uChar.UnicodeChar = pszText[i];
-			pKeyEvents[keyEventCount].Event.KeyEvent.dwControlKeyState = 0;
-
-			keyEventCount++;
+			record.Event.KeyEvent.bKeyDown          = TRUE;
+			record.Event.KeyEvent.wVirtualKeyCode   = GetCharVirtualKey(ch);
+			record.Event.KeyEvent.uChar.UnicodeChar = ch;
+
+			m_textRecords.push_back(record);
 		}
 	}
 
-	if( keyEventCount > 0 )
-		::WriteConsoleInput(hStdIn, pKeyEvents.get(), static_cast<DWORD>(keyEventCount), &dwTextWritten);
+	DWORD dwEventsWritten = 0;
+	if (!m_textRecords.empty()) ::WriteConsoleInput(hStdIn, &m_textRecords[0], static_cast<DWORD>(m_textRecords.size()), &dwEventsWritten);
+
+	::InterlockedExchangeAdd(reinterpret_cast<volatile LONG*>(&m_consoleParams->dwTextCharsDone), static_cast<LONG>(pos - m_pendingTextPos));
+
+	if (pos < textLen)
+	{
+		m_pendingTextPos = pos;
+		return true;
+	}
+
+	m_strPendingText.clear();
+	m_pendingTextPos = 0;
+
+	WritePipeInput(hStdIn);
+	return false;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void ConsoleHandler::CancelPendingText()
+{
+	// Console counts dropped chars as done
+	::InterlockedExchangeAdd(reinterpret_cast<volatile LONG*>(&m_consoleParams->dwTextCharsDone), static_cast<LONG>(m_strPendingText.length() - m_pendingTextPos));
+
+	wstring().swap(m_strPendingText);
+	m_pendingTextPos = 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+BYTE ConsoleHandler::GetCharVirtualKey(wchar_t ch)
+{
+	BYTE& vk = m_virtualKeys[ch];
+
+	if (vk == 0) vk = LOBYTE(::VkKeyScanEx(ch, m_hklVirtualKeys));
+
+	return vk;
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -1219,6 +1877,10 @@ DWORD ConsoleHandler::MonitorThread()
 
 	if (::WaitForSingleObject(m_consoleParams.GetRespEvent(), 10000) == WAIT_TIMEOUT) return 0;
 
+	if (!OpenConsoleScreen(1)) return 0;
+
+	OpenConsoleHistory();
+
 	ResizeConsoleWindow(hStdOut, m_consoleParams->dwColumns, m_consoleParams->dwRows, 0);
 
 	// FIX: this seems to case problems on startup
@@ -1227,12 +1889,39 @@ DWORD ConsoleHandler::MonitorThread()
 	std::shared_ptr<void> parentProcessWatchdog(::OpenMutex(SYNCHRONIZE, FALSE, (LPCTSTR)((SharedMemNames::formatWatchdog % m_consoleParams->dwParentProcessId).str().c_str())), ::CloseHandle);
 	TRACE(L"Watchdog handle: 0x%08X\n", parentProcessWatchdog.get());
 
-	NamedPipeMessage           npmsg;
-	size_t                     npmsglen = 0;
-	std::unique_ptr<wchar_t[]> text;
-	m_consoleMsgPipe.BeginReadAsync(&npmsg, sizeof(NamedPipeMessage));
+	BeginPipeRead();
+
+	// console WinEvents are raised by the console window owner (conhost or
+	// csrss), so we hook only that process and filter by window; if we
+	// can't hook them, we poll the console
+	HWINEVENTHOOK hWinEventHook = NULL;
+	DWORD         dwConsoleOwnerPid = 0;
+
+	if (m_consoleParams->bUseWinEvents) ::GetWindowThreadProcessId(::GetConsoleWindow(), &dwConsoleOwnerPid);
 
-	HANDLE arrWaitHandles[] =
+	if (dwConsoleOwnerPid != 0)
+	{
+		s_pWinEventHandler = this;
+
+		hWinEventHook = ::SetWinEventHook(
+							EVENT_CONSOLE_CARET,
+							EVENT_CONSOLE_LAYOUT,
+							NULL,
+							WinEventProcStatic,
+							dwConsoleOwnerPid,
+							0,
+							WINEVENT_OUTOFCONTEXT);
+
+		if (hWinEventHook == NULL)
+		{
+			Win32Exception err(::GetLastError());
+			TRACE(L"SetWinEventHook returns error (%lu) : %S\n", err.GetErrorCode(), err.what());
+		}
+	}
+
+	m_bWinEvents = (hWinEventHook != NULL);
+
+	HANDLE arrWaitHandles[8] =
 	{
 		m_hMonitorThreadExit.get(),
 		m_consoleCopyInfo.GetReqEvent(),
@@ -1240,24 +1929,84 @@ DWORD ConsoleHandler::MonitorThread()
 		m_consoleMouseEvent.GetReqEvent(),
 		m_newConsoleSize.GetReqEvent(),
 		m_consoleMsgPipe.Get(),
-		hStdOut,
 	};
 
-	DWORD dwWaitRes = 0;
+	DWORD dwWaitHandleCount = 6;
+
+	// when polling, STDOUT is signaled on console changes
+	if (!m_bWinEvents) arrWaitHandles[dwWaitHandleCount++] = hStdOut;
+
+	// watchdog mutex is owned by Console, it gets abandoned when Console dies
+	DWORD dwWatchdogIndex = dwWaitHandleCount;
 
-	while ((dwWaitRes = ::WaitForMultipleObjects(
-							ARRAYSIZE(arrWaitHandles),
+	if (parentProcessWatchdog.get() != NULL) arrWaitHandles[dwWaitHandleCount++] = parentProcessWatchdog.get();
+
+	DWORD dwWaitRes     = 0;
+	DWORD dwLastRefresh = ::GetTickCount();
+
+	for (;;)
+	{
+		bool bTextPending = SendPendingText(hStdIn);
+		bool bRefresh     = !m_bWinEvents || m_bScreenTooSmall || (m_sHistoryStaleRows > m_sHistoryStaleTop);
+
+		// while pasting, we wake up often to keep the console input topped
+		// up, but still refresh only every dwRefreshInterval
+		DWORD dwTimeout = bRefresh ? m_consoleParams->dwRefreshInterval : INFINITE;
+
+		if (bTextPending) dwTimeout = min(dwTimeout, static_cast<DWORD>(PASTE_POLL_INTERVAL));
+
+		if (m_bWinEvents)
+		{
+			// no timeout, we wake up on WinEvents (unless we're waiting for
+			// Console to remap the screen, re-reading stale history rows or
+			// pasting text)
+			dwWaitRes = ::MsgWaitForMultipleObjects(
+							dwWaitHandleCount,
 							arrWaitHandles,
 							FALSE,
-							m_consoleParams->dwRefreshInterval)) != WAIT_OBJECT_0)
-	{
-		if ((parentProcessWatchdog.get() != NULL) && (::WaitForSingleObject(parentProcessWatchdog.get(), 0) == WAIT_ABANDONED))
+							dwTimeout,
+							QS_ALLINPUT);
+		}
+		else
+		{
+			dwWaitRes = ::WaitForMultipleObjects(
+							dwWaitHandleCount,
+							arrWaitHandles,
+							FALSE,
+							dwTimeout);
+		}
+
+		if ((dwWaitRes == WAIT_TIMEOUT) && bTextPending)
+		{
+			if (!bRefresh || (::GetTickCount() - dwLastRefresh < m_consoleParams->dwRefreshInterval)) continue;
+		}
+
+		if (dwWaitRes == WAIT_OBJECT_0) break;
+
+		if ((parentProcessWatchdog.get() != NULL) &&
+			((dwWaitRes == WAIT_OBJECT_0 + dwWatchdogIndex) || (dwWaitRes == WAIT_ABANDONED_0 + dwWatchdogIndex)))
 		{
 			TRACE(L"Watchdog 0x%08X died. Time to exit", parentProcessWatchdog.get());
 			::SendMessage(m_consoleParams->hwndConsoleWindow, WM_CLOSE, 0, 0);
 			break;
 		}
 
+		// WinEvents are delivered while we dispatch messages, we read the
+		// console once for all of them
+		if (m_bWinEvents && (dwWaitRes == WAIT_OBJECT_0 + dwWaitHandleCount))
+		{
+			MSG msg;
+
+			while (::PeekMessage(&msg, NULL, 0, 0, PM_REMOVE))
+			{
+				::TranslateMessage(&msg);
+				::DispatchMessage(&msg);
+			}
+
+			if (m_bDirty) ReadConsoleBuffer();
+			continue;
+		}
+
 		switch (dwWaitRes)
 		{
 			// copy request
@@ -1273,9 +2022,15 @@ DWORD ConsoleHandler::MonitorThread()
 			// console scroll request
 			case WAIT_OBJECT_0 + 2 :
 			{
-				SharedMemoryLock memLock(m_newScrollPos);
+				{
+					// Console adds up scroll requests until we take them
+					SharedMemoryLock memLock(m_newScrollPos);
+
+					ScrollConsole(hStdOut, m_newScrollPos->cx, m_newScrollPos->cy);
+					m_newScrollPos->cx = 0;
+					m_newScrollPos->cy = 0;
+				}
 
-				ScrollConsole(hStdOut, m_newScrollPos->cx, m_newScrollPos->cy);
 				ReadConsoleBuffer();
 				break;
 			}
@@ -1304,159 +2059,17 @@ DWORD ConsoleHandler::MonitorThread()
 			{
 				try
 				{
-					npmsglen += m_consoleMsgPipe.EndAsync();
-
-					if( text.get() )
-					{
-						if( npmsglen == (npmsg.data.text.dwTextLen * sizeof(wchar_t)) )
-						{
-							text.get()[npmsg.data.text.dwTextLen] = 0;
-
-							SendConsoleText(hStdIn, text.get(), npmsg.data.text.dwTextLen);
-
-							text.reset();
-							npmsglen = 0;
-						}
-					}
-					else
-					{
-						if( npmsglen == sizeof(NamedPipeMessage) )
-						{
-							switch( npmsg.type )
-							{
-							case NamedPipeMessage::POSTMESSAGE:
-								TRACE(
-									L"NamedPipeMessage::POSTMESSAGE Msg = 0x%08lx WPARAM = %p LPARAM = %p\n",
-									npmsg.data.winmsg.msg,
-									npmsg.data.winmsg.wparam,
-									npmsg.data.winmsg.lparam);
-
-								if( !::PostMessage(
-									m_consoleParams->hwndConsoleWindow,
-									npmsg.data.winmsg.msg,
-									npmsg.data.winmsg.wparam,
-									npmsg.data.winmsg.lparam) )
-								{
-#ifdef _DEBUG
-									Win32Exception err(::GetLastError());
-									TRACE(
-										L"PostMessage Msg = 0x%08lx WPARAM = %p LPARAM = %p fails (reason: %S)\n",
-										npmsg.data.winmsg.msg,
-										npmsg.data.winmsg.wparam,
-										npmsg.data.winmsg.lparam,
-										err.what());
-#endif
-								}
-								break;
-
-							case NamedPipeMessage::SENDMESSAGE:
-								TRACE(
-									L"NamedPipeMessage::SENDMESSAGE Msg = 0x%08lx WPARAM = %p LPARAM = %p\n",
-									npmsg.data.winmsg.msg,
-									npmsg.data.winmsg.wparam,
-									npmsg.data.winmsg.lparam);
-
-#ifdef _DEBUG
-								{
-									LRESULT res = ::SendMessage(
-										m_consoleParams->hwndConsoleWindow,
-										npmsg.data.winmsg.msg,
-										npmsg.data.winmsg.wparam,
-										npmsg.data.winmsg.lparam);
-									TRACE(
-										L"SendMessage Msg = 0x%08lx WPARAM = %p LPARAM = %p returns %p (last error 0x%08lx)\n",
-										npmsg.data.winmsg.msg,
-										npmsg.data.winmsg.wparam,
-										npmsg.data.winmsg.lparam,
-										res,
-										GetLastError());
-								}
-#else
-								::SendMessage(
-									m_consoleParams->hwndConsoleWindow,
-									npmsg.data.winmsg.msg,
-									npmsg.data.winmsg.wparam,
-									npmsg.data.winmsg.lparam);
-#endif
-								break;
-
-							case NamedPipeMessage::SHOWWINDOW:
-								TRACE(
-									L"NamedPipeMessage::SHOWWINDOW nCmdShow = %ld\n",
-									npmsg.data.show.nCmdShow);
-
-								::ShowWindow(
-									m_consoleParams->hwndConsoleWindow,
-									npmsg.data.show.nCmdShow);
-								break;
-
-							case NamedPipeMessage::SETWINDOWPOS:
-								TRACE(
-									L"NamedPipeMessage::SETWINDOWPOS X = %d Y = %d cx = %d cy = %d uFlags = 0x%08lx\n",
-										npmsg.data.windowpos.X,
-										npmsg.data.windowpos.Y,
-										npmsg.data.windowpos.cx,
-										npmsg.data.windowpos.cy,
-										npmsg.data.windowpos.uFlags);
-
-								::SetWindowPos(
-									m_consoleParams->hwndConsoleWindow,
-									NULL,
-									npmsg.data.windowpos.X,
-									npmsg.data.windowpos.Y,
-									npmsg.data.windowpos.cx,
-									npmsg.data.windowpos.cy,
-									npmsg.data.windowpos.uFlags);
-								break;
-
-							case NamedPipeMessage::SENDTEXT:
-								TRACE(
-									L"NamedPipeMessage::SENDTEXT dwTextLen = %lu\n",
-									npmsg.data.text.dwTextLen);
-
-								text.reset(new wchar_t[npmsg.data.text.dwTextLen + 1]);
-								break;
-
-							case NamedPipeMessage::WRITECONSOLEINPUT:
-								{
-									INPUT_RECORD record;
-									record.EventType = KEY_EVENT;
-									record.Event.KeyEvent = npmsg.data.keyEvent;
-
-									TRACE(
-										L"NamedPipeMessage::WRITECONSOLEINPUT\n"
-										L"  bKeyDown          = %s\n"
-										L"  dwControlKeyState = 0x%08lx\n"
-										L"  UnicodeChar       = 0x%04hx\n"
-										L"  wRepeatCount      = %hu\n"
-										L"  wVirtualKeyCode   = 0x%04hx\n"
-										L"  wVirtualScanCode  = 0x%04hx\n",
-										record.Event.KeyEvent.bKeyDown?"TRUE":"FALSE",
-										record.Event.KeyEvent.dwControlKeyState,
-										record.Event.KeyEvent.uChar.UnicodeChar,
-										record.Event.KeyEvent.wRepeatCount,
-										record.Event.KeyEvent.wVirtualKeyCode,
-										record.Event.KeyEvent.wVirtualScanCode);
-
-									DWORD dwTextWritten = 0;
-									::WriteConsoleInput(hStdIn, &record, 1, &dwTextWritten);
-								}
-								break;
-							}
-
-							npmsglen = 0;
-						}
-					}
-
-					if( text.get() )
-						m_consoleMsgPipe.BeginReadAsync(reinterpret_cast<LPBYTE>(text.get()) + npmsglen, static_cast<size_t>(npmsg.data.text.dwTextLen) * sizeof(wchar_t) - npmsglen);
-					else
-						m_consoleMsgPipe.BeginReadAsync(reinterpret_cast<LPBYTE>(&npmsg) + npmsglen, sizeof(NamedPipeMessage) - npmsglen);
+					OnPipeRead(hStdIn, m_consoleMsgPipe.EndAsync());
+					BeginPipeRead();
 				}
 				catch(std::exception&)
 				{
 					// receives ERROR_BROKEN_PIPE when the tab is closed
 				}
+
+				// with WinEvents the console reports what the input changed,
+				// otherwise we poll after it like for any other change
+				if (m_bWinEvents) break;
 			}
 
 			case WAIT_OBJECT_0 + 6 :
@@ -1468,13 +2081,90 @@ DWORD ConsoleHandler::MonitorThread()
 			{
 				// refresh timer
 				ReadConsoleBuffer();
+				dwLastRefresh = ::GetTickCount();
 				break;
 			}
 		}
 	}
 
+	if (hWinEventHook != NULL) ::UnhookWinEvent(hWinEventHook);
+	s_pWinEventHandler = NULL;
+
 	return 0;
 }
 
 //////////////////////////////////////////////////////////////////////////////
 
+
+//////////////////////////////////////////////////////////////////////////////
+
+void CALLBACK ConsoleHandler::WinEventProcStatic(HWINEVENTHOOK /*hWinEventHook*/, DWORD dwEvent, HWND hwnd, LONG idObject, LONG idChild, DWORD /*dwEventThread*/, DWORD /*dwmsEventTime*/)
+{
+	if ((s_pWinEventHandler == NULL) || (hwnd != s_pWinEventHandler->m_consoleParams->hwndConsoleWindow)) return;
+
+	s_pWinEventHandler->OnWinEvent(dwEvent, idObject, idChild);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void ConsoleHandler::OnWinEvent(DWORD dwEvent, LONG idObject, LONG idChild)
+{
+	switch (dwEvent)
+	{
+		// idObject and idChild are the region corners (x in the low word, y
+		// in the high word, buffer coordinates)
+		case EVENT_CONSOLE_UPDATE_REGION :
+			AddDirtyRows(static_cast<SHORT>(HIWORD(idObject)), static_cast<SHORT>(HIWORD(idChild)));
+			break;
+
+		// idObject is the changed cell
+		case EVENT_CONSOLE_UPDATE_SIMPLE :
+			AddDirtyRows(static_cast<SHORT>(HIWORD(idObject)), static_cast<SHORT>(HIWORD(idObject)));
+			break;
+
+		// buffer contents have scrolled, or the window has changed
+		case EVENT_CONSOLE_UPDATE_SCROLL :
+		case EVENT_CONSOLE_LAYOUT :
+			m_bDirty    = true;
+			m_bDirtyAll = true;
+			break;
+
+		// idChild is the caret position, idObject the caret flags; the caret
+		// rows are always read, we only need to know it has moved (conhost
+		// raises this on caret blinks, too)
+		case EVENT_CONSOLE_CARET :
+			if (idChild != m_lLastCaret)
+			{
+				m_lLastCaret = idChild;
+				m_bDirty     = true;
+			}
+			break;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+void ConsoleHandler::AddDirtyRows(SHORT sTop, SHORT sBottom)
+{
+	if (m_sDirtyTop > m_sDirtyBottom)
+	{
+		m_sDirtyTop    = sTop;
+		m_sDirtyBottom = sBottom;
+	}
+	else
+	{
+		m_sDirtyTop    = min(m_sDirtyTop, sTop);
+		m_sDirtyBottom = max(m_sDirtyBottom, sBottom);
+	}
+
+	m_bDirty = true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
@@ -2,6 +2,29 @@
 
 //////////////////////////////////////////////////////////////////////////////
 
+// max interval between full captures of the console window (ms), we read
+// only rows around the cursor in between
+#define FULL_CAPTURE_INTERVAL	100
+
+// ReadConsoleOutput fails for large (around 6k CHAR_INFO's) buffers on some
+// conhost versions, we start with a bigger read and shrink down to this
+#define SAFE_READ_CELLS			6144
+#define INITIAL_READ_CELLS		65536
+
+// max number of stale history cells we re-read per ReadConsoleBuffer call,
+// and of cells above the window we search for the previous window when the
+// buffer has scrolled by more than a window
+#define HISTORY_REFRESH_CELLS	65536
+
+// pasted text is written to the console input while it has fewer than this
+// many events pending
+#define PASTE_INPUT_EVENTS		512
+
+// how often (ms) we top up the console input while text is pending
+#define PASTE_POLL_INTERVAL		5
+
+//////////////////////////////////////////////////////////////////////////////
+
 
 //////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////
@@ -25,14 +48,38 @@ class ConsoleHandler
 	private:
 
 		bool OpenSharedObjects();
+		bool OpenConsoleScreen(DWORD dwVersion);
+		void OpenConsoleHistory();
 
 		void ReadConsoleBuffer();
+		bool ReadWindowRows(HANDLE hStdOut, const SMALL_RECT& srWindow, SHORT sFirstRow, SHORT sRowCount);
+		bool ReadConsoleRows(HANDLE hStdOut, const SMALL_RECT& srRegion, CHAR_INFO* pBuffer);
+		void UpdateConsoleHistory(HANDLE hStdOut, const CONSOLE_SCREEN_BUFFER_INFO& csbi, LONG lBufferScroll);
+		bool CatchUpConsoleHistory(HANDLE hStdOut, const CONSOLE_SCREEN_BUFFER_INFO& csbi);
+		void RefreshConsoleHistory(HANDLE hStdOut);
+		void MarkHistoryStale(SHORT sTop, SHORT sBottom);
+		static unsigned __int64 HashRow(const CHAR_INFO* pRow, DWORD dwColumns);
+		static LONG DetectScroll(const std::vector<unsigned __int64>& oldHashes, const std::vector<unsigned __int64>& newHashes);
+
+		static void CALLBACK WinEventProcStatic(HWINEVENTHOOK hWinEventHook, DWORD dwEvent, HWND hwnd, LONG idObject, LONG idChild, DWORD dwEventThread, DWORD dwmsEventTime);
+		void OnWinEvent(DWORD dwEvent, LONG idObject, LONG idChild);
+		void AddDirtyRows(SHORT sTop, SHORT sBottom);
 
 		void ResizeConsoleWindow(HANDLE hStdOut, DWORD& dwColumns, DWORD& dwRows, DWORD dwResizeWindowEdge);
 
 		void CopyConsoleText();
 
-		void SendConsoleText(HANDLE hStdIn, const wchar_t*	pszText, size_t	textLen);
+		// messages from Console are read in batches, as many as the pipe has
+		void BeginPipeRead();
+		void OnPipeRead(HANDLE hStdIn, size_t readLen);
+		void DispatchPipeMessage(const NamedPipeMessage& npmsg);
+		void WritePipeInput(HANDLE hStdIn);
+		void SendPipeText(HANDLE hStdIn);
+
+		// pasted text is queued and written as the console reads its input
+		bool SendPendingText(HANDLE hStdIn);
+		void CancelPendingText();
+		BYTE GetCharVirtualKey(wchar_t ch);
 
 		void SendMouseEvent(HANDLE hStdIn);
 
@@ -53,7 +100,8 @@ class ConsoleHandler
 		SharedMemory<ConsoleParams>       m_consoleParams;
 		SharedMemory<ConsoleInfo>         m_consoleInfo;
 		SharedMemory<CONSOLE_CURSOR_INFO> m_cursorInfo;
-		SharedMemory<CHAR_INFO>           m_consoleBuffer;
+		SharedMemory<ConsoleScreen>       m_consoleScreen;
+		SharedMemory<ConsoleHistory>      m_consoleHistory;
 		SharedMemory<ConsoleCopy>         m_consoleCopyInfo;
 		SharedMemory<MOUSE_EVENT_RECORD>  m_consoleMouseEvent;
 
@@ -65,7 +113,74 @@ class ConsoleHandler
 		std::shared_ptr<void>             m_hMonitorThread;
 		std::shared_ptr<void>             m_hMonitorThreadExit;
 
+		DWORD                             m_dwScreenVersion;
 		DWORD                             m_dwScreenBufferSize;
+
+		// last published frame
+		DWORD                             m_dwFrame;
+		DWORD                             m_dwTextFrame;
+		LONG                              m_lScrollOffset;
+		CONSOLE_SCREEN_BUFFER_INFO        m_lastConsoleInfo;
+		CONSOLE_CURSOR_INFO               m_lastCursorInfo;
+		// the console window didn't fit the shared screen
+		bool                              m_bScreenTooSmall;
+
+		// console window capture, kept between ReadConsoleBuffer calls
+		std::unique_ptr<CHAR_INFO[]>      m_captureBuffer;
+		DWORD                             m_dwCaptureBufferSize;
+		DWORD                             m_dwMaxReadCells;
+		bool                              m_bCaptureValid;
+		DWORD                             m_dwLastFullCapture;
+		SMALL_RECT                        m_srCaptureWindow;
+		COORD                             m_coordCaptureBufferSize;
+		COORD                             m_coordCaptureCursor;
+
+		// per-row hashes and change frames of the last published screen
+		std::vector<unsigned __int64>     m_rowHashes;
+		std::vector<DWORD>                m_rowFrames;
+
+		// row hashes of a full capture, compared with m_rowHashes to detect
+		// scrolling
+		std::vector<unsigned __int64>     m_newRowHashes;
+
+		// console buffer size the history is mirroring; rows
+		// m_sHistoryStaleTop..m_sHistoryStaleRows-1 can be stale, we re-read
+		// them a few at a time (bottom-up)
+		COORD                             m_coordHistorySize;
+		SHORT                             m_sHistoryStaleTop;
+		SHORT                             m_sHistoryStaleRows;
+		std::unique_ptr<CHAR_INFO[]>      m_historyBuffer;
+
+		// changes reported by console WinEvents since the last capture
+		// (buffer rows); only used when the events are hooked
+		static ConsoleHandler*            s_pWinEventHandler;
+		bool                              m_bWinEvents;
+		bool                              m_bDirty;
+		bool                              m_bDirtyAll;
+		SHORT                             m_sDirtyTop;
+		SHORT                             m_sDirtyBottom;
+		LONG                              m_lLastCaret;
+
+		// pipe messages read so far (the last one can be partial), the text
+		// of a SENDTEXT message being read, and the key events of a batch
+		std::unique_ptr<BYTE[]>           m_pipeBuffer;
+		size_t                            m_pipeBufferLen;
+		std::unique_ptr<wchar_t[]>        m_pipeText;
+		DWORD                             m_dwPipeTextLen;
+		size_t                            m_pipeTextRead;
+		std::vector<INPUT_RECORD>         m_inputRecords;
+
+		// text waiting for the console input and the part already written;
+		// key events that come in meanwhile are held until it's all written
+		wstring                           m_strPendingText;
+		size_t                            m_pendingTextPos;
+		std::vector<INPUT_RECORD>         m_textRecords;
+		std::vector<INPUT_RECORD>         m_heldInput;
+
+		// virtual keys of chars for the current keyboard layout, looked up
+		// once per char (0 if not looked up yet)
+		HKL                               m_hklVirtualKeys;
+		std::unique_ptr<BYTE[]>           m_virtualKeys;
 };
 
 //////////////////////////////////////////////////////////////////////////////
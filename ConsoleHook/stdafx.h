@@ -22,6 +22,7 @@
 #include <dbghelp.h>
 
 #include <string>
+#include <vector>
 using namespace std;
 
 #pragma warning(push)
@@ -0,0 +1,188 @@
+//////////////////////////////////////////////////////////////////////////////
+// CellKernelsTests.cpp - SIMD cell kernels against the scalar ones
+
+#include "stdafx.h"
+#include "ConsoleTests.h"
+#include "../Console/CellKernels.h"
+
+// rows up to this long, so every SSE2 and AVX2 tail length is covered after
+// one or more full blocks
+#define MAX_ROW_COLUMNS		47
+#define MAX_START_OFFSET	7
+#define MAX_BIT_WORDS		67
+#define RANDOM_ITERATIONS	2000
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+// deterministic, so failures can be reproduced
+static DWORD NextRandom(DWORD& dwSeed)
+{
+	dwSeed = dwSeed * 1664525 + 1013904223;
+	return dwSeed;
+}
+
+// a row of random cells
+static void FillCells(CHAR_INFO* pCells, DWORD dwCount, DWORD& dwSeed)
+{
+	for (DWORD i = 0; i < dwCount; ++i)
+	{
+		DWORD dwCell = NextRandom(dwSeed);
+		::CopyMemory(pCells + i, &dwCell, sizeof(CHAR_INFO));
+	}
+}
+
+// copies the same source over the same destination with both kernels, for
+// every row length and start offset (guard cells around the row must stay
+// untouched), with rows that are equal, differ in one cell or differ in
+// random cells
+static bool CompareCopyRow(CellKernels::CopyRowFunc pfnKernel)
+{
+	const DWORD dwCells = MAX_START_OFFSET + MAX_ROW_COLUMNS + 1;
+
+	CHAR_INFO arrSrc[dwCells];
+	CHAR_INFO arrDestScalar[dwCells];
+	CHAR_INFO arrDestKernel[dwCells];
+	DWORD     dwSeed = 0x4321;
+
+	for (DWORD dwColumns = 0; dwColumns <= MAX_ROW_COLUMNS; ++dwColumns)
+	{
+		for (DWORD dwOffset = 0; dwOffset <= MAX_START_OFFSET; ++dwOffset)
+		{
+			// -1 for equal rows, -2 for random cells, the changed cell otherwise
+			for (int nChanged = -2; nChanged < static_cast<int>(dwColumns); ++nChanged)
+			{
+				FillCells(arrDestScalar, dwCells, dwSeed);
+				::CopyMemory(arrSrc, arrDestScalar, sizeof(arrSrc));
+
+				// cells around the row differ, so a kernel writing past it shows
+				for (DWORD i = 0; i < dwCells; ++i)
+				{
+					if ((i < dwOffset) || (i >= dwOffset + dwColumns)) FillCells(arrSrc + i, 1, dwSeed);
+				}
+
+				if (nChanged == -2)
+				{
+					for (DWORD i = 0; i < dwColumns; ++i)
+					{
+						if (NextRandom(dwSeed) & 0x100) FillCells(arrSrc + dwOffset + i, 1, dwSeed);
+					}
+				}
+				else if (nChanged >= 0)
+				{
+					arrSrc[dwOffset + nChanged].Attributes ^= 0x10;
+				}
+
+				::CopyMemory(arrDestKernel, arrDestScalar, sizeof(arrDestKernel));
+
+				bool bScalar = CellKernels::CopyRowScalar(arrDestScalar + dwOffset, arrSrc + dwOffset, dwColumns);
+				bool bKernel = pfnKernel(arrDestKernel + dwOffset, arrSrc + dwOffset, dwColumns);
+
+				if ((bScalar != bKernel) || (memcmp(arrDestScalar, arrDestKernel, sizeof(arrDestScalar)) != 0))
+				{
+					wprintf(L"  mismatch: %lu columns at offset %lu, changed %d\n", dwColumns, dwOffset, nChanged);
+					return false;
+				}
+
+				if (nChanged == -1) CHECK(!bKernel);
+				if (nChanged >= 0) CHECK(bKernel);
+			}
+		}
+	}
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+CONSOLE_TEST(CellKernelsCopyRowSSE2MatchesScalar)
+{
+	if (!CellKernels::HasSSE2())
+	{
+		wprintf(L"  no SSE2, skipped\n");
+		return true;
+	}
+
+	CHECK(CompareCopyRow(CellKernels::CopyRowSSE2));
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+CONSOLE_TEST(CellKernelsCopyRowAVX2MatchesScalar)
+{
+	if (!CellKernels::HasAVX2())
+	{
+		wprintf(L"  no AVX2, skipped\n");
+		return true;
+	}
+
+	CHECK(CompareCopyRow(CellKernels::CopyRowAVX2));
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+CONSOLE_TEST(CellKernelsCountBitsPopcntMatchesScalar)
+{
+	if (!CellKernels::HasPopcnt())
+	{
+		wprintf(L"  no POPCNT, skipped\n");
+		return true;
+	}
+
+	DWORD arrWords[MAX_BIT_WORDS + 1];
+	DWORD dwSeed = 0x5678;
+
+	// edge words first, then random ones
+	DWORD arrEdges[] = { 0x00000000, 0xFFFFFFFF, 0x80000000, 0x00000001, 0x55555555 };
+
+	for (size_t i = 0; i < _countof(arrEdges); ++i)
+	{
+		CHECK(CellKernels::CountBitsPopcnt(arrEdges + i, 1) == CellKernels::CountBitsScalar(arrEdges + i, 1));
+	}
+
+	for (int i = 0; i < RANDOM_ITERATIONS; ++i)
+	{
+		DWORD dwWords  = NextRandom(dwSeed) % (MAX_BIT_WORDS + 1);
+		DWORD dwOffset = NextRandom(dwSeed) & 1;
+
+		for (size_t j = 0; j < _countof(arrWords); ++j) arrWords[j] = NextRandom(dwSeed);
+
+		if (dwWords + dwOffset > MAX_BIT_WORDS + 1) dwWords = MAX_BIT_WORDS + 1 - dwOffset;
+
+		DWORD dwScalar = CellKernels::CountBitsScalar(arrWords + dwOffset, dwWords);
+		DWORD dwPopcnt = CellKernels::CountBitsPopcnt(arrWords + dwOffset, dwWords);
+
+		if (dwScalar != dwPopcnt)
+		{
+			wprintf(L"  mismatch: %lu words at offset %lu, %lu != %lu\n", dwWords, dwOffset, dwPopcnt, dwScalar);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
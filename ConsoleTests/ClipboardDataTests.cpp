@@ -0,0 +1,201 @@
+//////////////////////////////////////////////////////////////////////////////
+// ClipboardDataTests.cpp - clipboard builders fed by color runs
+
+#include "stdafx.h"
+#include "ConsoleTests.h"
+#include "../ConsoleHook/ClipboardData.h"
+
+#define BENCH_COLUMNS		200
+#define BENCH_ROWS			5000
+
+// gray on black, the console default
+#define DEFAULT_ATTRIBUTES	(FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE)
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+static CHAR_INFO MakeCell(wchar_t wch, WORD wAttributes)
+{
+	CHAR_INFO cell;
+
+	cell.Char.UnicodeChar = wch;
+	cell.Attributes       = wAttributes;
+
+	return cell;
+}
+
+// rows of text with the colors changing every few chars (the way colored
+// ls or compiler output looks), or plain
+static void MakeRows(vector<CHAR_INFO>& cells, SHORT sColumns, SHORT sRows, bool bColored)
+{
+	DWORD dwSeed = 0x4321;
+
+	cells.resize(static_cast<size_t>(sColumns) * sRows);
+
+	WORD wAttributes = DEFAULT_ATTRIBUTES;
+
+	for (size_t i = 0; i < cells.size(); ++i)
+	{
+		dwSeed = dwSeed * 1664525 + 1013904223;
+
+		if (bColored && ((dwSeed >> 28) == 0)) wAttributes = static_cast<WORD>((dwSeed >> 8) & 0x00ff);
+
+		cells[i] = MakeCell(static_cast<wchar_t>(L' ' + (dwSeed >> 16) % 95), wAttributes);
+	}
+}
+
+// the way rows were added before color runs, one char at a time
+static void AddCopyRowChars(const CHAR_INFO* pRow, SHORT sLeft, SHORT sRight, std::unique_ptr<ClipboardData> clipboardDataPtr[], size_t clipboardDataCount)
+{
+	for (SHORT x = sLeft; x <= sRight; ++x)
+	{
+		if (pRow[x].Attributes & COMMON_LVB_TRAILING_BYTE) continue;
+
+		for(size_t clipboardDataIndex = 0; clipboardDataIndex < clipboardDataCount; clipboardDataIndex ++)
+			clipboardDataPtr[clipboardDataIndex]->AddChar(pRow + x);
+	}
+}
+
+typedef void (*AddRowFunc)(const CHAR_INFO* pRow, SHORT sLeft, SHORT sRight, std::unique_ptr<ClipboardData> clipboardDataPtr[], size_t clipboardDataCount);
+
+static void CopyRows(const vector<CHAR_INFO>& cells, SHORT sColumns, AddRowFunc pfnAddRow, std::unique_ptr<ClipboardData> clipboardDataPtr[], size_t clipboardDataCount)
+{
+	size_t sizeRows = cells.size() / sColumns;
+
+	for(size_t clipboardDataIndex = 0; clipboardDataIndex < clipboardDataCount; clipboardDataIndex ++)
+		clipboardDataPtr[clipboardDataIndex]->Reserve(cells.size(), sizeRows);
+
+	for (size_t i = 0; i < sizeRows; ++i)
+	{
+		for(size_t clipboardDataIndex = 0; clipboardDataIndex < clipboardDataCount; clipboardDataIndex ++)
+			clipboardDataPtr[clipboardDataIndex]->StartRow();
+
+		pfnAddRow(&cells[i * sColumns], 0, static_cast<SHORT>(sColumns - 1), clipboardDataPtr, clipboardDataCount);
+
+		for(size_t clipboardDataIndex = 0; clipboardDataIndex < clipboardDataCount; clipboardDataIndex ++)
+		{
+			clipboardDataPtr[clipboardDataIndex]->TrimRight();
+			clipboardDataPtr[clipboardDataIndex]->Wrap(newlineCRLF);
+			clipboardDataPtr[clipboardDataIndex]->EndRow();
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+CONSOLE_TEST(ClipboardAnsiOmitsDefaultBackground)
+{
+	CHAR_INFO arrRow[] =
+	{
+		MakeCell(L'a', 0x07), MakeCell(L'b', 0x07),
+		MakeCell(L'c', 0x1F), MakeCell(L'd', 0x1F),
+		MakeCell(L'e', 0x0A), MakeCell(L'f', 0x0A),
+	};
+
+	std::unique_ptr<ClipboardData> clipboardDataPtr[1];
+	ClipboardDataAnsi*             pAnsi = new ClipboardDataAnsi(DEFAULT_ATTRIBUTES);
+
+	clipboardDataPtr[0].reset(pAnsi);
+
+	pAnsi->StartRow();
+	AddCopyRow(arrRow, 0, static_cast<SHORT>(_countof(arrRow) - 1), clipboardDataPtr, 1);
+	pAnsi->EndRow();
+
+	CHECK(pAnsi->GetText() == L"\x1b[0;37mab\x1b[0;97;44mcd\x1b[0;92mef");
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+CONSOLE_TEST(ClipboardRunsMatchChars)
+{
+	vector<CHAR_INFO> cells;
+
+	MakeRows(cells, 80, 50, true);
+
+	// a double width char, its trailing byte is skipped
+	cells[10].Attributes |= COMMON_LVB_LEADING_BYTE;
+	cells[11].Attributes |= COMMON_LVB_TRAILING_BYTE;
+
+	std::unique_ptr<ClipboardData> runsPtr[1];
+	std::unique_ptr<ClipboardData> charsPtr[1];
+	ClipboardDataAnsi*             pRuns  = new ClipboardDataAnsi(DEFAULT_ATTRIBUTES);
+	ClipboardDataAnsi*             pChars = new ClipboardDataAnsi(DEFAULT_ATTRIBUTES);
+
+	runsPtr[0].reset(pRuns);
+	charsPtr[0].reset(pChars);
+
+	CopyRows(cells, 80, AddCopyRow, runsPtr, 1);
+	CopyRows(cells, 80, AddCopyRowChars, charsPtr, 1);
+
+	CHECK(!pRuns->GetText().empty());
+	CHECK(pRuns->GetText() == pChars->GetText());
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Builds all four formats from a big selection, adding rows in color runs
+// and one char at a time
+
+CONSOLE_BENCHMARK(ClipboardDataBenchmark)
+{
+	ConsoleCopy consoleCopy;
+
+	for (int nColored = 0; nColored < 2; ++nColored)
+	{
+		vector<CHAR_INFO> cells;
+
+		MakeRows(cells, BENCH_COLUMNS, BENCH_ROWS, nColored != 0);
+
+		AddRowFunc     arrAddRow[] = { AddCopyRow, AddCopyRowChars };
+		const wchar_t* arrNames[]  = { L"runs", L"chars" };
+
+		for (size_t k = 0; k < _countof(arrAddRow); ++k)
+		{
+			std::unique_ptr<ClipboardData> clipboardDataPtr[4];
+
+			clipboardDataPtr[0].reset(new ClipboardDataUnicode());
+			clipboardDataPtr[1].reset(new ClipboardDataRtf(&consoleCopy));
+			clipboardDataPtr[2].reset(new ClipboardDataHtml(&consoleCopy));
+			clipboardDataPtr[3].reset(new ClipboardDataAnsi(DEFAULT_ATTRIBUTES));
+
+			BenchTimer timer;
+
+			CopyRows(cells, BENCH_COLUMNS, arrAddRow[k], clipboardDataPtr, _countof(clipboardDataPtr));
+
+			wprintf(L"  %-8s %-6s %8.3f ms\n", nColored ? L"colored" : L"plain", arrNames[k], timer.GetMs());
+		}
+	}
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,101 @@
+//////////////////////////////////////////////////////////////////////////////
+// ConsoleTests.cpp - standalone tests and benchmarks for Console's internals
+
+#include "stdafx.h"
+#include "ConsoleTests.h"
+
+CAppModule	_Module;
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+struct TestInfo
+{
+	const wchar_t*	pszName;
+	TestFunc		pfnTest;
+	bool			bBenchmark;
+};
+
+// tests register themselves during static init, so the list can't be a
+// plain global
+static vector<TestInfo>& GetTests()
+{
+	static vector<TestInfo> tests;
+	return tests;
+}
+
+TestRegistration::TestRegistration(const wchar_t* pszName, TestFunc pfnTest, bool bBenchmark)
+{
+	TestInfo testInfo = { pszName, pfnTest, bBenchmark };
+	GetTests().push_back(testInfo);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+// usage: ConsoleTests [/bench] [test name ...]
+
+int wmain(int argc, wchar_t* argv[])
+{
+	bool				bBenchmarks = false;
+	set<wstring>		names;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (_wcsicmp(argv[i], L"/bench") == 0)
+		{
+			bBenchmarks = true;
+		}
+		else
+		{
+			names.insert(argv[i]);
+		}
+	}
+
+	// renderers see the real DPI, scaling bugs are hidden when we're DPI
+	// virtualized
+	::SetProcessDPIAware();
+
+	int nRun    = 0;
+	int nFailed = 0;
+
+	for (vector<TestInfo>::const_iterator it = GetTests().begin(); it != GetTests().end(); ++it)
+	{
+		if (!names.empty())
+		{
+			if (names.find(it->pszName) == names.end()) continue;
+		}
+		else if (it->bBenchmark && !bBenchmarks)
+		{
+			continue;
+		}
+
+		wprintf(L"%s\n", it->pszName);
+
+		++nRun;
+		if (!it->pfnTest())
+		{
+			wprintf(L"  FAILED\n");
+			++nFailed;
+		}
+	}
+
+	wprintf(L"%d run, %d failed\n", nRun, nFailed);
+
+	return (nFailed == 0) ? 0 : 1;
+}
+
+//////////////////////////////////////////////////////////////////////////////
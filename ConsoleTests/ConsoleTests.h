@@ -0,0 +1,78 @@
+//////////////////////////////////////////////////////////////////////////////
+// ConsoleTests.h - standalone tests and benchmarks for Console's internals
+
+#pragma once
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Tests return false on the first failed CHECK. Benchmarks print timings
+// and run only when asked for (ConsoleTests.exe /bench).
+
+typedef bool (*TestFunc)();
+
+#define TEST_WIDEN2(x)	L ## x
+#define TEST_WIDEN(x)	TEST_WIDEN2(x)
+
+struct TestRegistration
+{
+	TestRegistration(const wchar_t* pszName, TestFunc pfnTest, bool bBenchmark);
+};
+
+#define CONSOLE_TEST(name) \
+	static bool name(); \
+	static TestRegistration s_reg##name(TEST_WIDEN(#name), name, false); \
+	static bool name()
+
+#define CONSOLE_BENCHMARK(name) \
+	static bool name(); \
+	static TestRegistration s_reg##name(TEST_WIDEN(#name), name, true); \
+	static bool name()
+
+#define CHECK(expr) \
+	if (!(expr)) \
+	{ \
+		wprintf(L"  %S(%d): CHECK(%S) failed\n", __FILE__, __LINE__, #expr); \
+		return false; \
+	}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+// High resolution timer for benchmarks
+
+class BenchTimer
+{
+	public:
+		BenchTimer()
+		{
+			::QueryPerformanceFrequency(&m_frequency);
+			::QueryPerformanceCounter(&m_start);
+		}
+
+		double GetMs() const
+		{
+			LARGE_INTEGER now;
+			::QueryPerformanceCounter(&now);
+			return static_cast<double>(now.QuadPart - m_start.QuadPart) * 1000.0 / static_cast<double>(m_frequency.QuadPart);
+		}
+
+	private:
+
+		LARGE_INTEGER	m_frequency;
+		LARGE_INTEGER	m_start;
+};
+
+//////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,199 @@
+//////////////////////////////////////////////////////////////////////////////
+// MessageRingTests.cpp - pipe message ring, single and two threaded
+
+#include "stdafx.h"
+#include "ConsoleTests.h"
+#include "../Console/MessageRing.h"
+
+// bytes streamed through the ring by the two threaded test
+#define STRESS_BYTES		(64*1024*1024)
+#define MAX_MESSAGE_SIZE	300
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+// byte at a position of the stream, doesn't repeat with the ring size
+static BYTE StreamByte(DWORD dwPos)
+{
+	return static_cast<BYTE>(dwPos*7 + (dwPos >> 9));
+}
+
+static void FillStream(BYTE* pBytes, size_t size, DWORD dwPos)
+{
+	for (size_t i = 0; i < size; ++i) pBytes[i] = StreamByte(dwPos + static_cast<DWORD>(i));
+}
+
+static bool CheckStream(const BYTE* pBytes, size_t size, DWORD dwPos)
+{
+	for (size_t i = 0; i < size; ++i)
+	{
+		if (pBytes[i] == StreamByte(dwPos + static_cast<DWORD>(i))) continue;
+
+		wprintf(L"  byte %lu is 0x%02X, expected 0x%02X\n", dwPos + static_cast<DWORD>(i), pBytes[i], StreamByte(dwPos + static_cast<DWORD>(i)));
+		return false;
+	}
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+CONSOLE_TEST(MessageRingWrapsPayloads)
+{
+	// a message plus payload that doesn't divide the ring size, so both
+	// parts end up split at the wraparound
+	MessageRing ring;
+	BYTE        arrMessage[24];
+	BYTE        arrPayload[1000];
+	BYTE        arrRead[sizeof(arrMessage) + sizeof(arrPayload)];
+	DWORD       dwWritePos = 0;
+	DWORD       dwReadPos  = 0;
+
+	for (int i = 0; i < 3*MESSAGE_RING_SIZE/static_cast<int>(sizeof(arrRead)); ++i)
+	{
+		// keep a few messages queued, so reads lag behind the writes
+		while (dwWritePos - dwReadPos < 3*sizeof(arrRead))
+		{
+			FillStream(arrMessage, sizeof(arrMessage), dwWritePos);
+			FillStream(arrPayload, sizeof(arrPayload), dwWritePos + static_cast<DWORD>(sizeof(arrMessage)));
+
+			CHECK(ring.Write(arrMessage, sizeof(arrMessage), arrPayload, sizeof(arrPayload)));
+			dwWritePos += static_cast<DWORD>(sizeof(arrRead));
+		}
+
+		CHECK(ring.Read(arrRead, sizeof(arrRead)) == sizeof(arrRead));
+		CHECK(CheckStream(arrRead, sizeof(arrRead), dwReadPos));
+
+		dwReadPos += static_cast<DWORD>(sizeof(arrRead));
+	}
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+CONSOLE_TEST(MessageRingRejectsOverflow)
+{
+	MessageRing             ring;
+	std::unique_ptr<BYTE[]> buffer(new BYTE[MESSAGE_RING_SIZE + 100]);
+	std::unique_ptr<BYTE[]> read(new BYTE[MESSAGE_RING_SIZE + 100]);
+
+	FillStream(buffer.get(), MESSAGE_RING_SIZE + 100, 0);
+
+	// never more than the ring holds, a rejected write leaves it alone
+	CHECK(!ring.Write(buffer.get(), MESSAGE_RING_SIZE + 1));
+	CHECK(!ring.Write(buffer.get(), MESSAGE_RING_SIZE, buffer.get(), 1));
+	CHECK(ring.IsEmpty());
+
+	CHECK(ring.Write(buffer.get(), MESSAGE_RING_SIZE - 10));
+	CHECK(!ring.Write(buffer.get(), 6, buffer.get(), 5));
+	CHECK(ring.Write(buffer.get() + MESSAGE_RING_SIZE - 10, 6, buffer.get() + MESSAGE_RING_SIZE - 4, 4));
+	CHECK(!ring.Write(buffer.get(), 1));
+
+	// reading frees exactly what was read
+	CHECK(ring.Read(read.get(), 100) == 100);
+	CHECK(!ring.Write(buffer.get(), 101));
+	CHECK(ring.Write(buffer.get() + MESSAGE_RING_SIZE, 1, buffer.get() + MESSAGE_RING_SIZE + 1, 99));
+
+	CHECK(ring.Read(read.get() + 100, MESSAGE_RING_SIZE + 1) == MESSAGE_RING_SIZE);
+	CHECK(ring.IsEmpty());
+	CHECK(CheckStream(read.get(), MESSAGE_RING_SIZE + 100, 0));
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+static DWORD WINAPI StressWriter(LPVOID lpParameter)
+{
+	MessageRing* pRing  = static_cast<MessageRing*>(lpParameter);
+	DWORD        dwSeed = 0x9876;
+	DWORD        dwPos  = 0;
+	BYTE         arrMessage[MAX_MESSAGE_SIZE];
+	BYTE         arrPayload[MAX_MESSAGE_SIZE];
+
+	while (dwPos < STRESS_BYTES)
+	{
+		dwSeed = dwSeed * 1664525 + 1013904223;
+
+		size_t size        = 1 + (dwSeed >> 8) % MAX_MESSAGE_SIZE;
+		size_t payloadSize = (dwSeed >> 20) % MAX_MESSAGE_SIZE;
+
+		FillStream(arrMessage, size, dwPos);
+		FillStream(arrPayload, payloadSize, dwPos + static_cast<DWORD>(size));
+
+		// the reader makes room eventually
+		while (!pRing->Write(arrMessage, size, arrPayload, payloadSize)) ::SwitchToThread();
+
+		dwPos += static_cast<DWORD>(size + payloadSize);
+	}
+
+	return dwPos;
+}
+
+CONSOLE_TEST(MessageRingTwoThreadsKeepOrder)
+{
+	MessageRing ring;
+	HANDLE      hWriter = ::CreateThread(NULL, 0, StressWriter, &ring, 0, NULL);
+
+	CHECK(hWriter != NULL);
+
+	// reads of every size, the writer publishes whole messages only; after
+	// a mismatch we keep reading so the writer can finish
+	BYTE  arrRead[MAX_MESSAGE_SIZE*3];
+	DWORD dwSeed   = 0x2468;
+	DWORD dwPos    = 0;
+	bool  bOrdered = true;
+
+	for (;;)
+	{
+		dwSeed = dwSeed * 1664525 + 1013904223;
+
+		size_t read = ring.Read(arrRead, 1 + (dwSeed >> 8) % sizeof(arrRead));
+
+		if (read == 0)
+		{
+			if ((::WaitForSingleObject(hWriter, 0) == WAIT_OBJECT_0) && ring.IsEmpty()) break;
+
+			::SwitchToThread();
+			continue;
+		}
+
+		if (bOrdered) bOrdered = CheckStream(arrRead, read, dwPos);
+		dwPos += static_cast<DWORD>(read);
+	}
+
+	DWORD dwWritten = 0;
+
+	::WaitForSingleObject(hWriter, INFINITE);
+	::GetExitCodeThread(hWriter, &dwWritten);
+	::CloseHandle(hWriter);
+
+	CHECK(bOrdered);
+	CHECK(dwPos == dwWritten);
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,224 @@
+//////////////////////////////////////////////////////////////////////////////
+// PixelKernelsTests.cpp - SSE2 pixel kernels against the scalar ones
+
+#include "stdafx.h"
+#include "ConsoleTests.h"
+#include "../Console/CellKernels.h"
+#include "../Console/PixelKernels.h"
+
+// spans up to this long, so every SSE2 tail length is covered
+#define MAX_SPAN_PIXELS		67
+#define RANDOM_ITERATIONS	20000
+
+#define BENCH_WIDTH			1920
+#define BENCH_HEIGHT		1080
+#define BENCH_FRAMES		20
+
+typedef void (*SpanKernel)(DWORD* pPixels, DWORD dwCount, COLORREF crColor, BYTE byAlpha);
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+// deterministic, so failures can be reproduced
+static DWORD NextRandom(DWORD& dwSeed)
+{
+	dwSeed = dwSeed * 1664525 + 1013904223;
+	return dwSeed;
+}
+
+// runs both kernels over the same random spans (one pixel off alignment,
+// with guard pixels on both sides) and compares the results
+static bool CompareKernels(SpanKernel pfnScalar, SpanKernel pfnSSE2)
+{
+	DWORD dwSeed = 0x1234;
+	DWORD arrScalar[MAX_SPAN_PIXELS + 2];
+	DWORD arrSSE2[MAX_SPAN_PIXELS + 2];
+
+	for (int i = 0; i < RANDOM_ITERATIONS; ++i)
+	{
+		DWORD    dwCount = NextRandom(dwSeed) % (MAX_SPAN_PIXELS + 1);
+		COLORREF crColor = NextRandom(dwSeed) & 0xFFFFFF;
+		BYTE     byAlpha = 0;
+
+		// edge alphas get a third of the runs each
+		switch (i % 3)
+		{
+			case 0 : byAlpha = 0; break;
+			case 1 : byAlpha = 255; break;
+			default: byAlpha = static_cast<BYTE>(NextRandom(dwSeed) >> 24); break;
+		}
+
+		for (size_t j = 0; j < _countof(arrScalar); ++j) arrScalar[j] = arrSSE2[j] = NextRandom(dwSeed);
+
+		pfnScalar(arrScalar + 1, dwCount, crColor, byAlpha);
+		pfnSSE2(arrSSE2 + 1, dwCount, crColor, byAlpha);
+
+		if (memcmp(arrScalar, arrSSE2, sizeof(arrScalar)) != 0)
+		{
+			wprintf(L"  mismatch: %lu pixels, color 0x%06lX, alpha %u\n", dwCount, crColor, byAlpha);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+CONSOLE_TEST(PixelKernelsFillMatchesScalar)
+{
+	if (!CellKernels::HasSSE2())
+	{
+		wprintf(L"  no SSE2, skipped\n");
+		return true;
+	}
+
+	CHECK(CompareKernels(PixelKernels::FillScalar, PixelKernels::FillSSE2));
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+CONSOLE_TEST(PixelKernelsBlendMatchesScalar)
+{
+	if (!CellKernels::HasSSE2())
+	{
+		wprintf(L"  no SSE2, skipped\n");
+		return true;
+	}
+
+	CHECK(CompareKernels(PixelKernels::BlendScalar, PixelKernels::BlendSSE2));
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+CONSOLE_TEST(PixelKernelsBlendEdgeAlphas)
+{
+	DWORD arrPixels[5] = { 0x00000000, 0xFF102030, 0x80402010, 0xFFFFFFFF, 0x7F7F7F7F };
+	DWORD arrBlended[5];
+
+	// alpha 0 leaves the pixels alone
+	memcpy(arrBlended, arrPixels, sizeof(arrPixels));
+	PixelKernels::Blend(arrBlended, static_cast<DWORD>(_countof(arrBlended)), RGB(0x12, 0x34, 0x56), 0);
+	CHECK(memcmp(arrBlended, arrPixels, sizeof(arrPixels)) == 0);
+
+	// alpha 255 is the same as a fill
+	DWORD dwFilled = 0;
+	PixelKernels::Fill(&dwFilled, 1, RGB(0x12, 0x34, 0x56), 255);
+	CHECK(dwFilled == 0xFF123456);
+
+	memcpy(arrBlended, arrPixels, sizeof(arrPixels));
+	PixelKernels::Blend(arrBlended, static_cast<DWORD>(_countof(arrBlended)), RGB(0x12, 0x34, 0x56), 255);
+
+	for (size_t i = 0; i < _countof(arrBlended); ++i) CHECK(arrBlended[i] == dwFilled);
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+// Blends a translucent color over a full HD bitmap, the way selections and
+// cursors are drawn over the text layer
+
+CONSOLE_BENCHMARK(PixelKernelsBlendBenchmark)
+{
+	BITMAPINFO bmpInfo;
+	void*      pBits = NULL;
+
+	::ZeroMemory(&bmpInfo, sizeof(BITMAPINFO));
+
+	bmpInfo.bmiHeader.biSize        = sizeof(BITMAPINFOHEADER);
+	bmpInfo.bmiHeader.biWidth       = BENCH_WIDTH;
+	bmpInfo.bmiHeader.biHeight      = -BENCH_HEIGHT;
+	bmpInfo.bmiHeader.biPlanes      = 1;
+	bmpInfo.bmiHeader.biBitCount    = 32;
+	bmpInfo.bmiHeader.biCompression = BI_RGB;
+
+	CDC         dc(::CreateCompatibleDC(NULL));
+	CBitmap     bmp;
+	PixelBuffer pixels;
+
+	bmp.CreateDIBSection(dc, &bmpInfo, DIB_RGB_COLORS, &pBits, NULL, 0);
+	CHECK(PixelKernels::GetPixelBuffer(bmp, pixels));
+
+	HBITMAP hOldBitmap = dc.SelectBitmap(bmp);
+	CRect   rect(0, 0, BENCH_WIDTH, BENCH_HEIGHT);
+
+	PixelKernels::FillRect(pixels, rect, RGB(0x20, 0x20, 0x20), 255);
+
+	SpanKernel     arrKernels[] = { PixelKernels::BlendScalar, PixelKernels::BlendSSE2 };
+	const wchar_t* arrNames[]   = { L"scalar", L"SSE2" };
+
+	for (size_t k = 0; k < _countof(arrKernels); ++k)
+	{
+		if ((arrKernels[k] == PixelKernels::BlendSSE2) && !CellKernels::HasSSE2()) continue;
+
+		BenchTimer timer;
+
+		for (int nFrame = 0; nFrame < BENCH_FRAMES; ++nFrame)
+		{
+			for (int y = 0; y < BENCH_HEIGHT; ++y) arrKernels[k](pixels.GetRow(y), BENCH_WIDTH, RGB(0x30, 0x60, 0xC0), 0x80);
+		}
+
+		wprintf(L"  %-8s %8.3f ms/frame\n", arrNames[k], timer.GetMs() / BENCH_FRAMES);
+	}
+
+	// what the kernels replaced: AlphaBlend from a 1x1 source, stretched
+	CDC     dcSource(::CreateCompatibleDC(NULL));
+	CBitmap bmpSource;
+	void*   pSourceBits = NULL;
+
+	bmpInfo.bmiHeader.biWidth  = 1;
+	bmpInfo.bmiHeader.biHeight = -1;
+
+	bmpSource.CreateDIBSection(dcSource, &bmpInfo, DIB_RGB_COLORS, &pSourceBits, NULL, 0);
+	*static_cast<DWORD*>(pSourceBits) = 0xFF3060C0;
+
+	HBITMAP       hOldSource = dcSource.SelectBitmap(bmpSource);
+	BLENDFUNCTION blend      = { AC_SRC_OVER, 0, 0x80, 0 };
+	BenchTimer    timer;
+
+	for (int nFrame = 0; nFrame < BENCH_FRAMES; ++nFrame)
+	{
+		dc.AlphaBlend(0, 0, BENCH_WIDTH, BENCH_HEIGHT, dcSource, 0, 0, 1, 1, blend);
+	}
+
+	::GdiFlush();
+	wprintf(L"  %-8s %8.3f ms/frame\n", L"GDI", timer.GetMs() / BENCH_FRAMES);
+
+	dcSource.SelectBitmap(hOldSource);
+	dc.SelectBitmap(hOldBitmap);
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
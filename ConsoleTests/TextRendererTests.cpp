@@ -0,0 +1,271 @@
+//////////////////////////////////////////////////////////////////////////////
+// TextRendererTests.cpp - text renderers against the software reference
+
+#include "stdafx.h"
+#include "ConsoleTests.h"
+#include "../Console/D2DTextRenderer.h"
+
+#define TEST_FONT_HEIGHT	16
+#define TEST_BITMAP_WIDTH	640
+
+// renderers are antialiased differently (ClearType, gray levels), but ink
+// has to land in the same place
+#define INK_LEVEL			96
+#define MAX_INK_OFFSET		1
+#define MAX_MEAN_DIFF		24
+
+static const wchar_t s_szTestText[] = L"The quick brown fox 0123456789 {}[]|@#$% WMgjpqy";
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+// A row of text drawn by one renderer into a black 32-bit DIB section
+
+class TextBitmap
+{
+	public:
+		TextBitmap(int nWidth, int nHeight)
+		: m_bmp()
+		, m_dc(::CreateCompatibleDC(NULL))
+		, m_pixels()
+		{
+			BITMAPINFO bmpInfo;
+			void*      pBits = NULL;
+
+			::ZeroMemory(&bmpInfo, sizeof(BITMAPINFO));
+
+			bmpInfo.bmiHeader.biSize        = sizeof(BITMAPINFOHEADER);
+			bmpInfo.bmiHeader.biWidth       = nWidth;
+			bmpInfo.bmiHeader.biHeight      = -nHeight;
+			bmpInfo.bmiHeader.biPlanes      = 1;
+			bmpInfo.bmiHeader.biBitCount    = 32;
+			bmpInfo.bmiHeader.biCompression = BI_RGB;
+
+			m_bmp.CreateDIBSection(m_dc, &bmpInfo, DIB_RGB_COLORS, &pBits, NULL, 0);
+			m_dc.SelectBitmap(m_bmp);
+
+			PixelKernels::GetPixelBuffer(m_bmp, m_pixels);
+			PixelKernels::FillRect(m_pixels, CRect(0, 0, nWidth, nHeight), RGB(0, 0, 0), 255);
+		}
+
+		bool Draw(TextRenderer& renderer, HFONT hFont, int nCharWidth, const wchar_t* pszText, const CRect& rectClip)
+		{
+			DWORD       dwChars = static_cast<DWORD>(wcslen(pszText));
+			vector<INT> charWidths(dwChars, nCharWidth);
+
+			renderer.SetFonts(hFont, hFont, 100, nCharWidth, m_pixels.nHeight);
+
+			if (!renderer.BeginDraw(m_dc, CRect(0, 0, m_pixels.nWidth, m_pixels.nHeight))) return false;
+
+			renderer.DrawRun(0, 0, pszText, &charWidths[0], dwChars, false, RGB(255, 255, 255), rectClip);
+			renderer.EndDraw();
+
+			::GdiFlush();
+			return true;
+		}
+
+		// gray level of a pixel
+		int GetLevel(int nX, int nY) const
+		{
+			DWORD dwPixel = m_pixels.GetRow(nY)[nX];
+			return static_cast<int>(((dwPixel & 0xFF) + ((dwPixel >> 8) & 0xFF) + ((dwPixel >> 16) & 0xFF)) / 3);
+		}
+
+		// bounding box of pixels at or above the given level
+		CRect GetInkRect() const
+		{
+			CRect rectInk(m_pixels.nWidth, m_pixels.nHeight, 0, 0);
+
+			for (int y = 0; y < m_pixels.nHeight; ++y)
+			{
+				for (int x = 0; x < m_pixels.nWidth; ++x)
+				{
+					if (GetLevel(x, y) < INK_LEVEL) continue;
+
+					rectInk.left   = min(rectInk.left, static_cast<LONG>(x));
+					rectInk.top    = min(rectInk.top, static_cast<LONG>(y));
+					rectInk.right  = max(rectInk.right, static_cast<LONG>(x + 1));
+					rectInk.bottom = max(rectInk.bottom, static_cast<LONG>(y + 1));
+				}
+			}
+
+			return rectInk;
+		}
+
+		int GetMeanDiff(const TextBitmap& other) const
+		{
+			__int64 nDiff = 0;
+
+			for (int y = 0; y < m_pixels.nHeight; ++y)
+			{
+				for (int x = 0; x < m_pixels.nWidth; ++x) nDiff += abs(GetLevel(x, y) - other.GetLevel(x, y));
+			}
+
+			return static_cast<int>(nDiff / (m_pixels.nWidth * m_pixels.nHeight));
+		}
+
+	private:
+
+		// the DC goes first, with the bitmap still selected
+		CBitmap		m_bmp;
+		CDC			m_dc;
+		PixelBuffer	m_pixels;
+};
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+struct TestFont
+{
+	TestFont()
+	: font()
+	, nCharWidth(0)
+	, nCharHeight(0)
+	{
+		font.CreateFont(-TEST_FONT_HEIGHT, 0, 0, 0, FW_NORMAL, FALSE, FALSE, FALSE, DEFAULT_CHARSET, OUT_DEFAULT_PRECIS, CLIP_DEFAULT_PRECIS, ANTIALIASED_QUALITY, FIXED_PITCH | FF_MODERN, L"Courier New");
+
+		CDC        dc(::CreateCompatibleDC(NULL));
+		TEXTMETRIC textMetric;
+
+		dc.SelectFont(font);
+		dc.GetTextMetrics(&textMetric);
+
+		nCharWidth  = textMetric.tmAveCharWidth;
+		nCharHeight = textMetric.tmHeight;
+	}
+
+	CFont	font;
+	int		nCharWidth;
+	int		nCharHeight;
+};
+
+static bool InkRectsMatch(const CRect& rect1, const CRect& rect2)
+{
+	return (abs(rect1.left - rect2.left) <= MAX_INK_OFFSET) &&
+	       (abs(rect1.top - rect2.top) <= MAX_INK_OFFSET) &&
+	       (abs(rect1.right - rect2.right) <= MAX_INK_OFFSET) &&
+	       (abs(rect1.bottom - rect2.bottom) <= MAX_INK_OFFSET);
+}
+
+// draws the test text with the renderer and compares it with the reference
+static bool CompareWithReference(TextRenderer& renderer, const wchar_t* pszRenderer)
+{
+	TestFont             testFont;
+	CRect                rectRow(0, 0, TEST_BITMAP_WIDTH, testFont.nCharHeight);
+	TextBitmap           reference(TEST_BITMAP_WIDTH, testFont.nCharHeight);
+	TextBitmap           rendered(TEST_BITMAP_WIDTH, testFont.nCharHeight);
+	SoftwareTextRenderer softwareRenderer;
+
+	CHECK(reference.Draw(softwareRenderer, testFont.font, testFont.nCharWidth, s_szTestText, rectRow));
+
+	if (!rendered.Draw(renderer, testFont.font, testFont.nCharWidth, s_szTestText, rectRow))
+	{
+		wprintf(L"  %s not available, skipped\n", pszRenderer);
+		return true;
+	}
+
+	CRect rectReferenceInk(reference.GetInkRect());
+	CRect rectInk(rendered.GetInkRect());
+	int   nMeanDiff = rendered.GetMeanDiff(reference);
+
+	wprintf(
+		L"  %s ink (%d,%d)-(%d,%d), reference (%d,%d)-(%d,%d), mean diff %d\n",
+		pszRenderer,
+		rectInk.left, rectInk.top, rectInk.right, rectInk.bottom,
+		rectReferenceInk.left, rectReferenceInk.top, rectReferenceInk.right, rectReferenceInk.bottom,
+		nMeanDiff);
+
+	// scaled text (e.g. a render target using the system DPI) fails here
+	CHECK(InkRectsMatch(rectInk, rectReferenceInk));
+	CHECK(nMeanDiff <= MAX_MEAN_DIFF);
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+CONSOLE_TEST(SoftwareTextRendererDrawsInCells)
+{
+	TestFont             testFont;
+	TextBitmap           bitmap(TEST_BITMAP_WIDTH, testFont.nCharHeight);
+	SoftwareTextRenderer renderer;
+
+	CHECK(bitmap.Draw(renderer, testFont.font, testFont.nCharWidth, L"MMMM", CRect(0, 0, TEST_BITMAP_WIDTH, testFont.nCharHeight)));
+
+	CRect rectInk(bitmap.GetInkRect());
+
+	CHECK(!rectInk.IsRectEmpty());
+	CHECK(rectInk.left >= 0);
+	CHECK(rectInk.right <= 4*testFont.nCharWidth + MAX_INK_OFFSET);
+	CHECK(rectInk.bottom <= testFont.nCharHeight);
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+CONSOLE_TEST(SoftwareTextRendererClips)
+{
+	TestFont             testFont;
+	TextBitmap           bitmap(TEST_BITMAP_WIDTH, testFont.nCharHeight);
+	SoftwareTextRenderer renderer;
+	CRect                rectClip(testFont.nCharWidth, 0, 3*testFont.nCharWidth, testFont.nCharHeight);
+
+	CHECK(bitmap.Draw(renderer, testFont.font, testFont.nCharWidth, L"MMMM", rectClip));
+
+	CRect rectInk(bitmap.GetInkRect());
+
+	CHECK(!rectInk.IsRectEmpty());
+	CHECK(rectInk.left >= rectClip.left);
+	CHECK(rectInk.right <= rectClip.right);
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+CONSOLE_TEST(GdiTextRendererMatchesReference)
+{
+	GdiTextRenderer renderer;
+	return CompareWithReference(renderer, L"GDI");
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+CONSOLE_TEST(D2DTextRendererMatchesReference)
+{
+	D2DTextRenderer renderer;
+	return CompareWithReference(renderer, L"Direct2D");
+}
+
+//////////////////////////////////////////////////////////////////////////////
@@ -2,6 +2,12 @@
 
 //////////////////////////////////////////////////////////////////////////////
 
+// pipe buffers, Console queues messages and the hook reads them in batches
+// of up to this many bytes
+#define NAMED_PIPE_BUFFER_SIZE	65536
+
+//////////////////////////////////////////////////////////////////////////////
+
 class NamedPipe
 {
 	public:
@@ -10,8 +16,11 @@ class NamedPipe
 			: m_strName(L"")
 			, m_hNamedPipe()
 			, m_hEvent()
+			, m_hWriteEvent()
 			, m_bConnected(false)
 		{
+			::ZeroMemory(&m_overlap, sizeof(OVERLAPPED));
+			::ZeroMemory(&m_overlapWrite, sizeof(OVERLAPPED));
 		}
 
 		~NamedPipe()
@@ -113,8 +122,8 @@ class NamedPipe
 					PIPE_ACCESS_OUTBOUND | FILE_FLAG_FIRST_PIPE_INSTANCE | FILE_FLAG_OVERLAPPED,
 					PIPE_TYPE_BYTE,
 					1,
-					1024,
-					1024,
+					NAMED_PIPE_BUFFER_SIZE,
+					NAMED_PIPE_BUFFER_SIZE,
 					0,
 					sa.get()));
 
@@ -132,6 +141,13 @@ class NamedPipe
 
 			m_overlap.hEvent = m_hEvent.get();
 
+			m_hWriteEvent.reset(::CreateEvent(NULL, FALSE, FALSE, NULL));
+
+			if( m_hWriteEvent.get() == NULL )
+			{
+				Win32Exception::ThrowFromLastError();
+			}
+
 			// starts connection to the client
 			if( !::ConnectNamedPipe(m_hNamedPipe.get(), &m_overlap) )
 			{
@@ -174,6 +190,8 @@ class NamedPipe
 		}
 
 		inline HANDLE Get() { return m_hEvent.get(); }
+		inline HANDLE GetWriteEvent() { return m_hWriteEvent.get(); }
+
 		void WaitConnect()
 		{
 			if( m_bConnected ) return;
@@ -209,6 +227,59 @@ class NamedPipe
 			}
 		}
 
+		// the write event is signaled when the write completes (even if it
+		// completes right away), data must be kept until then
+		void BeginWriteAsync(const void * data, size_t size)
+		{
+			::ZeroMemory(&m_overlapWrite, sizeof(OVERLAPPED));
+			m_overlapWrite.hEvent = m_hWriteEvent.get();
+
+			if( !::WriteFile(
+				m_hNamedPipe.get(),
+				data,
+				static_cast<DWORD>(size),
+				NULL,
+				&m_overlapWrite) )
+			{
+				if( ::GetLastError() != ERROR_IO_PENDING )
+				{
+					// nothing pending, nobody would reset the event
+					::SetEvent(m_hWriteEvent.get());
+					Win32Exception::ThrowFromLastError();
+				}
+			}
+		}
+
+		size_t EndWriteAsync()
+		{
+			DWORD dwNumberOfBytesTransferred;
+			if( !::GetOverlappedResult(
+				m_hNamedPipe.get(),
+				&m_overlapWrite,
+				&dwNumberOfBytesTransferred,
+				FALSE) )
+			{
+				Win32Exception::ThrowFromLastError();
+			}
+
+			return static_cast<size_t>(dwNumberOfBytesTransferred);
+		}
+
+		// cancels a pending write and waits for it to complete
+		void CancelWrite()
+		{
+			if( m_hWriteEvent.get() == NULL ) return;
+
+			::CancelIoEx(m_hNamedPipe.get(), &m_overlapWrite);
+
+			DWORD dwNumberOfBytesTransferred;
+			::GetOverlappedResult(
+				m_hNamedPipe.get(),
+				&m_overlapWrite,
+				&dwNumberOfBytesTransferred,
+				TRUE);
+		}
+
 		size_t BeginReadAsync(void * buffer, size_t size)
 		{
 			DWORD dwNumberOfBytesRead;
@@ -252,6 +323,9 @@ class NamedPipe
 
 		OVERLAPPED m_overlap;
 		std::unique_ptr<void, CloseHandleHelper> m_hEvent;
+
+		OVERLAPPED m_overlapWrite;
+		std::unique_ptr<void, CloseHandleHelper> m_hWriteEvent;
 		bool m_bConnected;
 };
 
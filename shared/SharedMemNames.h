@@ -10,6 +10,7 @@ class SharedMemNames
 		static boost::wformat formatInfo;
 		static boost::wformat formatCursorInfo;
 		static boost::wformat formatBuffer;
+		static boost::wformat formatHistory;
 		static boost::wformat formatCopyInfo;
 		static boost::wformat formatTextInfo;
 		static boost::wformat formatMouseEvent;
@@ -34,7 +35,8 @@ class SharedMemNames
 boost::wformat SharedMemNames::formatConsoleParams(L"Console2_params_%1%");
 boost::wformat SharedMemNames::formatInfo(L"Console2_consoleInfo_%1%");
 boost::wformat SharedMemNames::formatCursorInfo(L"Console2_cursorInfo_%1%");
-boost::wformat SharedMemNames::formatBuffer(L"Console2_consoleBuffer_%1%");
+boost::wformat SharedMemNames::formatBuffer(L"Console2_consoleBuffer_%1%_%2%");
+boost::wformat SharedMemNames::formatHistory(L"Console2_consoleHistory_%1%");
 boost::wformat SharedMemNames::formatCopyInfo(L"Console2_consoleCopyInfo_%1%");
 boost::wformat SharedMemNames::formatTextInfo(L"Console2_consoleTextInfo_%1%");
 boost::wformat SharedMemNames::formatMouseEvent(L"Console2_consoleMouseEvent_%1%");
@@ -95,6 +95,50 @@ class SharedMemoryLock
 //////////////////////////////////////////////////////////////////////////////
 
 
+//////////////////////////////////////////////////////////////////////////////
+
+// seqlock for data in shared memory with a single writer; the sequence is
+// odd while the writer is updating the data, readers copy the data without
+// locking and retry if the sequence changed in the meantime
+
+class SeqLock
+{
+	public:
+
+		static inline void BeginWrite(volatile LONG* plSequence)
+		{
+			::InterlockedIncrement(plSequence);
+		}
+
+		static inline void EndWrite(volatile LONG* plSequence)
+		{
+			::InterlockedIncrement(plSequence);
+		}
+
+		// returns an odd sequence if the writer is active
+		static inline LONG BeginRead(volatile LONG* plSequence)
+		{
+			LONG lSequence = *plSequence;
+			MemoryBarrier();
+			return lSequence;
+		}
+
+		// returns false for a torn read
+		static inline bool EndRead(volatile LONG* plSequence, LONG lSequence)
+		{
+			MemoryBarrier();
+			return (lSequence & 1) == 0 && *plSequence == lSequence;
+		}
+};
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+
 //////////////////////////////////////////////////////////////////////////////
 
 template<typename T>
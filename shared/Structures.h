@@ -12,10 +12,12 @@ struct ConsoleParams
 	, dwColumns(0)
 	, dwBufferRows(0)
 	, dwBufferColumns(0)
+	, bUseWinEvents(FALSE)
 	, dwMaxRows(0)
 	, dwMaxColumns(0)
 	, hwndConsoleWindow(NULL)
 	, dwHookThreadId(0)
+	, dwTextCharsDone(0)
 	{
 	}
 
@@ -27,10 +29,12 @@ struct ConsoleParams
 	, dwColumns(other.dwColumns)
 	, dwBufferRows(other.dwBufferRows)
 	, dwBufferColumns(other.dwBufferColumns)
+	, bUseWinEvents(other.bUseWinEvents)
 	, dwMaxRows(other.dwMaxRows)
 	, dwMaxColumns(other.dwMaxColumns)
 	, hwndConsoleWindow(other.hwndConsoleWindow)
 	, dwHookThreadId(other.dwHookThreadId)
+	, dwTextCharsDone(other.dwTextCharsDone)
 	{
 	}
 
@@ -42,6 +46,8 @@ struct ConsoleParams
 	DWORD	dwColumns;
 	DWORD	dwBufferRows;
 	DWORD	dwBufferColumns;
+	// capture changes reported by console WinEvents instead of polling
+	BOOL	bUseWinEvents;
 
 	// stuff set by console hook
 	DWORD	dwMaxRows;
@@ -54,6 +60,10 @@ struct ConsoleParams
 	};
 
 	DWORD	dwHookThreadId;
+
+	// SENDTEXT chars the hook has written to the console input (or dropped
+	// on CANCELTEXT) so far, Console paces pasting by it
+	DWORD	dwTextCharsDone;
 };
 
 //////////////////////////////////////////////////////////////////////////////
@@ -173,12 +183,10 @@ struct ConsoleInfo
 {
 	ConsoleInfo()
 	: csbi()
-	, textChanged(false)
 	{
 	}
 
 	CONSOLE_SCREEN_BUFFER_INFO	csbi;
-	bool						textChanged;
 };
 
 //////////////////////////////////////////////////////////////////////////////
@@ -191,31 +199,150 @@ struct ConsoleInfo
 
 //////////////////////////////////////////////////////////////////////////////
 
-struct CharInfo
+// console screen frame, written by the hook into a free frame of the
+// shared ConsoleScreen and published by setting ConsoleScreen::lFront;
+// Console either copies it without locking (and validates the copy with
+// lSequence), or pins it in ConsoleScreen::lPinned and renders from it
+//
+// ConsoleScreen is sized from the max console window size and versioned:
+// when the hook needs bigger frames, Console creates the next version and
+// hands it over through ConsoleScreen::lNewVersion
+
+struct ConsoleFrame
 {
-	CharInfo()
-	: changed(false)
+	// seqlock sequence, odd while the hook is writing the frame
+	volatile LONG				lSequence;
+
+	DWORD						dwFrame;
+	// last frame in which screen text has changed
+	DWORD						dwTextFrame;
+
+	DWORD						dwRows;
+	DWORD						dwColumns;
+
+	// total number of rows the screen text has scrolled by (positive when
+	// text moves up); Console shifts its buffer by the difference from the
+	// last frame it has read instead of repainting the whole view
+	LONG						lScrollOffset;
+
+	CONSOLE_SCREEN_BUFFER_INFO	csbi;
+	CONSOLE_CURSOR_INFO			cursorInfo;
+
+	// followed by:
+	// unsigned __int64 rowHashes[dwMaxRows] (row text hashes)
+	// DWORD            rowFrames[dwMaxRows] (last frame in which each row has changed)
+	// CHAR_INFO        buffer[dwMaxRows*dwMaxColumns]
+};
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+// with one frame published and one pinned by Console, the hook always
+// has a third one to write
+#define SCREEN_FRAMES	3
+
+struct ConsoleScreen
+{
+	static inline DWORD GetFrameSize(DWORD dwMaxRows, DWORD dwMaxColumns)
+	{
+		return sizeof(ConsoleFrame) + dwMaxRows*sizeof(unsigned __int64) + dwMaxRows*sizeof(DWORD) + dwMaxRows*dwMaxColumns*sizeof(CHAR_INFO);
+	}
+
+	// size in ConsoleScreen units, for SharedMemory<ConsoleScreen>::Create
+	static inline DWORD GetSharedMemSize(DWORD dwMaxRows, DWORD dwMaxColumns)
+	{
+		return (sizeof(ConsoleScreen) + SCREEN_FRAMES*GetFrameSize(dwMaxRows, dwMaxColumns) + sizeof(ConsoleScreen) - 1) / sizeof(ConsoleScreen);
+	}
+
+	inline ConsoleFrame* GetFrame(LONG lIndex)
+	{
+		return reinterpret_cast<ConsoleFrame*>(reinterpret_cast<BYTE*>(this + 1) + lIndex*GetFrameSize(dwMaxRows, dwMaxColumns));
+	}
+
+	inline unsigned __int64* GetRowHashes(ConsoleFrame* pFrame)
+	{
+		return reinterpret_cast<unsigned __int64*>(pFrame + 1);
+	}
+
+	inline DWORD* GetRowFrames(ConsoleFrame* pFrame)
 	{
-		// This is actually a shortcut for:
-		// charInfo.Attributes = 0;
-		// charInfo.Char.UnicodeChar = L' ';
-		// Is it faster, though?
-		*(reinterpret_cast<DWORD*>(&charInfo)) = 0x00000020;
+		return reinterpret_cast<DWORD*>(GetRowHashes(pFrame) + dwMaxRows);
 	}
 
-  inline void copy(CHAR_INFO* pnewCharInfo)
-  {
-    DWORD* pold = reinterpret_cast<DWORD*>(&charInfo);
-    DWORD* pnew = reinterpret_cast<DWORD*>(pnewCharInfo);
-    if( *pold != *pnew )
-    {
-      *pold = *pnew;
-      changed = true;
-    }
-  }
-
-	CHAR_INFO	charInfo;
-	bool		changed;
+	inline CHAR_INFO* GetBuffer(ConsoleFrame* pFrame)
+	{
+		return reinterpret_cast<CHAR_INFO*>(GetRowFrames(pFrame) + dwMaxRows);
+	}
+
+	// index of the last published frame
+	volatile LONG	lFront;
+
+	// index of the frame Console renders from (-1 if it copies frames), the
+	// hook doesn't write it
+	volatile LONG	lPinned;
+
+	DWORD			dwMaxRows;
+	DWORD			dwMaxColumns;
+
+	// set by the hook when the console window doesn't fit the frames
+	DWORD			dwRequestedRows;
+	DWORD			dwRequestedColumns;
+
+	// set by Console when it has created a bigger screen for the request;
+	// the hook then opens the new version and stops using this one
+	volatile LONG	lNewVersion;
+
+	// followed by SCREEN_FRAMES frames
+};
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//////////////////////////////////////////////////////////////////////////////
+
+// mirror of the whole console screen buffer (not just the window), kept by
+// the hook so Console can show scrolled rows without asking the hook
+//
+// rows are stored in a ring, buffer row r is at ring row (dwHead + r) %
+// dwRows; when the console buffer scrolls the hook only moves the head.
+// Rows outside the console window can be wrong for a while, Console gets the
+// real rows with the next screen frame after it has scrolled the console.
+
+struct ConsoleHistory
+{
+	// size in ConsoleHistory units, for SharedMemory<ConsoleHistory>::Create
+	static inline DWORD GetSharedMemSize(DWORD dwMaxCells)
+	{
+		return (sizeof(ConsoleHistory) + dwMaxCells*sizeof(CHAR_INFO) + sizeof(ConsoleHistory) - 1) / sizeof(ConsoleHistory);
+	}
+
+	inline CHAR_INFO* GetRow(DWORD dwBufferRow)
+	{
+		return reinterpret_cast<CHAR_INFO*>(this + 1) + ((dwHead + dwBufferRow) % dwRows)*dwColumns;
+	}
+
+	// seqlock sequence, odd while the hook is writing
+	volatile LONG	lSequence;
+
+	// set by Console
+	DWORD			dwMaxCells;
+
+	// mirrored buffer size, dwRows*dwColumns <= dwMaxCells (dwRows is 0 if
+	// the console buffer doesn't fit)
+	DWORD			dwRows;
+	DWORD			dwColumns;
+
+	// ring row of buffer row 0
+	DWORD			dwHead;
+
+	// buffer rows dwStaleTop..dwStaleRows-1 haven't been re-read since the
+	// console buffer has changed in a way the hook couldn't follow
+	DWORD			dwStaleTop;
+	DWORD			dwStaleRows;
+
+	// followed by CHAR_INFO buffer[dwMaxCells]
 };
 
 //////////////////////////////////////////////////////////////////////////////
@@ -237,7 +364,8 @@ struct NamedPipeMessage
 		SHOWWINDOW,
 		SETWINDOWPOS,
 		SENDTEXT,
-		WRITECONSOLEINPUT
+		WRITECONSOLEINPUT,
+		CANCELTEXT
 	} type;
 
 	union